@@ -127,7 +127,9 @@ typedef unsigned long long uint64_t;
 #endif
 
 typedef   float float32_t;
-//typedef   float __fp16;
+#if defined(__GNUC__) && !defined(__clang__)
+typedef   float __fp16;     // gcc has no __fp16 storage type on IA32
+#endif
 
 typedef  uint8_t poly8_t;
 typedef  uint16_t poly16_t;
@@ -0,0 +1,280 @@
+#include "gbBufferPool.h"
+
+// ===============
+// gbBufferPool.c:
+// ===============
+//
+// Recycles fixed-size buffers (eg, decoded 256x256 RGBA tiles) so the hot
+// path doesn't malloc, fault in and free the same sizes over and over from
+// many threads at once.
+//
+// The free list is split into shards, each with its own mutex.  A thread
+// always returns buffers to, and first takes buffers from, its own shard, so
+// workers mostly don't contend with each other.  Since buffers usually move
+// between threads (eg, allocated by a decode thread, released by an encode
+// thread), a thread whose shard is empty takes from the others before falling
+// back to malloc.
+//
+// Buffers of any other size may be passed to gbBufferPool_Put, and are simply
+// freed.  Counters for hits, misses, etc. can be printed to size the pool.
+//
+
+#define kGB_BufferPool_ShardN    8
+#define kGB_BufferPool_CacheLine 64
+
+typedef struct gbBufferPool_Shard
+{
+    pthread_mutex_t mutex;
+    void**          bufs;
+    size_t          buf_n;
+    uint8_t         _pad[kGB_BufferPool_CacheLine];
+} gbBufferPool_Shard;
+
+struct gbBufferPool
+{
+    char               name[32];
+    size_t             buffer_size;
+    size_t             shard_cap;       // max free buffers held per shard
+    gbBufferPool_Shard shards[kGB_BufferPool_ShardN];
+    
+    uint64_t           hit_n;           // Get served from a free list
+    uint64_t           miss_n;          // Get had to malloc
+    uint64_t           put_n;           // Put kept the buffer for reuse
+    uint64_t           drop_n;          // Put freed it (wrong size, or full)
+    int64_t            out_n;           // buffers currently handed out
+    int64_t            out_max;
+};
+
+static          size_t _gbBufferPool_NextShard = 0;
+static __thread size_t _gbBufferPool_Shard     = SIZE_MAX;
+
+
+
+
+// =======================
+// _gbBufferPool_GetShard:
+// =======================
+//
+// Assigns each thread a shard on first use, round robin.
+//
+static inline size_t _gbBufferPool_GetShard(void)
+{
+    if (_gbBufferPool_Shard == SIZE_MAX)
+    {
+        _gbBufferPool_Shard = __atomic_fetch_add(&_gbBufferPool_NextShard, 1, __ATOMIC_RELAXED) % kGB_BufferPool_ShardN;
+    }//if
+    
+    return _gbBufferPool_Shard;
+}//_gbBufferPool_GetShard
+
+
+
+
+// ====================
+// gbBufferPool_Create:
+// ====================
+//
+// buffer_size: bytes per buffer.
+// max_free_n:  max idle buffers kept in total, beyond which Put frees.
+//              (0 -> kept buffers are not limited)
+//
+gbBufferPool* gbBufferPool_Create(const char*  name,
+                                  const size_t buffer_size,
+                                  const size_t max_free_n)
+{
+    gbBufferPool* pool = calloc(1, sizeof(gbBufferPool));
+    
+    snprintf(pool->name, sizeof(pool->name), "%s", name != NULL ? name : "");
+    
+    pool->buffer_size = buffer_size;
+    pool->shard_cap   = max_free_n > 0 ? (max_free_n + kGB_BufferPool_ShardN - 1) / kGB_BufferPool_ShardN : SIZE_MAX;
+    
+    for (size_t i = 0; i < kGB_BufferPool_ShardN; i++)
+    {
+        pthread_mutex_init(&pool->shards[i].mutex, NULL);
+        
+        pool->shards[i].bufs  = NULL;
+        pool->shards[i].buf_n = 0;
+    }//for
+    
+    return pool;
+}//gbBufferPool_Create
+
+
+
+
+// =================
+// gbBufferPool_Get:
+// =================
+//
+// Returns a buffer of gbBufferPool_GetBufferSize bytes.  Contents are
+// undefined.  Release with gbBufferPool_Put. (or free)
+//
+void* gbBufferPool_Get(gbBufferPool* pool)
+{
+    const size_t own = _gbBufferPool_GetShard();
+    void*        buf = NULL;
+    
+    for (size_t i = 0; i < kGB_BufferPool_ShardN && buf == NULL; i++)
+    {
+        gbBufferPool_Shard* shard = &(pool->shards[(own + i) % kGB_BufferPool_ShardN]);
+        
+        if (i == 0)
+        {
+            pthread_mutex_lock(&shard->mutex);
+        }//if
+        else if (pthread_mutex_trylock(&shard->mutex) != 0)
+        {
+            continue;                           // busy, not worth waiting on
+        }//else if
+        
+        if (shard->buf_n > 0)
+        {
+            shard->buf_n--;
+            buf = shard->bufs[shard->buf_n];
+        }//if
+        
+        pthread_mutex_unlock(&shard->mutex);
+    }//for
+    
+    if (buf != NULL)
+    {
+        __atomic_fetch_add(&pool->hit_n, 1, __ATOMIC_RELAXED);
+    }//if
+    else
+    {
+        __atomic_fetch_add(&pool->miss_n, 1, __ATOMIC_RELAXED);
+        buf = malloc(pool->buffer_size);
+    }//else
+    
+    const int64_t out_n   = __atomic_add_fetch(&pool->out_n, 1, __ATOMIC_RELAXED);
+    int64_t       out_max = __atomic_load_n(&pool->out_max, __ATOMIC_RELAXED);
+    
+    while (out_n > out_max && !__atomic_compare_exchange_n(&pool->out_max, &out_max, out_n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+    return buf;
+}//gbBufferPool_Get
+
+
+
+
+// =================
+// gbBufferPool_Put:
+// =================
+//
+// Gives buf back for reuse.  buf_size is its allocated size; anything but
+// the pool's buffer size is freed instead, so buffers that did not come from
+// the pool can be released the same way.  NULL is ignored.
+//
+void gbBufferPool_Put(gbBufferPool* pool,
+                      void*         buf,
+                      const size_t  buf_size)
+{
+    if (buf == NULL)
+    {
+        return;
+    }//if
+    
+    bool isKept = false;
+    
+    if (buf_size == pool->buffer_size)
+    {
+        gbBufferPool_Shard* shard = &(pool->shards[_gbBufferPool_GetShard()]);
+        
+        pthread_mutex_lock(&shard->mutex);
+        
+        if (shard->buf_n < pool->shard_cap)
+        {
+            if ((shard->buf_n & (shard->buf_n - 1)) == 0)   // 0, 1, 2, 4, ... -> grow
+            {
+                shard->bufs = realloc(shard->bufs, sizeof(void*) * (shard->buf_n > 0 ? shard->buf_n * 2 : 1));
+            }//if
+            
+            shard->bufs[shard->buf_n] = buf;
+            shard->buf_n++;
+            isKept = true;
+        }//if
+        
+        pthread_mutex_unlock(&shard->mutex);
+        
+        __atomic_fetch_sub(&pool->out_n, 1, __ATOMIC_RELAXED);
+    }//if
+    
+    if (isKept)
+    {
+        __atomic_fetch_add(&pool->put_n, 1, __ATOMIC_RELAXED);
+    }//if
+    else
+    {
+        __atomic_fetch_add(&pool->drop_n, 1, __ATOMIC_RELAXED);
+        free(buf);
+    }//else
+}//gbBufferPool_Put
+
+
+
+
+size_t gbBufferPool_GetBufferSize(const gbBufferPool* pool)
+{
+    return pool->buffer_size;
+}//gbBufferPool_GetBufferSize
+
+
+
+
+// ========================
+// gbBufferPool_PrintStats:
+// ========================
+//
+// One line.  Once warm, a pool that is big enough has about as many misses
+// as its peak number of buffers out; far more means max_free_n is too low.
+//
+void gbBufferPool_PrintStats(const gbBufferPool* pool,
+                             const char*         logPrefix)
+{
+    const uint64_t hit_n  = __atomic_load_n(&pool->hit_n,  __ATOMIC_RELAXED);
+    const uint64_t miss_n = __atomic_load_n(&pool->miss_n, __ATOMIC_RELAXED);
+    const double   hit_pc = hit_n + miss_n > 0 ? 100.0 * (double)hit_n / (double)(hit_n + miss_n) : 0.0;
+    
+    printf("%spool %-8s hits=%-8llu misses=%-6llu (%5.1f%%)  returned=%llu dropped=%llu  peak out=%lld x %zu bytes\n",
+           logPrefix != NULL ? logPrefix : "",
+           pool->name,
+           (unsigned long long)hit_n,
+           (unsigned long long)miss_n,
+           hit_pc,
+           (unsigned long long)__atomic_load_n(&pool->put_n,  __ATOMIC_RELAXED),
+           (unsigned long long)__atomic_load_n(&pool->drop_n, __ATOMIC_RELAXED),
+           (long long)__atomic_load_n(&pool->out_max, __ATOMIC_RELAXED),
+           pool->buffer_size);
+}//gbBufferPool_PrintStats
+
+
+
+
+// =====================
+// gbBufferPool_Destroy:
+// =====================
+//
+// Frees all idle buffers and the pool.  Buffers still handed out are not
+// tracked, and must be freed by their owners.
+//
+void gbBufferPool_Destroy(gbBufferPool* pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }//if
+    
+    for (size_t i = 0; i < kGB_BufferPool_ShardN; i++)
+    {
+        for (size_t j = 0; j < pool->shards[i].buf_n; j++)
+        {
+            free(pool->shards[i].bufs[j]);
+        }//for
+        
+        free(pool->shards[i].bufs);
+        pthread_mutex_destroy(&pool->shards[i].mutex);
+    }//for
+    
+    free(pool);
+}//gbBufferPool_Destroy
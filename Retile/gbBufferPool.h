@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifndef gbBufferPool_h
+#define gbBufferPool_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+typedef struct gbBufferPool gbBufferPool;
+
+gbBufferPool* gbBufferPool_Create(const char*  name,
+                                  const size_t buffer_size,
+                                  const size_t max_free_n);
+
+void* gbBufferPool_Get(gbBufferPool* pool);
+
+void gbBufferPool_Put(gbBufferPool* pool,
+                      void*         buf,
+                      const size_t  buf_size);
+
+size_t gbBufferPool_GetBufferSize(const gbBufferPool* pool);
+
+void gbBufferPool_PrintStats(const gbBufferPool* pool,
+                             const char*         logPrefix);
+
+void gbBufferPool_Destroy(gbBufferPool* pool);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,442 @@
+#include "gbDirScan.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ============
+// gbDirScan.c:
+// ============
+//
+// Multithreaded directory tree walk, for indexing millions of tiles.
+//
+// Each directory found is pushed onto a shared stack, and worker threads pop
+// and read them concurrently.  For an OSM {z}/{x}/{y}.png tree, that means the
+// x column directories are read in parallel, which matters most on network
+// storage where each readdir is a round trip.
+//
+// File vs. directory is taken from readdir's d_type, so no entry is stat'd
+// unless the filesystem doesn't report a type (DT_UNKNOWN) or it is a symlink.
+//
+// Entries whose names begin with "." are ignored.  (., .., .DS_Store, and
+// AppleDouble ._ files)
+//
+// Found files are collected per thread and handed to the caller in batches,
+// under a mutex, so the caller's function does not need to be thread safe.
+//
+
+#define kGB_DirScan_BatchN    1024      // paths per batch
+#define kGB_DirScan_PathN     1024      // max path length, as elsewhere
+
+typedef struct gbDirScan
+{
+    char**                  dirs;       // stack of directories to be read
+    size_t                  dir_n;
+    size_t                  dir_cap;
+    size_t                  busy_n;     // workers currently reading a directory
+    bool                    isRecursive;
+    bool                    isListDirs;     // report subdirectories, not files
+    
+    gbDirScan_BatchFunction fn;
+    void*                   ctx;
+    size_t                  file_n;
+    
+    pthread_mutex_t         mutex;      // dirs, busy_n
+    pthread_cond_t          cond;       // signalled on push, or when done
+    pthread_mutex_t         fn_mutex;   // serializes fn and file_n
+} gbDirScan;
+
+typedef struct gbDirScan_Batch
+{
+    char*  paths[kGB_DirScan_BatchN];
+    char   arena[kGB_DirScan_BatchN * 64];  // most tile paths are short
+    size_t arena_n;
+    size_t n;
+} gbDirScan_Batch;
+
+
+
+
+// =======================
+// _gbDirScan_Batch_Flush:
+// =======================
+//
+// Hands the batch to the caller's function and empties it.
+//
+static void _gbDirScan_Batch_Flush(gbDirScan*       scan,
+                                   gbDirScan_Batch* batch)
+{
+    if (batch->n == 0)
+    {
+        return;
+    }//if
+    
+    pthread_mutex_lock(&scan->fn_mutex);
+    
+    if (scan->fn != NULL)
+    {
+        scan->fn((const char* const*)batch->paths, batch->n, scan->ctx);
+    }//if
+    
+    scan->file_n += batch->n;
+    
+    pthread_mutex_unlock(&scan->fn_mutex);
+    
+    batch->n       = 0;
+    batch->arena_n = 0;
+}//_gbDirScan_Batch_Flush
+
+
+
+
+// ====================
+// _gbDirScan_JoinPath:
+// ====================
+//
+// dest = path + "/" + name.  Returns the length, or 0 if it would not fit in
+// dest_n. (including the terminator)
+//
+static inline size_t _gbDirScan_JoinPath(char*        dest,
+                                         const size_t dest_n,
+                                         const char*  path,
+                                         const size_t path_len,
+                                         const char*  name)
+{
+    const bool   hasSlash = path_len > 0 && path[path_len - 1] == '/';
+    const size_t name_len = strlen(name);
+    const size_t len      = path_len + (hasSlash ? 0 : 1) + name_len;
+    
+    if (len + 1 > dest_n)
+    {
+        return 0;
+    }//if
+    
+    memcpy(dest, path, path_len);
+    
+    if (!hasSlash)
+    {
+        dest[path_len] = '/';
+    }//if
+    
+    memcpy(dest + len - name_len, name, name_len);
+    dest[len] = '\0';
+    
+    return len;
+}//_gbDirScan_JoinPath
+
+
+
+
+// ===================
+// _gbDirScan_AddFile:
+// ===================
+//
+// Appends path + name to the batch, flushing first if it is full.
+//
+static void _gbDirScan_AddFile(gbDirScan*       scan,
+                               gbDirScan_Batch* batch,
+                               const char*      path,
+                               const size_t     path_len,
+                               const char*      name)
+{
+    const size_t need_n = path_len + strlen(name) + 2;     // slash + terminator
+    
+    if (need_n > kGB_DirScan_PathN)
+    {
+        printf("gbDirScan: [ERR] Path too long, skipping: [%s/%s]\n", path, name);
+        return;
+    }//if
+    
+    if (batch->n == kGB_DirScan_BatchN || batch->arena_n + need_n > sizeof(batch->arena))
+    {
+        _gbDirScan_Batch_Flush(scan, batch);
+    }//if
+    
+    char*        dest = &(batch->arena[batch->arena_n]);
+    const size_t len  = _gbDirScan_JoinPath(dest, sizeof(batch->arena) - batch->arena_n, path, path_len, name);
+    
+    batch->paths[batch->n] = dest;
+    batch->n++;
+    batch->arena_n        += len + 1;
+}//_gbDirScan_AddFile
+
+
+
+
+// ===================
+// _gbDirScan_PushDir:
+// ===================
+//
+// Takes ownership of path, a malloc'd string.
+//
+static void _gbDirScan_PushDir(gbDirScan* scan,
+                               char*      path)
+{
+    pthread_mutex_lock(&scan->mutex);
+    
+    if (scan->dir_n == scan->dir_cap)
+    {
+        scan->dir_cap = scan->dir_cap > 0 ? scan->dir_cap * 2 : 256;
+        scan->dirs    = realloc(scan->dirs, sizeof(char*) * scan->dir_cap);
+    }//if
+    
+    scan->dirs[scan->dir_n] = path;
+    scan->dir_n++;
+    
+    pthread_cond_signal(&scan->cond);
+    pthread_mutex_unlock(&scan->mutex);
+}//_gbDirScan_PushDir
+
+
+
+
+// ===================
+// _gbDirScan_ReadDir:
+// ===================
+//
+// Reads one directory.  Files go into batch, subdirectories onto the stack.
+// (or into batch, for gbDirScan_ListDirs)
+//
+static void _gbDirScan_ReadDir(gbDirScan*       scan,
+                               gbDirScan_Batch* batch,
+                               const char*      path)
+{
+    DIR* dir = opendir(path);
+    
+    if (dir == NULL)
+    {
+        printf("gbDirScan: [ERR] Could not open directory [%s]\n", path);
+        return;
+    }//if
+    
+    const size_t   path_len = strlen(path);
+    struct dirent* ent;
+    
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+        {
+            continue;
+        }//if
+        
+        bool isDir  = false;
+        bool isFile = false;
+        
+#ifdef DT_DIR
+        isDir  = ent->d_type == DT_DIR;
+        isFile = ent->d_type == DT_REG;
+#endif
+        
+        if (!isDir && !isFile)                  // DT_UNKNOWN or DT_LNK: ask
+        {
+            struct stat st;
+            
+            if (fstatat(dirfd(dir), ent->d_name, &st, 0) == 0)
+            {
+                isDir  = S_ISDIR(st.st_mode);
+                isFile = S_ISREG(st.st_mode);
+            }//if
+        }//if
+        
+        if (scan->isListDirs)
+        {
+            if (isDir)
+            {
+                _gbDirScan_AddFile(scan, batch, path, path_len, ent->d_name);
+            }//if
+        }//if
+        else if (isFile)
+        {
+            _gbDirScan_AddFile(scan, batch, path, path_len, ent->d_name);
+        }//else if
+        else if (isDir && scan->isRecursive)
+        {
+            char* subPath = malloc(sizeof(char) * kGB_DirScan_PathN);
+            
+            if (_gbDirScan_JoinPath(subPath, kGB_DirScan_PathN, path, path_len, ent->d_name) > 0)
+            {
+                _gbDirScan_PushDir(scan, subPath);
+            }//if
+            else
+            {
+                printf("gbDirScan: [ERR] Path too long, skipping: [%s/%s]\n", path, ent->d_name);
+                free(subPath);
+            }//else
+        }//else if
+    }//while
+    
+    closedir(dir);
+}//_gbDirScan_ReadDir
+
+
+
+
+// ==================
+// _gbDirScan_Worker:
+// ==================
+//
+// Pops and reads directories until the stack is empty and no other worker
+// is still reading one. (which could push more)
+//
+static void* _gbDirScan_Worker(void* arg)
+{
+    gbDirScan*       scan  = (gbDirScan*)arg;
+    gbDirScan_Batch* batch = malloc(sizeof(gbDirScan_Batch));
+    
+    batch->n       = 0;
+    batch->arena_n = 0;
+    
+    pthread_mutex_lock(&scan->mutex);
+    
+    while (true)
+    {
+        while (scan->dir_n == 0 && scan->busy_n > 0)
+        {
+            pthread_cond_wait(&scan->cond, &scan->mutex);
+        }//while
+        
+        if (scan->dir_n == 0)                   // and nobody busy: done
+        {
+            pthread_cond_broadcast(&scan->cond);
+            break;
+        }//if
+        
+        scan->dir_n--;
+        char* path = scan->dirs[scan->dir_n];
+        scan->busy_n++;
+        
+        pthread_mutex_unlock(&scan->mutex);
+        
+        _gbDirScan_ReadDir(scan, batch, path);
+        free(path);
+        
+        pthread_mutex_lock(&scan->mutex);
+        
+        scan->busy_n--;
+        
+        if (scan->busy_n == 0 && scan->dir_n == 0)
+        {
+            pthread_cond_broadcast(&scan->cond);
+        }//if
+    }//while
+    
+    pthread_mutex_unlock(&scan->mutex);
+    
+    _gbDirScan_Batch_Flush(scan, batch);
+    free(batch);
+    
+    return NULL;
+}//_gbDirScan_Worker
+
+
+
+
+// ===============
+// _gbDirScan_Run:
+// ===============
+//
+// Shared by gbDirScan_Scan and gbDirScan_ListDirs.
+//
+static size_t _gbDirScan_Run(const char*             srcPath,
+                             const bool              isRecursive,
+                             const bool              isListDirs,
+                             const size_t            thread_n,
+                             gbDirScan_BatchFunction fn,
+                             void*                   ctx)
+{
+    gbDirScan scan;
+    long      cpu_n = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t    th_n  = thread_n > 0 ? thread_n : cpu_n > 2 ? 2 * (size_t)cpu_n : 4;
+    
+    memset(&scan, 0, sizeof(gbDirScan));
+    
+    scan.isRecursive = isRecursive;
+    scan.isListDirs  = isListDirs;
+    scan.fn          = fn;
+    scan.ctx         = ctx;
+    
+    pthread_mutex_init(&scan.mutex,    NULL);
+    pthread_mutex_init(&scan.fn_mutex, NULL);
+    pthread_cond_init (&scan.cond,     NULL);
+    
+    char* root = malloc(sizeof(char) * kGB_DirScan_PathN);
+    
+    snprintf(root, kGB_DirScan_PathN, "%s", srcPath);
+    
+    _gbDirScan_PushDir(&scan, root);
+    
+    pthread_t* threads = malloc(sizeof(pthread_t) * th_n);
+    size_t     start_n = 0;
+    
+    for (size_t i = 0; i < th_n && th_n > 1; i++)
+    {
+        if (pthread_create(&(threads[i]), NULL, _gbDirScan_Worker, &scan) != 0)
+        {
+            printf("gbDirScan_Scan: [ERR] pthread_create failed for thread %zu of %zu.\n", i, th_n);
+            break;
+        }//if
+        
+        start_n++;
+    }//for
+    
+    if (start_n == 0)
+    {
+        _gbDirScan_Worker(&scan);               // single threaded, or no threads
+    }//if
+    
+    for (size_t i = 0; i < start_n; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }//for
+    
+    free(threads);
+    free(scan.dirs);
+    
+    pthread_mutex_destroy(&scan.mutex);
+    pthread_mutex_destroy(&scan.fn_mutex);
+    pthread_cond_destroy (&scan.cond);
+    
+    return scan.file_n;
+}//_gbDirScan_Run
+
+
+
+
+// ===============
+// gbDirScan_Scan:
+// ===============
+//
+// Walks srcPath (and its subdirectories, if isRecursive) on thread_n threads,
+// passing every file found to fn in batches.  fn may be NULL to only count.
+//
+// Returns the number of files found.  Order is not defined.
+//
+// thread_n: 0 -> 2x the CPU count, min 4.  Reads mostly wait on the
+//           filesystem, so more threads than CPUs helps.
+//
+size_t gbDirScan_Scan(const char*             srcPath,
+                      const bool              isRecursive,
+                      const size_t            thread_n,
+                      gbDirScan_BatchFunction fn,
+                      void*                   ctx)
+{
+    return _gbDirScan_Run(srcPath, isRecursive, false, thread_n, fn, ctx);
+}//gbDirScan_Scan
+
+
+
+
+// ===================
+// gbDirScan_ListDirs:
+// ===================
+//
+// Passes the full path of every immediate subdirectory of srcPath to fn, in
+// batches, on the calling thread.  (eg, the x columns of a z level)
+//
+// Returns the number of subdirectories found.
+//
+size_t gbDirScan_ListDirs(const char*             srcPath,
+                          gbDirScan_BatchFunction fn,
+                          void*                   ctx)
+{
+    return _gbDirScan_Run(srcPath, false, true, 1, fn, ctx);
+}//gbDirScan_ListDirs
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef gbDirScan_h
+#define gbDirScan_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+// Receives a batch of n full file paths.  Calls are serialized, so this need
+// not be thread safe.  The paths are only valid for the duration of the call.
+typedef void (*gbDirScan_BatchFunction)(const char* const* filepaths,
+                                        const size_t       n,
+                                        void*              ctx);
+
+size_t gbDirScan_Scan(const char*             srcPath,
+                      const bool              isRecursive,
+                      const size_t            thread_n,
+                      gbDirScan_BatchFunction fn,
+                      void*                   ctx);
+
+size_t gbDirScan_ListDirs(const char*             srcPath,
+                          gbDirScan_BatchFunction fn,
+                          void*                   ctx);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
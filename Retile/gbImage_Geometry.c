@@ -528,10 +528,14 @@ void gbImage_Resize_vImage_Lanczos3x3_RGBA8888(const uint8_t* src,
                                                const size_t   dest_h,
                                                const size_t   dest_rowBytes)
 {
+#ifdef __ACCELERATE__
     vImage_Buffer vi_src  = { (void*)src,   src_h,  src_w,  src_rowBytes };
     vImage_Buffer vi_dest = { (void*)dest, dest_h, dest_w, dest_rowBytes };
     
     vImageScale_ARGB8888(&vi_src, &vi_dest, NULL, kvImageNoFlags);
+#else
+    gbImage_Resize_Bilinear_RGBA8888(src, dest, src_w, src_h, dest_w, dest_h);   // no vImage, best available
+#endif
 }//gbImage_Resize_vImage_Lanczos3x3_RGBA8888
 
 void gbImage_Resize_vImage_Lanczos5x5_RGBA8888(const uint8_t* src,
@@ -543,10 +547,14 @@ void gbImage_Resize_vImage_Lanczos5x5_RGBA8888(const uint8_t* src,
                                                const size_t   dest_h,
                                                const size_t   dest_rowBytes)
 {
+#ifdef __ACCELERATE__
     vImage_Buffer vi_src  = { (void*)src,   src_h,  src_w,  src_rowBytes };
     vImage_Buffer vi_dest = { (void*)dest, dest_h, dest_w, dest_rowBytes };
     
     vImageScale_ARGB8888(&vi_src, &vi_dest, NULL, kvImageHighQualityResampling);
+#else
+    gbImage_Resize_Bilinear_RGBA8888(src, dest, src_w, src_h, dest_w, dest_h);   // no vImage, best available
+#endif
 }//gbImage_Resize_vImage_Lanczos5x5_RGBA8888
 
 // =================================
@@ -762,7 +770,9 @@ void gbImage_Resize_HalfTile_RGBA8888(const uint8_t*      src,
     int _interpolationTypeId = interpolationTypeId;
     
 #ifndef __ACCELERATE__
-    _interpolationTypeId  = _interpolationTypeId  == kGB_Image_Interp_Lanczos3x3 || kGB_Image_Interp_Lanczos5x5 ? kGB_Image_Interp_Average;
+    _interpolationTypeId  =    _interpolationTypeId == kGB_Image_Interp_Lanczos3x3
+                            || _interpolationTypeId == kGB_Image_Interp_Lanczos5x5 ? kGB_Image_Interp_Average
+                                                                                   : _interpolationTypeId;
 #endif
     
     if (_interpolationTypeId == kGB_Image_Interp_Average)
@@ -2998,6 +3008,164 @@ void gbImage_Resize_EnlargeTile_RGBA8888(const uint8_t*  src,
 
 
 
+// ============================================
+// _EnlargeWholeTile_Bilinear_ByChild_RGBA8888:
+// ============================================
+//
+// For gbImage_Resize_EnlargeWholeTile_RGBA8888.  Resamples each dest tile
+// from its padded window of the padded src, sized as in
+// gbImage_Resize_EnlargeTile_Lanczos_RGBA8888, and copies the result to its
+// place in dest.
+//
+static void _EnlargeWholeTile_Bilinear_ByChild_RGBA8888(const uint32_t* padded_src,
+                                                        const size_t    padded_src_w,
+                                                        uint8_t*        dest,
+                                                        const size_t    dest_rowBytes,
+                                                        const size_t    w,
+                                                        const size_t    h,
+                                                        const uint32_t  zs,
+                                                        const size_t    rsExtent)
+{
+    const size_t roi_w = w >> zs;
+    const size_t roi_h = h >> zs;
+    
+    size_t padded_roi_w;
+    size_t padded_roi_h;
+    size_t padded_w;
+    size_t padded_h;
+    
+    _GetAdjustedROI_ForKernelExtent(rsExtent, w, h, roi_w, roi_h, &padded_w, &padded_h, &padded_roi_w, &padded_roi_h);
+    
+    uint32_t* crop_rgba = malloc(sizeof(uint32_t) * padded_roi_w * padded_roi_h);
+    uint32_t* temp_rgba = malloc(sizeof(uint32_t) * padded_w     * padded_h);
+    
+    for (size_t cy = 0; cy < (1UL << zs); cy++)
+    {
+        for (size_t cx = 0; cx < (1UL << zs); cx++)
+        {
+            _CopyByRow_RGBA8888((const uint8_t*)(padded_src + cy * roi_h * padded_src_w + cx * roi_w),
+                                padded_roi_w, padded_roi_h, padded_src_w * 4,
+                                (uint8_t*)crop_rgba,
+                                padded_roi_w, padded_roi_h, padded_roi_w * 4);
+            
+            gbImage_Resize_Bilinear_RGBA8888((uint8_t*)crop_rgba,
+                                             (uint8_t*)temp_rgba,
+                                             padded_roi_w, padded_roi_h,
+                                             padded_w,     padded_h);
+            
+            _CopyByRow_RGBA8888((uint8_t*)temp_rgba,
+                                padded_w, padded_h, padded_w * 4,
+                                dest + cy * h * dest_rowBytes + cx * w * 4,
+                                w, h, dest_rowBytes);
+        }//for
+    }//for
+    
+    free(temp_rgba);
+    free(crop_rgba);
+}//_EnlargeWholeTile_Bilinear_ByChild_RGBA8888
+
+
+
+
+// =========================================
+// gbImage_Resize_EnlargeWholeTile_RGBA8888:
+// =========================================
+//
+// Enlarges all of tile src by 2^zs, for the padded kernels. (Lanczos and
+// bilinear)  gbImage_Resize_EnlargeTile_RGBA8888 pads, NODATA fills and
+// resamples a crop once per dest tile, and the padding of neighbouring crops
+// overlaps; here that is done once for the whole tile, and vImage resamples
+// it in one go.
+//
+// Bilinear aligns the corners of its src and dest, so where it samples
+// depends on the size resampled.  It, and the vImage kernels in builds
+// without Accelerate, which fall back to it, still resample each dest tile's
+// padded window separately, at the same size as the per-dest-tile path, so
+// the output does not change.  Only the pad and fill are shared.
+//
+// Returns a new buffer, which the caller must free, of (w << zs) x (h << zs)
+// pixels plus the padding on the right and bottom.  Its row stride is set in
+// dest_rowBytes.  The dest tile at cx, cy, relative to the first child of
+// src, starts at (cy * h * dest_rowBytes) + (cx * w * 4) and can be used in
+// place, with that stride.
+//
+// The NN family does not pad, and should use gbImage_Resize_EnlargeTile_RGBA8888.
+//
+uint8_t* gbImage_Resize_EnlargeWholeTile_RGBA8888(const uint8_t* src,
+                                                  const size_t   w,
+                                                  const size_t   h,
+                                                  const size_t   src_rowBytes,
+                                                  const uint32_t zs,
+                                                  const int      interpolationTypeId,
+                                                  size_t*        dest_rowBytes)
+{
+    const bool NODATA_FILL_NEIGHBORHOOD = false;    // see gbImage_Resize_EnlargeTile_Lanczos_RGBA8888
+    const bool NODATA_FILL_EDGE_EXTEND  = true;
+    
+    size_t padded_src_w;
+    size_t padded_src_h;
+    size_t padded_w;
+    size_t padded_h;
+    
+    const size_t rsExtent = _GetResampleKernelExtent_ForInterpolationTypeId(interpolationTypeId);
+    _GetAdjustedROI_ForKernelExtent(rsExtent, w << zs, h << zs, w, h, &padded_w, &padded_h, &padded_src_w, &padded_src_h);
+    
+    
+    // --- pad src once, filling the padding ---
+    uint32_t* crop_rgba = malloc(sizeof(uint32_t) * padded_src_w * padded_src_h);
+    memset(crop_rgba, 0, sizeof(uint32_t) * padded_src_w * padded_src_h);
+    _CopyByRow_RGBA8888(src,
+                        w, h, src_rowBytes,
+                        (uint8_t*)crop_rgba,
+                        w, h, padded_src_w * 4);
+    
+    gbImage_FillNODATA_RGBA8888((uint8_t*)crop_rgba,
+                                padded_src_w, padded_src_h,
+                                w, h,
+                                NODATA_FILL_EDGE_EXTEND,
+                                NODATA_FILL_NEIGHBORHOOD);
+    
+    
+    // --- resample, the children are views into the output ---
+    uint8_t* dest = malloc(sizeof(uint32_t) * padded_w * padded_h);
+    
+#ifdef __ACCELERATE__
+    const bool isBilinear = interpolationTypeId == kGB_Image_Interp_Bilinear;
+#else
+    const bool isBilinear = true;       // see gbImage_Resize_vImage_Lanczos3x3_RGBA8888
+#endif
+    
+    if (isBilinear)
+    {
+        _EnlargeWholeTile_Bilinear_ByChild_RGBA8888(crop_rgba, padded_src_w, dest, padded_w * 4, w, h, zs, rsExtent);
+    }//if
+    else if (interpolationTypeId == kGB_Image_Interp_Lanczos3x3)
+    {
+        gbImage_Resize_vImage_Lanczos3x3_RGBA8888((uint8_t*)crop_rgba,
+                                                  dest,
+                                                  padded_src_w, padded_src_h, padded_src_w * 4,
+                                                  padded_w,     padded_h,     padded_w     * 4);
+    }//else if
+    else if (interpolationTypeId == kGB_Image_Interp_Lanczos5x5)
+    {
+        gbImage_Resize_vImage_Lanczos5x5_RGBA8888((uint8_t*)crop_rgba,
+                                                  dest,
+                                                  padded_src_w, padded_src_h, padded_src_w * 4,
+                                                  padded_w,     padded_h,     padded_w     * 4);
+    }//else if
+    
+    free(crop_rgba);
+    crop_rgba = NULL;
+    
+    *dest_rowBytes = padded_w * 4;
+    
+    return dest;
+}//gbImage_Resize_EnlargeWholeTile_RGBA8888
+
+
+
+
+
 
 
 
@@ -2,9 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/param.h> // MIN, MAX
 #include "sqlite3.h"
 #include "unistd.h"
+#ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
+#endif
 #include "NEONvsSSE_5.h" // https://software.intel.com/en-us/blogs/2012/12/12/from-arm-neon-to-intel-mmxsse-automatic-porting-solution-tips-and-tricks
 
 #ifndef gbImage_Geometry_h
@@ -61,6 +65,21 @@ void gbImage_Resize_EnlargeTile_RGBA8888(const uint8_t*  src,
                                          const int       interpolationTypeId,
                                          bool*           roiWasEmpty);
 
+uint8_t* gbImage_Resize_EnlargeWholeTile_RGBA8888(const uint8_t* src,
+                                                  const size_t   w,
+                                                  const size_t   h,
+                                                  const size_t   src_rowBytes,
+                                                  const uint32_t zs,
+                                                  const int      interpolationTypeId,
+                                                  size_t*        dest_rowBytes);
+
+bool gbStats_GetHasAnyDataROI_RGBA8888(const uint32_t* v0,
+                                       const size_t    width,
+                                       const size_t    rwx0,
+                                       const size_t    rwy0,
+                                       const size_t    rwx1,
+                                       const size_t    rwy1);
+    
     
     
 // the following should not be used directly, they are exposed for testing.
@@ -4,7 +4,8 @@
 // gbImage_png.c:
 // ==============
 //
-// Reads/writes RGBA8888 buffers to PNG files on disk.
+// Reads/writes RGBA8888 buffers to PNG files on disk, or to/from PNGs held
+// in memory.
 //
 // Writes are optimized, and were improved by <1% when running
 // pngcrush -rem alla -reduce -brute on the output for ~300k tiles.
@@ -455,31 +456,101 @@ static FORCE_INLINE void _IndexedToPlanar8_IfNeeded_PNG(uint8_t*         idxs,
 
 
 
-// ====================
-// _svceqqi_u32_scalar:
-// ====================
+// ===================
+// _PalHash_* (types):
+// ===================
 //
-// Scalar-vector compare equality and find index, scalar version.
+// Palette lookup for _MakePaletteFromRGBA8888, replacing a linear search of
+// up to 256 entries per pixel.  RGBA values hash to one of 128 buckets of 4
+// slots, and a bucket is probed with a single 4-wide compare.  A full bucket
+// spills into the next.  With at most 257 colors in 512 slots, nearly every
+// lookup is one probe.
 //
-// (don't ask what happened to the SIMD version)
-//
-static FORCE_INLINE size_t _svceqqi_u32_scalar(const uint32_t* src,
-                                               const uint32_t  x,
-                                               const size_t    n)
+#define kPalHash_BucketN 128
+
+typedef struct PalHash
+{
+    uint32_t keys[kPalHash_BucketN * 4] __attribute__ ((aligned(16)));
+    uint16_t vals[kPalHash_BucketN * 4];
+    uint8_t  n   [kPalHash_BucketN];
+} PalHash;
+
+static FORCE_INLINE size_t _PalHash_FindInBucket_scalar(const uint32_t* keys,
+                                                        const uint32_t  rgba,
+                                                        const size_t    n)
 {
-    size_t idx = UINT32_MAX;
-    
     for (size_t i = 0; i < n; i++)
     {
-        if (src[i] == x)
+        if (keys[i] == rgba)
         {
-            idx = i;
-            break;
+            return i;
         }//if
     }//for
     
-    return idx;
-}//_svceqqi_u32_scalar
+    return 4;
+}//_PalHash_FindInBucket_scalar
+
+static FORCE_INLINE size_t _PalHash_FindInBucket_NEON(const uint32_t* keys,
+                                                      const uint32_t  rgba,
+                                                      const size_t    n)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    const uint32x4_t k    = vld1q_u32(keys);
+    const uint32x4_t x    = vdupq_n_u32(rgba);
+    const uint32x4_t eq   = vceqq_u32(k, x);
+    const uint16x4_t eq16 = vmovn_u32(eq);
+    uint64_t         mask = vget_lane_u64(vreinterpret_u64_u16(eq16), 0);           // 16 bits per lane
+    
+    mask &= n < 4 ? (1ULL << (n * 16)) - 1ULL : UINT64_MAX;                         // unused slots hold junk
+    
+    return mask != 0 ? (size_t)__builtin_ctzll(mask) >> 4 : 4;
+#else
+    return 4;
+#endif
+}//_PalHash_FindInBucket_NEON
+
+
+// =================
+// _PalHash_FindAdd:
+// =================
+//
+// Returns the value slot for rgba.  If rgba was not there yet, it is added,
+// *isNew is set, and the caller must fill in the value.
+//
+static FORCE_INLINE uint16_t* _PalHash_FindAdd(PalHash*       h,
+                                               const uint32_t rgba,
+                                               bool*          isNew)
+{
+    size_t b = (size_t)((rgba * 0x9E3779B1U) >> 25);                   // top 7 bits -> 0 ... 127
+    
+    while (true)
+    {
+        const size_t n = h->n[b];
+        
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+        const size_t i = _PalHash_FindInBucket_NEON(&(h->keys[b * 4]), rgba, n);
+#else
+        const size_t i = _PalHash_FindInBucket_scalar(&(h->keys[b * 4]), rgba, n);
+#endif
+        
+        if (i < 4)
+        {
+            *isNew = false;
+            return &(h->vals[b * 4 + i]);
+        }//if
+        
+        if (n < 4)
+        {
+            h->keys[b * 4 + n] = rgba;
+            h->n[b]            = (uint8_t)(n + 1);
+            *isNew             = true;
+            return &(h->vals[b * 4 + n]);
+        }//if
+        
+        b = (b + 1) & (kPalHash_BucketN - 1);
+    }//while
+}//_PalHash_FindAdd
+
 
 
 // ====================
@@ -619,6 +690,39 @@ static FORCE_INLINE void _RGBA8888_to_RGB888_vImage(const uint8_t* src,
 }//_RGBA8888_to_RGB888_vImage
 
 
+// =========================
+// _RGBA8888_to_RGB888_NEON:
+// =========================
+//
+// As _RGBA8888_to_RGB888, for width * height evenly divisible by 16.
+//
+// Each store of 48 bytes ends before the next load of 64 begins, so this
+// will work in-place.  NEON/SSE version.
+//
+static FORCE_INLINE void _RGBA8888_to_RGB888_NEON(const uint8_t* src,
+                                                  uint8_t*       dest,
+                                                  const size_t   width,
+                                                  const size_t   height)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    const size_t n = width * height;
+    uint8x16x4_t s_u8x16x4;
+    uint8x16x3_t d_u8x16x3;
+    
+    for (size_t i = 0; i < n; i += 16)
+    {
+        s_u8x16x4 = vld4q_u8( &(src[i * 4]) );
+        
+        d_u8x16x3.val[0] = s_u8x16x4.val[0];
+        d_u8x16x3.val[1] = s_u8x16x4.val[1];
+        d_u8x16x3.val[2] = s_u8x16x4.val[2];
+        
+        vst3q_u8( &(dest[i * 3]), d_u8x16x3);
+    }//for
+#endif
+}//_RGBA8888_to_RGB888_NEON
+
+
 // ====================
 // _RGBA8888_to_RGB888:
 // ====================
@@ -645,8 +749,29 @@ static inline void _RGBA8888_to_RGB888(const uint8_t* src,
     {
         _RGBA8888_to_RGB888_scalar(src, dest, width, height);
     }//else
+#elif defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    const size_t n = width * height;
+    
+    if (n > 15)
+    {
+        const size_t lastCleanN = n - n % 16;
+        
+        _RGBA8888_to_RGB888_NEON(src, dest, lastCleanN, 1);
+        
+        if (n % 16 != 0)
+        {
+            _RGBA8888_to_RGB888_scalar(src  + lastCleanN * 4,
+                                       dest + lastCleanN * 3,
+                                       n    - lastCleanN,
+                                       1);
+        }//if
+    }//if
+    else
+    {
+        _RGBA8888_to_RGB888_scalar(src, dest, width, height);
+    }//else
 #else
-    _RGBA8888_to_RGB888_InPlace_scalar(src, width, height);
+    _RGBA8888_to_RGB888_scalar(src, dest, width, height);
 #endif
 }//_RGBA8888_to_RGB888
 
@@ -720,29 +845,132 @@ static inline void _RGBA8888_u32_to_png_color_a08(const uint32_t* src,
 // Pushes RGBA value onto palette stack, updates corresponding value idat_idx,
 // and increments pal_idx.
 //
-// If RGBA value was already on stack, just updates idat_idx.
+// If RGBA value was already on stack, just updates idat_idx.  hash maps each
+// value on the stack to its idat_idx.
 //
 static inline void _PalettePush_UpdateIdxs_RGBA8888(const uint32_t rgba,
                                                     uint32_t*      palette,
+                                                    PalHash*       hash,
                                                     uint16_t*      idat_idx,
                                                     size_t*        pal_idx,
                                                     const uint16_t idat_idx_offset)
 {
-    size_t existsIdx = _svceqqi_u32_scalar(palette, rgba, *pal_idx);
+    bool      isNew;
+    uint16_t* val = _PalHash_FindAdd(hash, rgba, &isNew);
     
-    if (existsIdx != UINT32_MAX)
+    if (isNew)
     {
-        *idat_idx         = existsIdx + idat_idx_offset;
-    }//if
-    else
-    {
-        *idat_idx         = *pal_idx  + idat_idx_offset;
+        *val              = *pal_idx  + idat_idx_offset;
         palette[*pal_idx] = rgba;
-
+        
         *pal_idx          = *pal_idx  + 1;
-    }//else
+    }//if
+    
+    *idat_idx = *val;
 }//_PalettePush_UpdateIdxs_RGBA8888
 
+// =========================
+// _IsOpaqueRGBA8888_scalar:
+// =========================
+//
+// As _IsOpaqueRGBA8888 (scalar version).
+//
+static FORCE_INLINE bool _IsOpaqueRGBA8888_scalar(const uint8_t* src,
+                                                  const size_t   width,
+                                                  const size_t   height,
+                                                  const size_t   rowBytes,
+                                                  const size_t   first_i)
+{
+    bool isOpaque = true;
+    
+    for (size_t y = first_i / width; y < height && isOpaque; y++)
+    {
+        const uint32_t* src_u32 = (uint32_t*)(src + y * rowBytes);
+        
+        for (size_t x = y == first_i / width ? first_i % width : 0; x < width; x++)
+        {
+            if (src_u32[x] >> 24 != 0xFF)   // LSB
+            {
+                isOpaque = false;
+                break;
+            }//if
+        }//for
+    }//for
+    
+    return isOpaque;
+}//_IsOpaqueRGBA8888_scalar
+
+// =======================
+// _IsOpaqueRGBA8888_NEON:
+// =======================
+//
+// As _IsOpaqueRGBA8888 (NEON/SSE version).
+//
+// ANDs each row together 16 pixels at a time, and only looks at the alpha
+// byte of the result at the end of the row.
+//
+static FORCE_INLINE bool _IsOpaqueRGBA8888_NEON(const uint8_t* src,
+                                                const size_t   width,
+                                                const size_t   height,
+                                                const size_t   rowBytes,
+                                                const size_t   first_i)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    uint32x4_t s0_u32x4;
+    uint32x4_t s1_u32x4;
+    uint32x4_t s2_u32x4;
+    uint32x4_t s3_u32x4;
+    uint32x4_t m_u32x4;
+    uint32_t   m_u32;
+    
+    for (size_t y = first_i / width; y < height; y++)
+    {
+        const uint32_t* src_u32 = (uint32_t*)(src + y * rowBytes);
+        size_t          x       = y == first_i / width ? first_i % width : 0;
+        
+        m_u32x4 = vdupq_n_u32(0xFF000000);
+        
+        for (; x + 16 <= width; x += 16)
+        {
+            s0_u32x4 = vld1q_u32( &(src_u32[x     ]) );
+            s1_u32x4 = vld1q_u32( &(src_u32[x +  4]) );
+            s2_u32x4 = vld1q_u32( &(src_u32[x +  8]) );
+            s3_u32x4 = vld1q_u32( &(src_u32[x + 12]) );
+            
+            s0_u32x4 = vandq_u32(s0_u32x4, s1_u32x4);
+            s2_u32x4 = vandq_u32(s2_u32x4, s3_u32x4);
+            s0_u32x4 = vandq_u32(s0_u32x4, s2_u32x4);
+            m_u32x4  = vandq_u32(m_u32x4,  s0_u32x4);
+        }//for
+        
+        for (; x + 4 <= width; x += 4)
+        {
+            s0_u32x4 = vld1q_u32( &(src_u32[x]) );
+            m_u32x4  = vandq_u32(m_u32x4, s0_u32x4);
+        }//for
+        
+        m_u32 = vgetq_lane_u32(m_u32x4, 0)
+              & vgetq_lane_u32(m_u32x4, 1)
+              & vgetq_lane_u32(m_u32x4, 2)
+              & vgetq_lane_u32(m_u32x4, 3);
+        
+        for (; x < width; x++)
+        {
+            m_u32 &= src_u32[x];
+        }//for
+        
+        if (m_u32 >> 24 != 0xFF)
+        {
+            return false;
+        }//if
+    }//for
+    
+    return true;
+#else
+    return _IsOpaqueRGBA8888_scalar(src, width, height, rowBytes, first_i);
+#endif
+}//_IsOpaqueRGBA8888_NEON
+
 // ==================
 // _IsOpaqueRGBA8888:
 // ==================
@@ -754,23 +982,146 @@ static inline void _PalettePush_UpdateIdxs_RGBA8888(const uint32_t rgba,
 // primary conversion to indexed color fails because there are too many colors
 // found.
 //
+// Only pixels from first_i on, counting row by row, are checked.
+//
 static inline bool _IsOpaqueRGBA8888(const uint8_t* src,
-                                     const size_t   n)
+                                     const size_t   width,
+                                     const size_t   height,
+                                     const size_t   rowBytes,
+                                     const size_t   first_i)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    return _IsOpaqueRGBA8888_NEON(src, width, height, rowBytes, first_i);
+#else
+    return _IsOpaqueRGBA8888_scalar(src, width, height, rowBytes, first_i);
+#endif
+}//_IsOpaqueRGBA8888
+
+
+
+// ===========================
+// _IsUniformRGBA8888_scalar:
+// ===========================
+//
+// As _IsUniformRGBA8888 (scalar version).
+//
+static FORCE_INLINE bool _IsUniformRGBA8888_scalar(const uint8_t* src,
+                                                   const size_t   width,
+                                                   const size_t   height,
+                                                   const size_t   rowBytes)
 {
-    bool            isOpaque = true;
-    const uint32_t* src_u32  = (uint32_t*)src;
+    const uint32_t rgba = *(const uint32_t*)src;
     
-    for (size_t i = 0; i < n; i++)
+    for (size_t y = 0; y < height; y++)
     {
-        if (src_u32[i] >> 24 != 0xFF)   // LSB
+        const uint32_t* src_u32 = (const uint32_t*)(src + y * rowBytes);
+        
+        for (size_t x = 0; x < width; x++)
         {
-            isOpaque = false;
-            break;
+            if (src_u32[x] != rgba)
+            {
+                return false;
+            }//if
+        }//for
+    }//for
+    
+    return true;
+}//_IsUniformRGBA8888_scalar
+
+// =========================
+// _IsUniformRGBA8888_NEON:
+// =========================
+//
+// As _IsUniformRGBA8888 (NEON/SSE version).
+//
+// Compares 16 pixels at a time to the first, and checks the ANDed results at
+// the end of each row.
+//
+static FORCE_INLINE bool _IsUniformRGBA8888_NEON(const uint8_t* src,
+                                                 const size_t   width,
+                                                 const size_t   height,
+                                                 const size_t   rowBytes)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    const uint32_t   rgba    = *(const uint32_t*)src;
+    const uint32x4_t c_u32x4 = vdupq_n_u32(rgba);
+    uint32x4_t       s0_u32x4;
+    uint32x4_t       s1_u32x4;
+    uint32x4_t       s2_u32x4;
+    uint32x4_t       s3_u32x4;
+    uint32x4_t       m_u32x4;
+    uint32_t         m_u32;
+    
+    for (size_t y = 0; y < height; y++)
+    {
+        const uint32_t* src_u32 = (const uint32_t*)(src + y * rowBytes);
+        size_t          x       = 0;
+        
+        m_u32x4 = vdupq_n_u32(UINT32_MAX);
+        
+        for (; x + 16 <= width; x += 16)
+        {
+            s0_u32x4 = vld1q_u32( &(src_u32[x     ]) );
+            s1_u32x4 = vld1q_u32( &(src_u32[x +  4]) );
+            s2_u32x4 = vld1q_u32( &(src_u32[x +  8]) );
+            s3_u32x4 = vld1q_u32( &(src_u32[x + 12]) );
+            
+            s0_u32x4 = vceqq_u32(s0_u32x4, c_u32x4);
+            s1_u32x4 = vceqq_u32(s1_u32x4, c_u32x4);
+            s2_u32x4 = vceqq_u32(s2_u32x4, c_u32x4);
+            s3_u32x4 = vceqq_u32(s3_u32x4, c_u32x4);
+            
+            s0_u32x4 = vandq_u32(s0_u32x4, s1_u32x4);
+            s2_u32x4 = vandq_u32(s2_u32x4, s3_u32x4);
+            s0_u32x4 = vandq_u32(s0_u32x4, s2_u32x4);
+            m_u32x4  = vandq_u32(m_u32x4,  s0_u32x4);
+        }//for
+        
+        m_u32 = vgetq_lane_u32(m_u32x4, 0)
+              & vgetq_lane_u32(m_u32x4, 1)
+              & vgetq_lane_u32(m_u32x4, 2)
+              & vgetq_lane_u32(m_u32x4, 3);
+        
+        for (; x < width && m_u32 != 0; x++)
+        {
+            m_u32 = src_u32[x] == rgba ? m_u32 : 0;
+        }//for
+        
+        if (m_u32 == 0)
+        {
+            return false;
         }//if
     }//for
     
-    return isOpaque;
-}//_IsOpaqueRGBA8888
+    return true;
+#else
+    return _IsUniformRGBA8888_scalar(src, width, height, rowBytes);
+#endif
+}//_IsUniformRGBA8888_NEON
+
+// ===================
+// _IsUniformRGBA8888:
+// ===================
+//
+// Returns whether or not every pixel of the interleaved RGBA8888 image src is
+// the same value, such as a fully transparent or a flat fill tile.
+//
+static inline bool _IsUniformRGBA8888(const uint8_t* src,
+                                      const size_t   width,
+                                      const size_t   height,
+                                      const size_t   rowBytes)
+{
+    if (width == 0 || height == 0)
+    {
+        return false;
+    }//if
+    
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    return _IsUniformRGBA8888_NEON(src, width, height, rowBytes);
+#else
+    return _IsUniformRGBA8888_scalar(src, width, height, rowBytes);
+#endif
+}//_IsUniformRGBA8888
 
 
 
@@ -787,9 +1138,12 @@ static inline bool _IsOpaqueRGBA8888(const uint8_t* src,
 //
 // Note this is a lossless palletization ONLY.  No median cuts, dithering, etc.
 //
+// src rows are rowBytes apart; idxOut is packed.
+//
 static inline size_t _MakePaletteFromRGBA8888(uint8_t*     src,
                                               const size_t width,
                                               const size_t height,
+                                              const size_t rowBytes,
                                               png_color**  rgbOut,
                                               uint8_t**    aOut,
                                               uint8_t**    idxOut,
@@ -798,6 +1152,8 @@ static inline size_t _MakePaletteFromRGBA8888(uint8_t*     src,
 {
     const size_t        n = width * height;
     uint32_t*     src_u32 = (uint32_t*)src;                                 // oh noes, someone call the programming police
+    const uint32_t*   row = src_u32;                                        // src row of pixel i
+    size_t              x = 0;
     uint16_t*    idxs_u16 = malloc(sizeof(uint16_t) * n);                   // widen to 16 bits to encode threshold offset
     uint8_t*     idxs_u08 = NULL;
     uint8_t*           _a = NULL;                                           // Planar8 alpha values for palette
@@ -808,22 +1164,45 @@ static inline size_t _MakePaletteFromRGBA8888(uint8_t*     src,
     
     uint32_t  tempPal_IsO[257] __attribute__ ((aligned(16)));
     uint32_t  tempPal_NoO[257] __attribute__ ((aligned(16)));
+    PalHash   hash;
+    uint32_t  last_rgba = 0;                                                // run cache: neighbors are usually equal
+    uint16_t  last_idx  = UINT16_MAX;
+    
+    memset(hash.n, 0, sizeof(hash.n));
     
     for (i = 0; i < n; i++)
     {
-        if (src_u32[i] >> 24 != 0xFF)   // LSB
+        const uint32_t rgba = row[x];
+        
+        if (rgba == last_rgba && last_idx != UINT16_MAX)
         {
-            _PalettePush_UpdateIdxs_RGBA8888(src_u32[i], tempPal_NoO, &( idxs_u16[i] ), &palIdx_NoO, 0);
+            idxs_u16[i] = last_idx;
         }//if
         else
         {
-            // add 512 to these indices so can identify and fix later
-            _PalettePush_UpdateIdxs_RGBA8888(src_u32[i], tempPal_IsO, &( idxs_u16[i] ), &palIdx_IsO, 512);
-        }//if
+            if (rgba >> 24 != 0xFF)   // LSB
+            {
+                _PalettePush_UpdateIdxs_RGBA8888(rgba, tempPal_NoO, &hash, &( idxs_u16[i] ), &palIdx_NoO, 0);
+            }//if
+            else
+            {
+                // add 512 to these indices so can identify and fix later
+                _PalettePush_UpdateIdxs_RGBA8888(rgba, tempPal_IsO, &hash, &( idxs_u16[i] ), &palIdx_IsO, 512);
+            }//if
+            
+            if (palIdx_NoO + palIdx_IsO > 256)
+            {
+                break;
+            }//if
+            
+            last_rgba = rgba;
+            last_idx  = idxs_u16[i];
+        }//else
         
-        if (palIdx_NoO + palIdx_IsO > 256)
+        if (++x == width)
         {
-            break;
+            x   = 0;
+            row = (const uint32_t*)((const uint8_t*)row + rowBytes);
         }//if
     }//for
     
@@ -881,213 +1260,1411 @@ static inline size_t _MakePaletteFromRGBA8888(uint8_t*     src,
 
 
 
-int gbImage_PNG_Write_RGBA8888(const char*  filename,
-                               const size_t width,
-                               const size_t height,
-                               uint8_t*     src)
+// ============================
+// _gbImage_PNG_MemoryBuffer_*:
+// ============================
+//
+// Growable output buffer for the encoder, and libpng read callback for the
+// decoder's fallback path.
+//
+typedef struct gbImage_PNG_MemoryBuffer
 {
-	int         code        = 0;
-    int         result;
-    bool        shouldWrite = true;
-	png_structp png_ptr     = NULL;
-	png_infop   info_ptr    = NULL;
-	
-	FILE*       fp          = fopen(filename, "wb");
+    uint8_t* data;
+    size_t   size;
+    size_t   capacity;
+    size_t   offset;
+} gbImage_PNG_MemoryBuffer;
+
+// Grows mem so that add_n more bytes fit.  Returns false if out of memory.
+static bool _gbImage_PNG_MemoryBuffer_Reserve(gbImage_PNG_MemoryBuffer* mem,
+                                              const size_t              add_n)
+{
+    if (mem->size + add_n > mem->capacity)
+    {
+        size_t capacity = mem->capacity > 0 ? mem->capacity : 16384;
+        
+        while (mem->size + add_n > capacity)
+        {
+            capacity = capacity << 1;
+        }//while
+        
+        uint8_t* data_new = realloc(mem->data, capacity);
+        
+        if (data_new == NULL)
+        {
+            return false;
+        }//if
+        
+        mem->data     = data_new;
+        mem->capacity = capacity;
+    }//if
     
-    if (src == NULL)
+    return true;
+}//_gbImage_PNG_MemoryBuffer_Reserve
+
+static void _gbImage_PNG_MemoryBuffer_Read(png_structp png_ptr,
+                                           png_bytep   data,
+                                           png_size_t  length)
+{
+    gbImage_PNG_MemoryBuffer* mem = (gbImage_PNG_MemoryBuffer*)png_get_io_ptr(png_ptr);
+    
+    if (mem->offset + length > mem->size)
     {
-		fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Can't write NULL src buffer for %s.\n", filename);
-		code        = 1;
-		shouldWrite = false;
+        png_error(png_ptr, "gbImage_PNG: read past end of buffer");
     }//if
     
-	if (fp == NULL)
+    memcpy(data, mem->data + mem->offset, length);
+    mem->offset += length;
+}//_gbImage_PNG_MemoryBuffer_Read
+
+
+
+
+// =====================
+// _gbImage_PNG_Codec_*:
+// =====================
+//
+// Per-thread zlib state and scratch buffer, kept between tiles.  deflateInit
+// at level 9 allocates and clears a 256 KiB window and hash tables, which for
+// a paletted 256x256 tile costs about as much as compressing it.  Here each
+// thread initializes its z_streams once, and only resets them per tile.
+//
+// Held in a pthread key rather than __thread, so the destructor frees them
+// when a worker thread exits, as GCD threads regularly do.
+//
+// Each thread also keeps the encoded PNGs of the last few uniform (single
+// color) images it wrote, as most such tiles are the same few colors.
+//
+#define kGB_PNG_UniformCacheN 16
+
+typedef struct gbImage_PNG_UniformPNG
+{
+    uint32_t rgba;
+    size_t   width;
+    size_t   height;
+    uint8_t* png;                       // NULL -> empty slot
+    size_t   png_n;
+} gbImage_PNG_UniformPNG;
+
+typedef struct gbImage_PNG_Codec
+{
+    z_stream               deflate;
+    z_stream               inflate;
+    bool                   hasDeflate;
+    bool                   hasInflate;
+    uint8_t*               scratch;     // filtered scanlines, for either direction
+    size_t                 scratch_n;
+    gbImage_PNG_UniformPNG uniform[kGB_PNG_UniformCacheN];
+} gbImage_PNG_Codec;
+
+static pthread_key_t  _gbImage_PNG_CodecKey;
+static pthread_once_t _gbImage_PNG_CodecOnce = PTHREAD_ONCE_INIT;
+
+static void _gbImage_PNG_Codec_Destroy(void* context)
+{
+    gbImage_PNG_Codec* codec = (gbImage_PNG_Codec*)context;
+    
+    if (codec->hasDeflate) { deflateEnd(&codec->deflate); }//if
+    if (codec->hasInflate) { inflateEnd(&codec->inflate); }//if
+    
+    for (size_t i = 0; i < kGB_PNG_UniformCacheN; i++)
     {
-		fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Could not open file %s for writing\n", filename);
-		code        = 1;
-		shouldWrite = false;
-	}//if
+        free(codec->uniform[i].png);
+    }//for
+    
+    free(codec->scratch);
+    free(codec);
+}//_gbImage_PNG_Codec_Destroy
+
+static void _gbImage_PNG_Codec_MakeKey(void)
+{
+    pthread_key_create(&_gbImage_PNG_CodecKey, _gbImage_PNG_Codec_Destroy);
+}//_gbImage_PNG_Codec_MakeKey
+
+static gbImage_PNG_Codec* _gbImage_PNG_Codec_Get(void)
+{
+    pthread_once(&_gbImage_PNG_CodecOnce, _gbImage_PNG_Codec_MakeKey);
     
-    if (shouldWrite)
+    gbImage_PNG_Codec* codec = pthread_getspecific(_gbImage_PNG_CodecKey);
+    
+    if (codec == NULL)
     {
-        png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-        
-        if (png_ptr == NULL)
-        {
-            fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Could not allocate write struct\n");
-            code        = 1;
-            shouldWrite = false;
-        }//if
+        codec = calloc(1, sizeof(gbImage_PNG_Codec));
+        pthread_setspecific(_gbImage_PNG_CodecKey, codec);
     }//if
+    
+    return codec;
+}//_gbImage_PNG_Codec_Get
 
-    if (shouldWrite)
+// Returns a scratch buffer of at least n bytes, valid until the next call.
+static uint8_t* _gbImage_PNG_Codec_GetScratch(gbImage_PNG_Codec* codec,
+                                              const size_t       n)
+{
+    if (n > codec->scratch_n)
     {
-       	info_ptr = png_create_info_struct(png_ptr);
+        free(codec->scratch);
         
-        if (info_ptr == NULL)
-        {
-            fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Could not allocate info struct\n");
-            code        = 1;
-            shouldWrite = false;
-        }//if
+        codec->scratch   = malloc(n);
+        codec->scratch_n = codec->scratch != NULL ? n : 0;
     }//if
+    
+    return codec->scratch;
+}//_gbImage_PNG_Codec_GetScratch
 
-    if (shouldWrite)
+static z_stream* _gbImage_PNG_Codec_GetDeflate(gbImage_PNG_Codec* codec)
+{
+    if (codec->hasDeflate)
     {
-        result = setjmp(png_jmpbuf(png_ptr));
-        
-        if (result)
-        {
-            fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Error during png creation\n");
-            code        = 1;
-            shouldWrite = false;
-        }//if
+        deflateReset(&codec->deflate);
     }//if
-
-    if (shouldWrite)
+    else
     {
-        // <zlib>
-        png_set_compression_level(png_ptr, 9);          // RLE=1
-        png_set_compression_strategy(png_ptr, 0);       // RLE=3
-        png_set_filter(png_ptr, 0, PNG_NO_FILTERS);     // filters are only useful for webpage gradients
-        // </zlib>
-        
-        png_init_io(png_ptr, fp);
-        
-        int _png_color_type = PNG_COLOR_TYPE_RGBA;
-        int bitsPerComp     = 8;
-        size_t y;
+        memset(&codec->deflate, 0, sizeof(z_stream));
         
-        // 4 color types are supported and set by the next block:
-        //
-        // - 1. RGBA8888                32-bit color
-        // - 2. RGB888                  24-bit color
-        // - 3. Indexed8 w/ tRNS     -> 32-bit color
-        // - 4. Indexed8             -> 24-bit color
-        
-        
-        // <indexedColorQuant>
-        const bool usePal  = true;
-        bool       isOpaque;
-        uint8_t*   _a      = NULL;
-        uint8_t*   _i      = NULL;
-        png_color* _p      = NULL;
-        size_t     _nopIdx = UINT32_MAX;
-        size_t     _last_i = 0;
-        size_t     color_n = usePal ? _MakePaletteFromRGBA8888(src, width, height, &_p, &_a, &_i, &_nopIdx, &_last_i) : 9000;
-        
-        isOpaque = _a == NULL; // 2014-07-31 ND: bugfix: should not compare color_n, was causing all non-paletted RGBA->RGB conversions to fail.
+        codec->hasDeflate = deflateInit2(&codec->deflate, 9, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }//else
+    
+    return codec->hasDeflate ? &codec->deflate : NULL;
+}//_gbImage_PNG_Codec_GetDeflate
+
+static z_stream* _gbImage_PNG_Codec_GetInflate(gbImage_PNG_Codec* codec)
+{
+    if (codec->hasInflate)
+    {
+        inflateReset(&codec->inflate);
+    }//if
+    else
+    {
+        memset(&codec->inflate, 0, sizeof(z_stream));
         
-        if (color_n <= 256)
-        {
-            _png_color_type = PNG_COLOR_TYPE_PALETTE;
+        codec->hasInflate = inflateInit(&codec->inflate) == Z_OK;
+    }//else
+    
+    return codec->hasInflate ? &codec->inflate : NULL;
+}//_gbImage_PNG_Codec_GetInflate
+
+// Returns the cache slot for a uniform image of rgba, which may hold another.
+static gbImage_PNG_UniformPNG* _gbImage_PNG_Codec_GetUniform(gbImage_PNG_Codec* codec,
+                                                             const uint32_t     rgba,
+                                                             const size_t       width,
+                                                             const size_t       height)
+{
+    const uint32_t key = rgba ^ (uint32_t)((width << 16) ^ height);
+    
+    return &(codec->uniform[((key * 0x9E3779B1U) >> 28) % kGB_PNG_UniformCacheN]);
+}//_gbImage_PNG_Codec_GetUniform
+
+
+
+// ================
+// _gbImage_PNG_*N:
+// ================
+//
+// Counts of images encoded, for gbImage_PNG_PrintStats.  Relaxed atomics, as
+// they are only read after the run.
+//
+static uint64_t _gbImage_PNG_EncodeN      = 0;
+static uint64_t _gbImage_PNG_TransparentN = 0;  // uniform, alpha 0
+static uint64_t _gbImage_PNG_SolidN       = 0;  // uniform, other
+static uint64_t _gbImage_PNG_UniformHitN  = 0;  // uniform, copied from the cache
+
+
+
+
+static inline uint32_t _gbImage_PNG_GetU32BE(const uint8_t* src)
+{
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+}//_gbImage_PNG_GetU32BE
+
+static inline void _gbImage_PNG_PutU32BE(uint8_t*       dest,
+                                         const uint32_t v)
+{
+    dest[0] = (uint8_t)(v >> 24);
+    dest[1] = (uint8_t)(v >> 16);
+    dest[2] = (uint8_t)(v >>  8);
+    dest[3] = (uint8_t)(v      );
+}//_gbImage_PNG_PutU32BE
+
+// Appends a whole chunk: length, type, data and CRC.
+static bool _gbImage_PNG_AppendChunk(gbImage_PNG_MemoryBuffer* mem,
+                                     const char*               type,
+                                     const uint8_t*            data,
+                                     const size_t              data_n)
+{
+    if (!_gbImage_PNG_MemoryBuffer_Reserve(mem, data_n + 12))
+    {
+        return false;
+    }//if
+    
+    uint8_t* dest = mem->data + mem->size;
+    
+    _gbImage_PNG_PutU32BE(dest, (uint32_t)data_n);
+    memcpy(dest + 4, type, 4);
+    
+    if (data_n > 0)
+    {
+        memcpy(dest + 8, data, data_n);
+    }//if
+    
+    _gbImage_PNG_PutU32BE(dest + 8 + data_n, (uint32_t)crc32(0, dest + 4, (uInt)(data_n + 4)));
+    
+    mem->size += data_n + 12;
+    
+    return true;
+}//_gbImage_PNG_AppendChunk
+
+
+// ========================
+// _gbImage_PNG_AppendIDAT:
+// ========================
+//
+// Compresses raw_n bytes of filtered scanlines straight into mem as a single
+// IDAT chunk, using the thread's z_stream, which must be new or reset.
+// isLongest also tunes the match search to its longest.
+//
+// zlib before 1.2.12 flushes in deflateParams if the strategy or match
+// function changes, even on a reset stream, which writes the zlib header to
+// next_out.  So the output must already point at this IDAT, and avail_in is
+// only set afterwards, so that none of raw is deflated with the old params.
+//
+static bool _gbImage_PNG_AppendIDAT(gbImage_PNG_MemoryBuffer* mem,
+                                    z_stream*                 zs,
+                                    const int                 level,
+                                    const int                 strategy,
+                                    const bool                isLongest,
+                                    const uint8_t*            raw,
+                                    const size_t              raw_n)
+{
+    const size_t bound = deflateBound(zs, (uLong)raw_n);
+    
+    if (!_gbImage_PNG_MemoryBuffer_Reserve(mem, bound + 12))
+    {
+        return false;
+    }//if
+    
+    uint8_t* dest = mem->data + mem->size;
+    
+    zs->next_in   = (Bytef*)raw;
+    zs->avail_in  = 0;
+    zs->next_out  = dest + 8;
+    zs->avail_out = (uInt)bound;
+    
+    if (   deflateParams(zs, level, strategy) != Z_OK
+        || (isLongest && deflateTune(zs, 258, 258, 258, 32768) != Z_OK))   // good, lazy, nice, chain
+    {
+        return false;
+    }//if
+    
+    zs->avail_in = (uInt)raw_n;
+    
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END)
+    {
+        return false;
+    }//if
+    
+    const size_t data_n = bound - zs->avail_out;
+    
+    _gbImage_PNG_PutU32BE(dest, (uint32_t)data_n);
+    memcpy(dest + 4, "IDAT", 4);
+    _gbImage_PNG_PutU32BE(dest + 8 + data_n, (uint32_t)crc32(0, dest + 4, (uInt)(data_n + 4)));
+    
+    mem->size += data_n + 12;
+    
+    return true;
+}//_gbImage_PNG_AppendIDAT
+
+
+
+// =================================
+// _gbImage_PNG_AppendIDAT_Smallest:
+// =================================
+//
+// For kGB_PNG_Compress_Max.  Deflates raw with each zlib strategy in turn, at
+// level 9 with the match search tuned to its longest, and keeps whichever
+// IDAT is smallest, as pngcrush -brute does.  zs must be new or reset.
+//
+// Z_DEFAULT_STRATEGY usually wins, so it goes last and is rarely redone.
+//
+static bool _gbImage_PNG_AppendIDAT_Smallest(gbImage_PNG_MemoryBuffer* mem,
+                                             z_stream*                 zs,
+                                             const uint8_t*            raw,
+                                             const size_t              raw_n)
+{
+    const int    strategies[3] = { Z_RLE, Z_FILTERED, Z_DEFAULT_STRATEGY };
+    const size_t start         = mem->size;
+    size_t       best_n        = SIZE_MAX;
+    size_t       best_i        = 0;
+    
+    for (size_t i = 0; i < 4; i++)
+    {
+        const size_t s = i < 3 ? i : best_i;                            // 3: redo the best, if not the last
+        
+        if (i == 3 && best_i == 2)
+        {
+            break;
+        }//if
+        
+        mem->size = start;
+        
+        deflateReset(zs);
+        
+        if (!_gbImage_PNG_AppendIDAT(mem, zs, 9, strategies[s], true, raw, raw_n))
+        {
+            return false;
+        }//if
+        
+        if (i < 3 && mem->size - start < best_n)
+        {
+            best_n = mem->size - start;
+            best_i = i;
+        }//if
+    }//for
+    
+    return true;
+}//_gbImage_PNG_AppendIDAT_Smallest
+
+
+
+
+// =======================
+// _gbImage_PNG_WriteFile:
+// ========================
+//
+// Writes an encoded PNG to filename in one write(), rather than the many
+// small ones png_init_io makes.  Returns 0 on success, as the encoder does.
+//
+static int _gbImage_PNG_WriteFile(const char*    filename,
+                                  const uint8_t* src,
+                                  const size_t   src_n)
+{
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    
+    if (fd < 0)
+    {
+        fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Could not open file %s for writing\n", filename);
+        return 1;
+    }//if
+    
+    size_t done_n = 0;
+    
+    while (done_n < src_n)
+    {
+        const ssize_t n = write(fd, src + done_n, src_n - done_n);
+        
+        if (n <= 0)
+        {
+            break;
+        }//if
+        
+        done_n += (size_t)n;
+    }//while
+    
+    if (close(fd) != 0 || done_n != src_n)
+    {
+        fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Error writing %s\n", filename);
+        return 1;
+    }//if
+    
+    return 0;
+}//_gbImage_PNG_WriteFile
+
+
+
+
+// ======================
+// _gbImage_PNG_ReadFile:
+// ======================
+//
+// Reads all of filename into a new malloc'd buffer.  Returns NULL if it could
+// not be opened or read.
+//
+static uint8_t* _gbImage_PNG_ReadFile(const char* filename,
+                                      size_t*     dest_n)
+{
+    const int   fd = open(filename, O_RDONLY);
+    struct stat st;
+    
+    *dest_n = 0;
+    
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }//if
+        
+        return NULL;
+    }//if
+    
+    const size_t size   = (size_t)st.st_size;
+    uint8_t*     dest   = malloc(size);
+    size_t       done_n = 0;
+    
+    while (done_n < size)
+    {
+        const ssize_t n = read(fd, dest + done_n, size - done_n);
+        
+        if (n <= 0)
+        {
+            break;
+        }//if
+        
+        done_n += (size_t)n;
+    }//while
+    
+    close(fd);
+    
+    *dest_n = done_n;
+    
+    return dest;
+}//_gbImage_PNG_ReadFile
+
+
+
+
+// =======================
+// _gbImage_PNG_FilterRow:
+// =======================
+//
+// Applies PNG filter type filter (1 - 4) to scanline row, writing the result
+// to dest.  prev is the previous unfiltered scanline, all zeroes for the
+// first.  bpp is bytes per complete pixel.
+//
+// The scalar version filters bytes start ... row_n - 1.  The NEON version
+// does the same 16 bytes at a time, for start >= bpp and (row_n - start)
+// evenly divisible by 16.
+//
+static FORCE_INLINE void _gbImage_PNG_FilterRow_scalar(const uint8_t  filter,
+                                                       const uint8_t* row,
+                                                       const uint8_t* prev,
+                                                       uint8_t*       dest,
+                                                       const size_t   start,
+                                                       const size_t   row_n,
+                                                       const size_t   bpp)
+{
+    for (size_t i = start; i < row_n; i++)
+    {
+        const int a = i >= bpp ? row[i - bpp]  : 0;
+        const int b = prev[i];
+        const int c = i >= bpp ? prev[i - bpp] : 0;
+        
+        if (filter == 1)                                                // Sub
+        {
+            dest[i] = (uint8_t)(row[i] - a);
+        }//if
+        else if (filter == 2)                                           // Up
+        {
+            dest[i] = (uint8_t)(row[i] - b);
+        }//else if
+        else if (filter == 3)                                           // Average
+        {
+            dest[i] = (uint8_t)(row[i] - ((a + b) >> 1));
+        }//else if
+        else                                                            // Paeth
+        {
+            const int p  = a + b - c;
+            const int pa = abs(p - a);
+            const int pb = abs(p - b);
+            const int pc = abs(p - c);
+            
+            dest[i] = (uint8_t)(row[i] - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+        }//else
+    }//for
+}//_gbImage_PNG_FilterRow_scalar
+
+static FORCE_INLINE void _gbImage_PNG_FilterRow_NEON(const uint8_t  filter,
+                                                     const uint8_t* row,
+                                                     const uint8_t* prev,
+                                                     uint8_t*       dest,
+                                                     const size_t   start,
+                                                     const size_t   row_n,
+                                                     const size_t   bpp)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    uint8x16_t x_u8x16;
+    uint8x16_t a_u8x16;
+    uint8x16_t b_u8x16;
+    uint8x16_t c_u8x16;
+    uint8x16_t p_u8x16;
+    uint8x16_t pa_u8x16;
+    uint8x16_t pb_u8x16;
+    uint8x16_t pc_u8x16;
+    uint8x16_t s_u8x16;
+    uint8x16_t t_u8x16;
+    
+    for (size_t i = start; i < row_n; i += 16)
+    {
+        x_u8x16 = vld1q_u8( &(row [i      ]) );
+        a_u8x16 = vld1q_u8( &(row [i - bpp]) );
+        b_u8x16 = vld1q_u8( &(prev[i      ]) );
+        
+        if (filter == 1)                                                // Sub
+        {
+            p_u8x16 = a_u8x16;
+        }//if
+        else if (filter == 2)                                           // Up
+        {
+            p_u8x16 = b_u8x16;
+        }//else if
+        else if (filter == 3)                                           // Average
+        {
+            p_u8x16 = vhaddq_u8(a_u8x16, b_u8x16);                      // (a + b) >> 1, without overflow
+        }//else if
+        else                                                            // Paeth
+        {
+            // pa = |b - c| and pb = |a - c|.  pc = |(b - c) + (a - c)| is
+            // pa + pb if both have the same sign, else |pa - pb|.  The sum
+            // saturating at 255 does not change any of the comparisons.
+            c_u8x16  = vld1q_u8( &(prev[i - bpp]) );
+            pa_u8x16 = vabdq_u8(b_u8x16, c_u8x16);
+            pb_u8x16 = vabdq_u8(a_u8x16, c_u8x16);
+            s_u8x16  = vcgeq_u8(b_u8x16, c_u8x16);
+            t_u8x16  = vcgeq_u8(a_u8x16, c_u8x16);
+            s_u8x16  = vceqq_u8(s_u8x16, t_u8x16);                      // same sign
+            t_u8x16  = vqaddq_u8(pa_u8x16, pb_u8x16);
+            pc_u8x16 = vabdq_u8(pa_u8x16, pb_u8x16);
+            pc_u8x16 = vbslq_u8(s_u8x16, t_u8x16, pc_u8x16);
+            
+            s_u8x16  = vcleq_u8(pa_u8x16, pb_u8x16);
+            t_u8x16  = vcleq_u8(pa_u8x16, pc_u8x16);
+            s_u8x16  = vandq_u8(s_u8x16, t_u8x16);                      // a
+            t_u8x16  = vcleq_u8(pb_u8x16, pc_u8x16);                    // else b
+            p_u8x16  = vbslq_u8(t_u8x16, b_u8x16, c_u8x16);
+            p_u8x16  = vbslq_u8(s_u8x16, a_u8x16, p_u8x16);
+        }//else
+        
+        x_u8x16 = vsubq_u8(x_u8x16, p_u8x16);
+        
+        vst1q_u8( &(dest[i]), x_u8x16);
+    }//for
+#endif
+}//_gbImage_PNG_FilterRow_NEON
+
+static inline void _gbImage_PNG_FilterRow(const uint8_t  filter,
+                                          const uint8_t* row,
+                                          const uint8_t* prev,
+                                          uint8_t*       dest,
+                                          const size_t   row_n,
+                                          const size_t   bpp)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    if (row_n > 31)
+    {
+        const size_t lastCleanN = row_n - (row_n - 16) % 16;
+        
+        _gbImage_PNG_FilterRow_scalar(filter, row, prev, dest, 0,          16,         bpp);
+        _gbImage_PNG_FilterRow_NEON  (filter, row, prev, dest, 16,         lastCleanN, bpp);
+        _gbImage_PNG_FilterRow_scalar(filter, row, prev, dest, lastCleanN, row_n,      bpp);
+    }//if
+    else
+    {
+        _gbImage_PNG_FilterRow_scalar(filter, row, prev, dest, 0, row_n, bpp);
+    }//else
+#else
+    _gbImage_PNG_FilterRow_scalar(filter, row, prev, dest, 0, row_n, bpp);
+#endif
+}//_gbImage_PNG_FilterRow
+
+
+
+// ======================
+// _gbImage_PNG_SumAbsS8:
+// ======================
+//
+// Sum of the absolute values of n filtered bytes, taken as signed.  This is
+// libpng's estimate of how well a filtered row will compress: the smaller,
+// the closer to zero the values are.
+//
+static FORCE_INLINE uint32_t _gbImage_PNG_SumAbsS8_scalar(const uint8_t* src,
+                                                          const size_t   n)
+{
+    uint32_t sum = 0;
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        sum += src[i] < 128 ? src[i] : 256 - src[i];
+    }//for
+    
+    return sum;
+}//_gbImage_PNG_SumAbsS8_scalar
+
+static FORCE_INLINE uint32_t _gbImage_PNG_SumAbsS8_NEON(const uint8_t* src,
+                                                        const size_t   n)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    uint32_t   sum = 0;
+    int8x16_t  s_s8x16;
+    uint8x16_t s_u8x16;
+    uint16x8_t m_u16x8;
+    
+    for (size_t i = 0; i < n; )
+    {
+        const size_t end = i + 16 * 128 < n ? i + 16 * 128 : n;      // each u16 lane adds <= 510 per pass
+        
+        m_u16x8 = vdupq_n_u16(0);
+        
+        for (; i < end; i += 16)
+        {
+            s_s8x16 = vld1q_s8( (const int8_t*)&(src[i]) );
+            s_s8x16 = vabsq_s8(s_s8x16);                                // |-128| is -128, which is 128 as a u8
+            s_u8x16 = vreinterpretq_u8_s8(s_s8x16);
+            m_u16x8 = vpadalq_u8(m_u16x8, s_u8x16);
+        }//for
+        
+        sum += (uint32_t)vgetq_lane_u16(m_u16x8, 0) + vgetq_lane_u16(m_u16x8, 1)
+             + (uint32_t)vgetq_lane_u16(m_u16x8, 2) + vgetq_lane_u16(m_u16x8, 3)
+             + (uint32_t)vgetq_lane_u16(m_u16x8, 4) + vgetq_lane_u16(m_u16x8, 5)
+             + (uint32_t)vgetq_lane_u16(m_u16x8, 6) + vgetq_lane_u16(m_u16x8, 7);
+    }//for
+    
+    return sum;
+#else
+    return _gbImage_PNG_SumAbsS8_scalar(src, n);
+#endif
+}//_gbImage_PNG_SumAbsS8_NEON
+
+static inline uint32_t _gbImage_PNG_SumAbsS8(const uint8_t* src,
+                                             const size_t   n)
+{
+#if defined (__ARM_NEON__) || defined(NEON2SSE_H)
+    const size_t lastCleanN = n - n % 16;
+    
+    return _gbImage_PNG_SumAbsS8_NEON  (src,              lastCleanN)
+         + _gbImage_PNG_SumAbsS8_scalar(src + lastCleanN, n - lastCleanN);
+#else
+    return _gbImage_PNG_SumAbsS8_scalar(src, n);
+#endif
+}//_gbImage_PNG_SumAbsS8
+
+
+
+// =================================
+// _gbImage_PNG_FilterRows_Adaptive:
+// =================================
+//
+// Filters each of the height scanlines in raw (filter byte + rowBytes) with
+// whichever of the five filter types gives the least _gbImage_PNG_SumAbsS8,
+// as libpng does for PNG_ALL_FILTERS.  raw holds the unfiltered rows on entry,
+// with filter bytes of 0.
+//
+// Rows are done last to first, so the row above is still unfiltered.  tmp
+// must have room for 5 * rowBytes.
+//
+static void _gbImage_PNG_FilterRows_Adaptive(uint8_t*     raw,
+                                             const size_t height,
+                                             const size_t rowBytes,
+                                             const size_t bpp,
+                                             uint8_t*     tmp)
+{
+    uint8_t* zero = tmp + 4 * rowBytes;                                 // prev for the first row
+    
+    memset(zero, 0, rowBytes);
+    
+    for (size_t y = height; y-- > 0; )
+    {
+        uint8_t*       row      = &(raw[y * (rowBytes + 1) + 1]);
+        const uint8_t* prev     = y > 0 ? row - (rowBytes + 1) : zero;
+        uint8_t        best     = 0;
+        uint32_t       best_sum = _gbImage_PNG_SumAbsS8(row, rowBytes);
+        
+        for (uint8_t filter = 1; filter <= 4; filter++)
+        {
+            uint8_t* dest = tmp + (filter - 1) * rowBytes;
             
-            _Indexed8ToIndexed124_IfNeeded_PNG(_i, width, height, &bitsPerComp, color_n);
+            _gbImage_PNG_FilterRow(filter, row, prev, dest, rowBytes, bpp);
+            
+            const uint32_t sum = _gbImage_PNG_SumAbsS8(dest, rowBytes);
+            
+            if (sum < best_sum)
+            {
+                best     = filter;
+                best_sum = sum;
+            }//if
+        }//for
+        
+        if (best != 0)
+        {
+            memcpy(row, tmp + (best - 1) * rowBytes, rowBytes);
+        }//if
+        
+        row[-1] = best;
+    }//for
+}//_gbImage_PNG_FilterRows_Adaptive
+
+
+
+// ==========================
+// gbImage_PNG_SetFilterMode:
+// ==========================
+//
+// Sets the PNG filter mode for all later writes, from any thread.  Call before
+// starting any.  Indexed and grayscale output is never filtered.
+//
+static GB_PNG_FilterMode _gbImage_PNG_FilterMode = kGB_PNG_Filter_None;
+
+void gbImage_PNG_SetFilterMode(const GB_PNG_FilterMode mode)
+{
+    _gbImage_PNG_FilterMode = mode;
+}//gbImage_PNG_SetFilterMode
+
+
+
+// ===============================
+// gbImage_PNG_SetCompressProfile:
+// ===============================
+//
+// Sets the deflate profile for all later writes, from any thread.  Call
+// before starting any.
+//
+// - Default: zlib level 9 (level 6 + Z_FILTERED for filtered rows).
+// - Fast:    zlib level 1, for frequent rebuilds.
+// - Max:     best of several zlib strategies with the longest match search,
+//            for archives.  Each worker tries them for its own tiles.  RGB
+//            and RGBA rows are also filtered, as with kGB_PNG_Filter_Adaptive.
+//
+static GB_PNG_CompressProfile _gbImage_PNG_CompressProfile = kGB_PNG_Compress_Default;
+
+void gbImage_PNG_SetCompressProfile(const GB_PNG_CompressProfile profile)
+{
+    _gbImage_PNG_CompressProfile = profile;
+}//gbImage_PNG_SetCompressProfile
+
+
+
+
+// ============================
+// _gbImage_PNG_Write_RGBA8888:
+// ============================
+//
+// The encoder.  Appends the PNG to mem; the file variant writes that out
+// afterwards.  filename is only used for logging.
+//
+// The chunks are written directly rather than through libpng, as a libpng
+// write struct cannot be reused, and each new one makes a new z_stream.
+// Only IHDR, PLTE, tRNS, IDAT and IEND are written, as libpng did.
+//
+static int _gbImage_PNG_Write_RGBA8888(const char*               filename,
+                                       gbImage_PNG_MemoryBuffer* mem,
+                                       const size_t              width,
+                                       const size_t              height,
+                                       const size_t              src_rowBytes,
+                                       uint8_t*                  src)
+{
+    if (src == NULL)
+    {
+		fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Can't write NULL src buffer for %s.\n", filename);
+		return 1;
+    }//if
+    
+    gbImage_PNG_Codec* codec = _gbImage_PNG_Codec_Get();
+    z_stream*          zs    = codec != NULL ? _gbImage_PNG_Codec_GetDeflate(codec) : NULL;
+    
+    if (zs == NULL)
+    {
+        fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Could not allocate deflate state\n");
+        return 1;
+    }//if
+    
+    
+    // <uniform>
+    // Single color images are encoded once per thread, then copied.  The
+    // bytes are the same as encoding them again.
+    const bool              isUniform = _IsUniformRGBA8888(src, width, height, src_rowBytes);
+    const uint32_t          rgba0     = *(const uint32_t*)src;
+    gbImage_PNG_UniformPNG* uniform   = isUniform ? _gbImage_PNG_Codec_GetUniform(codec, rgba0, width, height) : NULL;
+    const size_t            mem_start = mem->size;
+    
+    __atomic_fetch_add(&_gbImage_PNG_EncodeN, 1, __ATOMIC_RELAXED);
+    
+    if (isUniform)
+    {
+        __atomic_fetch_add(rgba0 >> 24 == 0 ? &_gbImage_PNG_TransparentN : &_gbImage_PNG_SolidN, 1, __ATOMIC_RELAXED);
+    }//if
+    
+    if (   uniform         != NULL
+        && uniform->png    != NULL
+        && uniform->rgba   == rgba0
+        && uniform->width  == width
+        && uniform->height == height)
+    {
+        if (!_gbImage_PNG_MemoryBuffer_Reserve(mem, uniform->png_n))
+        {
+            fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Error during png creation\n");
+            return 1;
+        }//if
+        
+        memcpy(mem->data + mem->size, uniform->png, uniform->png_n);
+        mem->size += uniform->png_n;
+        
+        __atomic_fetch_add(&_gbImage_PNG_UniformHitN, 1, __ATOMIC_RELAXED);
+        
+        return 0;
+    }//if
+    // </uniform>
+    
+    int    _png_color_type = PNG_COLOR_TYPE_RGBA;
+    int    bitsPerComp     = 8;
+    size_t y;
+    
+    // 4 color types are supported and set by the next block:
+    //
+    // - 1. RGBA8888                32-bit color
+    // - 2. RGB888                  24-bit color
+    // - 3. Indexed8 w/ tRNS     -> 32-bit color
+    // - 4. Indexed8             -> 24-bit color
+    
+    
+    // <indexedColorQuant>
+    const bool usePal  = true;
+    bool       isOpaque;
+    uint8_t*   _a      = NULL;
+    uint8_t*   _i      = NULL;
+    png_color* _p      = NULL;
+    size_t     _nopIdx = UINT32_MAX;
+    size_t     _last_i = 0;
+    size_t     color_n = usePal ? _MakePaletteFromRGBA8888(src, width, height, src_rowBytes, &_p, &_a, &_i, &_nopIdx, &_last_i) : 9000;
+    
+    isOpaque = _a == NULL; // 2014-07-31 ND: bugfix: should not compare color_n, was causing all non-paletted RGBA->RGB conversions to fail.
+    
+    // with > 256 colors there is no _a, but the palette scan may already have
+    // passed non-opaque pixels before _last_i, which _IsOpaqueRGBA8888 below
+    // does not look at again.
+    isOpaque = isOpaque && _nopIdx == 0;
+    
+    if (color_n <= 256)
+    {
+        _png_color_type = PNG_COLOR_TYPE_PALETTE;
+        
+        _Indexed8ToIndexed124_IfNeeded_PNG(_i, width, height, &bitsPerComp, color_n);
+        
+        _IndexedToPlanar8_IfNeeded_PNG(_i, width, height, bitsPerComp, _p, color_n, isOpaque, &_png_color_type);    // Indexed8 -> Planar8 (PNG_COLOR_TYPE_GRAY)
+    }//if
+    else if (isOpaque)
+    {
+        _png_color_type = _IsOpaqueRGBA8888(src, width, height, src_rowBytes, _last_i) ? PNG_COLOR_TYPE_RGB : _png_color_type;
+    }//else if
+    // </indexedColorQuant>
+    
+    const int    write_bpp = _png_color_type == PNG_COLOR_TYPE_RGBA ? 32 : _png_color_type == PNG_COLOR_TYPE_RGB ? 24 : bitsPerComp;
+    const size_t rowBytes  = (width * write_bpp + 7) >> 3;
+    const size_t raw_n     = height * (rowBytes + 1);
+    const bool   useFilter = (   _gbImage_PNG_FilterMode     == kGB_PNG_Filter_Adaptive
+                              || _gbImage_PNG_CompressProfile == kGB_PNG_Compress_Max) && write_bpp >= 24;
+    uint8_t*     raw       = _gbImage_PNG_Codec_GetScratch(codec, raw_n + (useFilter ? 5 * rowBytes : 0));
+    bool         isOK      = raw != NULL;
+    
+    // <filter>
+    // Filter type 0 (none) for every row: filters are only useful for webpage
+    // gradients.  Except with kGB_PNG_Filter_Adaptive, where truecolor rows,
+    // such as resampled imagery, get the best filter of each row afterwards.
+    for (y=0; y<height && isOK; y++)
+    {
+        uint8_t* dest = &(raw[y*(rowBytes+1)]);
+        
+        dest[0] = 0;
+        
+        if (   _png_color_type == PNG_COLOR_TYPE_PALETTE
+            || _png_color_type == PNG_COLOR_TYPE_GRAY)
+        {
+            memcpy(dest + 1, &(_i[y*rowBytes]), rowBytes);
+        }//if
+        else if (_png_color_type == PNG_COLOR_TYPE_RGBA)
+        {
+            memcpy(dest + 1, &(src[y*src_rowBytes]), rowBytes);
+        }//else if
+        else
+        {
+            _RGBA8888_to_RGB888(&(src[y*src_rowBytes]), dest + 1, width, 1);
+        }//else
+    }//for
+    
+    if (useFilter && isOK)
+    {
+        _gbImage_PNG_FilterRows_Adaptive(raw, height, rowBytes, write_bpp >> 3, raw + raw_n);
+    }//if
+    // </filter>
+    
+    
+    // <write>
+    uint8_t ihdr[13];
+    
+    _gbImage_PNG_PutU32BE(ihdr,     (uint32_t)width);
+    _gbImage_PNG_PutU32BE(ihdr + 4, (uint32_t)height);
+    
+    ihdr[8]  = (uint8_t)bitsPerComp;
+    ihdr[9]  = (uint8_t)_png_color_type;
+    ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    ihdr[11] = PNG_FILTER_TYPE_BASE;
+    ihdr[12] = PNG_INTERLACE_NONE;
+    
+    isOK = isOK && _gbImage_PNG_MemoryBuffer_Reserve(mem, 8);
+    
+    if (isOK)
+    {
+        memcpy(mem->data + mem->size, "\x89PNG\r\n\x1a\n", 8);
+        mem->size += 8;
+    }//if
+    
+    isOK = isOK && _gbImage_PNG_AppendChunk(mem, "IHDR", ihdr, sizeof(ihdr));
+    
+    if (_png_color_type == PNG_COLOR_TYPE_PALETTE)
+    {
+        isOK = isOK && _gbImage_PNG_AppendChunk(mem, "PLTE", (const uint8_t*)_p, color_n * 3);
+        
+        if (!isOpaque && _nopIdx > 0 && _nopIdx <= color_n)
+        {
+            isOK = isOK && _gbImage_PNG_AppendChunk(mem, "tRNS", _a, _nopIdx);
+        }//if
+    }//if
+    
+    // Filtered rows are mostly small values with few long matches.  On them,
+    // the level 9 match search took 14x as long as level 6, for output only 7%
+    // smaller.  So they get the level 6 search and Z_FILTERED, as libpng uses.
+    if (_gbImage_PNG_CompressProfile == kGB_PNG_Compress_Max)
+    {
+        isOK = isOK && _gbImage_PNG_AppendIDAT_Smallest(mem, zs, raw, raw_n);
+    }//if
+    else
+    {
+        const int level = _gbImage_PNG_CompressProfile == kGB_PNG_Compress_Fast ? 1 : useFilter ? 6 : 9;
+        
+        isOK = isOK && _gbImage_PNG_AppendIDAT(mem, zs, level, useFilter ? Z_FILTERED : Z_DEFAULT_STRATEGY, false, raw, raw_n);
+    }//else
+    
+    isOK = isOK && _gbImage_PNG_AppendChunk(mem, "IEND", NULL, 0);
+    // </write>
+    
+    if (!isOK)
+    {
+        fprintf(stderr, "gbImage_PNG_Write_RGBA8888: Error during png creation\n");
+    }//if
+    else if (uniform != NULL)
+    {
+        uint8_t* png = malloc(mem->size - mem_start);
+        
+        if (png != NULL)
+        {
+            memcpy(png, mem->data + mem_start, mem->size - mem_start);
+            
+            free(uniform->png);
+            
+            uniform->rgba   = rgba0;
+            uniform->width  = width;
+            uniform->height = height;
+            uniform->png    = png;
+            uniform->png_n  = mem->size - mem_start;
+        }//if
+    }//else if
+    
+    if (_p != NULL) { free(_p); }//if
+    if (_a != NULL) { free(_a); }//if
+    if (_i != NULL) { free(_i); }//if
+    
+	return isOK ? 0 : 1;
+}//_gbImage_PNG_Write_RGBA8888
+
+
+
+
+// ===========================
+// gbImage_PNG_Write_RGBA8888:
+// ===========================
+//
+// Encodes to memory, then writes the file in one go.
+//
+int gbImage_PNG_Write_RGBA8888(const char*  filename,
+                               const size_t width,
+                               const size_t height,
+                               uint8_t*     src)
+{
+    gbImage_PNG_MemoryBuffer mem = { NULL, 0, 0, 0 };
+    
+    int code = _gbImage_PNG_Write_RGBA8888(filename, &mem, width, height, width * 4, src);
+    
+    if (code == 0)
+    {
+        code = _gbImage_PNG_WriteFile(filename, mem.data, mem.size);
+    }//if
+    
+    free(mem.data);
+    
+    return code;
+}//gbImage_PNG_Write_RGBA8888
+
+
+
+
+// ====================================
+// gbImage_PNG_Write_RGBA8888_ToMemory:
+// ====================================
+//
+// As gbImage_PNG_Write_RGBA8888, but the encoded PNG is returned in a
+// malloc'd buffer in *dest rather than written to disk.  The caller must free
+// *dest.  On failure, *dest is NULL and *dest_n is 0.
+//
+// As with the file variant, src may be modified. (RGBA -> RGB in place)
+//
+int gbImage_PNG_Write_RGBA8888_ToMemory(const size_t width,
+                                        const size_t height,
+                                        uint8_t*     src,
+                                        uint8_t**    dest,
+                                        size_t*      dest_n)
+{
+    return gbImage_PNG_Write_RGBA8888_ToMemory_Strided(width, height, width * 4, src, dest, dest_n);
+}//gbImage_PNG_Write_RGBA8888_ToMemory
+
+
+
+
+// ============================================
+// gbImage_PNG_Write_RGBA8888_ToMemory_Strided:
+// ============================================
+//
+// As gbImage_PNG_Write_RGBA8888_ToMemory, but src rows are rowBytes apart,
+// so a tile can be encoded straight out of a larger image.  Only the width x
+// height pixels of src are read or modified.
+//
+int gbImage_PNG_Write_RGBA8888_ToMemory_Strided(const size_t width,
+                                                const size_t height,
+                                                const size_t rowBytes,
+                                                uint8_t*     src,
+                                                uint8_t**    dest,
+                                                size_t*      dest_n)
+{
+    gbImage_PNG_MemoryBuffer mem = { NULL, 0, 0, 0 };
+    
+    int code = _gbImage_PNG_Write_RGBA8888("<memory>", &mem, width, height, rowBytes, src);
+    
+    if (code != 0 && mem.data != NULL)
+    {
+        free(mem.data);
+        mem.data = NULL;
+        mem.size = 0;
+    }//if
+    
+    *dest   = mem.data;
+    *dest_n = mem.size;
+    
+    return code;
+}//gbImage_PNG_Write_RGBA8888_ToMemory_Strided
+
+
+
+
+
+
+
+
+
+
+
+// =========================
+// _gbImage_PNG_UnfilterRow:
+// =========================
+//
+// Undoes the PNG filter of one scanline in place.  prev is the previous
+// unfiltered scanline, or NULL for the first.  bpp is bytes per complete
+// pixel, at least 1.  Returns false for an unknown filter type.
+//
+static FORCE_INLINE bool _gbImage_PNG_UnfilterRow(const uint8_t  filter,
+                                                  uint8_t*       row,
+                                                  const uint8_t* prev,
+                                                  const size_t   row_n,
+                                                  const size_t   bpp)
+{
+    size_t i;
+    
+    switch (filter)
+    {
+        case 0:
+            break;
+        case 1:                                                         // Sub
+            for (i = bpp; i < row_n; i++)
+            {
+                row[i] += row[i - bpp];
+            }//for
+            break;
+        case 2:                                                         // Up
+            for (i = 0; i < row_n && prev != NULL; i++)
+            {
+                row[i] += prev[i];
+            }//for
+            break;
+        case 3:                                                         // Average
+            for (i = 0; i < row_n; i++)
+            {
+                const unsigned a = i >= bpp     ? row[i - bpp] : 0;
+                const unsigned b = prev != NULL ? prev[i]      : 0;
+                
+                row[i] += (uint8_t)((a + b) >> 1);
+            }//for
+            break;
+        case 4:                                                         // Paeth
+            for (i = 0; i < row_n; i++)
+            {
+                const int a  = i >= bpp                    ? row[i - bpp]  : 0;
+                const int b  = prev != NULL                ? prev[i]       : 0;
+                const int c  = i >= bpp && prev != NULL    ? prev[i - bpp] : 0;
+                const int p  = a + b - c;
+                const int pa = abs(p - a);
+                const int pb = abs(p - b);
+                const int pc = abs(p - c);
+                
+                row[i] += (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+            }//for
+            break;
+        default:
+            return false;
+    }//switch
+    
+    return true;
+}//_gbImage_PNG_UnfilterRow
+
+
+// =========================
+// _gbImage_PNG_Read_Direct:
+// =========================
+//
+// Decodes the PNGs Retile itself writes, and most others, without libpng:
+// non-interlaced, at most 8 bits per sample, and tRNS only with a palette.
+// Inflates with the thread's z_stream, reset rather than recreated, as on
+// the write side.
+//
+// Returns false, having output nothing, for anything else, or anything
+// malformed.  The caller then falls back to libpng, which also reports the
+// error if there is one.
+//
+static bool _gbImage_PNG_Read_Direct(const gbImage_PNG_MemoryBuffer* mem,
+                                     uint32_t*                       reuse,
+                                     const size_t                    reuse_n,
+                                     uint32_t**                      dest,
+                                     size_t*                         width,
+                                     size_t*                         height)
+{
+    const uint8_t* src      = mem->data;
+    const size_t   src_n    = mem->size;
+    size_t         pos      = 8;
+    uint32_t       w        = 0;
+    uint32_t       h        = 0;
+    int            depth    = 0;
+    int            type     = -1;
+    size_t         spp      = 0;                                        // samples per pixel
+    size_t         row_n    = 0;
+    uint8_t*       raw      = NULL;
+    z_stream*      zs       = NULL;
+    bool           isEnd    = false;
+    const uint8_t* pal      = NULL;
+    size_t         pal_n    = 0;
+    const uint8_t* trns     = NULL;
+    size_t         trns_n   = 0;
+    
+    if (src_n < 8 || png_sig_cmp((png_const_bytep)src, 0, 8) != 0)
+    {
+        return false;
+    }//if
+    
+    while (pos + 12 <= src_n && !isEnd)
+    {
+        const size_t   len   = _gbImage_PNG_GetU32BE(src + pos);
+        const uint8_t* chunk = src + pos + 4;                           // type, then data
+        const uint8_t* data  = src + pos + 8;
+        
+        if (len > src_n - pos - 12
+            || crc32(0, chunk, (uInt)(len + 4)) != _gbImage_PNG_GetU32BE(data + len))
+        {
+            return false;
+        }//if
+        
+        if (memcmp(chunk, "IHDR", 4) == 0)
+        {
+            if (len != 13 || data[10] != 0 || data[11] != 0 || data[12] != 0)
+            {
+                return false;                                           // interlaced, or unknown methods
+            }//if
             
-            _IndexedToPlanar8_IfNeeded_PNG(_i, width, height, bitsPerComp, _p, color_n, isOpaque, &_png_color_type);    // Indexed8 -> Planar8 (PNG_COLOR_TYPE_GRAY)
+            w     = _gbImage_PNG_GetU32BE(data);
+            h     = _gbImage_PNG_GetU32BE(data + 4);
+            depth = data[8];
+            type  = data[9];
+            spp   = type == PNG_COLOR_TYPE_GRAY       ? 1
+                  : type == PNG_COLOR_TYPE_PALETTE    ? 1
+                  : type == PNG_COLOR_TYPE_GRAY_ALPHA ? 2
+                  : type == PNG_COLOR_TYPE_RGB        ? 3
+                  : type == PNG_COLOR_TYPE_RGBA       ? 4 : 0;
             
-            if (_png_color_type == PNG_COLOR_TYPE_PALETTE)
+            if (spp == 0 || w == 0 || h == 0 || w > 65536 || h > 65536
+                || (depth != 8 && (spp > 1 || (depth != 1 && depth != 2 && depth != 4))))
             {
-                png_set_PLTE(png_ptr, info_ptr, _p, (int)color_n);
-                
-                if (!isOpaque)
-                {
-                    png_set_tRNS(png_ptr, info_ptr, &(_a[0]), (int)_nopIdx, NULL);
-                }//if
+                return false;
             }//if
             
-            free(_p);
-            _p = NULL;
+            row_n = ((size_t)w * spp * depth + 7) >> 3;
+            raw   = _gbImage_PNG_Codec_GetScratch(_gbImage_PNG_Codec_Get(), (size_t)h * (row_n + 1));
+            zs    = raw != NULL ? _gbImage_PNG_Codec_GetInflate(_gbImage_PNG_Codec_Get()) : NULL;
             
-            if (_a != NULL)
+            if (zs == NULL)
             {
-                free(_a);
-                _a = NULL;
+                return false;
             }//if
+            
+            zs->next_out  = raw;
+            zs->avail_out = (uInt)((size_t)h * (row_n + 1));
         }//if
-        else if (isOpaque)
+        else if (memcmp(chunk, "PLTE", 4) == 0)
         {
-            _png_color_type = _IsOpaqueRGBA8888(src + 4 * _last_i, width * height - _last_i) ? PNG_COLOR_TYPE_RGB : _png_color_type;
+            pal   = data;
+            pal_n = len / 3;
+        }//else if
+        else if (memcmp(chunk, "tRNS", 4) == 0)
+        {
+            if (type != PNG_COLOR_TYPE_PALETTE)
+            {
+                return false;                                           // color key, left to libpng
+            }//if
+            
+            trns   = data;
+            trns_n = len;
+        }//else if
+        else if (memcmp(chunk, "IDAT", 4) == 0)
+        {
+            if (zs == NULL)
+            {
+                return false;
+            }//if
+            
+            zs->next_in  = (Bytef*)data;
+            zs->avail_in = (uInt)len;
+            
+            const int rc = zs->avail_out > 0 ? inflate(zs, Z_NO_FLUSH) : Z_STREAM_END;
+            
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+            {
+                return false;
+            }//if
+        }//else if
+        else if (memcmp(chunk, "IEND", 4) == 0)
+        {
+            isEnd = true;
         }//else if
-        // </indexedColorQuant>
-        
-        const int    write_bpp   = _png_color_type == PNG_COLOR_TYPE_RGBA ? 32 : _png_color_type == PNG_COLOR_TYPE_RGB ? 24 : bitsPerComp;
-        const size_t rowBytes    = (width * write_bpp) >> 3;
-        
-        // <PNG_IHDR>
-        png_set_IHDR(png_ptr,
-                     info_ptr,
-                     (uint32_t)width,
-                     (uint32_t)height,
-                     bitsPerComp,
-                     _png_color_type,
-                     PNG_INTERLACE_NONE,
-                     PNG_COMPRESSION_TYPE_BASE,
-                     PNG_FILTER_TYPE_BASE);
-
-        png_write_info(png_ptr, info_ptr);
         
-        setjmp(png_jmpbuf(png_ptr));
-        // </PNG_IHDR>
+        pos += len + 12;
+    }//while
+    
+    if (zs == NULL || zs->avail_out != 0 || (type == PNG_COLOR_TYPE_PALETTE && pal == NULL))
+    {
+        return false;
+    }//if
+    
+    const size_t bpp    = (spp * depth + 7) >> 3;
+    const size_t n      = (size_t)w * h * 4;
+    uint8_t*     _dest  = reuse != NULL && n <= reuse_n ? (uint8_t*)reuse : malloc(n);
+    const int    mask   = (1 << depth) - 1;
+    const int    scale  = 255 / mask;                                   // gray 1/2/4 -> 8 bit, as png_set_expand_gray_1_2_4_to_8
+    bool         isOK   = true;
+    uint8_t*     prev   = NULL;
+    
+    for (size_t y = 0; y < h && isOK; y++)
+    {
+        uint8_t* row = raw + y * (row_n + 1) + 1;
+        uint8_t* out = _dest + y * w * 4;
         
+        isOK = _gbImage_PNG_UnfilterRow(row[-1], row, prev, row_n, bpp);
+        prev = row;
         
-        // <write>
-        if (   _png_color_type == PNG_COLOR_TYPE_PALETTE
-            || _png_color_type == PNG_COLOR_TYPE_GRAY)
+        if (type == PNG_COLOR_TYPE_RGBA)
         {
-            for (y=0; y<height; y++)
-            {
-                png_write_row(png_ptr, &(_i[y*rowBytes]));
-            }//for
-
-            free(_i);
-            _i = NULL;
+            memcpy(out, row, (size_t)w * 4);
         }//if
-        else if (_png_color_type == PNG_COLOR_TYPE_RGBA)
+        else if (type == PNG_COLOR_TYPE_RGB)
         {
-            for (y=0; y<height; y++)
+            for (size_t x = 0; x < w; x++)
             {
-                png_write_row(png_ptr, &(src[y*rowBytes]));
+                out[x*4  ] = row[x*3  ];
+                out[x*4+1] = row[x*3+1];
+                out[x*4+2] = row[x*3+2];
+                out[x*4+3] = 0xFF;
             }//for
         }//else if
-        else if (_png_color_type == PNG_COLOR_TYPE_RGB)
+        else if (type == PNG_COLOR_TYPE_GRAY_ALPHA)
         {
-            _RGBA8888_to_RGB888(src, src, width, height);
-            
-            for (y=0; y<height; y++)
+            for (size_t x = 0; x < w; x++)
             {
-                png_write_row(png_ptr, &(src[y*rowBytes]));
+                out[x*4  ] = row[x*2];
+                out[x*4+1] = row[x*2];
+                out[x*4+2] = row[x*2];
+                out[x*4+3] = row[x*2+1];
             }//for
         }//else if
+        else
+        {
+            for (size_t x = 0; x < w && isOK; x++)
+            {
+                const size_t bit = x * depth;
+                const int    v   = (row[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+                
+                if (type == PNG_COLOR_TYPE_GRAY)
+                {
+                    out[x*4  ] = (uint8_t)(v * scale);
+                    out[x*4+1] = (uint8_t)(v * scale);
+                    out[x*4+2] = (uint8_t)(v * scale);
+                    out[x*4+3] = 0xFF;
+                }//if
+                else if ((size_t)v < pal_n)
+                {
+                    out[x*4  ] = pal[v*3  ];
+                    out[x*4+1] = pal[v*3+1];
+                    out[x*4+2] = pal[v*3+2];
+                    out[x*4+3] = (size_t)v < trns_n ? trns[v] : 0xFF;
+                }//else if
+                else
+                {
+                    isOK = false;                                       // index past the palette
+                }//else
+            }//for
+        }//else
+    }//for
+    
+    if (!isOK)
+    {
+        if (_dest != (uint8_t*)reuse)
+        {
+            free(_dest);
+        }//if
         
-        setjmp(png_jmpbuf(png_ptr));
-        
-        png_write_end(png_ptr, NULL);
-        // </write>
+        return false;
     }//if
     
-	if (fp       != NULL) { fclose(fp);                                           }//if
-	if (info_ptr != NULL) { png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);   }//if
-	if (png_ptr  != NULL) { png_destroy_write_struct(&png_ptr, (png_infopp)NULL); }//if
-
-	return code;
-}//_WriteImagePNG
-
-
-
-
-
-
-
+    *dest   = (uint32_t*)_dest;
+    *width  = w;
+    *height = h;
+    
+    return true;
+}//_gbImage_PNG_Read_Direct
 
 
 
 
-void gbImage_PNG_Read_RGBA8888(const char* filename,
-                               uint32_t**  dest,
-                               size_t*     width,
-                               size_t*     height,
-                               size_t*     rowBytes)
+// ===========================
+// _gbImage_PNG_Read_RGBA8888:
+// ===========================
+//
+// The decoder.  Reads the PNG from mem, which the file variant fills first.
+// filename is only used for logging.
+//
+// Tries _gbImage_PNG_Read_Direct first, and libpng for whatever that does not
+// handle.
+//
+// Decodes into reuse if it is non-NULL and the image fits in reuse_n bytes,
+// otherwise into a new malloc'd buffer.
+//
+static void _gbImage_PNG_Read_RGBA8888(const char*               filename,
+                                       gbImage_PNG_MemoryBuffer* mem,
+                                       uint32_t*                 reuse,
+                                       const size_t              reuse_n,
+                                       uint32_t**                dest,
+                                       size_t*                   width,
+                                       size_t*                   height,
+                                       size_t*                   rowBytes)
 {
     png_structp png_ptr    = NULL;
 	png_infop   info_ptr   = NULL;
@@ -1098,9 +2675,15 @@ void gbImage_PNG_Read_RGBA8888(const char* filename,
     int         result;
     uint8_t     header[8] __attribute__ ((aligned(16)));
     
-    FILE *fp = fopen(filename, "rb");
+    if (mem != NULL && _gbImage_PNG_Read_Direct(mem, reuse, reuse_n, dest, width, height))
+    {
+        *rowBytes = *width * 4;
+        return;
+    }//if
+    
+    memset(header, 0, sizeof(header));
     
-    if (!fp)
+    if (mem == NULL)
     {
         printf("gbImage_PNG_Read_RGBA8888: can't open file [%s]\n", filename);
         shouldRead = false;
@@ -1108,7 +2691,11 @@ void gbImage_PNG_Read_RGBA8888(const char* filename,
     
     if (shouldRead)
     {
-        fread(header, 1, 8, fp);
+        if (mem->size >= 8)
+        {
+            memcpy(header, mem->data, 8);
+            mem->offset = 8;
+        }//if
         
         result = png_sig_cmp(header, 0, 8);
         
@@ -1160,7 +2747,8 @@ void gbImage_PNG_Read_RGBA8888(const char* filename,
 
     if (shouldRead)
     {
-        png_init_io(png_ptr, fp);
+        png_set_read_fn(png_ptr, mem, _gbImage_PNG_MemoryBuffer_Read);
+        
         png_set_sig_bytes(png_ptr, 8);
         
         png_read_info(png_ptr, info_ptr);
@@ -1222,7 +2810,7 @@ void gbImage_PNG_Read_RGBA8888(const char* filename,
         if (shouldRead)
         {
             const size_t _rowBytes = png_get_rowbytes(png_ptr, info_ptr);
-            _dest                  = malloc(sizeof(uint8_t) * _rowBytes * _height);
+            _dest                  = reuse != NULL && _rowBytes * _height <= reuse_n ? reuse : malloc(sizeof(uint8_t) * _rowBytes * _height);
             size_t       destIdx   = 0;
             const size_t _inc      = _rowBytes / sizeof(uint32_t);
             
@@ -1239,7 +2827,6 @@ void gbImage_PNG_Read_RGBA8888(const char* filename,
     }//if
 
     
-	if (fp       != NULL) fclose(fp);
 	if (info_ptr != NULL) png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
 	if (png_ptr  != NULL) png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
 
@@ -1247,11 +2834,395 @@ void gbImage_PNG_Read_RGBA8888(const char* filename,
     *width    = _width;
     *height   = _height;
     *rowBytes = _width * 4;
+}//_gbImage_PNG_Read_RGBA8888
+
+
+
+
+void gbImage_PNG_Read_RGBA8888(const char* filename,
+                               uint32_t**  dest,
+                               size_t*     width,
+                               size_t*     height,
+                               size_t*     rowBytes)
+{
+    size_t                   src_n = 0;
+    uint8_t*                 src   = _gbImage_PNG_ReadFile(filename, &src_n);
+    gbImage_PNG_MemoryBuffer mem   = { src, src_n, src_n, 0 };
+    
+    _gbImage_PNG_Read_RGBA8888(filename, src != NULL ? &mem : NULL, NULL, 0, dest, width, height, rowBytes);
+    
+    free(src);
 }//gbImage_PNG_Read_RGBA8888
 
 
 
 
+// =====================================
+// gbImage_PNG_Read_RGBA8888_FromMemory:
+// =====================================
+//
+// As gbImage_PNG_Read_RGBA8888, but decodes src_n bytes of an encoded PNG
+// already in memory at src.  filename is only used for logging.
+//
+void gbImage_PNG_Read_RGBA8888_FromMemory(const uint8_t* src,
+                                          const size_t   src_n,
+                                          const char*    filename,
+                                          uint32_t**     dest,
+                                          size_t*        width,
+                                          size_t*        height,
+                                          size_t*        rowBytes)
+{
+    gbImage_PNG_MemoryBuffer mem = { (uint8_t*)src, src_n, src_n, 0 };
+    
+    _gbImage_PNG_Read_RGBA8888(filename, src != NULL ? &mem : NULL, NULL, 0, dest, width, height, rowBytes);
+}//gbImage_PNG_Read_RGBA8888_FromMemory
+
+
+
+
+// ===================================================
+// gbImage_PNG_Read_RGBA8888_FromMemory_ReusingBuffer:
+// ===================================================
+//
+// As gbImage_PNG_Read_RGBA8888_FromMemory, but decodes into buf (buf_n bytes)
+// when the image fits, rather than allocating.  On return, *dest == buf if
+// it was used; otherwise the caller still owns buf, and *dest (if not NULL)
+// is a new buffer.
+//
+void gbImage_PNG_Read_RGBA8888_FromMemory_ReusingBuffer(const uint8_t* src,
+                                                        const size_t   src_n,
+                                                        const char*    filename,
+                                                        uint32_t*      buf,
+                                                        const size_t   buf_n,
+                                                        uint32_t**     dest,
+                                                        size_t*        width,
+                                                        size_t*        height,
+                                                        size_t*        rowBytes)
+{
+    gbImage_PNG_MemoryBuffer mem = { (uint8_t*)src, src_n, src_n, 0 };
+    
+    _gbImage_PNG_Read_RGBA8888(filename, src != NULL ? &mem : NULL, buf, buf_n, dest, width, height, rowBytes);
+}//gbImage_PNG_Read_RGBA8888_FromMemory_ReusingBuffer
+
+
+
+
+// =======================
+// gbImage_PNG_PrintStats:
+// =======================
+//
+// One line: how many of the images encoded so far were uniform (a single
+// color), and how many of those were copied from the per-thread cache rather
+// than encoded.
+//
+void gbImage_PNG_PrintStats(const char* logPrefix)
+{
+    const uint64_t encode_n      = __atomic_load_n(&_gbImage_PNG_EncodeN,      __ATOMIC_RELAXED);
+    const uint64_t transparent_n = __atomic_load_n(&_gbImage_PNG_TransparentN, __ATOMIC_RELAXED);
+    const uint64_t solid_n       = __atomic_load_n(&_gbImage_PNG_SolidN,       __ATOMIC_RELAXED);
+    const uint64_t hit_n         = __atomic_load_n(&_gbImage_PNG_UniformHitN,  __ATOMIC_RELAXED);
+    const double   uniform_pc    = encode_n > 0 ? 100.0 * (double)(transparent_n + solid_n) / (double)encode_n : 0.0;
+    
+    printf("%sPNG writes=%llu  uniform=%llu (%.1f%%): transparent=%llu solid=%llu  from cache=%llu\n",
+           logPrefix != NULL ? logPrefix : "",
+           (unsigned long long)encode_n,
+           (unsigned long long)(transparent_n + solid_n),
+           uniform_pc,
+           (unsigned long long)transparent_n,
+           (unsigned long long)solid_n,
+           (unsigned long long)hit_n);
+}//gbImage_PNG_PrintStats
+
+
+
+
+// ======================
+// gbImage_PNG_SelfCheck:
+// ======================
+//
+// Runs each of the SIMD pixel conversion helpers above against its scalar
+// version on pseudo-random data of assorted sizes and alignments, and
+// returns true if every result was bit-identical.  Mismatches are printed.
+//
+// For builds on a new platform or compiler, where the NEON -> SSE
+// translation may not be as expected.  Without NEON/SSE, this compares
+// the scalar versions to themselves.
+//
+bool gbImage_PNG_SelfCheck(void)
+{
+    const size_t max_n    = 256 * 256 + 67;
+    uint8_t*     src      = malloc(max_n * 4 + 16);
+    uint8_t*     dest_a   = malloc(max_n * 4 + 16);
+    uint8_t*     dest_b   = malloc(max_n * 4 + 16);
+    uint16_t*    src_u16  = malloc(max_n * sizeof(uint16_t));
+    uint32_t     seed     = 0x2545F491;
+    size_t       fail_n   = 0;
+    size_t       check_n  = 0;
+    
+    #define _SC_RAND() (seed = seed * 1664525U + 1013904223U, seed >> 8)
+    
+    // _RGBA8888_to_RGB888, to a new buffer and in-place
+    for (size_t n = 0; n < max_n; n = n < 70 ? n + 1 : n * 3 + 1)
+    {
+        for (size_t off = 0; off < 4; off++)
+        {
+            for (size_t i = 0; i < n * 4; i++)
+            {
+                src[off + i] = (uint8_t)_SC_RAND();
+            }//for
+            
+            memset(dest_a, 0xCD, n * 4 + 16);
+            memset(dest_b, 0xCD, n * 4 + 16);
+            
+            _RGBA8888_to_RGB888       (src + off, dest_a + off, n, 1);
+            _RGBA8888_to_RGB888_scalar(src + off, dest_b + off, n, 1);
+            
+            check_n++;
+            
+            if (memcmp(dest_a, dest_b, n * 4 + 16) != 0)
+            {
+                printf("gbImage_PNG_SelfCheck: [ERR] _RGBA8888_to_RGB888 n=%zu off=%zu\n", n, off);
+                fail_n++;
+            }//if
+            
+            memcpy(dest_a + off, src + off, n * 4);
+            memcpy(dest_b + off, src + off, n * 4);
+            
+            _RGBA8888_to_RGB888       (dest_a + off, dest_a + off, n, 1);
+            _RGBA8888_to_RGB888_scalar(dest_b + off, dest_b + off, n, 1);
+            
+            check_n++;
+            
+            if (memcmp(dest_a + off, dest_b + off, n * 3) != 0)
+            {
+                printf("gbImage_PNG_SelfCheck: [ERR] _RGBA8888_to_RGB888 (in-place) n=%zu off=%zu\n", n, off);
+                fail_n++;
+            }//if
+        }//for
+    }//for
+    
+    // _IsOpaqueRGBA8888, with one non-opaque pixel (or none) anywhere
+    for (size_t t = 0; t < 4000; t++)
+    {
+        const size_t width    = 1 + _SC_RAND() % (t < 2000 ? 40 : 300);
+        const size_t height   = 1 + _SC_RAND() % 24;
+        const size_t rowBytes = (width + _SC_RAND() % 3) * 4;
+        const size_t first_i  = _SC_RAND() % (width * height);
+        uint32_t*    src_u32  = (uint32_t*)src;
+        
+        if (rowBytes * height > max_n * 4)
+        {
+            continue;
+        }//if
+        
+        for (size_t i = 0; i < rowBytes * height / 4; i++)
+        {
+            src_u32[i] = _SC_RAND() | 0xFF000000;
+        }//for
+        
+        if (t % 3 != 0)
+        {
+            const size_t y = _SC_RAND() % height;
+            const size_t x = _SC_RAND() % width;
+            
+            src_u32[y * rowBytes / 4 + x] &= 0x00FFFFFF | (uint32_t)(_SC_RAND() % 255) << 24;
+        }//if
+        
+        check_n++;
+        
+        if (   _IsOpaqueRGBA8888       (src, width, height, rowBytes, first_i)
+            != _IsOpaqueRGBA8888_scalar(src, width, height, rowBytes, first_i))
+        {
+            printf("gbImage_PNG_SelfCheck: [ERR] _IsOpaqueRGBA8888 w=%zu h=%zu first_i=%zu\n", width, height, first_i);
+            fail_n++;
+        }//if
+    }//for
+    
+    // _IsUniformRGBA8888, with one differing pixel (or none) anywhere
+    for (size_t t = 0; t < 4000; t++)
+    {
+        const size_t   width    = 1 + _SC_RAND() % (t < 2000 ? 40 : 300);
+        const size_t   height   = 1 + _SC_RAND() % 24;
+        const size_t   rowBytes = (width + _SC_RAND() % 3) * 4;
+        const uint32_t rgba     = t % 5 == 0 ? 0 : _SC_RAND() << 8 ^ _SC_RAND();
+        uint32_t*      src_u32  = (uint32_t*)src;
+        
+        if (rowBytes * height > max_n * 4)
+        {
+            continue;
+        }//if
+        
+        for (size_t i = 0; i < rowBytes * height / 4; i++)
+        {
+            src_u32[i] = i % (rowBytes / 4) < width ? rgba : _SC_RAND();
+        }//for
+        
+        if (t % 3 != 0)
+        {
+            const size_t y = _SC_RAND() % height;
+            const size_t x = _SC_RAND() % width;
+            
+            src_u32[y * rowBytes / 4 + x] ^= 1U << (_SC_RAND() % 32);
+        }//if
+        
+        check_n++;
+        
+        if (   _IsUniformRGBA8888       (src, width, height, rowBytes)
+            != _IsUniformRGBA8888_scalar(src, width, height, rowBytes))
+        {
+            printf("gbImage_PNG_SelfCheck: [ERR] _IsUniformRGBA8888 w=%zu h=%zu\n", width, height);
+            fail_n++;
+        }//if
+    }//for
+    
+    // _gbImage_PNG_FilterRow, _gbImage_PNG_SumAbsS8
+    for (size_t n = 1; n < 1100; n = n < 70 ? n + 1 : n * 2 + 3)
+    {
+        for (size_t i = 0; i < n * 2; i++)
+        {
+            src[i] = (uint8_t)(i % 7 == 0 ? _SC_RAND() : src[i > 0 ? i - 1 : 0] + _SC_RAND() % 5);   // some runs
+        }//for
+        
+        for (uint8_t filter = 1; filter <= 4; filter++)
+        {
+            for (size_t bpp = 3; bpp <= 4; bpp++)
+            {
+                memset(dest_a, 0xCD, n + 16);
+                memset(dest_b, 0xCD, n + 16);
+                
+                _gbImage_PNG_FilterRow       (filter, src + n, src, dest_a,    n, bpp);
+                _gbImage_PNG_FilterRow_scalar(filter, src + n, src, dest_b, 0, n, bpp);
+                
+                check_n++;
+                
+                if (memcmp(dest_a, dest_b, n + 16) != 0)
+                {
+                    printf("gbImage_PNG_SelfCheck: [ERR] _gbImage_PNG_FilterRow filter=%d bpp=%zu n=%zu\n", filter, bpp, n);
+                    fail_n++;
+                }//if
+            }//for
+        }//for
+        
+        check_n++;
+        
+        if (   _gbImage_PNG_SumAbsS8       (src, n * 2)
+            != _gbImage_PNG_SumAbsS8_scalar(src, n * 2))
+        {
+            printf("gbImage_PNG_SelfCheck: [ERR] _gbImage_PNG_SumAbsS8 n=%zu\n", n * 2);
+            fail_n++;
+        }//if
+    }//for
+    
+    memset(src, 0x80, max_n * 4);                                       // |-128| in every byte, for overflow
+    
+    check_n++;
+    
+    if (   _gbImage_PNG_SumAbsS8       (src, max_n * 4)
+        != _gbImage_PNG_SumAbsS8_scalar(src, max_n * 4))
+    {
+        printf("gbImage_PNG_SelfCheck: [ERR] _gbImage_PNG_SumAbsS8 n=%zu\n", max_n * 4);
+        fail_n++;
+    }//if
+    
+    // _PalHash_FindInBucket
+    for (size_t t = 0; t < 20000; t++)
+    {
+        uint32_t     keys[4] __attribute__ ((aligned(16)));
+        const size_t n    = _SC_RAND() % 5;
+        uint32_t     rgba = _SC_RAND() % 6;
+        
+        for (size_t i = 0; i < 4; i++)
+        {
+            keys[i] = _SC_RAND() % 6;
+        }//for
+        
+        rgba = t % 2 == 0 ? rgba : rgba | 0xFF000000;
+        
+        check_n++;
+        
+        if (   _PalHash_FindInBucket_NEON  (keys, rgba, n)
+            != _PalHash_FindInBucket_scalar(keys, rgba, n))
+        {
+            printf("gbImage_PNG_SelfCheck: [ERR] _PalHash_FindInBucket n=%zu\n", n);
+            fail_n++;
+        }//if
+    }//for
+    
+    // _vscgtsubcvtu8
+    for (size_t n = 0; n < 600; n = n < 40 ? n + 1 : n * 2)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            src_u16[i] = (uint16_t)(_SC_RAND() % 512);
+        }//for
+        
+        memset(dest_a, 0xCD, n + 16);
+        memset(dest_b, 0xCD, n + 16);
+        
+        _vscgtsubcvtu8       (src_u16, 255, 256, dest_a, n);
+        _vscgtsubcvtu8_scalar(src_u16, 255, 256, dest_b, n);
+        
+        check_n++;
+        
+        if (memcmp(dest_a, dest_b, n + 16) != 0)
+        {
+            printf("gbImage_PNG_SelfCheck: [ERR] _vscgtsubcvtu8 n=%zu\n", n);
+            fail_n++;
+        }//if
+    }//for
+    
+    // _Planar8ToPlanar4_InPlace, _Planar8ToPlanar2_InPlace
+    for (size_t width = 4; width <= 256; width *= 4)
+    {
+        const size_t height = 256 * 64 / width;     // n % 64 == 0, as for tiles
+        
+        for (size_t i = 0; i < width * height; i++)
+        {
+            dest_a[i] = dest_b[i] = (uint8_t)(_SC_RAND() % 16);
+        }//for
+        
+        _Planar8ToPlanar4_InPlace       (dest_a, width, height, width);
+        _Planar8ToPlanar4_InPlace_scalar(dest_b, width, height, width);
+        
+        check_n++;
+        
+        if (memcmp(dest_a, dest_b, width * height / 2) != 0)
+        {
+            printf("gbImage_PNG_SelfCheck: [ERR] _Planar8ToPlanar4_InPlace w=%zu\n", width);
+            fail_n++;
+        }//if
+        
+        for (size_t i = 0; i < width * height; i++)
+        {
+            dest_a[i] = dest_b[i] = (uint8_t)(_SC_RAND() % 4);
+        }//for
+        
+        _Planar8ToPlanar2_InPlace       (dest_a, width, height, width);
+        _Planar8ToPlanar2_InPlace_scalar(dest_b, width, height, width);
+        
+        check_n++;
+        
+        if (memcmp(dest_a, dest_b, width * height / 4) != 0)
+        {
+            printf("gbImage_PNG_SelfCheck: [ERR] _Planar8ToPlanar2_InPlace w=%zu\n", width);
+            fail_n++;
+        }//if
+    }//for
+    
+    #undef _SC_RAND
+    
+    free(src);
+    free(dest_a);
+    free(dest_b);
+    free(src_u16);
+    
+    printf("gbImage_PNG_SelfCheck: %s: %zu/%zu checks passed.\n", fail_n == 0 ? "OK" : "FAILED", check_n - fail_n, check_n);
+    
+    return fail_n == 0;
+}//gbImage_PNG_SelfCheck
+
+
+
 
 
 
@@ -2,10 +2,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
+#ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
+#endif
 #include "sqlite3.h"
 #include "unistd.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef __APPLE__
 #include <libpng15/png.h> // http://ethan.tira-thompson.com/Mac_OS_X_Ports.html
+#else
+#include <png.h>
+#endif
 #include "NEONvsSSE_5.h" // https://software.intel.com/en-us/blogs/2012/12/12/from-arm-neon-to-intel-mmxsse-automatic-porting-solution-tips-and-tricks
 
 #ifndef gbImage_png_h
@@ -15,17 +26,69 @@
 extern "C" {
 #endif
 
+typedef int GB_PNG_FilterMode; enum
+{
+    kGB_PNG_Filter_None     = 0,    // filter type 0 for every row
+    kGB_PNG_Filter_Adaptive = 1     // truecolor rows: best of all 5 per row
+};
+
+void gbImage_PNG_SetFilterMode(const GB_PNG_FilterMode mode);
+    
+typedef int GB_PNG_CompressProfile; enum
+{
+    kGB_PNG_Compress_Default = 0,   // zlib level 9
+    kGB_PNG_Compress_Fast    = 1,   // zlib level 1
+    kGB_PNG_Compress_Max     = 2    // smallest of several zlib strategies
+};
+
+void gbImage_PNG_SetCompressProfile(const GB_PNG_CompressProfile profile);
+    
 int gbImage_PNG_Write_RGBA8888(const char*  filename,
                                const size_t width,
                                const size_t height,
                                uint8_t*     src);
     
+int gbImage_PNG_Write_RGBA8888_ToMemory(const size_t width,
+                                        const size_t height,
+                                        uint8_t*     src,
+                                        uint8_t**    dest,
+                                        size_t*      dest_n);
+    
+int gbImage_PNG_Write_RGBA8888_ToMemory_Strided(const size_t width,
+                                                const size_t height,
+                                                const size_t rowBytes,
+                                                uint8_t*     src,
+                                                uint8_t**    dest,
+                                                size_t*      dest_n);
+    
 void gbImage_PNG_Read_RGBA8888(const char* filename,
                                uint32_t**  dest,
                                size_t*     width,
                                size_t*     height,
                                size_t*     rowBytes);
     
+void gbImage_PNG_Read_RGBA8888_FromMemory(const uint8_t* src,
+                                          const size_t   src_n,
+                                          const char*    filename,
+                                          uint32_t**     dest,
+                                          size_t*        width,
+                                          size_t*        height,
+                                          size_t*        rowBytes);
+    
+void gbImage_PNG_Read_RGBA8888_FromMemory_ReusingBuffer(const uint8_t* src,
+                                                        const size_t   src_n,
+                                                        const char*    filename,
+                                                        uint32_t*      buf,
+                                                        const size_t   buf_n,
+                                                        uint32_t**     dest,
+                                                        size_t*        width,
+                                                        size_t*        height,
+                                                        size_t*        rowBytes);
+    
+void gbImage_PNG_PrintStats(const char* logPrefix);
+    
+bool gbImage_PNG_SelfCheck(void);
+    
 #if defined (__cplusplus)
 }
 #endif
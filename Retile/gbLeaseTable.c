@@ -0,0 +1,334 @@
+#include "gbLeaseTable.h"
+
+// ===============
+// gbLeaseTable.c:
+// ===============
+//
+// Work queue shared by several processes, on one host or many, through a
+// SQLite file they can all reach.  A job is split into chunk_n chunks, and
+// each process claims one at a time, does it, and marks it done.
+//
+// A claim is a lease: it expires lease_s seconds after it was taken.  A chunk
+// whose lease expired before it was marked done is issued again, so a worker
+// that died or stalled holds up nothing for longer than that.  Should the
+// slow worker finish after all, the chunk is simply done twice.
+//
+// Claims run in a BEGIN IMMEDIATE transaction, so two processes can never take
+// the same free chunk.  Other processes wait on the write lock with a busy
+// timeout, and the transactions are a few small statements each.
+//
+// The database is left in the default rollback journal mode, not WAL: WAL
+// keeps its index in shared memory, which only works between processes on
+// the same host.  Leases compare wall clock time across hosts, so their
+// clocks should be roughly in sync, and lease_s well above any skew.
+//
+// Table layout:
+//
+//     Job   (name, chunk_n)
+//     Lease (job, chunk, state, owner, expires, claim_n)
+//
+// state is 0 free, 1 leased or 2 done.  Rows are kept, so a job that is run
+// again against the same file finds everything done and returns at once.
+//
+
+#define kGB_LeaseTable_BusyTimeoutMS 60000
+
+struct gbLeaseTable
+{
+    sqlite3* db;
+    char     job  [256];
+    char     owner[320];
+    int      lease_s;
+};
+
+
+
+
+static bool _gbLeaseTable_Exec(gbLeaseTable* lt,
+                               const char*   sql)
+{
+    char* err = NULL;
+    
+    if (sqlite3_exec(lt->db, sql, NULL, NULL, &err) != SQLITE_OK)
+    {
+        printf("gbLeaseTable: [ERR] %s (query: %s)\n", err != NULL ? err : sqlite3_errmsg(lt->db), sql);
+        sqlite3_free(err);
+        return false;
+    }//if
+    
+    return true;
+}//_gbLeaseTable_Exec
+
+
+// Prepares sql and binds the job name to ?1.
+static sqlite3_stmt* _gbLeaseTable_Prepare(gbLeaseTable* lt,
+                                           const char*   sql)
+{
+    sqlite3_stmt* stmt = NULL;
+    
+    if (sqlite3_prepare_v2(lt->db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    {
+        printf("gbLeaseTable: [ERR] Error preparing statement: %s (query: %s)\n", sqlite3_errmsg(lt->db), sql);
+        sqlite3_finalize(stmt);
+        return NULL;
+    }//if
+    
+    sqlite3_bind_text(stmt, 1, lt->job, -1, SQLITE_STATIC);
+    
+    return stmt;
+}//_gbLeaseTable_Prepare
+
+
+// Runs a statement that returns at most one integer.  Returns -1 on error, or
+// if there was no row.
+static int64_t _gbLeaseTable_StepScalar(gbLeaseTable* lt,
+                                        sqlite3_stmt* stmt)
+{
+    int64_t   val = -1;
+    const int rc  = stmt != NULL ? sqlite3_step(stmt) : SQLITE_ERROR;
+    
+    if (rc == SQLITE_ROW)
+    {
+        val = sqlite3_column_int64(stmt, 0);
+    }//if
+    else if (rc != SQLITE_DONE)
+    {
+        printf("gbLeaseTable: [ERR] %s\n", sqlite3_errmsg(lt->db));
+    }//else if
+    
+    sqlite3_finalize(stmt);
+    
+    return val;
+}//_gbLeaseTable_StepScalar
+
+
+
+
+// ==================
+// gbLeaseTable_Open:
+// ==================
+//
+// Opens, or creates, the lease table at dbPath for job.  The first process to
+// open a job adds its chunks; the rest find them there.  Returns NULL if the
+// file could not be opened, or already has job with a different chunk_n.
+//
+gbLeaseTable* gbLeaseTable_Open(const char*  dbPath,
+                                const char*  job,
+                                const size_t chunk_n,
+                                const int    lease_s)
+{
+    gbLeaseTable* lt = malloc(sizeof(gbLeaseTable));
+    
+    lt->db      = NULL;
+    lt->lease_s = lease_s > 0 ? lease_s : 1;
+    
+    snprintf(lt->job, sizeof(lt->job), "%s", job);
+    
+    char host[256];
+    
+    if (gethostname(host, sizeof(host)) != 0)
+    {
+        snprintf(host, sizeof(host), "unknown");
+    }//if
+    
+    host[sizeof(host) - 1] = '\0';
+    
+    snprintf(lt->owner, sizeof(lt->owner), "%s:%d", host, (int)getpid());
+    
+    if (sqlite3_open_v2(dbPath, &lt->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK)
+    {
+        printf("gbLeaseTable_Open: [ERR] Error opening DB: %s\n", sqlite3_errmsg(lt->db));
+        gbLeaseTable_Close(lt);
+        return NULL;
+    }//if
+    
+    sqlite3_busy_timeout(lt->db, kGB_LeaseTable_BusyTimeoutMS);
+    
+    if (!_gbLeaseTable_Exec(lt, "CREATE TABLE IF NOT EXISTS Job(name TEXT PRIMARY KEY, chunk_n INTEGER);"
+                                "CREATE TABLE IF NOT EXISTS Lease(job TEXT, chunk INTEGER, state INTEGER, owner TEXT,"
+                                " expires INTEGER, claim_n INTEGER, PRIMARY KEY(job, chunk));")
+        || !_gbLeaseTable_Exec(lt, "BEGIN IMMEDIATE;"))
+    {
+        gbLeaseTable_Close(lt);
+        return NULL;
+    }//if
+    
+    int64_t old_n = _gbLeaseTable_StepScalar(lt, _gbLeaseTable_Prepare(lt, "SELECT chunk_n FROM Job WHERE name = ?1;"));
+    bool    isOK  = true;
+    
+    if (old_n < 0)
+    {
+        sqlite3_stmt* stmt = _gbLeaseTable_Prepare(lt, "INSERT INTO Job(name, chunk_n) VALUES (?1, ?2);");
+        
+        if (stmt != NULL)
+        {
+            sqlite3_bind_int64(stmt, 2, (int64_t)chunk_n);
+        }//if
+        
+        _gbLeaseTable_StepScalar(lt, stmt);
+        
+        stmt = _gbLeaseTable_Prepare(lt, "WITH RECURSIVE c(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM c WHERE i + 1 < ?2)"
+                                         " INSERT INTO Lease(job, chunk, state, owner, expires, claim_n)"
+                                         " SELECT ?1, i, 0, NULL, 0, 0 FROM c;");
+        
+        if (stmt != NULL)
+        {
+            sqlite3_bind_int64(stmt, 2, (int64_t)chunk_n);
+        }//if
+        
+        _gbLeaseTable_StepScalar(lt, stmt);
+    }//if
+    else if ((size_t)old_n != chunk_n)
+    {
+        printf("gbLeaseTable_Open: [ERR] %s has job [%s] with %lld chunks, not %zu.  Were the src tiles changed?\n",
+               dbPath, job, (long long)old_n, chunk_n);
+        isOK = false;
+    }//else if
+    
+    isOK = _gbLeaseTable_Exec(lt, isOK ? "COMMIT;" : "ROLLBACK;") && isOK;
+    
+    if (!isOK)
+    {
+        gbLeaseTable_Close(lt);
+        return NULL;
+    }//if
+    
+    return lt;
+}//gbLeaseTable_Open
+
+
+
+
+// ===================
+// gbLeaseTable_Claim:
+// ===================
+//
+// Takes the lowest chunk that is free or whose lease has expired.  Returns
+// kGB_LeaseTable_Wait if there is none but some other process still holds a
+// live lease.  The caller should sleep a bit and try again, as that lease may
+// yet expire.
+//
+int gbLeaseTable_Claim(gbLeaseTable* lt,
+                       size_t*       chunk_i)
+{
+    const int64_t now = (int64_t)time(NULL);
+    int           res = kGB_LeaseTable_Error;
+    
+    if (!_gbLeaseTable_Exec(lt, "BEGIN IMMEDIATE;"))
+    {
+        return res;
+    }//if
+    
+    sqlite3_stmt* stmt = _gbLeaseTable_Prepare(lt, "SELECT chunk FROM Lease WHERE job = ?1"
+                                                   " AND (state = 0 OR (state = 1 AND expires < ?2)) ORDER BY chunk LIMIT 1;");
+    
+    if (stmt != NULL)
+    {
+        sqlite3_bind_int64(stmt, 2, now);
+    }//if
+    
+    const int64_t chunk = _gbLeaseTable_StepScalar(lt, stmt);
+    
+    if (chunk >= 0)
+    {
+        stmt = _gbLeaseTable_Prepare(lt, "UPDATE Lease SET state = 1, owner = ?2, expires = ?3, claim_n = claim_n + 1"
+                                         " WHERE job = ?1 AND chunk = ?4;");
+        
+        bool isClaimed = false;
+        
+        if (stmt != NULL)
+        {
+            sqlite3_bind_text (stmt, 2, lt->owner, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 3, now + lt->lease_s);
+            sqlite3_bind_int64(stmt, 4, chunk);
+            
+            isClaimed = sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(lt->db) == 1;
+            
+            if (!isClaimed)
+            {
+                printf("gbLeaseTable: [ERR] Could not claim chunk %lld: %s\n", (long long)chunk, sqlite3_errmsg(lt->db));
+            }//if
+            
+            sqlite3_finalize(stmt);
+        }//if
+        
+        if (!isClaimed)                                                 // never work a chunk that is not ours
+        {
+            _gbLeaseTable_Exec(lt, "ROLLBACK;");
+            return kGB_LeaseTable_Error;
+        }//if
+        
+        *chunk_i = (size_t)chunk;
+        res      = kGB_LeaseTable_Claimed;
+    }//if
+    else
+    {
+        const int64_t left_n = _gbLeaseTable_StepScalar(lt, _gbLeaseTable_Prepare(lt, "SELECT COUNT(*) FROM Lease WHERE job = ?1 AND state <> 2;"));
+        
+        res = left_n == 0 ? kGB_LeaseTable_Done
+            : left_n >  0 ? kGB_LeaseTable_Wait
+            :               kGB_LeaseTable_Error;
+    }//else
+    
+    if (!_gbLeaseTable_Exec(lt, "COMMIT;"))
+    {
+        _gbLeaseTable_Exec(lt, "ROLLBACK;");
+        res = kGB_LeaseTable_Error;
+    }//if
+    
+    return res;
+}//gbLeaseTable_Claim
+
+
+
+
+// ======================
+// gbLeaseTable_Complete:
+// ======================
+//
+// Marks chunk_i done, even if its lease expired and it was claimed again in
+// the meantime.  The work is done either way.
+//
+bool gbLeaseTable_Complete(gbLeaseTable* lt,
+                           const size_t  chunk_i)
+{
+    sqlite3_stmt* stmt = _gbLeaseTable_Prepare(lt, "UPDATE Lease SET state = 2 WHERE job = ?1 AND chunk = ?2;");
+    
+    if (stmt == NULL)
+    {
+        return false;
+    }//if
+    
+    sqlite3_bind_int64(stmt, 2, (int64_t)chunk_i);
+    
+    const bool isOK = sqlite3_step(stmt) == SQLITE_DONE;
+    
+    if (!isOK)
+    {
+        printf("gbLeaseTable_Complete: [ERR] %s\n", sqlite3_errmsg(lt->db));
+    }//if
+    
+    sqlite3_finalize(stmt);
+    
+    return isOK;
+}//gbLeaseTable_Complete
+
+
+size_t gbLeaseTable_GetDoneCount(gbLeaseTable* lt)
+{
+    const int64_t n = _gbLeaseTable_StepScalar(lt, _gbLeaseTable_Prepare(lt, "SELECT COUNT(*) FROM Lease WHERE job = ?1 AND state = 2;"));
+    
+    return n > 0 ? (size_t)n : 0;
+}//gbLeaseTable_GetDoneCount
+
+
+void gbLeaseTable_Close(gbLeaseTable* lt)
+{
+    if (lt == NULL)
+    {
+        return;
+    }//if
+    
+    sqlite3_close(lt->db);
+    free(lt);
+}//gbLeaseTable_Close
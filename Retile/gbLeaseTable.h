@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include "sqlite3.h"
+
+#ifndef gbLeaseTable_h
+#define gbLeaseTable_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+enum gbLeaseTable_ClaimResult
+{
+    kGB_LeaseTable_Claimed = 0,     // chunk_i is ours until the lease expires
+    kGB_LeaseTable_Wait    = 1,     // none free, but some are leased and not done
+    kGB_LeaseTable_Done    = 2,     // every chunk is done
+    kGB_LeaseTable_Error   = 3
+};
+
+typedef struct gbLeaseTable gbLeaseTable;
+
+gbLeaseTable* gbLeaseTable_Open(const char*  dbPath,
+                                const char*  job,
+                                const size_t chunk_n,
+                                const int    lease_s);
+
+int gbLeaseTable_Claim(gbLeaseTable* lt,
+                       size_t*       chunk_i);
+
+bool gbLeaseTable_Complete(gbLeaseTable* lt,
+                           const size_t  chunk_i);
+
+size_t gbLeaseTable_GetDoneCount(gbLeaseTable* lt);
+
+void gbLeaseTable_Close(gbLeaseTable* lt);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
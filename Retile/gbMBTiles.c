@@ -0,0 +1,643 @@
+#include "gbMBTiles.h"
+
+// ============
+// gbMBTiles.c:
+// ============
+//
+// Writes tiles into an MBTiles file, a single SQLite database, instead of one
+// file per tile.  (https://github.com/mapbox/mbtiles-spec)  For millions of
+// small tiles, this avoids most of the filesystem cost: no inode, directory
+// entry or mkdir per tile.
+//
+// Any number of threads hand encoded tiles to gbMBTiles_Put, which queues
+// them for a single writer thread.  That thread owns the connection, and
+// inserts the tiles in transactions of kGB_MBTiles_TxnN, which is where the
+// throughput comes from.  The queue is bounded, so a writer that falls behind
+// blocks the producers rather than letting encoded tiles pile up in memory.
+//
+// Tiles are given in XYZ (Google / OSM) coordinates.  MBTiles rows are TMS,
+// with y counted from the bottom, which the writer converts to.
+//
+// An existing file is added to, replacing any tiles written again.  On close,
+// the metadata is brought up to date with every tile in the file.
+//
+// gbMBTilesReader, below, reads a level back out as a source.
+//
+
+#define kGB_MBTiles_QueueN         1024
+#define kGB_MBTiles_TxnN           4096
+#define kGB_MBTiles_BusyTimeoutMS  600000
+
+typedef struct gbMBTiles_Tile
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    uint8_t* png;
+    size_t   png_n;
+} gbMBTiles_Tile;
+
+struct gbMBTiles
+{
+    sqlite3*        db;
+    sqlite3_stmt*   insertStmt;
+    char            path[1024];
+    
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  hasWork;
+    pthread_cond_t  hasSpace;
+    gbMBTiles_Tile* queue;                  // producers -> writer
+    gbMBTiles_Tile* batch;                  // writer only
+    size_t          queue_n;
+    bool            isClosing;
+    
+    size_t          written_n;              // writer only, until joined
+    size_t          error_n;
+};
+
+
+
+
+static bool _gbMBTiles_Exec(gbMBTiles*  mbt,
+                            const char* sql)
+{
+    char* err = NULL;
+    
+    if (sqlite3_exec(mbt->db, sql, NULL, NULL, &err) != SQLITE_OK)
+    {
+        printf("gbMBTiles: [ERR] %s (query: %s)\n", err != NULL ? err : sqlite3_errmsg(mbt->db), sql);
+        sqlite3_free(err);
+        return false;
+    }//if
+    
+    return true;
+}//_gbMBTiles_Exec
+
+
+static void _gbMBTiles_InsertTile(gbMBTiles*            mbt,
+                                  const gbMBTiles_Tile* t)
+{
+    const uint32_t tms_y = (uint32_t)((1ULL << t->z) - 1ULL - t->y);
+    
+    sqlite3_bind_int (mbt->insertStmt, 1, (int)t->z);
+    sqlite3_bind_int (mbt->insertStmt, 2, (int)t->x);
+    sqlite3_bind_int (mbt->insertStmt, 3, (int)tms_y);
+    sqlite3_bind_blob(mbt->insertStmt, 4, t->png, (int)t->png_n, SQLITE_STATIC);
+    
+    if (sqlite3_step(mbt->insertStmt) != SQLITE_DONE)
+    {
+        printf("gbMBTiles: [ERR] Insert of (%u, %u, %u) failed: %s\n", t->x, t->y, t->z, sqlite3_errmsg(mbt->db));
+        mbt->error_n++;
+    }//if
+    else
+    {
+        mbt->written_n++;
+    }//else
+    
+    sqlite3_reset(mbt->insertStmt);
+    sqlite3_clear_bindings(mbt->insertStmt);
+}//_gbMBTiles_InsertTile
+
+
+
+
+// ==================
+// _gbMBTiles_Writer:
+// ==================
+//
+// Writer thread.  Takes the whole queue at once, so producers are blocked
+// only for a pointer swap, and commits every kGB_MBTiles_TxnN tiles.
+//
+static void* _gbMBTiles_Writer(void* context)
+{
+    gbMBTiles* mbt   = (gbMBTiles*)context;
+    size_t     txn_n = 0;
+    bool       isTxn = false;
+    
+    pthread_mutex_lock(&mbt->mutex);
+    
+    while (true)
+    {
+        while (mbt->queue_n == 0 && !mbt->isClosing)
+        {
+            pthread_cond_wait(&mbt->hasWork, &mbt->mutex);
+        }//while
+        
+        if (mbt->queue_n == 0)
+        {
+            break;
+        }//if
+        
+        gbMBTiles_Tile* batch   = mbt->queue;
+        const size_t    batch_n = mbt->queue_n;
+        
+        mbt->queue   = mbt->batch;
+        mbt->batch   = batch;
+        mbt->queue_n = 0;
+        
+        pthread_cond_broadcast(&mbt->hasSpace);
+        pthread_mutex_unlock(&mbt->mutex);
+        
+        for (size_t i = 0; i < batch_n; i++)
+        {
+            if (!isTxn)
+            {
+                isTxn = _gbMBTiles_Exec(mbt, "BEGIN IMMEDIATE;");
+                txn_n = 0;
+            }//if
+            
+            _gbMBTiles_InsertTile(mbt, &(batch[i]));
+            
+            free(batch[i].png);
+            batch[i].png = NULL;
+            
+            if (isTxn && ++txn_n >= kGB_MBTiles_TxnN)
+            {
+                _gbMBTiles_Exec(mbt, "COMMIT;");
+                isTxn = false;
+            }//if
+        }//for
+        
+        pthread_mutex_lock(&mbt->mutex);
+    }//while
+    
+    pthread_mutex_unlock(&mbt->mutex);
+    
+    if (isTxn)
+    {
+        _gbMBTiles_Exec(mbt, "COMMIT;");
+    }//if
+    
+    return NULL;
+}//_gbMBTiles_Writer
+
+
+
+
+// ===============
+// gbMBTiles_Open:
+// ===============
+//
+// Opens or creates the MBTiles file at path, and starts its writer thread.
+// Returns NULL if it could not be opened.
+//
+gbMBTiles* gbMBTiles_Open(const char* path)
+{
+    gbMBTiles* mbt = malloc(sizeof(gbMBTiles));
+    
+    memset(mbt, 0, sizeof(gbMBTiles));
+    
+    snprintf(mbt->path, sizeof(mbt->path), "%s", path);
+    
+    if (sqlite3_open_v2(path, &mbt->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK)
+    {
+        printf("gbMBTiles_Open: [ERR] Error opening DB [%s]: %s\n", path, sqlite3_errmsg(mbt->db));
+        sqlite3_close(mbt->db);
+        free(mbt);
+        return NULL;
+    }//if
+    
+    sqlite3_busy_timeout(mbt->db, kGB_MBTiles_BusyTimeoutMS);
+    
+    if (!_gbMBTiles_Exec(mbt, "PRAGMA synchronous = NORMAL;"
+                              "CREATE TABLE IF NOT EXISTS metadata (name TEXT, value TEXT);"
+                              "CREATE UNIQUE INDEX IF NOT EXISTS metadata_name ON metadata (name);"
+                              "CREATE TABLE IF NOT EXISTS tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB);"
+                              "CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row);")
+        || sqlite3_prepare_v2(mbt->db, "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?);",
+                              -1, &mbt->insertStmt, NULL) != SQLITE_OK)
+    {
+        printf("gbMBTiles_Open: [ERR] Could not set up [%s]: %s\n", path, sqlite3_errmsg(mbt->db));
+        sqlite3_finalize(mbt->insertStmt);
+        sqlite3_close(mbt->db);
+        free(mbt);
+        return NULL;
+    }//if
+    
+    mbt->queue = malloc(sizeof(gbMBTiles_Tile) * kGB_MBTiles_QueueN);
+    mbt->batch = malloc(sizeof(gbMBTiles_Tile) * kGB_MBTiles_QueueN);
+    
+    pthread_mutex_init(&mbt->mutex,    NULL);
+    pthread_cond_init (&mbt->hasWork,  NULL);
+    pthread_cond_init (&mbt->hasSpace, NULL);
+    pthread_create(&mbt->thread, NULL, _gbMBTiles_Writer, mbt);
+    
+    return mbt;
+}//gbMBTiles_Open
+
+
+
+
+// ==============
+// gbMBTiles_Put:
+// ==============
+//
+// Queues a tile for the writer, which takes ownership of png and frees it.
+// Thread safe.  Blocks while the queue is full.
+//
+void gbMBTiles_Put(gbMBTiles*     mbt,
+                   const uint32_t x,
+                   const uint32_t y,
+                   const uint32_t z,
+                   uint8_t*       png,
+                   const size_t   png_n)
+{
+    pthread_mutex_lock(&mbt->mutex);
+    
+    while (mbt->queue_n == kGB_MBTiles_QueueN)
+    {
+        pthread_cond_wait(&mbt->hasSpace, &mbt->mutex);
+    }//while
+    
+    gbMBTiles_Tile* t = &(mbt->queue[mbt->queue_n++]);
+    
+    t->x     = x;
+    t->y     = y;
+    t->z     = z;
+    t->png   = png;
+    t->png_n = png_n;
+    
+    pthread_cond_signal(&mbt->hasWork);
+    pthread_mutex_unlock(&mbt->mutex);
+}//gbMBTiles_Put
+
+
+
+
+static void _gbMBTiles_SetMetadata(gbMBTiles*  mbt,
+                                   const char* name,
+                                   const char* value,
+                                   const bool  isReplace)
+{
+    sqlite3_stmt* stmt = NULL;
+    
+    if (sqlite3_prepare_v2(mbt->db, isReplace ? "INSERT OR REPLACE INTO metadata (name, value) VALUES (?, ?);"
+                                              : "INSERT OR IGNORE INTO metadata (name, value) VALUES (?, ?);",
+                           -1, &stmt, NULL) == SQLITE_OK)
+    {
+        sqlite3_bind_text(stmt, 1, name,  -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, value, -1, SQLITE_STATIC);
+        
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            printf("gbMBTiles: [ERR] Could not set metadata %s: %s\n", name, sqlite3_errmsg(mbt->db));
+        }//if
+    }//if
+    
+    sqlite3_finalize(stmt);
+}//_gbMBTiles_SetMetadata
+
+
+// Tile edge -> degrees.  y is a TMS row.
+static inline double _gbMBTiles_TileToLon(const double x, const uint32_t z) { return x / (double)(1ULL << z) * 360.0 - 180.0; }
+static inline double _gbMBTiles_TileToLat(const double y, const uint32_t z)
+{
+    const double n = M_PI - 2.0 * M_PI * ((double)(1ULL << z) - y) / (double)(1ULL << z);
+    
+    return 180.0 / M_PI * atan(0.5 * (exp(n) - exp(-n)));
+}//_gbMBTiles_TileToLat
+
+
+// ==========================
+// _gbMBTiles_UpdateMetadata:
+// ==========================
+//
+// Sets minzoom, maxzoom and bounds from the tiles table, so they also cover
+// tiles written by earlier runs, or other processes, into the same file.
+// name and format are only set if missing.  bounds is taken from the highest
+// zoom level, the most precise.
+//
+static void _gbMBTiles_UpdateMetadata(gbMBTiles* mbt)
+{
+    sqlite3_stmt* stmt  = NULL;
+    int           min_z = -1;
+    int           max_z = -1;
+    char          value[256];
+    
+    if (sqlite3_prepare_v2(mbt->db, "SELECT MIN(zoom_level), MAX(zoom_level) FROM tiles;", -1, &stmt, NULL) == SQLITE_OK
+        && sqlite3_step(stmt) == SQLITE_ROW
+        && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+    {
+        min_z = sqlite3_column_int(stmt, 0);
+        max_z = sqlite3_column_int(stmt, 1);
+    }//if
+    
+    sqlite3_finalize(stmt);
+    
+    const char* slash = strrchr(mbt->path, '/');
+    
+    snprintf(value, sizeof(value), "%.*s", (int)sizeof(value) - 1, slash != NULL ? slash + 1 : mbt->path);
+    
+    char* dot = strrchr(value, '.');
+    
+    if (dot != NULL && dot != value)
+    {
+        *dot = '\0';
+    }//if
+    
+    _gbMBTiles_SetMetadata(mbt, "name",   value, false);
+    _gbMBTiles_SetMetadata(mbt, "format", "png", false);
+    
+    if (min_z < 0)
+    {
+        return;
+    }//if
+    
+    snprintf(value, sizeof(value), "%d", min_z);
+    _gbMBTiles_SetMetadata(mbt, "minzoom", value, true);
+    
+    snprintf(value, sizeof(value), "%d", max_z);
+    _gbMBTiles_SetMetadata(mbt, "maxzoom", value, true);
+    
+    if (sqlite3_prepare_v2(mbt->db, "SELECT MIN(tile_column), MAX(tile_column), MIN(tile_row), MAX(tile_row) FROM tiles WHERE zoom_level = ?;",
+                           -1, &stmt, NULL) == SQLITE_OK)
+    {
+        sqlite3_bind_int(stmt, 1, max_z);
+        
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const uint32_t z = (uint32_t)max_z;
+            
+            snprintf(value, sizeof(value), "%.6f,%.6f,%.6f,%.6f",
+                     _gbMBTiles_TileToLon((double)sqlite3_column_int(stmt, 0),       z),
+                     _gbMBTiles_TileToLat((double)sqlite3_column_int(stmt, 2),       z),
+                     _gbMBTiles_TileToLon((double)sqlite3_column_int(stmt, 1) + 1.0, z),
+                     _gbMBTiles_TileToLat((double)sqlite3_column_int(stmt, 3) + 1.0, z));
+            
+            _gbMBTiles_SetMetadata(mbt, "bounds", value, true);
+        }//if
+    }//if
+    
+    sqlite3_finalize(stmt);
+}//_gbMBTiles_UpdateMetadata
+
+
+
+
+// ================
+// gbMBTiles_Close:
+// ================
+//
+// Writes every tile still queued, updates the metadata and closes the file.
+// Returns false if any tile could not be written.
+//
+bool gbMBTiles_Close(gbMBTiles* mbt)
+{
+    if (mbt == NULL)
+    {
+        return true;
+    }//if
+    
+    pthread_mutex_lock(&mbt->mutex);
+    mbt->isClosing = true;
+    pthread_cond_signal(&mbt->hasWork);
+    pthread_mutex_unlock(&mbt->mutex);
+    
+    pthread_join(mbt->thread, NULL);
+    
+    _gbMBTiles_UpdateMetadata(mbt);
+    
+    printf("gbMBTiles: %zu tiles written to [%s]%s.\n", mbt->written_n, mbt->path, mbt->error_n > 0 ? ", with errors" : "");
+    
+    const bool isOK = mbt->error_n == 0;
+    
+    sqlite3_finalize(mbt->insertStmt);
+    sqlite3_close(mbt->db);
+    
+    pthread_mutex_destroy(&mbt->mutex);
+    pthread_cond_destroy (&mbt->hasWork);
+    pthread_cond_destroy (&mbt->hasSpace);
+    
+    free(mbt->queue);
+    free(mbt->batch);
+    free(mbt);
+    
+    return isOK;
+}//gbMBTiles_Close
+
+
+
+
+// ================
+// gbMBTilesReader:
+// ================
+//
+// Reads tiles back out of an MBTiles file, for use as a source level.
+//
+// A SQLite connection must not be used by two threads at once, so the reader
+// keeps a small pool of read-only connections, each with its lookup prepared,
+// and a thread takes one for the duration of a read.  Reads are point
+// lookups on the (zoom_level, tile_column, tile_row) index, in whatever order
+// they are asked for; for Retile, that is quadkey order, which keeps them
+// local in the file.
+//
+#define kGB_MBTiles_ReaderConnN 8
+
+typedef struct gbMBTilesReader_Conn
+{
+    sqlite3*      db;
+    sqlite3_stmt* readStmt;
+    bool          isBusy;
+} gbMBTilesReader_Conn;
+
+struct gbMBTilesReader
+{
+    gbMBTilesReader_Conn conns[kGB_MBTiles_ReaderConnN];
+    char                 path[1024];
+    pthread_mutex_t      mutex;
+    pthread_cond_t       hasFree;
+};
+
+
+
+
+// =====================
+// gbMBTilesReader_Open:
+// =====================
+//
+// Opens the MBTiles file at path read-only.  Returns NULL if it could not be
+// opened or has no tiles table.
+//
+gbMBTilesReader* gbMBTilesReader_Open(const char* path)
+{
+    gbMBTilesReader* r = malloc(sizeof(gbMBTilesReader));
+    
+    memset(r, 0, sizeof(gbMBTilesReader));
+    
+    snprintf(r->path, sizeof(r->path), "%s", path);
+    
+    pthread_mutex_init(&r->mutex,   NULL);
+    pthread_cond_init (&r->hasFree, NULL);
+    
+    for (size_t i = 0; i < kGB_MBTiles_ReaderConnN; i++)
+    {
+        gbMBTilesReader_Conn* conn = &(r->conns[i]);
+        
+        if (sqlite3_open_v2(path, &conn->db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK
+            || sqlite3_prepare_v2(conn->db, "SELECT tile_data FROM tiles WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?;",
+                                  -1, &conn->readStmt, NULL) != SQLITE_OK)
+        {
+            printf("gbMBTilesReader_Open: [ERR] Could not open [%s]: %s\n", path, sqlite3_errmsg(conn->db));
+            gbMBTilesReader_Close(r);
+            return NULL;
+        }//if
+        
+        sqlite3_busy_timeout(conn->db, kGB_MBTiles_BusyTimeoutMS);
+    }//for
+    
+    return r;
+}//gbMBTilesReader_Open
+
+
+// Highest zoom level with any tiles, or -1 if there are none.
+int gbMBTilesReader_GetMaxZ(gbMBTilesReader* r)
+{
+    sqlite3_stmt* stmt  = NULL;
+    int           max_z = -1;
+    
+    if (sqlite3_prepare_v2(r->conns[0].db, "SELECT MAX(zoom_level) FROM tiles;", -1, &stmt, NULL) == SQLITE_OK
+        && sqlite3_step(stmt) == SQLITE_ROW
+        && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+    {
+        max_z = sqlite3_column_int(stmt, 0);
+    }//if
+    
+    sqlite3_finalize(stmt);
+    
+    return max_z;
+}//gbMBTilesReader_GetMaxZ
+
+
+
+
+// ==========================
+// gbMBTilesReader_ScanLevel:
+// ==========================
+//
+// Calls fn for each tile of zoom level z, and returns how many there were.
+// Only the index is read, not the tile data.  Not thread safe.
+//
+size_t gbMBTilesReader_ScanLevel(gbMBTilesReader*       r,
+                                 const uint32_t         z,
+                                 gbMBTiles_TileFunction fn,
+                                 void*                  ctx)
+{
+    sqlite3_stmt* stmt = NULL;
+    size_t        n    = 0;
+    
+    if (sqlite3_prepare_v2(r->conns[0].db, "SELECT tile_column, tile_row FROM tiles WHERE zoom_level = ?;", -1, &stmt, NULL) != SQLITE_OK)
+    {
+        printf("gbMBTilesReader_ScanLevel: [ERR] %s\n", sqlite3_errmsg(r->conns[0].db));
+        return 0;
+    }//if
+    
+    sqlite3_bind_int(stmt, 1, (int)z);
+    
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const uint32_t x     = (uint32_t)sqlite3_column_int(stmt, 0);
+        const uint32_t tms_y = (uint32_t)sqlite3_column_int(stmt, 1);
+        
+        fn(x, (uint32_t)((1ULL << z) - 1ULL - tms_y), z, ctx);
+        n++;
+    }//while
+    
+    sqlite3_finalize(stmt);
+    
+    return n;
+}//gbMBTilesReader_ScanLevel
+
+
+
+
+// =====================
+// gbMBTilesReader_Read:
+// =====================
+//
+// Returns a malloc'd copy of the data of tile (x, y, z), in XYZ coordinates,
+// or NULL if there is no such tile.  Thread safe.  Blocks while every
+// connection is in use.
+//
+uint8_t* gbMBTilesReader_Read(gbMBTilesReader* r,
+                              const uint32_t   x,
+                              const uint32_t   y,
+                              const uint32_t   z,
+                              size_t*          png_n)
+{
+    gbMBTilesReader_Conn* conn = NULL;
+    uint8_t*              png  = NULL;
+    
+    *png_n = 0;
+    
+    pthread_mutex_lock(&r->mutex);
+    
+    while (conn == NULL)
+    {
+        for (size_t i = 0; i < kGB_MBTiles_ReaderConnN && conn == NULL; i++)
+        {
+            conn = !r->conns[i].isBusy ? &(r->conns[i]) : NULL;
+        }//for
+        
+        if (conn == NULL)
+        {
+            pthread_cond_wait(&r->hasFree, &r->mutex);
+        }//if
+    }//while
+    
+    conn->isBusy = true;
+    
+    pthread_mutex_unlock(&r->mutex);
+    
+    sqlite3_bind_int(conn->readStmt, 1, (int)z);
+    sqlite3_bind_int(conn->readStmt, 2, (int)x);
+    sqlite3_bind_int(conn->readStmt, 3, (int)((1ULL << z) - 1ULL - y));
+    
+    const int rc = sqlite3_step(conn->readStmt);
+    
+    if (rc == SQLITE_ROW)
+    {
+        const int n = sqlite3_column_bytes(conn->readStmt, 0);
+        
+        if (n > 0)
+        {
+            png    = malloc((size_t)n);
+            *png_n = (size_t)n;
+            
+            memcpy(png, sqlite3_column_blob(conn->readStmt, 0), (size_t)n);
+        }//if
+    }//if
+    else if (rc != SQLITE_DONE)
+    {
+        printf("gbMBTilesReader_Read: [ERR] (%u, %u, %u): %s\n", x, y, z, sqlite3_errmsg(conn->db));
+    }//else if
+    
+    sqlite3_reset(conn->readStmt);
+    
+    pthread_mutex_lock(&r->mutex);
+    conn->isBusy = false;
+    pthread_cond_signal(&r->hasFree);
+    pthread_mutex_unlock(&r->mutex);
+    
+    return png;
+}//gbMBTilesReader_Read
+
+
+void gbMBTilesReader_Close(gbMBTilesReader* r)
+{
+    if (r == NULL)
+    {
+        return;
+    }//if
+    
+    for (size_t i = 0; i < kGB_MBTiles_ReaderConnN; i++)
+    {
+        sqlite3_finalize(r->conns[i].readStmt);
+        sqlite3_close(r->conns[i].db);
+    }//for
+    
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy (&r->hasFree);
+    
+    free(r);
+}//gbMBTilesReader_Close
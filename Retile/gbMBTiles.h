@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+#include "sqlite3.h"
+
+#ifndef gbMBTiles_h
+#define gbMBTiles_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+typedef struct gbMBTiles gbMBTiles;
+
+gbMBTiles* gbMBTiles_Open(const char* path);
+
+void gbMBTiles_Put(gbMBTiles*     mbt,
+                   const uint32_t x,
+                   const uint32_t y,
+                   const uint32_t z,
+                   uint8_t*       png,
+                   const size_t   png_n);
+
+bool gbMBTiles_Close(gbMBTiles* mbt);
+
+typedef struct gbMBTilesReader gbMBTilesReader;
+
+// Receives each tile of a level, in XYZ coordinates.
+typedef void (*gbMBTiles_TileFunction)(const uint32_t x,
+                                       const uint32_t y,
+                                       const uint32_t z,
+                                       void*          ctx);
+
+gbMBTilesReader* gbMBTilesReader_Open(const char* path);
+
+int gbMBTilesReader_GetMaxZ(gbMBTilesReader* r);
+
+size_t gbMBTilesReader_ScanLevel(gbMBTilesReader*       r,
+                                 const uint32_t         z,
+                                 gbMBTiles_TileFunction fn,
+                                 void*                  ctx);
+
+uint8_t* gbMBTilesReader_Read(gbMBTilesReader* r,
+                              const uint32_t   x,
+                              const uint32_t   y,
+                              const uint32_t   z,
+                              size_t*          png_n);
+
+void gbMBTilesReader_Close(gbMBTilesReader* r);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,760 @@
+#include "gbPMTiles.h"
+
+// ============
+// gbPMTiles.c:
+// ============
+//
+// Writes tiles into a PMTiles (v3) archive: one file, laid out so it can be
+// served by range requests straight from static storage.
+// (https://github.com/protomaps/PMTiles/blob/main/spec/v3/spec.md)
+//
+// The archive can only be written once every tile is known, so it is built
+// in two steps:
+//
+// 1. gbPMTiles_Put, from any thread, appends each tile to a spool file next
+//    to the archive as it is encoded.  Tiles are hashed first, outside the
+//    lock, and a tile identical to one already spooled is only recorded, not
+//    written again.  Overlays have huge numbers of identical transparent or
+//    solid tiles, so this is most of them.
+//
+// 2. gbPMTiles_Close sorts the tiles by Hilbert tile ID, run-length encodes
+//    consecutive IDs with the same content, builds the gzipped root and leaf
+//    directories, and writes the archive in a single sequential pass, copying
+//    the tile data out of the spool in tile ID order.  The spool is then
+//    deleted.
+//
+// The tile data is clustered: each distinct tile is stored once, at the
+// position of its first tile ID.
+//
+// Unlike gbMBTiles, an existing archive is replaced, not added to.
+//
+
+#define kGB_PMTiles_HeaderN        127
+#define kGB_PMTiles_RootMaxN       (16384 - kGB_PMTiles_HeaderN)
+#define kGB_PMTiles_LeafMinN       4096
+#define kGB_PMTiles_Compression    2                // gzip, for the directories and metadata
+#define kGB_PMTiles_TileTypePNG    2
+
+typedef struct gbPMTiles_Content
+{
+    uint64_t hash_hi;
+    uint64_t hash_lo;
+    uint64_t spool_offset;
+    uint64_t offset;                                // in the tile data, UINT64_MAX until placed
+    uint32_t length;
+} gbPMTiles_Content;
+
+typedef struct gbPMTiles_Entry
+{
+    uint64_t tile_id;
+    uint32_t content_i;
+    uint32_t seq;                                   // so a tile written again replaces the first
+} gbPMTiles_Entry;
+
+typedef struct gbPMTiles_DirEntry
+{
+    uint64_t tile_id;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t run_length;                            // 0: offset and length are of a leaf directory
+    uint32_t content_i;                             // not serialized
+} gbPMTiles_DirEntry;
+
+typedef struct gbPMTiles_Buffer
+{
+    uint8_t* data;
+    size_t   n;
+    size_t   max;
+} gbPMTiles_Buffer;
+
+struct gbPMTiles
+{
+    char               path     [1024];
+    char               spoolPath[1040];
+    FILE*              spool;
+    uint64_t           spool_n;
+    pthread_mutex_t    mutex;
+    
+    gbPMTiles_Content* contents;
+    size_t             content_n;
+    size_t             content_max;
+    uint32_t*          slots;                       // content_i + 1, 0 is empty
+    size_t             slot_n;
+    
+    gbPMTiles_Entry*   entries;
+    size_t             entry_n;
+    size_t             entry_max;
+    
+    uint32_t           min_x[32];                   // bounds of each zoom level
+    uint32_t           min_y[32];
+    uint32_t           max_x[32];
+    uint32_t           max_y[32];
+    
+    size_t             error_n;
+};
+
+
+
+
+// =====================
+// _gbPMTiles_GetTileId:
+// =====================
+//
+// PMTiles tile ID: the tiles of every lower zoom level, then the position
+// along the Hilbert curve that covers zoom level z.
+//
+static uint64_t _gbPMTiles_GetTileId(const uint32_t x,
+                                     const uint32_t y,
+                                     const uint32_t z)
+{
+    uint64_t id = ((1ULL << (2 * z)) - 1ULL) / 3ULL;
+    uint64_t tx = x;
+    uint64_t ty = y;
+    
+    for (uint64_t s = (1ULL << z) >> 1; s > 0; s >>= 1)
+    {
+        const uint64_t rx = (tx & s) > 0 ? 1 : 0;
+        const uint64_t ry = (ty & s) > 0 ? 1 : 0;
+        
+        id += s * s * ((3ULL * rx) ^ ry);
+        
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                tx = s - 1 - (tx & (s - 1));
+                ty = s - 1 - (ty & (s - 1));
+            }//if
+            
+            const uint64_t t = tx;
+            
+            tx = ty;
+            ty = t;
+        }//if
+    }//for
+    
+    return id;
+}//_gbPMTiles_GetTileId
+
+
+// FNV-1a, 128 bit.  Identical tiles are matched on hash and length alone.
+static void _gbPMTiles_Hash(const uint8_t* src,
+                            const size_t   src_n,
+                            uint64_t*      hash_hi,
+                            uint64_t*      hash_lo)
+{
+    const __uint128_t prime = ((__uint128_t)0x0000000001000000ULL << 64) | 0x000000000000013BULL;
+    __uint128_t       h     = ((__uint128_t)0x6C62272E07BB0142ULL << 64) | 0x62B821756295C58DULL;
+    
+    for (size_t i = 0; i < src_n; i++)
+    {
+        h ^= src[i];
+        h *= prime;
+    }//for
+    
+    *hash_hi = (uint64_t)(h >> 64);
+    *hash_lo = (uint64_t)h;
+}//_gbPMTiles_Hash
+
+
+
+
+static void _gbPMTiles_Buffer_Reserve(gbPMTiles_Buffer* b,
+                                      const size_t      add_n)
+{
+    if (b->n + add_n > b->max)
+    {
+        b->max  = (b->n + add_n) * 2;
+        b->data = realloc(b->data, b->max);
+    }//if
+}//_gbPMTiles_Buffer_Reserve
+
+
+static void _gbPMTiles_Buffer_AppendVarint(gbPMTiles_Buffer* b,
+                                           uint64_t          v)
+{
+    _gbPMTiles_Buffer_Reserve(b, 10);
+    
+    while (v >= 0x80)
+    {
+        b->data[b->n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }//while
+    
+    b->data[b->n++] = (uint8_t)v;
+}//_gbPMTiles_Buffer_AppendVarint
+
+
+static void _gbPMTiles_Buffer_Append(gbPMTiles_Buffer* b,
+                                     const uint8_t*    src,
+                                     const size_t      src_n)
+{
+    _gbPMTiles_Buffer_Reserve(b, src_n);
+    memcpy(b->data + b->n, src, src_n);
+    b->n += src_n;
+}//_gbPMTiles_Buffer_Append
+
+
+static uint8_t* _gbPMTiles_Gzip(const uint8_t* src,
+                                const size_t   src_n,
+                                size_t*        dest_n)
+{
+    z_stream zs;
+    
+    memset(&zs, 0, sizeof(z_stream));
+    
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        *dest_n = 0;
+        return NULL;
+    }//if
+    
+    const size_t dest_max = deflateBound(&zs, (uLong)src_n);
+    uint8_t*     dest     = malloc(dest_max);
+    
+    zs.next_in   = (Bytef*)src;
+    zs.avail_in  = (uInt)src_n;
+    zs.next_out  = dest;
+    zs.avail_out = (uInt)dest_max;
+    
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+    {
+        free(dest);
+        dest = NULL;
+    }//if
+    
+    *dest_n = dest != NULL ? (size_t)zs.total_out : 0;
+    
+    deflateEnd(&zs);
+    
+    return dest;
+}//_gbPMTiles_Gzip
+
+
+// ========================
+// _gbPMTiles_SerializeDir:
+// ========================
+//
+// Encodes a directory as the spec lays it out, column by column: the delta
+// encoded tile IDs, then run lengths, lengths and offsets.  An offset that
+// follows directly on the previous entry is written as 0, else as offset + 1.
+// Returns the gzipped result.
+//
+static uint8_t* _gbPMTiles_SerializeDir(const gbPMTiles_DirEntry* dir,
+                                        const size_t              dir_n,
+                                        size_t*                   dest_n)
+{
+    gbPMTiles_Buffer b       = { NULL, 0, 0 };
+    uint64_t         last_id = 0;
+    
+    _gbPMTiles_Buffer_AppendVarint(&b, dir_n);
+    
+    for (size_t i = 0; i < dir_n; i++)
+    {
+        _gbPMTiles_Buffer_AppendVarint(&b, dir[i].tile_id - last_id);
+        last_id = dir[i].tile_id;
+    }//for
+    
+    for (size_t i = 0; i < dir_n; i++)
+    {
+        _gbPMTiles_Buffer_AppendVarint(&b, dir[i].run_length);
+    }//for
+    
+    for (size_t i = 0; i < dir_n; i++)
+    {
+        _gbPMTiles_Buffer_AppendVarint(&b, dir[i].length);
+    }//for
+    
+    for (size_t i = 0; i < dir_n; i++)
+    {
+        const bool isNext = i > 0 && dir[i].offset == dir[i - 1].offset + dir[i - 1].length;
+        
+        _gbPMTiles_Buffer_AppendVarint(&b, isNext ? 0 : dir[i].offset + 1);
+    }//for
+    
+    uint8_t* dest = _gbPMTiles_Gzip(b.data, b.n, dest_n);
+    
+    free(b.data);
+    
+    return dest;
+}//_gbPMTiles_SerializeDir
+
+
+// =====================
+// _gbPMTiles_BuildDirs:
+// =====================
+//
+// The root directory has to fit in the first 16 KiB along with the header.
+// If every entry does not, they are split into leaf directories of leaf_n
+// entries, with one root entry per leaf, and leaf_n is grown until the root
+// fits.  Returns the root; the leaves are appended to leaves.
+//
+static uint8_t* _gbPMTiles_BuildDirs(const gbPMTiles_DirEntry* dir,
+                                     const size_t              dir_n,
+                                     size_t*                   root_n,
+                                     gbPMTiles_Buffer*         leaves)
+{
+    uint8_t* root = _gbPMTiles_SerializeDir(dir, dir_n, root_n);
+    
+    if (root == NULL || *root_n <= kGB_PMTiles_RootMaxN)
+    {
+        return root;
+    }//if
+    
+    double leaf_n = (double)dir_n / 3500.0;
+    
+    leaf_n = leaf_n > kGB_PMTiles_LeafMinN ? leaf_n : kGB_PMTiles_LeafMinN;
+    
+    while (root != NULL && *root_n > kGB_PMTiles_RootMaxN)
+    {
+        free(root);
+        
+        const size_t        per_leaf = (size_t)leaf_n;
+        const size_t        rdir_n   = (dir_n + per_leaf - 1) / per_leaf;
+        gbPMTiles_DirEntry* rdir     = malloc(sizeof(gbPMTiles_DirEntry) * rdir_n);
+        
+        leaves->n = 0;
+        
+        for (size_t i = 0; i < rdir_n; i++)
+        {
+            const size_t start  = i * per_leaf;
+            const size_t end    = start + per_leaf < dir_n ? start + per_leaf : dir_n;
+            size_t       leaf_z = 0;
+            uint8_t*     leaf   = _gbPMTiles_SerializeDir(&(dir[start]), end - start, &leaf_z);
+            
+            rdir[i].tile_id    = dir[start].tile_id;
+            rdir[i].offset     = leaves->n;
+            rdir[i].length     = (uint32_t)leaf_z;
+            rdir[i].run_length = 0;
+            rdir[i].content_i  = 0;
+            
+            _gbPMTiles_Buffer_Append(leaves, leaf, leaf_z);
+            free(leaf);
+        }//for
+        
+        root    = _gbPMTiles_SerializeDir(rdir, rdir_n, root_n);
+        leaf_n *= 1.2;
+        
+        free(rdir);
+    }//while
+    
+    return root;
+}//_gbPMTiles_BuildDirs
+
+
+
+
+// ===============
+// gbPMTiles_Open:
+// ===============
+//
+// Creates the spool file for the archive at path.  Returns NULL if it could
+// not be created.
+//
+gbPMTiles* gbPMTiles_Open(const char* path)
+{
+    gbPMTiles* pmt = malloc(sizeof(gbPMTiles));
+    
+    memset(pmt, 0, sizeof(gbPMTiles));
+    
+    snprintf(pmt->path,      sizeof(pmt->path),      "%s",       path);
+    snprintf(pmt->spoolPath, sizeof(pmt->spoolPath), "%s.spool", path);
+    
+    if ((pmt->spool = fopen(pmt->spoolPath, "w+b")) == NULL)
+    {
+        printf("gbPMTiles_Open: [ERR] Could not create spool file [%s].\n", pmt->spoolPath);
+        free(pmt);
+        return NULL;
+    }//if
+    
+    pmt->slot_n = 1 << 16;
+    pmt->slots  = calloc(pmt->slot_n, sizeof(uint32_t));
+    
+    for (size_t z = 0; z < 32; z++)
+    {
+        pmt->min_x[z] = UINT32_MAX;
+        pmt->min_y[z] = UINT32_MAX;
+    }//for
+    
+    pthread_mutex_init(&pmt->mutex, NULL);
+    
+    return pmt;
+}//gbPMTiles_Open
+
+
+
+
+// Open addressing on the hash.  Returns a pointer to the slot holding the
+// content, or to the empty slot where it belongs.
+static uint32_t* _gbPMTiles_FindSlot(gbPMTiles*     pmt,
+                                     const uint64_t hash_hi,
+                                     const uint64_t hash_lo,
+                                     const uint32_t length)
+{
+    const size_t mask = pmt->slot_n - 1;
+    
+    for (size_t i = (size_t)hash_lo & mask; ; i = (i + 1) & mask)
+    {
+        if (pmt->slots[i] == 0)
+        {
+            return &(pmt->slots[i]);
+        }//if
+        
+        const gbPMTiles_Content* c = &(pmt->contents[pmt->slots[i] - 1]);
+        
+        if (c->hash_hi == hash_hi && c->hash_lo == hash_lo && c->length == length)
+        {
+            return &(pmt->slots[i]);
+        }//if
+    }//for
+}//_gbPMTiles_FindSlot
+
+
+static void _gbPMTiles_GrowSlots(gbPMTiles* pmt)
+{
+    free(pmt->slots);
+    
+    pmt->slot_n *= 2;
+    pmt->slots   = calloc(pmt->slot_n, sizeof(uint32_t));
+    
+    for (size_t i = 0; i < pmt->content_n; i++)
+    {
+        const gbPMTiles_Content* c = &(pmt->contents[i]);
+        
+        *_gbPMTiles_FindSlot(pmt, c->hash_hi, c->hash_lo, c->length) = (uint32_t)(i + 1);
+    }//for
+}//_gbPMTiles_GrowSlots
+
+
+
+
+// ==============
+// gbPMTiles_Put:
+// ==============
+//
+// Adds a tile, which is spooled unless an identical one already was.  Takes
+// ownership of png and frees it.  Thread safe.
+//
+void gbPMTiles_Put(gbPMTiles*     pmt,
+                   const uint32_t x,
+                   const uint32_t y,
+                   const uint32_t z,
+                   uint8_t*       png,
+                   const size_t   png_n)
+{
+    const uint64_t tile_id = _gbPMTiles_GetTileId(x, y, z);
+    uint64_t       hash_hi;
+    uint64_t       hash_lo;
+    
+    _gbPMTiles_Hash(png, png_n, &hash_hi, &hash_lo);
+    
+    pthread_mutex_lock(&pmt->mutex);
+    
+    uint32_t* slot = _gbPMTiles_FindSlot(pmt, hash_hi, hash_lo, (uint32_t)png_n);
+    
+    if (*slot == 0)
+    {
+        if (fwrite(png, 1, png_n, pmt->spool) != png_n)
+        {
+            printf("gbPMTiles_Put: [ERR] Could not spool (%u, %u, %u) to [%s].\n", x, y, z, pmt->spoolPath);
+            pmt->error_n++;
+            pthread_mutex_unlock(&pmt->mutex);
+            free(png);
+            return;
+        }//if
+        
+        if (pmt->content_n == pmt->content_max)
+        {
+            pmt->content_max = pmt->content_max > 0 ? pmt->content_max * 2 : 4096;
+            pmt->contents    = realloc(pmt->contents, sizeof(gbPMTiles_Content) * pmt->content_max);
+        }//if
+        
+        gbPMTiles_Content* c = &(pmt->contents[pmt->content_n++]);
+        
+        c->hash_hi      = hash_hi;
+        c->hash_lo      = hash_lo;
+        c->spool_offset = pmt->spool_n;
+        c->offset       = UINT64_MAX;
+        c->length       = (uint32_t)png_n;
+        
+        pmt->spool_n += png_n;
+        *slot         = (uint32_t)pmt->content_n;
+        
+        if (pmt->content_n * 2 > pmt->slot_n)
+        {
+            _gbPMTiles_GrowSlots(pmt);
+            slot = _gbPMTiles_FindSlot(pmt, hash_hi, hash_lo, (uint32_t)png_n);
+        }//if
+    }//if
+    
+    if (pmt->entry_n == pmt->entry_max)
+    {
+        pmt->entry_max = pmt->entry_max > 0 ? pmt->entry_max * 2 : 4096;
+        pmt->entries   = realloc(pmt->entries, sizeof(gbPMTiles_Entry) * pmt->entry_max);
+    }//if
+    
+    gbPMTiles_Entry* e = &(pmt->entries[pmt->entry_n]);
+    
+    e->tile_id   = tile_id;
+    e->content_i = *slot - 1;
+    e->seq       = (uint32_t)pmt->entry_n++;
+    
+    pmt->min_x[z] = x < pmt->min_x[z] ? x : pmt->min_x[z];
+    pmt->min_y[z] = y < pmt->min_y[z] ? y : pmt->min_y[z];
+    pmt->max_x[z] = x > pmt->max_x[z] ? x : pmt->max_x[z];
+    pmt->max_y[z] = y > pmt->max_y[z] ? y : pmt->max_y[z];
+    
+    pthread_mutex_unlock(&pmt->mutex);
+    
+    free(png);
+}//gbPMTiles_Put
+
+
+
+
+static int _gbPMTiles_CompareEntry(const void* a,
+                                   const void* b)
+{
+    const gbPMTiles_Entry* ea = (const gbPMTiles_Entry*)a;
+    const gbPMTiles_Entry* eb = (const gbPMTiles_Entry*)b;
+    
+    return ea->tile_id < eb->tile_id ? -1 : ea->tile_id > eb->tile_id ? 1
+         : ea->seq     < eb->seq     ? -1 : ea->seq     > eb->seq     ? 1 : 0;
+}//_gbPMTiles_CompareEntry
+
+
+static inline void _gbPMTiles_PutU64(uint8_t* dest, const uint64_t v) { for (int i = 0; i < 8; i++) { dest[i] = (uint8_t)(v >> (i * 8)); } }
+static inline void _gbPMTiles_PutI32(uint8_t* dest, const int32_t  v) { for (int i = 0; i < 4; i++) { dest[i] = (uint8_t)((uint32_t)v >> (i * 8)); } }
+
+// Tile edge -> degrees * 10^7.  y is an XYZ row.
+static inline int32_t _gbPMTiles_TileToLonE7(const double x, const uint32_t z) { return (int32_t)round((x / (double)(1ULL << z) * 360.0 - 180.0) * 1.0e7); }
+static inline int32_t _gbPMTiles_TileToLatE7(const double y, const uint32_t z)
+{
+    const double n = M_PI - 2.0 * M_PI * y / (double)(1ULL << z);
+    
+    return (int32_t)round(180.0 / M_PI * atan(0.5 * (exp(n) - exp(-n))) * 1.0e7);
+}//_gbPMTiles_TileToLatE7
+
+
+// ==================
+// _gbPMTiles_Header:
+// ==================
+//
+// Fills in the 127 byte header.  min_z is -1 for an empty archive.
+//
+static void _gbPMTiles_Header(const gbPMTiles* pmt,
+                              uint8_t*         h,
+                              const uint64_t*  section,         // root, metadata, leaves, data: offset, length
+                              const uint64_t   addressed_n,
+                              const uint64_t   dir_n,
+                              const int        min_z,
+                              const int        max_z)
+{
+    memset(h, 0, kGB_PMTiles_HeaderN);
+    memcpy(h, "PMTiles", 7);
+    
+    h[7] = 3;
+    
+    for (int i = 0; i < 8; i++)
+    {
+        _gbPMTiles_PutU64(h + 8 + i * 8, section[i]);
+    }//for
+    
+    _gbPMTiles_PutU64(h + 72, addressed_n);
+    _gbPMTiles_PutU64(h + 80, dir_n);
+    _gbPMTiles_PutU64(h + 88, pmt->content_n);
+    
+    h[96] = 1;                                      // clustered
+    h[97] = kGB_PMTiles_Compression;
+    h[98] = 1;                                      // PNG, no further compression
+    h[99] = kGB_PMTiles_TileTypePNG;
+    
+    if (min_z < 0)
+    {
+        return;
+    }//if
+    
+    const uint32_t z       = (uint32_t)max_z;
+    const int32_t  min_lon = _gbPMTiles_TileToLonE7((double)pmt->min_x[z],       z);
+    const int32_t  max_lon = _gbPMTiles_TileToLonE7((double)pmt->max_x[z] + 1.0, z);
+    const int32_t  min_lat = _gbPMTiles_TileToLatE7((double)pmt->max_y[z] + 1.0, z);
+    const int32_t  max_lat = _gbPMTiles_TileToLatE7((double)pmt->min_y[z],       z);
+    
+    h[100] = (uint8_t)min_z;
+    h[101] = (uint8_t)max_z;
+    
+    _gbPMTiles_PutI32(h + 102, min_lon);
+    _gbPMTiles_PutI32(h + 106, min_lat);
+    _gbPMTiles_PutI32(h + 110, max_lon);
+    _gbPMTiles_PutI32(h + 114, max_lat);
+    
+    h[118] = (uint8_t)min_z;
+    
+    _gbPMTiles_PutI32(h + 119, (int32_t)(((int64_t)min_lon + max_lon) / 2));
+    _gbPMTiles_PutI32(h + 123, (int32_t)(((int64_t)min_lat + max_lat) / 2));
+}//_gbPMTiles_Header
+
+
+
+
+// ================
+// gbPMTiles_Close:
+// ================
+//
+// Writes the archive and deletes the spool.  Every gbPMTiles_Put must have
+// returned.  Returns false if any tile or the archive could not be written.
+//
+bool gbPMTiles_Close(gbPMTiles* pmt)
+{
+    if (pmt == NULL)
+    {
+        return true;
+    }//if
+    
+    qsort(pmt->entries, pmt->entry_n, sizeof(gbPMTiles_Entry), _gbPMTiles_CompareEntry);
+    
+    // Keep the last write of each tile ID, place each content at its first
+    // tile ID, and run-length encode.
+    
+    gbPMTiles_DirEntry* dir         = malloc(sizeof(gbPMTiles_DirEntry) * (pmt->entry_n > 0 ? pmt->entry_n : 1));
+    size_t              dir_n       = 0;
+    uint64_t            data_n      = 0;
+    uint64_t            addressed_n = 0;
+    int                 min_z       = -1;
+    int                 max_z       = -1;
+    
+    for (size_t i = 0; i < pmt->entry_n; i++)
+    {
+        if (i + 1 < pmt->entry_n && pmt->entries[i + 1].tile_id == pmt->entries[i].tile_id)
+        {
+            continue;
+        }//if
+        
+        gbPMTiles_Content* c = &(pmt->contents[pmt->entries[i].content_i]);
+        
+        if (c->offset == UINT64_MAX)
+        {
+            c->offset  = data_n;
+            data_n    += c->length;
+        }//if
+        
+        gbPMTiles_DirEntry* last = dir_n > 0 ? &(dir[dir_n - 1]) : NULL;
+        
+        if (last != NULL && last->tile_id + last->run_length == pmt->entries[i].tile_id && last->offset == c->offset)
+        {
+            last->run_length++;
+        }//if
+        else
+        {
+            dir[dir_n].tile_id    = pmt->entries[i].tile_id;
+            dir[dir_n].offset     = c->offset;
+            dir[dir_n].length     = c->length;
+            dir[dir_n].run_length = 1;
+            dir[dir_n].content_i  = pmt->entries[i].content_i;
+            dir_n++;
+        }//else
+        
+        addressed_n++;
+    }//for
+    
+    for (int z = 0; z < 32; z++)
+    {
+        if (pmt->min_x[z] != UINT32_MAX)
+        {
+            min_z = min_z < 0 ? z : min_z;
+            max_z = z;
+        }//if
+    }//for
+    
+    gbPMTiles_Buffer leaves = { NULL, 0, 0 };
+    size_t           root_n = 0;
+    uint8_t*         root   = _gbPMTiles_BuildDirs(dir, dir_n, &root_n, &leaves);
+    
+    const char* slash = strrchr(pmt->path, '/');
+    char        name[256];
+    char        json[512];
+    
+    snprintf(name, sizeof(name), "%.*s", (int)sizeof(name) - 1, slash != NULL ? slash + 1 : pmt->path);
+    
+    for (char* s = name; *s != '\0'; s++)
+    {
+        *s = *s == '.' ? '\0' : *s == '"' || *s == '\\' ? '_' : *s;
+    }//for
+    
+    snprintf(json, sizeof(json), "{\"name\":\"%s\",\"format\":\"png\"}", name);
+    
+    size_t   meta_n = 0;
+    uint8_t* meta   = _gbPMTiles_Gzip((const uint8_t*)json, strlen(json), &meta_n);
+    uint64_t section[8];
+    uint8_t  header[kGB_PMTiles_HeaderN];
+    
+    section[0] = kGB_PMTiles_HeaderN;                   section[1] = root_n;
+    section[2] = section[0] + section[1];               section[3] = meta_n;
+    section[4] = section[2] + section[3];               section[5] = leaves.n;
+    section[6] = section[4] + section[5];               section[7] = data_n;
+    
+    _gbPMTiles_Header(pmt, header, section, addressed_n, dir_n, min_z, max_z);
+    
+    FILE* fp   = root != NULL && meta != NULL ? fopen(pmt->path, "wb") : NULL;
+    bool  isOK = fp != NULL
+              && fwrite(header, 1, kGB_PMTiles_HeaderN, fp) == kGB_PMTiles_HeaderN
+              && fwrite(root,   1, root_n,              fp) == root_n
+              && fwrite(meta,   1, meta_n,              fp) == meta_n
+              && (leaves.n == 0 || fwrite(leaves.data, 1, leaves.n, fp) == leaves.n);
+    
+    // Tile data, each content where it was placed above, in tile ID order.
+    
+    fflush(pmt->spool);
+    
+    uint8_t* buf     = NULL;
+    size_t   buf_max = 0;
+    uint64_t done_n  = 0;
+    
+    for (size_t i = 0; i < dir_n && isOK; i++)
+    {
+        if (dir[i].offset != done_n)
+        {
+            continue;                               // stored already, at an earlier tile ID
+        }//if
+        
+        if (dir[i].length > buf_max)
+        {
+            buf_max = dir[i].length;
+            buf     = realloc(buf, buf_max);
+        }//if
+        
+        const gbPMTiles_Content* c = &(pmt->contents[dir[i].content_i]);
+        
+        isOK    = pread(fileno(pmt->spool), buf, c->length, (off_t)c->spool_offset) == (ssize_t)c->length
+               && fwrite(buf, 1, c->length, fp) == c->length;
+        done_n += c->length;
+    }//for
+    
+    isOK = fp != NULL && fclose(fp) == 0 && isOK && pmt->error_n == 0;
+    
+    if (isOK)
+    {
+        printf("gbPMTiles: %zu tiles, %zu distinct, written to [%s].\n", (size_t)addressed_n, pmt->content_n, pmt->path);
+    }//if
+    else
+    {
+        printf("gbPMTiles_Close: [ERR] Could not write [%s].\n", pmt->path);
+    }//else
+    
+    fclose(pmt->spool);
+    remove(pmt->spoolPath);
+    
+    pthread_mutex_destroy(&pmt->mutex);
+    
+    free(buf);
+    free(meta);
+    free(root);
+    free(leaves.data);
+    free(dir);
+    free(pmt->slots);
+    free(pmt->contents);
+    free(pmt->entries);
+    free(pmt);
+    
+    return isOK;
+}//gbPMTiles_Close
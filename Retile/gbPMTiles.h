@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#ifndef gbPMTiles_h
+#define gbPMTiles_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+typedef struct gbPMTiles gbPMTiles;
+
+gbPMTiles* gbPMTiles_Open(const char* path);
+
+void gbPMTiles_Put(gbPMTiles*     pmt,
+                   const uint32_t x,
+                   const uint32_t y,
+                   const uint32_t z,
+                   uint8_t*       png,
+                   const size_t   png_n);
+
+bool gbPMTiles_Close(gbPMTiles* pmt);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,712 @@
+#include "gbPipeline.h"
+#include <sched.h>
+#include <sys/time.h>
+
+// =============
+// gbPipeline.c:
+// =============
+//
+// Fixed chain of stages connected by bounded queues.  Each stage has its own
+// pool of worker threads, which pop an item from the stage's queue, run the
+// stage function on it, and push the result into the next stage's queue.
+//
+// The point is overlap: while some threads are blocked on disk or network
+// reads/writes, others keep the CPUs busy with decode, resample and encode.
+// Since every queue is bounded, a slow stage applies backpressure upstream,
+// which in turn bounds the number of items (and decoded tiles) in memory.
+//
+// The queues are lock-free bounded MPMC rings (Dmitry Vyukov's design), using
+// the GCC/clang __atomic builtins.  Idle or blocked threads sched_yield for a
+// few retries, then sleep on a per-queue condition until a push (or pop) on
+// the other side wakes them, so a stage with more threads than work costs
+// nothing.  The push and pop fast paths only touch the mutex when someone is
+// asleep on it.  gbPipeline_WaitAll likewise sleeps on a condition signalled
+// when the last outstanding item finishes.
+//
+// Per-stage stats (items, busy time, queue depth, full/idle events) are kept
+// with relaxed atomics and can be printed after the run, to find which stage
+// needs more (or fewer) threads.
+//
+
+#define kGB_Pipeline_CacheLine 64
+#define kGB_Pipeline_YieldN    4            // retries before a thread sleeps
+
+typedef struct gbPipeline_Cell
+{
+    size_t seq;
+    void*  item;
+} gbPipeline_Cell;
+
+typedef struct gbPipeline_Queue
+{
+    gbPipeline_Cell* cells;
+    size_t           mask;
+    uint8_t          _pad0[kGB_Pipeline_CacheLine];
+    size_t           enq_pos;
+    uint8_t          _pad1[kGB_Pipeline_CacheLine];
+    size_t           deq_pos;
+    uint8_t          _pad2[kGB_Pipeline_CacheLine];
+    
+    pthread_mutex_t  wait_mutex;
+    pthread_cond_t   not_empty_cond;
+    pthread_cond_t   not_full_cond;
+    size_t           pop_wait_n;            // threads asleep on not_empty_cond
+    size_t           push_wait_n;           // threads asleep on not_full_cond
+} gbPipeline_Queue;
+
+typedef struct gbPipeline_Stage
+{
+    char                     name[32];
+    gbPipeline_StageFunction fn;
+    void*                    ctx;
+    size_t                   thread_n;
+    size_t                   queue_depth;
+    pthread_t*               threads;
+    gbPipeline_Queue         queue;
+    
+    uint64_t                 processed_n;
+    uint64_t                 busy_us;
+    uint64_t                 full_n;        // pushes that found the queue full
+    uint64_t                 idle_n;        // times a worker found the queue empty
+    uint64_t                 depth_sum;     // queue depth sampled at each push
+    uint64_t                 depth_max;
+} gbPipeline_Stage;
+
+typedef struct gbPipeline_Worker
+{
+    gbPipeline* pipe;
+    size_t      stage_idx;
+} gbPipeline_Worker;
+
+struct gbPipeline
+{
+    gbPipeline_Stage*  stages;
+    size_t             stage_n;
+    gbPipeline_Worker* workers;             // one per stage, shared by its threads
+    uint64_t           pushed_n;
+    uint64_t           forked_n;
+    uint64_t           done_n;
+    uint64_t           pending_n;           // pushed, not yet done
+    pthread_mutex_t    done_mutex;
+    pthread_cond_t     done_cond;
+    uint64_t           start_us;
+    bool               isStarted;
+    bool               isShuttingDown;
+};
+
+
+
+
+static inline uint64_t _gbPipeline_GetTimeUS(void)
+{
+    struct timeval tv;
+    
+    gettimeofday(&tv, NULL);
+    
+    return (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec;
+}//_gbPipeline_GetTimeUS
+
+
+
+
+// =======================
+// _gbPipeline_Queue_Init:
+// =======================
+//
+// Capacity is rounded up to a power of two.
+//
+static void _gbPipeline_Queue_Init(gbPipeline_Queue* q,
+                                   const size_t      depth)
+{
+    size_t n = 2;
+    
+    while (n < depth)
+    {
+        n = n << 1;
+    }//while
+    
+    q->cells   = malloc(sizeof(gbPipeline_Cell) * n);
+    q->mask    = n - 1;
+    q->enq_pos     = 0;
+    q->deq_pos     = 0;
+    q->pop_wait_n  = 0;
+    q->push_wait_n = 0;
+    
+    pthread_mutex_init(&q->wait_mutex,     NULL);
+    pthread_cond_init (&q->not_empty_cond, NULL);
+    pthread_cond_init (&q->not_full_cond,  NULL);
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        q->cells[i].seq  = i;
+        q->cells[i].item = NULL;
+    }//for
+}//_gbPipeline_Queue_Init
+
+
+
+
+// =======================
+// _gbPipeline_Queue_Wake:
+// =======================
+//
+// Called after a push or pop, with the other side's wait_n and cond.  The
+// fence pairs with the one in _gbPipeline_Queue_Wait: either the sleeper sees
+// the push/pop on its recheck, or this sees its wait_n and signals it under
+// the mutex, after which it can't miss it.
+//
+static inline void _gbPipeline_Queue_Wake(gbPipeline_Queue* q,
+                                          size_t*           wait_n,
+                                          pthread_cond_t*   cond)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(wait_n, __ATOMIC_RELAXED) > 0)
+    {
+        pthread_mutex_lock(&q->wait_mutex);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&q->wait_mutex);
+    }//if
+}//_gbPipeline_Queue_Wake
+
+
+
+
+static bool _gbPipeline_Queue_TryPush(gbPipeline_Queue* q,
+                                      void*             item)
+{
+    gbPipeline_Cell* cell;
+    size_t           pos  = __atomic_load_n(&q->enq_pos, __ATOMIC_RELAXED);
+    
+    while (true)
+    {
+        cell = &(q->cells[pos & q->mask]);
+        
+        const size_t   seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->enq_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }//if
+        }//if
+        else if (dif < 0)
+        {
+            return false;   // full
+        }//else if
+        else
+        {
+            pos = __atomic_load_n(&q->enq_pos, __ATOMIC_RELAXED);
+        }//else
+    }//while
+    
+    cell->item = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    
+    return true;
+}//_gbPipeline_Queue_TryPush
+
+
+
+
+static bool _gbPipeline_Queue_TryPop(gbPipeline_Queue* q,
+                                     void**            item)
+{
+    gbPipeline_Cell* cell;
+    size_t           pos  = __atomic_load_n(&q->deq_pos, __ATOMIC_RELAXED);
+    
+    while (true)
+    {
+        cell = &(q->cells[pos & q->mask]);
+        
+        const size_t   seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->deq_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }//if
+        }//if
+        else if (dif < 0)
+        {
+            return false;   // empty
+        }//else if
+        else
+        {
+            pos = __atomic_load_n(&q->deq_pos, __ATOMIC_RELAXED);
+        }//else
+    }//while
+    
+    *item = cell->item;
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    
+    return true;
+}//_gbPipeline_Queue_TryPop
+
+
+
+
+// ====================
+// _gbPipeline_Enqueue:
+// ====================
+//
+// Pushes item into a stage's queue.  While it is full, yields for a few
+// retries and then sleeps until a pop makes room.
+//
+static void _gbPipeline_Enqueue(gbPipeline_Stage* stage,
+                                void*             item)
+{
+    gbPipeline_Queue* q        = &stage->queue;
+    uint32_t          spin_n   = 0;
+    bool              isPushed = _gbPipeline_Queue_TryPush(q, item);
+    
+    if (!isPushed)
+    {
+        __atomic_fetch_add(&stage->full_n, 1, __ATOMIC_RELAXED);
+    }//if
+    
+    while (!isPushed && spin_n < kGB_Pipeline_YieldN)
+    {
+        sched_yield();
+        spin_n++;
+        isPushed = _gbPipeline_Queue_TryPush(q, item);
+    }//while
+    
+    if (!isPushed)
+    {
+        pthread_mutex_lock(&q->wait_mutex);
+        
+        __atomic_fetch_add(&q->push_wait_n, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        
+        while (!_gbPipeline_Queue_TryPush(q, item))
+        {
+            pthread_cond_wait(&q->not_full_cond, &q->wait_mutex);
+        }//while
+        
+        __atomic_fetch_sub(&q->push_wait_n, 1, __ATOMIC_RELAXED);
+        
+        pthread_mutex_unlock(&q->wait_mutex);
+    }//if
+    
+    _gbPipeline_Queue_Wake(q, &q->pop_wait_n, &q->not_empty_cond);
+    
+    const size_t   enq   = __atomic_load_n(&stage->queue.enq_pos, __ATOMIC_RELAXED);
+    const size_t   deq   = __atomic_load_n(&stage->queue.deq_pos, __ATOMIC_RELAXED);
+    const uint64_t depth = enq > deq ? (uint64_t)(enq - deq) : 0;
+    uint64_t       max   = __atomic_load_n(&stage->depth_max, __ATOMIC_RELAXED);
+    
+    __atomic_fetch_add(&stage->depth_sum, depth, __ATOMIC_RELAXED);
+    
+    while (depth > max && !__atomic_compare_exchange_n(&stage->depth_max, &max, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        // max was reloaded by the failed CAS
+    }//while
+}//_gbPipeline_Enqueue
+
+
+
+
+// ====================
+// _gbPipeline_Dequeue:
+// ====================
+//
+// Pops the next item from a stage's queue.  While it is empty, yields for a
+// few retries and then sleeps until a push arrives.  Returns false, without
+// an item, once the pipeline is shutting down and the queue is empty.
+//
+static bool _gbPipeline_Dequeue(gbPipeline*       pipe,
+                                gbPipeline_Stage* stage,
+                                void**            item)
+{
+    gbPipeline_Queue* q        = &stage->queue;
+    uint32_t          spin_n   = 0;
+    bool              isPopped = _gbPipeline_Queue_TryPop(q, item);
+    
+    if (!isPopped)
+    {
+        __atomic_fetch_add(&stage->idle_n, 1, __ATOMIC_RELAXED);
+    }//if
+    
+    while (!isPopped && spin_n < kGB_Pipeline_YieldN)
+    {
+        if (__atomic_load_n(&pipe->isShuttingDown, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }//if
+        
+        sched_yield();
+        spin_n++;
+        isPopped = _gbPipeline_Queue_TryPop(q, item);
+    }//while
+    
+    if (!isPopped)
+    {
+        pthread_mutex_lock(&q->wait_mutex);
+        
+        __atomic_fetch_add(&q->pop_wait_n, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        
+        while (!(isPopped = _gbPipeline_Queue_TryPop(q, item))
+               && !__atomic_load_n(&pipe->isShuttingDown, __ATOMIC_ACQUIRE))
+        {
+            pthread_cond_wait(&q->not_empty_cond, &q->wait_mutex);
+        }//while
+        
+        __atomic_fetch_sub(&q->pop_wait_n, 1, __ATOMIC_RELAXED);
+        
+        pthread_mutex_unlock(&q->wait_mutex);
+    }//if
+    
+    if (isPopped)
+    {
+        _gbPipeline_Queue_Wake(q, &q->push_wait_n, &q->not_full_cond);
+    }//if
+    
+    return isPopped;
+}//_gbPipeline_Dequeue
+
+
+
+
+static inline void* _gbPipeline_RunStage(gbPipeline_Stage* stage,
+                                         void*             item)
+{
+    const uint64_t st = _gbPipeline_GetTimeUS();
+    
+    void* next = stage->fn(item, stage->ctx);
+    
+    __atomic_fetch_add(&stage->busy_us,     _gbPipeline_GetTimeUS() - st, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stage->processed_n, 1,                            __ATOMIC_RELAXED);
+    
+    return next;
+}//_gbPipeline_RunStage
+
+
+
+
+// ====================
+// _gbPipeline_Forward:
+// ====================
+//
+// Hands item to stage_idx, or marks it done if it is NULL or has passed the
+// last stage.  Stages without threads (eg, pthread_create failed) are run
+// inline on the calling thread.
+//
+static void _gbPipeline_Forward(gbPipeline* pipe,
+                                size_t      stage_idx,
+                                void*       item)
+{
+    while (item != NULL && stage_idx < pipe->stage_n && pipe->stages[stage_idx].thread_n == 0)
+    {
+        item = _gbPipeline_RunStage(&(pipe->stages[stage_idx]), item);
+        stage_idx++;
+    }//while
+    
+    if (item == NULL || stage_idx >= pipe->stage_n)
+    {
+        __atomic_fetch_add(&pipe->done_n, 1, __ATOMIC_RELAXED);
+        
+        // last one out wakes WaitAll.  taking the mutex orders the signal
+        // after the waiter's check, so it can't be lost.
+        if (__atomic_sub_fetch(&pipe->pending_n, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            pthread_mutex_lock(&pipe->done_mutex);
+            pthread_cond_broadcast(&pipe->done_cond);
+            pthread_mutex_unlock(&pipe->done_mutex);
+        }//if
+        
+        return;
+    }//if
+    
+    _gbPipeline_Enqueue(&(pipe->stages[stage_idx]), item);
+}//_gbPipeline_Forward
+
+
+
+
+// ===================
+// _gbPipeline_Worker:
+// ===================
+//
+// Thread entry point.  Runs items through one stage until the pipeline is
+// destroyed.
+//
+static void* _gbPipeline_Worker(void* arg)
+{
+    gbPipeline_Worker* w     = (gbPipeline_Worker*)arg;
+    gbPipeline*        pipe  = w->pipe;
+    gbPipeline_Stage*  stage = &(pipe->stages[w->stage_idx]);
+    void*              item  = NULL;
+    
+    while (_gbPipeline_Dequeue(pipe, stage, &item))
+    {
+        item = _gbPipeline_RunStage(stage, item);
+        
+        _gbPipeline_Forward(pipe, w->stage_idx + 1, item);
+    }//while
+    
+    return NULL;
+}//_gbPipeline_Worker
+
+
+
+
+// ==================
+// gbPipeline_Create:
+// ==================
+//
+// Creates a pipeline of stage_n stages.  Each must be configured with
+// gbPipeline_SetStage before gbPipeline_Start.
+//
+gbPipeline* gbPipeline_Create(const size_t stage_n)
+{
+    gbPipeline* pipe = malloc(sizeof(gbPipeline));
+    
+    pipe->stage_n        = stage_n;
+    pipe->stages         = calloc(stage_n, sizeof(gbPipeline_Stage));
+    pipe->workers        = malloc(sizeof(gbPipeline_Worker) * stage_n);
+    pipe->pushed_n       = 0;
+    pipe->forked_n       = 0;
+    pipe->done_n         = 0;
+    pipe->pending_n      = 0;
+    pipe->start_us       = 0;
+    pipe->isStarted      = false;
+    pipe->isShuttingDown = false;
+    
+    pthread_mutex_init(&pipe->done_mutex, NULL);
+    pthread_cond_init (&pipe->done_cond,  NULL);
+    
+    for (size_t i = 0; i < stage_n; i++)
+    {
+        pipe->workers[i].pipe      = pipe;
+        pipe->workers[i].stage_idx = i;
+    }//for
+    
+    return pipe;
+}//gbPipeline_Create
+
+
+
+
+// ====================
+// gbPipeline_SetStage:
+// ====================
+//
+// thread_n:    workers for this stage. (0 -> one per CPU)
+// queue_depth: max items waiting to enter this stage before upstream blocks.
+//
+void gbPipeline_SetStage(gbPipeline*              pipe,
+                         const size_t             stage_idx,
+                         const char*              name,
+                         gbPipeline_StageFunction fn,
+                         void*                    ctx,
+                         const size_t             thread_n,
+                         const size_t             queue_depth)
+{
+    gbPipeline_Stage* stage = &(pipe->stages[stage_idx]);
+    const long        cpu_n = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    snprintf(stage->name, sizeof(stage->name), "%s", name != NULL ? name : "");
+    
+    stage->fn          = fn;
+    stage->ctx         = ctx;
+    stage->thread_n    = thread_n > 0 ? thread_n : cpu_n > 0 ? (size_t)cpu_n : 1;
+    stage->queue_depth = queue_depth > 0 ? queue_depth : 1;
+}//gbPipeline_SetStage
+
+
+
+
+// =================
+// gbPipeline_Start:
+// =================
+//
+// Creates the queues and worker threads for every stage.
+//
+void gbPipeline_Start(gbPipeline* pipe)
+{
+    pipe->start_us  = _gbPipeline_GetTimeUS();
+    pipe->isStarted = true;
+    
+    for (size_t s = 0; s < pipe->stage_n; s++)
+    {
+        gbPipeline_Stage* stage = &(pipe->stages[s]);
+        
+        _gbPipeline_Queue_Init(&stage->queue, stage->queue_depth);
+        
+        stage->threads = malloc(sizeof(pthread_t) * stage->thread_n);
+        
+        for (size_t i = 0; i < stage->thread_n; i++)
+        {
+            if (pthread_create(&(stage->threads[i]), NULL, _gbPipeline_Worker, &(pipe->workers[s])) != 0)
+            {
+                printf("gbPipeline_Start: [ERR] pthread_create failed for %s thread %zu of %zu.\n", stage->name, i, stage->thread_n);
+                stage->thread_n = i;
+                break;
+            }//if
+        }//for
+    }//for
+}//gbPipeline_Start
+
+
+
+
+// ================
+// gbPipeline_Push:
+// ================
+//
+// Feeds item into the first stage.  Blocks while that stage's queue is
+// full.  Ownership of item passes to the pipeline.
+//
+void gbPipeline_Push(gbPipeline* pipe,
+                     void*       item)
+{
+    __atomic_fetch_add(&pipe->pushed_n,  1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pipe->pending_n, 1, __ATOMIC_ACQ_REL);
+    
+    _gbPipeline_Forward(pipe, 0, item);
+}//gbPipeline_Push
+
+
+
+
+// ================
+// gbPipeline_Fork:
+// ================
+//
+// For use by a stage function, to fan one item out into several: feeds the
+// extra item into stage stage_idx, to be run by that stage's threads in
+// parallel with whatever the function itself returns.  Blocks while that
+// stage's queue is full.  Ownership of item passes to the pipeline.
+//
+void gbPipeline_Fork(gbPipeline*  pipe,
+                     const size_t stage_idx,
+                     void*        item)
+{
+    __atomic_fetch_add(&pipe->forked_n,  1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pipe->pending_n, 1, __ATOMIC_ACQ_REL);
+    
+    _gbPipeline_Forward(pipe, stage_idx, item);
+}//gbPipeline_Fork
+
+
+
+
+// ===================
+// gbPipeline_WaitAll:
+// ===================
+//
+// Blocks until every item pushed so far has left the pipeline.  Sleeps on a
+// condition signalled by the last item out, so there is no polling delay.
+//
+void gbPipeline_WaitAll(gbPipeline* pipe)
+{
+    pthread_mutex_lock(&pipe->done_mutex);
+    
+    while (__atomic_load_n(&pipe->pending_n, __ATOMIC_ACQUIRE) > 0)
+    {
+        pthread_cond_wait(&pipe->done_cond, &pipe->done_mutex);
+    }//while
+    
+    pthread_mutex_unlock(&pipe->done_mutex);
+}//gbPipeline_WaitAll
+
+
+
+
+// ======================
+// gbPipeline_PrintStats:
+// ======================
+//
+// One line per stage.  busy is the share of the stage's thread time spent in
+// the stage function; depth is sampled at each push into the stage's queue.
+// full counts pushes that had to wait for space, idle counts times a worker
+// ran out of work.
+//
+void gbPipeline_PrintStats(const gbPipeline* pipe,
+                           const char*       logPrefix)
+{
+    const uint64_t wall_us = pipe->isStarted ? _gbPipeline_GetTimeUS() - pipe->start_us : 0;
+    
+    for (size_t s = 0; s < pipe->stage_n; s++)
+    {
+        const gbPipeline_Stage* stage = &(pipe->stages[s]);
+        
+        const uint64_t n         = __atomic_load_n(&stage->processed_n, __ATOMIC_RELAXED);
+        const uint64_t busy_us   = __atomic_load_n(&stage->busy_us,     __ATOMIC_RELAXED);
+        const uint64_t depth_sum = __atomic_load_n(&stage->depth_sum,   __ATOMIC_RELAXED);
+        const double   busy_pct  = wall_us > 0 && stage->thread_n > 0 ? 100.0 * (double)busy_us / ((double)wall_us * (double)stage->thread_n) : 0.0;
+        const double   depth_avg = n > 0 ? (double)depth_sum / (double)n : 0.0;
+        
+        printf("%s%-8s threads=%-3zu n=%-8llu busy=%5.1f%%  depth avg=%5.1f max=%llu/%zu  full=%llu idle=%llu\n",
+               logPrefix != NULL ? logPrefix : "",
+               stage->name,
+               stage->thread_n,
+               (unsigned long long)n,
+               busy_pct,
+               depth_avg,
+               (unsigned long long)__atomic_load_n(&stage->depth_max, __ATOMIC_RELAXED),
+               stage->queue.mask + 1,
+               (unsigned long long)__atomic_load_n(&stage->full_n, __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&stage->idle_n, __ATOMIC_RELAXED));
+    }//for
+}//gbPipeline_PrintStats
+
+
+
+
+// ===================
+// gbPipeline_Destroy:
+// ===================
+//
+// Finishes any outstanding items, joins all threads and frees the pipeline.
+//
+void gbPipeline_Destroy(gbPipeline* pipe)
+{
+    if (pipe == NULL)
+    {
+        return;
+    }//if
+    
+    if (pipe->isStarted)
+    {
+        gbPipeline_WaitAll(pipe);
+        
+        __atomic_store_n(&pipe->isShuttingDown, true, __ATOMIC_SEQ_CST);
+        
+        for (size_t s = 0; s < pipe->stage_n; s++)
+        {
+            gbPipeline_Queue* q = &(pipe->stages[s].queue);
+            
+            // sleepers recheck isShuttingDown under the mutex, so they wake
+            // here or never sleep
+            pthread_mutex_lock(&q->wait_mutex);
+            pthread_cond_broadcast(&q->not_empty_cond);
+            pthread_mutex_unlock(&q->wait_mutex);
+            
+            for (size_t i = 0; i < pipe->stages[s].thread_n; i++)
+            {
+                pthread_join(pipe->stages[s].threads[i], NULL);
+            }//for
+            
+            pthread_mutex_destroy(&q->wait_mutex);
+            pthread_cond_destroy (&q->not_empty_cond);
+            pthread_cond_destroy (&q->not_full_cond);
+            
+            free(pipe->stages[s].threads);
+            free(q->cells);
+        }//for
+    }//if
+    
+    pthread_mutex_destroy(&pipe->done_mutex);
+    pthread_cond_destroy (&pipe->done_cond);
+    
+    free(pipe->workers);
+    free(pipe->stages);
+    free(pipe);
+}//gbPipeline_Destroy
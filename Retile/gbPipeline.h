@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef gbPipeline_h
+#define gbPipeline_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+// Returns the item to hand to the next stage, or NULL if the item is
+// finished. (ie, it was freed or dropped)  The last stage should return NULL.
+typedef void* (*gbPipeline_StageFunction)(void* item, void* ctx);
+
+typedef struct gbPipeline gbPipeline;
+
+gbPipeline* gbPipeline_Create(const size_t stage_n);
+
+void gbPipeline_SetStage(gbPipeline*              pipe,
+                         const size_t             stage_idx,
+                         const char*              name,
+                         gbPipeline_StageFunction fn,
+                         void*                    ctx,
+                         const size_t             thread_n,
+                         const size_t             queue_depth);
+
+void gbPipeline_Start(gbPipeline* pipe);
+
+void gbPipeline_Push(gbPipeline* pipe,
+                     void*       item);
+
+void gbPipeline_Fork(gbPipeline*  pipe,
+                     const size_t stage_idx,
+                     void*        item);
+
+void gbPipeline_WaitAll(gbPipeline* pipe);
+
+void gbPipeline_PrintStats(const gbPipeline* pipe,
+                           const char*       logPrefix);
+
+void gbPipeline_Destroy(gbPipeline* pipe);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
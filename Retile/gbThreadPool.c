@@ -0,0 +1,261 @@
+#include "gbThreadPool.h"
+
+// ===============
+// gbThreadPool.c:
+// ===============
+//
+// Minimal pthreads worker pool, used in place of libdispatch (GCD) on
+// platforms where it is not available.
+//
+// Work is queued as a function pointer + context, similar to
+// dispatch_async_f.  The number of work items that may be queued or running
+// at any one time is bounded; once that limit is reached, gbThreadPool_AddWork
+// blocks the caller.  This mirrors the dispatch_semaphore_create(32) pattern
+// used with GCD, and keeps the reader from racing ahead and allocating
+// buffers for every tile in a zoom level at once.
+//
+
+typedef struct gbThreadPool_Work
+{
+    gbThreadPool_WorkFunction fn;
+    void*                     ctx;
+} gbThreadPool_Work;
+
+struct gbThreadPool
+{
+    pthread_t*         threads;
+    size_t             thread_n;
+    
+    gbThreadPool_Work* ring;        // FIFO of queued (not yet running) work
+    size_t             ring_n;
+    size_t             ring_head;
+    size_t             ring_count;
+    
+    size_t             maxInFlight_n;
+    size_t             inFlight_n;  // queued + running
+    bool               isShuttingDown;
+    
+    pthread_mutex_t    mutex;
+    pthread_cond_t     cond_work;   // signalled when work is queued
+    pthread_cond_t     cond_space;  // signalled when in-flight count drops
+    pthread_cond_t     cond_idle;   // signalled when in-flight count hits zero
+};
+
+
+
+
+// =========================
+// gbThreadPool_GetCPUCount:
+// =========================
+//
+// Returns the number of online logical CPUs, or 1 if that can't be determined.
+//
+size_t gbThreadPool_GetCPUCount(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    return n > 0 ? (size_t)n : 1;
+}//gbThreadPool_GetCPUCount
+
+
+
+
+// =====================
+// _gbThreadPool_Worker:
+// =====================
+//
+// Thread entry point.  Pulls work off the ring until the pool is destroyed.
+//
+static void* _gbThreadPool_Worker(void* arg)
+{
+    gbThreadPool*     pool = (gbThreadPool*)arg;
+    gbThreadPool_Work work;
+    
+    while (true)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        
+        while (pool->ring_count == 0 && !pool->isShuttingDown)
+        {
+            pthread_cond_wait(&pool->cond_work, &pool->mutex);
+        }//while
+        
+        if (pool->ring_count == 0 && pool->isShuttingDown)
+        {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }//if
+        
+        work            = pool->ring[pool->ring_head];
+        pool->ring_head = (pool->ring_head + 1) % pool->ring_n;
+        pool->ring_count--;
+        
+        pthread_mutex_unlock(&pool->mutex);
+        
+        work.fn(work.ctx);
+        
+        pthread_mutex_lock(&pool->mutex);
+        
+        pool->inFlight_n--;
+        
+        pthread_cond_signal(&pool->cond_space);
+        
+        if (pool->inFlight_n == 0)
+        {
+            pthread_cond_broadcast(&pool->cond_idle);
+        }//if
+        
+        pthread_mutex_unlock(&pool->mutex);
+    }//while
+    
+    return NULL;
+}//_gbThreadPool_Worker
+
+
+
+
+// ===================
+// gbThreadPool_Create
+// ===================
+//
+// Creates a pool of thread_n worker threads.  (0 -> one per CPU)
+//
+// maxInFlight_n is the limit of queued + running work items before
+// gbThreadPool_AddWork blocks.  It is raised to thread_n if lower, as
+// otherwise some threads could never be given anything to do.
+//
+gbThreadPool* gbThreadPool_Create(const size_t thread_n,
+                                  const size_t maxInFlight_n)
+{
+    gbThreadPool* pool = malloc(sizeof(gbThreadPool));
+    
+    pool->thread_n       = thread_n > 0 ? thread_n : gbThreadPool_GetCPUCount();
+    pool->maxInFlight_n  = maxInFlight_n > pool->thread_n ? maxInFlight_n : pool->thread_n;
+    pool->inFlight_n     = 0;
+    pool->isShuttingDown = false;
+    
+    pool->ring_n         = pool->maxInFlight_n;
+    pool->ring_head      = 0;
+    pool->ring_count     = 0;
+    pool->ring           = malloc(sizeof(gbThreadPool_Work) * pool->ring_n);
+    
+    pthread_mutex_init(&pool->mutex,      NULL);
+    pthread_cond_init (&pool->cond_work,  NULL);
+    pthread_cond_init (&pool->cond_space, NULL);
+    pthread_cond_init (&pool->cond_idle,  NULL);
+    
+    pool->threads = malloc(sizeof(pthread_t) * pool->thread_n);
+    
+    for (size_t i = 0; i < pool->thread_n; i++)
+    {
+        if (pthread_create(&(pool->threads[i]), NULL, _gbThreadPool_Worker, pool) != 0)
+        {
+            printf("gbThreadPool_Create: [ERR] pthread_create failed for thread %zu of %zu.\n", i, pool->thread_n);
+            pool->thread_n = i;
+            break;
+        }//if
+    }//for
+    
+    return pool;
+}//gbThreadPool_Create
+
+
+
+
+// ====================
+// gbThreadPool_AddWork
+// ====================
+//
+// Queues fn(ctx) to be run on a worker thread.
+//
+// Blocks while the pool already has maxInFlight_n work items queued or
+// running.  Ownership of ctx passes to fn.
+//
+// If the pool has no threads (eg, pthread_create failed), fn is run
+// synchronously on the calling thread.
+//
+void gbThreadPool_AddWork(gbThreadPool*             pool,
+                          gbThreadPool_WorkFunction fn,
+                          void*                     ctx)
+{
+    if (pool->thread_n == 0)
+    {
+        fn(ctx);
+        return;
+    }//if
+    
+    pthread_mutex_lock(&pool->mutex);
+    
+    while (pool->inFlight_n >= pool->maxInFlight_n)
+    {
+        pthread_cond_wait(&pool->cond_space, &pool->mutex);
+    }//while
+    
+    const size_t idx = (pool->ring_head + pool->ring_count) % pool->ring_n;
+    
+    pool->ring[idx].fn  = fn;
+    pool->ring[idx].ctx = ctx;
+    pool->ring_count++;
+    pool->inFlight_n++;
+    
+    pthread_cond_signal(&pool->cond_work);
+    
+    pthread_mutex_unlock(&pool->mutex);
+}//gbThreadPool_AddWork
+
+
+
+
+// ====================
+// gbThreadPool_WaitAll
+// ====================
+//
+// Blocks until every work item added so far has finished running.
+//
+void gbThreadPool_WaitAll(gbThreadPool* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    
+    while (pool->inFlight_n > 0)
+    {
+        pthread_cond_wait(&pool->cond_idle, &pool->mutex);
+    }//while
+    
+    pthread_mutex_unlock(&pool->mutex);
+}//gbThreadPool_WaitAll
+
+
+
+
+// ====================
+// gbThreadPool_Destroy
+// ====================
+//
+// Finishes any outstanding work, joins all threads and frees the pool.
+//
+void gbThreadPool_Destroy(gbThreadPool* pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }//if
+    
+    pthread_mutex_lock(&pool->mutex);
+    pool->isShuttingDown = true;
+    pthread_cond_broadcast(&pool->cond_work);
+    pthread_mutex_unlock(&pool->mutex);
+    
+    for (size_t i = 0; i < pool->thread_n; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }//for
+    
+    pthread_cond_destroy (&pool->cond_idle);
+    pthread_cond_destroy (&pool->cond_space);
+    pthread_cond_destroy (&pool->cond_work);
+    pthread_mutex_destroy(&pool->mutex);
+    
+    free(pool->threads);
+    free(pool->ring);
+    free(pool);
+}//gbThreadPool_Destroy
@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef gbThreadPool_h
+#define gbThreadPool_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+typedef void (*gbThreadPool_WorkFunction)(void* ctx);
+
+typedef struct gbThreadPool gbThreadPool;
+
+size_t gbThreadPool_GetCPUCount(void);
+
+gbThreadPool* gbThreadPool_Create(const size_t thread_n,
+                                  const size_t maxInFlight_n);
+
+void gbThreadPool_AddWork(gbThreadPool*             pool,
+                          gbThreadPool_WorkFunction fn,
+                          void*                     ctx);
+
+void gbThreadPool_WaitAll(gbThreadPool* pool);
+
+void gbThreadPool_Destroy(gbThreadPool* pool);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,517 @@
+#include "gbTileIndex.h"
+
+// ==============
+// gbTileIndex.c:
+// ==============
+//
+// In-memory index of tile references, sorted by quadkey.
+//
+// Replaces the SQLite TileRef staging table.  Each tile is a 16 byte entry,
+// a key and an offset into a string arena holding its filepath.  The key is:
+//
+//     z << 58 | quadkey(x, y)
+//
+// Sorted by key, every quad, and every quad of quads, is contiguous, which is
+// all the data clustering Retile needs.  The sort is an LSD radix sort over
+// the key bytes that actually vary, spread over a gbThreadPool.
+//
+
+typedef struct gbTileIndex_Entry
+{
+    uint64_t key;
+    uint64_t pathOffset;
+} gbTileIndex_Entry;
+
+struct gbTileIndex
+{
+    gbTileIndex_Entry* entries;
+    size_t             entry_n;
+    size_t             entry_cap;
+    
+    char*              arena;       // NUL-terminated filepaths, back to back
+    size_t             arena_n;
+    size_t             arena_cap;
+};
+
+
+
+
+// ==============================
+// gbTileIndex_GetMortonKeyForXY:
+// ==============================
+//
+// Interleaves the bits of tile x and y into a quadkey / Z-order (Morton) code,
+// with y in the odd bits.  This is the Bing Maps quadkey as an integer.
+//
+// The key of the ancestor dz levels up is simply key >> (2 * dz).
+//
+uint64_t gbTileIndex_GetMortonKeyForXY(const uint32_t x,
+                                       const uint32_t y)
+{
+    uint64_t _x = x;
+    uint64_t _y = y;
+    
+    _x = (_x | (_x << 16)) & 0x0000FFFF0000FFFFULL;
+    _x = (_x | (_x <<  8)) & 0x00FF00FF00FF00FFULL;
+    _x = (_x | (_x <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+    _x = (_x | (_x <<  2)) & 0x3333333333333333ULL;
+    _x = (_x | (_x <<  1)) & 0x5555555555555555ULL;
+    
+    _y = (_y | (_y << 16)) & 0x0000FFFF0000FFFFULL;
+    _y = (_y | (_y <<  8)) & 0x00FF00FF00FF00FFULL;
+    _y = (_y | (_y <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+    _y = (_y | (_y <<  2)) & 0x3333333333333333ULL;
+    _y = (_y | (_y <<  1)) & 0x5555555555555555ULL;
+    
+    return _x | (_y << 1);
+}//gbTileIndex_GetMortonKeyForXY
+
+
+static inline uint32_t _gbTileIndex_CompactBits(uint64_t v)
+{
+    v &= 0x5555555555555555ULL;
+    v  = (v | (v >>  1)) & 0x3333333333333333ULL;
+    v  = (v | (v >>  2)) & 0x0F0F0F0F0F0F0F0FULL;
+    v  = (v | (v >>  4)) & 0x00FF00FF00FF00FFULL;
+    v  = (v | (v >>  8)) & 0x0000FFFF0000FFFFULL;
+    v  = (v | (v >> 16)) & 0x00000000FFFFFFFFULL;
+    
+    return (uint32_t)v;
+}//_gbTileIndex_CompactBits
+
+
+void gbTileIndex_GetXYForMortonKey(const uint64_t key,
+                                   uint32_t*      x,
+                                   uint32_t*      y)
+{
+    *x = _gbTileIndex_CompactBits(key);
+    *y = _gbTileIndex_CompactBits(key >> 1);
+}//gbTileIndex_GetXYForMortonKey
+
+
+uint64_t gbTileIndex_GetKeyForXYZ(const uint32_t x,
+                                  const uint32_t y,
+                                  const uint32_t z)
+{
+    return ((uint64_t)z << kGB_TileIndex_ZShift) | gbTileIndex_GetMortonKeyForXY(x, y);
+}//gbTileIndex_GetKeyForXYZ
+
+
+void gbTileIndex_GetXYZForKey(const uint64_t key,
+                              uint32_t*      x,
+                              uint32_t*      y,
+                              uint32_t*      z)
+{
+    *z = (uint32_t)(key >> kGB_TileIndex_ZShift);
+    
+    gbTileIndex_GetXYForMortonKey(key & ((1ULL << kGB_TileIndex_ZShift) - 1ULL), x, y);
+}//gbTileIndex_GetXYZForKey
+
+
+
+
+gbTileIndex* gbTileIndex_Create(void)
+{
+    gbTileIndex* idx = malloc(sizeof(gbTileIndex));
+    
+    idx->entry_cap = 4096;
+    idx->entry_n   = 0;
+    idx->entries   = malloc(sizeof(gbTileIndex_Entry) * idx->entry_cap);
+    
+    idx->arena_cap = 4096 * 64;
+    idx->arena_n   = 0;
+    idx->arena     = malloc(sizeof(char) * idx->arena_cap);
+    
+    return idx;
+}//gbTileIndex_Create
+
+
+void gbTileIndex_Destroy(gbTileIndex* idx)
+{
+    if (idx == NULL)
+    {
+        return;
+    }//if
+    
+    free(idx->entries);
+    free(idx->arena);
+    free(idx);
+}//gbTileIndex_Destroy
+
+
+void gbTileIndex_Clear(gbTileIndex* idx)
+{
+    idx->entry_n = 0;
+    idx->arena_n = 0;
+}//gbTileIndex_Clear
+
+
+
+
+// ================
+// gbTileIndex_Add:
+// ================
+//
+// Appends a tile.  The filepath is copied.  Not thread safe.
+//
+void gbTileIndex_Add(gbTileIndex*   idx,
+                     const uint32_t x,
+                     const uint32_t y,
+                     const uint32_t z,
+                     const char*    filepath)
+{
+    const size_t len = strnlen(filepath, 1023) + 1;
+    
+    if (idx->entry_n == idx->entry_cap)
+    {
+        idx->entry_cap = idx->entry_cap << 1;
+        idx->entries   = realloc(idx->entries, sizeof(gbTileIndex_Entry) * idx->entry_cap);
+    }//if
+    
+    while (idx->arena_n + len > idx->arena_cap)
+    {
+        idx->arena_cap = idx->arena_cap << 1;
+        idx->arena     = realloc(idx->arena, sizeof(char) * idx->arena_cap);
+    }//while
+    
+    memcpy(idx->arena + idx->arena_n, filepath, len - 1);
+    idx->arena[idx->arena_n + len - 1] = '\0';
+    
+    idx->entries[idx->entry_n].key        = gbTileIndex_GetKeyForXYZ(x, y, z);
+    idx->entries[idx->entry_n].pathOffset = idx->arena_n;
+    
+    idx->entry_n++;
+    idx->arena_n += len;
+}//gbTileIndex_Add
+
+
+
+
+// ================
+// Radix sort state
+// ================
+//
+// One chunk per thread.  Each pass, every chunk histograms its slice of src
+// for one key byte, then scatters it to dest at offsets derived from all the
+// chunk histograms, which keeps the sort stable.
+//
+typedef struct gbTileIndex_SortChunk
+{
+    const gbTileIndex_Entry* src;
+    gbTileIndex_Entry*       dest;
+    size_t                   start;
+    size_t                   end;
+    uint32_t                 shift;
+    size_t                   counts[256];
+} gbTileIndex_SortChunk;
+
+
+static void _gbTileIndex_Sort_Histogram(void* ctx)
+{
+    gbTileIndex_SortChunk* c = (gbTileIndex_SortChunk*)ctx;
+    
+    memset(c->counts, 0, sizeof(c->counts));
+    
+    for (size_t i = c->start; i < c->end; i++)
+    {
+        c->counts[(c->src[i].key >> c->shift) & 0xFF]++;
+    }//for
+}//_gbTileIndex_Sort_Histogram
+
+
+static void _gbTileIndex_Sort_Scatter(void* ctx)
+{
+    gbTileIndex_SortChunk* c = (gbTileIndex_SortChunk*)ctx;
+    
+    // counts holds the output offsets at this point
+    for (size_t i = c->start; i < c->end; i++)
+    {
+        c->dest[c->counts[(c->src[i].key >> c->shift) & 0xFF]++] = c->src[i];
+    }//for
+}//_gbTileIndex_Sort_Scatter
+
+
+static inline void _gbTileIndex_Sort_RunChunks(gbThreadPool*             pool,
+                                               gbThreadPool_WorkFunction fn,
+                                               gbTileIndex_SortChunk*    chunks,
+                                               const size_t              chunk_n)
+{
+    for (size_t i = 0; i < chunk_n; i++)
+    {
+        if (pool != NULL)
+        {
+            gbThreadPool_AddWork(pool, fn, &(chunks[i]));
+        }//if
+        else
+        {
+            fn(&(chunks[i]));
+        }//else
+    }//for
+    
+    if (pool != NULL)
+    {
+        gbThreadPool_WaitAll(pool);
+    }//if
+}//_gbTileIndex_Sort_RunChunks
+
+
+
+
+// =================
+// gbTileIndex_Sort:
+// =================
+//
+// Sorts by key.  (z, then quadkey)  Stable.
+//
+// thread_n: 0 -> one per CPU.  Small indices are sorted on the calling thread.
+//
+// Key bytes which are the same for every entry are skipped.  For a single zoom
+// level z, this is typically ceil(2z / 8) passes.
+//
+void gbTileIndex_Sort(gbTileIndex* idx,
+                      const size_t thread_n)
+{
+    const size_t n = idx->entry_n;
+    
+    if (n < 2)
+    {
+        return;
+    }//if
+    
+    uint64_t key_and = UINT64_MAX;
+    uint64_t key_or  = 0;
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        key_and &= idx->entries[i].key;
+        key_or  |= idx->entries[i].key;
+    }//for
+    
+    const uint64_t varying = key_and ^ key_or;
+    
+    if (varying == 0)
+    {
+        return;
+    }//if
+    
+    const size_t           kMinPerChunk = 1 << 16;
+    size_t                 chunk_n      = thread_n > 0 ? thread_n : gbThreadPool_GetCPUCount();
+    
+    chunk_n = n / chunk_n < kMinPerChunk ? n / kMinPerChunk : chunk_n;
+    chunk_n = chunk_n < 1 ? 1 : chunk_n;
+    
+    gbThreadPool*          pool   = chunk_n > 1 ? gbThreadPool_Create(chunk_n, chunk_n) : NULL;
+    gbTileIndex_SortChunk* chunks = malloc(sizeof(gbTileIndex_SortChunk) * chunk_n);
+    gbTileIndex_Entry*     temp   = malloc(sizeof(gbTileIndex_Entry) * n);
+    gbTileIndex_Entry*     src    = idx->entries;
+    gbTileIndex_Entry*     dest   = temp;
+    
+    for (size_t i = 0; i < chunk_n; i++)
+    {
+        chunks[i].start = n * i       / chunk_n;
+        chunks[i].end   = n * (i + 1) / chunk_n;
+    }//for
+    
+    for (uint32_t shift = 0; shift < 64; shift += 8)
+    {
+        if (((varying >> shift) & 0xFF) == 0)
+        {
+            continue;
+        }//if
+        
+        for (size_t i = 0; i < chunk_n; i++)
+        {
+            chunks[i].src   = src;
+            chunks[i].dest  = dest;
+            chunks[i].shift = shift;
+        }//for
+        
+        _gbTileIndex_Sort_RunChunks(pool, _gbTileIndex_Sort_Histogram, chunks, chunk_n);
+        
+        // histograms -> output offsets, bucket-major then chunk-major
+        size_t offset = 0;
+        
+        for (size_t b = 0; b < 256; b++)
+        {
+            for (size_t i = 0; i < chunk_n; i++)
+            {
+                const size_t count = chunks[i].counts[b];
+                
+                chunks[i].counts[b] = offset;
+                offset             += count;
+            }//for
+        }//for
+        
+        _gbTileIndex_Sort_RunChunks(pool, _gbTileIndex_Sort_Scatter, chunks, chunk_n);
+        
+        gbTileIndex_Entry* swap = src;
+        src  = dest;
+        dest = swap;
+    }//for
+    
+    if (src != idx->entries)
+    {
+        free(idx->entries);
+        idx->entries   = src;
+        idx->entry_cap = n;
+    }//if
+    else
+    {
+        free(temp);
+    }//else
+    
+    gbThreadPool_Destroy(pool);
+    free(chunks);
+}//gbTileIndex_Sort
+
+
+
+
+size_t gbTileIndex_GetCount(const gbTileIndex* idx)
+{
+    return idx->entry_n;
+}//gbTileIndex_GetCount
+
+
+uint64_t gbTileIndex_GetKey(const gbTileIndex* idx,
+                            const size_t       i)
+{
+    return idx->entries[i].key;
+}//gbTileIndex_GetKey
+
+
+void gbTileIndex_GetXYZ(const gbTileIndex* idx,
+                        const size_t       i,
+                        uint32_t*          x,
+                        uint32_t*          y,
+                        uint32_t*          z)
+{
+    gbTileIndex_GetXYZForKey(idx->entries[i].key, x, y, z);
+}//gbTileIndex_GetXYZ
+
+
+const char* gbTileIndex_GetFilePath(const gbTileIndex* idx,
+                                    const size_t       i)
+{
+    return idx->arena + idx->entries[i].pathOffset;
+}//gbTileIndex_GetFilePath
+
+
+void gbTileIndex_GetZRange(const gbTileIndex* idx,
+                           uint32_t*          min_z,
+                           uint32_t*          max_z)
+{
+    uint32_t _min = UINT32_MAX;
+    uint32_t _max = 0;
+    
+    for (size_t i = 0; i < idx->entry_n; i++)
+    {
+        const uint32_t z = (uint32_t)(idx->entries[i].key >> kGB_TileIndex_ZShift);
+        
+        _min = z < _min ? z : _min;
+        _max = z > _max ? z : _max;
+    }//for
+    
+    *min_z = _min;
+    *max_z = _max;
+}//gbTileIndex_GetZRange
+
+
+
+
+// =============================
+// gbTileIndex_GetAncestorCount:
+// =============================
+//
+// Number of distinct tiles at anc_z that are ancestors of (or are) the tiles
+// in idx.  idx must be sorted and hold a single zoom level >= anc_z.
+//
+size_t gbTileIndex_GetAncestorCount(const gbTileIndex* idx,
+                                    const uint32_t     anc_z)
+{
+    size_t   n    = 0;
+    uint64_t last = UINT64_MAX;
+    
+    for (size_t i = 0; i < idx->entry_n; i++)
+    {
+        const uint64_t key = idx->entries[i].key;
+        const uint32_t z   = (uint32_t)(key >> kGB_TileIndex_ZShift);
+        const uint64_t anc = (key & ((1ULL << kGB_TileIndex_ZShift) - 1ULL)) >> (2 * (z - anc_z));
+        
+        n   += anc != last ? 1 : 0;
+        last = anc;
+    }//for
+    
+    return n;
+}//gbTileIndex_GetAncestorCount
+
+
+
+
+// ======================
+// gbTileIndex_CopyShard:
+// ======================
+//
+// Appends to dest the tiles of shard shard_i of shard_n.  Returns the number
+// of tiles appended.
+//
+// idx must be sorted and hold a single zoom level >= anc_z.  It is cut into
+// shard_n contiguous quadkey ranges, only ever between the subtrees of two
+// anc_z tiles, so each shard holds every src tile of any dest tile at or
+// above anc_z it writes.  Each subtree goes to the shard its midpoint falls
+// in, by tile count, which balances the shards by the tiles that actually
+// exist rather than by area.
+//
+// The cut depends only on idx, so separate processes given the same src
+// tiles agree on it without talking to each other.
+//
+size_t gbTileIndex_CopyShard(const gbTileIndex* idx,
+                             const uint32_t     anc_z,
+                             const size_t       shard_i,
+                             const size_t       shard_n,
+                             gbTileIndex*       dest)
+{
+    const size_t n     = idx->entry_n;
+    size_t       start = 0;
+    size_t       add_n = 0;
+    uint32_t     x;
+    uint32_t     y;
+    uint32_t     z;
+    
+    while (start < n)
+    {
+        const uint32_t start_z   = (uint32_t)(idx->entries[start].key >> kGB_TileIndex_ZShift);
+        const uint32_t shift     = 2 * (start_z - anc_z);
+        const uint64_t start_anc = (idx->entries[start].key & ((1ULL << kGB_TileIndex_ZShift) - 1ULL)) >> shift;
+        size_t         end       = start + 1;
+        
+        while (end < n
+               && ((idx->entries[end].key & ((1ULL << kGB_TileIndex_ZShift) - 1ULL)) >> shift) == start_anc)
+        {
+            end++;
+        }//while
+        
+        size_t         group_shard = (start + end) * shard_n / (2 * n);
+        
+        group_shard = group_shard < shard_n ? group_shard : shard_n - 1;
+        
+        if (group_shard == shard_i)
+        {
+            for (size_t i = start; i < end; i++)
+            {
+                gbTileIndex_GetXYZForKey(idx->entries[i].key, &x, &y, &z);
+                gbTileIndex_Add(dest, x, y, z, idx->arena + idx->entries[i].pathOffset);
+            }//for
+            
+            add_n += end - start;
+        }//if
+        else if (group_shard > shard_i)
+        {
+            break;
+        }//else if
+        
+        start = end;
+    }//while
+    
+    return add_n;
+}//gbTileIndex_CopyShard
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "gbThreadPool.h"
+
+#ifndef gbTileIndex_h
+#define gbTileIndex_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define kGB_TileIndex_ZShift 58     // key = z << 58 | quadkey(x, y)
+#define kGB_TileIndex_MaxZ   29
+
+typedef struct gbTileIndex gbTileIndex;
+
+uint64_t gbTileIndex_GetMortonKeyForXY(const uint32_t x,
+                                       const uint32_t y);
+
+void gbTileIndex_GetXYForMortonKey(const uint64_t key,
+                                   uint32_t*      x,
+                                   uint32_t*      y);
+
+uint64_t gbTileIndex_GetKeyForXYZ(const uint32_t x,
+                                  const uint32_t y,
+                                  const uint32_t z);
+
+void gbTileIndex_GetXYZForKey(const uint64_t key,
+                              uint32_t*      x,
+                              uint32_t*      y,
+                              uint32_t*      z);
+
+gbTileIndex* gbTileIndex_Create(void);
+
+void gbTileIndex_Destroy(gbTileIndex* idx);
+
+void gbTileIndex_Clear(gbTileIndex* idx);
+
+void gbTileIndex_Add(gbTileIndex*   idx,
+                     const uint32_t x,
+                     const uint32_t y,
+                     const uint32_t z,
+                     const char*    filepath);
+
+void gbTileIndex_Sort(gbTileIndex* idx,
+                      const size_t thread_n);
+
+size_t gbTileIndex_GetCount(const gbTileIndex* idx);
+
+uint64_t gbTileIndex_GetKey(const gbTileIndex* idx,
+                            const size_t       i);
+
+void gbTileIndex_GetXYZ(const gbTileIndex* idx,
+                        const size_t       i,
+                        uint32_t*          x,
+                        uint32_t*          y,
+                        uint32_t*          z);
+
+const char* gbTileIndex_GetFilePath(const gbTileIndex* idx,
+                                    const size_t       i);
+
+void gbTileIndex_GetZRange(const gbTileIndex* idx,
+                           uint32_t*          min_z,
+                           uint32_t*          max_z);
+
+size_t gbTileIndex_GetAncestorCount(const gbTileIndex* idx,
+                                    const uint32_t     anc_z);
+
+size_t gbTileIndex_CopyShard(const gbTileIndex* idx,
+                             const uint32_t     anc_z,
+                             const size_t       shard_i,
+                             const size_t       shard_n,
+                             gbTileIndex*       dest);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,263 @@
+#include "gbTileManifest.h"
+
+// =================
+// gbTileManifest.c:
+// =================
+//
+// Persistent record of the source tiles a run was built from, so the next
+// run can tell which ones changed.  (see -incremental)
+//
+// The file is plain text, one tile per line, sorted by key:
+//
+//     z x y mtime_ns size hash filepath
+//
+// hash is a 64-bit FNV-1a of the file contents in hex, or 0 if not computed.
+// The filepath is informational only and is not read back.
+//
+
+#define kGB_TileManifest_Header    "# retile manifest 1"
+#define kGB_TileManifest_HashChunk 65536
+
+
+
+
+// ========================
+// gbTileManifest_StatFile:
+// ========================
+//
+// Fills in the mtime and size of entry from the file.  Returns false if the
+// file could not be stat'd.
+//
+bool gbTileManifest_StatFile(const char*           filepath,
+                             gbTileManifest_Entry* entry)
+{
+    struct stat st;
+    
+    if (stat(filepath, &st) != 0)
+    {
+        entry->mtime_ns = 0;
+        entry->size     = 0;
+        return false;
+    }//if
+    
+#ifdef __APPLE__
+    entry->mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + (int64_t)st.st_mtimespec.tv_nsec;
+#else
+    entry->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + (int64_t)st.st_mtim.tv_nsec;
+#endif
+    
+    entry->size = (uint64_t)st.st_size;
+    
+    return true;
+}//gbTileManifest_StatFile
+
+
+
+
+// ========================
+// gbTileManifest_HashFile:
+// ========================
+//
+// 64-bit FNV-1a of the file contents.  Returns 0 if the file could not be
+// read, which never matches.
+//
+uint64_t gbTileManifest_HashFile(const char* filepath)
+{
+    FILE* fp = fopen(filepath, "rb");
+    
+    if (fp == NULL)
+    {
+        return 0;
+    }//if
+    
+    uint8_t  buf[kGB_TileManifest_HashChunk];
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    size_t   n;
+    
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            hash ^= buf[i];
+            hash *= 0x00000100000001B3ULL;
+        }//for
+    }//while
+    
+    fclose(fp);
+    
+    return hash != 0 ? hash : 1;
+}//gbTileManifest_HashFile
+
+
+
+
+static int _gbTileManifest_CompareEntry(const void* a,
+                                        const void* b)
+{
+    const uint64_t ka = ((const gbTileManifest_Entry*)a)->key;
+    const uint64_t kb = ((const gbTileManifest_Entry*)b)->key;
+    
+    return ka < kb ? -1 : ka > kb ? 1 : 0;
+}//_gbTileManifest_CompareEntry
+
+
+
+
+// ====================
+// gbTileManifest_Load:
+// ====================
+//
+// Returns the entries of the manifest file, sorted by key, or NULL if it does
+// not exist or could not be read.  Free with free().
+//
+gbTileManifest_Entry* gbTileManifest_Load(const char* manifestPath,
+                                          size_t*     entry_n)
+{
+    *entry_n = 0;
+    
+    FILE* fp = fopen(manifestPath, "r");
+    
+    if (fp == NULL)
+    {
+        return NULL;
+    }//if
+    
+    char line[2048];
+    
+    if (fgets(line, sizeof(line), fp) == NULL
+        || strncmp(line, kGB_TileManifest_Header, strlen(kGB_TileManifest_Header)) != 0)
+    {
+        printf("gbTileManifest_Load: [ERR] Not a manifest file: [%s]\n", manifestPath);
+        fclose(fp);
+        return NULL;
+    }//if
+    
+    size_t                n       = 0;
+    size_t                cap     = 4096;
+    gbTileManifest_Entry* entries = malloc(sizeof(gbTileManifest_Entry) * cap);
+    
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char*          s = line;
+        const uint32_t z = (uint32_t)strtoul(s, &s, 10);
+        const uint32_t x = (uint32_t)strtoul(s, &s, 10);
+        const uint32_t y = (uint32_t)strtoul(s, &s, 10);
+        const int64_t  t = (int64_t) strtoll(s, &s, 10);
+        const uint64_t l = (uint64_t)strtoull(s, &s, 10);
+        const uint64_t h = (uint64_t)strtoull(s, &s, 16);
+        
+        if (s == line || z > kGB_TileIndex_MaxZ)
+        {
+            continue;
+        }//if
+        
+        if (n == cap)
+        {
+            cap     = cap << 1;
+            entries = realloc(entries, sizeof(gbTileManifest_Entry) * cap);
+        }//if
+        
+        entries[n].key      = gbTileIndex_GetKeyForXYZ(x, y, z);
+        entries[n].mtime_ns = t;
+        entries[n].size     = l;
+        entries[n].hash     = h;
+        entries[n].filepath = NULL;
+        n++;
+    }//while
+    
+    fclose(fp);
+    
+    qsort(entries, n, sizeof(gbTileManifest_Entry), _gbTileManifest_CompareEntry);
+    
+    *entry_n = n;
+    
+    return entries;
+}//gbTileManifest_Load
+
+
+
+
+// ====================
+// gbTileManifest_Save:
+// ====================
+//
+// Writes entries, which must be sorted by key, to a temporary file which then
+// replaces manifestPath.  An interrupted save leaves the old manifest as is.
+//
+bool gbTileManifest_Save(const char*                 manifestPath,
+                         const gbTileManifest_Entry* entries,
+                         const size_t                entry_n)
+{
+    char tmpPath[1024];
+    
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", manifestPath);
+    
+    FILE* fp = fopen(tmpPath, "w");
+    
+    if (fp == NULL)
+    {
+        printf("gbTileManifest_Save: [ERR] Could not open [%s] for writing.\n", tmpPath);
+        return false;
+    }//if
+    
+    fprintf(fp, "%s\n", kGB_TileManifest_Header);
+    
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    
+    for (size_t i = 0; i < entry_n; i++)
+    {
+        gbTileIndex_GetXYZForKey(entries[i].key, &x, &y, &z);
+        
+        fprintf(fp, "%u %u %u %lld %llu %llx %s\n", z, x, y,
+                (long long)entries[i].mtime_ns,
+                (unsigned long long)entries[i].size,
+                (unsigned long long)entries[i].hash,
+                entries[i].filepath != NULL ? entries[i].filepath : "-");
+    }//for
+    
+    const bool isOK = ferror(fp) == 0;
+    
+    if (fclose(fp) != 0 || !isOK || rename(tmpPath, manifestPath) != 0)
+    {
+        printf("gbTileManifest_Save: [ERR] Could not write [%s].\n", manifestPath);
+        unlink(tmpPath);
+        return false;
+    }//if
+    
+    return true;
+}//gbTileManifest_Save
+
+
+
+
+// ====================
+// gbTileManifest_Find:
+// ====================
+//
+// Binary search of entries, sorted by key.  Returns NULL if key is absent.
+//
+const gbTileManifest_Entry* gbTileManifest_Find(const gbTileManifest_Entry* entries,
+                                                const size_t                entry_n,
+                                                const uint64_t              key)
+{
+    size_t lo = 0;
+    size_t hi = entry_n;
+    
+    while (lo < hi)
+    {
+        const size_t mid = lo + ((hi - lo) >> 1);
+        
+        if (entries[mid].key < key)
+        {
+            lo = mid + 1;
+        }//if
+        else
+        {
+            hi = mid;
+        }//else
+    }//while
+    
+    return lo < entry_n && entries[lo].key == key ? &(entries[lo]) : NULL;
+}//gbTileManifest_Find
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "gbTileIndex.h"
+
+#ifndef gbTileManifest_h
+#define gbTileManifest_h
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+typedef struct gbTileManifest_Entry
+{
+    uint64_t    key;        // gbTileIndex key, z << 58 | quadkey(x, y)
+    int64_t     mtime_ns;
+    uint64_t    size;
+    uint64_t    hash;       // 0 -> none
+    const char* filepath;   // not owned.  NULL for loaded entries.
+} gbTileManifest_Entry;
+
+bool gbTileManifest_StatFile(const char*           filepath,
+                             gbTileManifest_Entry* entry);
+
+uint64_t gbTileManifest_HashFile(const char* filepath);
+
+gbTileManifest_Entry* gbTileManifest_Load(const char* manifestPath,
+                                          size_t*     entry_n);
+
+bool gbTileManifest_Save(const char*                 manifestPath,
+                         const gbTileManifest_Entry* entries,
+                         const size_t                entry_n);
+
+const gbTileManifest_Entry* gbTileManifest_Find(const gbTileManifest_Entry* entries,
+                                                const size_t                entry_n,
+                                                const uint64_t              key);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif
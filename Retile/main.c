@@ -23,9 +23,14 @@
 //
 // Linux/BSD/etc
 // -------------
-// With some modification of the build process and header references it
-// should run on anything posix-y, though it will lose the Apple frameworks
-// Accelerate and libdispatch.  This is untested.
+// With some modification of the build process it should run on anything
+// posix-y, though it will lose the Apple frameworks Accelerate and libdispatch.
+//
+// Without libdispatch, multithreading falls back to a pthreads worker pool
+// (gbThreadPool.c), sized by -threads N.  Without Accelerate, Lanczos is not
+// available and downsampling uses the average method instead.
+//
+// eg: cc -std=gnu99 -O3 -msse4.2 *.c -o Retile -lpng -lsqlite3 -lz -lpthread -lm
 //
 //
 //
@@ -37,7 +42,6 @@
 // "tinydir.h" should provide Windows compatibility for reading, though.
 //
 // CURRENT_TIMESTAMP: this uses a posix call and will need to be fixed/removed.
-// dbFilePath:        /tmp/retile.sqlite probably isn't going to work.
 //
 // Note that it's possible there may be other issues with the path parsing
 // and generation in Windows, though this seems unlikely.
@@ -48,6 +52,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
 #include <unistd.h>
 
 #include <errno.h>  // for mkdir
@@ -59,27 +65,88 @@
 
 #include "gbImage_png.h"
 #include "gbImage_Geometry.h"
-#include "gbDB.h"
+#include "gbThreadPool.h"
+#include "gbTileIndex.h"
+#include "gbPipeline.h"
+#include "gbBufferPool.h"
+#include "gbDirScan.h"
+#include "gbTileManifest.h"
+#include "gbLeaseTable.h"
+#include "gbMBTiles.h"
+#include "gbPMTiles.h"
 
 #include "tinydir.h"        // https://github.com/cxong/tinydir/blob/master/tinydir.h
-#include "sqlite3.h"
 
+#ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
+#endif
 
 
 
 
 typedef int Retile_TemplateFormatType; enum
 {
-    kRetile_Template_OSM = 0,
-    kRetile_Template_ZXY = 1,
-    kRetile_Template_XYZ = 2
+    kRetile_Template_OSM     = 0,
+    kRetile_Template_ZXY     = 1,
+    kRetile_Template_XYZ     = 2,
+    kRetile_Template_MBTiles = 3,    // tiles come from _mbtilesSrc, or go to _mbtiles
+    kRetile_Template_PMTiles = 4     // tiles go to _pmtiles
 };
 
+// -inMBTiles / -outMBTiles / -outPMTiles: where tiles for the single file
+// templates come from and go.  Opened and closed by main, once for the run.
+static gbMBTilesReader* _mbtilesSrc = NULL;
+static gbMBTiles*       _mbtiles    = NULL;
+static gbPMTiles*       _pmtiles    = NULL;
+
+// Single file outputs take encoded tiles from _PutArchiveTile, not a path.
+static inline bool _IsArchiveTemplate(const Retile_TemplateFormatType t) { return t == kRetile_Template_MBTiles || t == kRetile_Template_PMTiles; }
+
+// The suffix of the -interp?? argument for interpolationTypeId.
+static inline const char* _GetInterpolationTypeName(const int interpolationTypeId)
+{
+    return interpolationTypeId == kGB_Image_Interp_Average    ? "AV"
+         : interpolationTypeId == kGB_Image_Interp_Bilinear   ? "BI"
+         : interpolationTypeId == kGB_Image_Interp_Eagle      ? "EA"
+         : interpolationTypeId == kGB_Image_Interp_EPX        ? "EX"
+         : interpolationTypeId == kGB_Image_Interp_Lanczos3x3 ? "L3"
+         : interpolationTypeId == kGB_Image_Interp_Lanczos5x5 ? "L5"
+         : interpolationTypeId == kGB_Image_Interp_XBR        ? "XB"
+         :                                                      "NN";
+}//_GetInterpolationTypeName
+
+// Hands png to whichever archive is open, which takes ownership of it.
+static inline void _PutArchiveTile(const uint32_t x,
+                                   const uint32_t y,
+                                   const uint32_t z,
+                                   uint8_t*       png,
+                                   const size_t   png_n)
+{
+    if (_pmtiles != NULL)
+    {
+        gbPMTiles_Put(_pmtiles, x, y, z, png, png_n);
+    }//if
+    else
+    {
+        gbMBTiles_Put(_mbtiles, x, y, z, png, png_n);
+    }//else
+}//_PutArchiveTile
+
 typedef int Retile_OpModeType; enum
 {
     kRetile_OpMode_Downsample = 0,
     kRetile_OpMode_Enlarge    = 1,
+    kRetile_OpMode_Pyramid    = 2
+};
+
+typedef int Retile_StageType; enum
+{
+    kRetile_Stage_Read     = 0,
+    kRetile_Stage_Decode   = 1,
+    kRetile_Stage_Resample = 2,
+    kRetile_Stage_Encode   = 3,
+    kRetile_Stage_Write    = 4,
+    kRetile_Stage_Count    = 5
 };
 
 
@@ -436,173 +503,194 @@ void _ParseXYZ_FromTemplate(const char* src,
 //           1         2         3        |
 // 0123456789012345678901234567890123456789
 
-// =========================
-// _ParseAnddAddFileXYZ_ToDB
-// =========================
+// ============================
+// _ParseAndAddFileXYZ_ToIndex
+// ============================
 //
-// Attempts to parse tile x/y/z from the filename, and writes a row to db
-// if successful.  Waits for insert to complete.
+// Attempts to parse tile x/y/z from the full filepath, and adds it to the
+// index if successful.
 //
 // Not thread safe.
 //
-static inline void _ParseAnddAddFileXYZ_ToDB(const char*    filename,
-                                             const char*    srcPath,
-                                             sqlite3*       db,
-                                             sqlite3_stmt*  insertStmt,
-                                             size_t*        n,
-                                             const int      urlTemplateId)
+static inline void _ParseAndAddFileXYZ_ToIndex(const char*    filepath,
+                                               gbTileIndex*   idx,
+                                               size_t*        n,
+                                               const int      urlTemplateId)
 {
     uint32_t x;
     uint32_t y;
     uint32_t z;
-    char     filepath[1024];
-    int      result;
     
-    if (urlTemplateId == kRetile_Template_OSM)
-    {
-        _StringByAppendingPathComponent(filepath, srcPath, filename);
-        _ParseXYZ_FromTemplate(filepath, &x, &y, &z, urlTemplateId);
-    }//if
-    else
-    {
-        _ParseXYZ_FromTemplate(filename, &x, &y, &z, urlTemplateId); // not sure why legacy weren't doing the above
-    }//else
+    _ParseXYZ_FromTemplate(filepath, &x, &y, &z, urlTemplateId);    // legacy templates only look past the last slash
     
     if (x != UINT32_MAX && y != UINT32_MAX && z != UINT32_MAX
-        && z > 0)
+        && z > 0 && z <= kGB_TileIndex_MaxZ)
     {
-        _StringByAppendingPathComponent(filepath, srcPath, filename);
-        
-        sqlite3_bind_int (insertStmt, 1, x);
-        sqlite3_bind_int (insertStmt, 2, y);
-        sqlite3_bind_int (insertStmt, 3, z);
-        sqlite3_bind_text(insertStmt, 4, filepath, (int)strnlen(filepath, 1024), SQLITE_STATIC);
-        
-        // wait for DB write, since insert statement will be reused
-        while (true)
-        {
-            result = sqlite3_step(insertStmt);
-            
-            if (result == SQLITE_DONE)
-            {
-                break;
-            }//if
-            else if (result != SQLITE_BUSY)
-            {
-                printf("gbDB_CompressTileAndWriteSync_ReusingDatabase: DB error writing tile (%d, %d, %d): %s\n", x, y, z, sqlite3_errmsg(db));
-                break;
-            }//if
-        }//while
-        
-        sqlite3_clear_bindings(insertStmt);
-        sqlite3_reset(insertStmt);
+        gbTileIndex_Add(idx, x, y, z, filepath);
         
         *n = *n + 1;
     }//if
-}//_ParseAnddAddFileXYZ_ToDB
+}//_ParseAndAddFileXYZ_ToIndex
 
 
-// ==============
-// _ParsePathToDB
-// ==============
+typedef struct Retile_IndexScanContext
+{
+    gbTileIndex* idx;
+    size_t       n;
+    int          urlTemplateId;
+} Retile_IndexScanContext;
+
+
+// =======================
+// _ParseBatchToIndex_Work
+// =======================
+//
+// gbDirScan batch function.  Calls are serialized by gbDirScan, so adding to
+// the index here is safe.
+//
+static void _ParseBatchToIndex_Work(const char* const* filepaths,
+                                    const size_t       n,
+                                    void*              context)
+{
+    Retile_IndexScanContext* c = (Retile_IndexScanContext*)context;
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        _ParseAndAddFileXYZ_ToIndex(filepaths[i], c->idx, &(c->n), c->urlTemplateId);
+    }//for
+}//_ParseBatchToIndex_Work
+
+
+// =================
+// _ParsePathToIndex
+// =================
 //
 // Primary filesystem directory read function, which then invokes
-// _ParseAndAddFileXYZ_ToDB to do something with the results.
+// _ParseAndAddFileXYZ_ToIndex to do something with the results.
 //
-// Uses tinydir.h in an attempt to be multiplatform, but this is untested.
+// The tree is walked by gbDirScan on multiple threads, one directory (eg, an
+// OSM x column) per thread at a time, using readdir's d_type rather than a
+// stat() per entry.  Files are added to the index in batches.
 //
 // Allows for recursive scans.
 //
-static inline void _ParsePathToDB(const char*    srcPath,
-                                  sqlite3*       db,
-                                  sqlite3_stmt*  insertStmt,
-                                  size_t*        n,
-                                  const int      urlTemplateId,
-                                  const bool     isRecursive)
+static inline void _ParsePathToIndex(const char*    srcPath,
+                                     gbTileIndex*   idx,
+                                     size_t*        n,
+                                     const int      urlTemplateId,
+                                     const bool     isRecursive,
+                                     const int      thread_n)
 {
-    tinydir_dir dir;
-    tinydir_open(&dir, srcPath);
+    Retile_IndexScanContext c = { idx, 0, urlTemplateId };
     
-    while (dir.has_next)
-    {
-        tinydir_file file;
-        tinydir_readfile(&dir, &file);
-        
-        if (!file.is_dir
-            && file.name[0] != '.') // ignore annoying things like .DS_Store (or, even worse, unpacked .filename metadata copying HFS -> FAT32)
-        {
-            //printf("Found file: [%s] ... path: [%s]\n", file.name, srcPath);
-            
-            _ParseAnddAddFileXYZ_ToDB(file.name, srcPath, db, insertStmt, n, urlTemplateId);
-        }//if
-        else if (isRecursive
-                  && (strnlen(file.name, 1024) != 1 || strcmp(file.name, ".")  != 0)
-                  && (strnlen(file.name, 1024) != 2 || strcmp(file.name, "..") != 0)
-                  && file.name[0] != '.')
-        {
-            char* subPath = malloc(sizeof(char) * strnlen(srcPath, 1024) + 1UL); // heap to reduce stack pressure from multiple recursions
-            
-            _StringByAppendingPathComponent(subPath, srcPath, file.name);
-            
-            //printf("Found subpath: [%s]\n", subPath);
-            
-            _ParsePathToDB(subPath, db, insertStmt, n, urlTemplateId, isRecursive);
-            
-            free(subPath);
-            subPath = NULL;
-        }//if
-        
-        tinydir_next(&dir);
-    }//while
+    gbDirScan_Scan(srcPath, isRecursive, thread_n > 0 ? (size_t)thread_n : 0, _ParseBatchToIndex_Work, &c);
     
-    tinydir_close(&dir);
-}//_ParsePathToDB
+    *n = *n + c.n;
+}//_ParsePathToIndex
 
 
 
-// =============
-// _ReadPathToDB
-// =============
+// ======================
+// _MBTiles_SplitSrcPath:
+// ======================
+//
+// -inMBTiles src paths are <file>/<z>, after the /tiles/<z> of the other
+// formats, or just <file> for its highest zoom level.  (z = -1)
+//
+static void _MBTiles_SplitSrcPath(const char* srcPath,
+                                  char*       filePath,
+                                  int*        z)
+{
+    struct stat st;
+    
+    snprintf(filePath, 1024, "%s", srcPath);
+    *z = -1;
+    
+    char* slash = strrchr(filePath, '/');
+    
+    if (stat(filePath, &st) != 0 && slash != NULL && slash[1] >= '0' && slash[1] <= '9')
+    {
+        *z     = atoi(slash + 1);
+        *slash = '\0';
+    }//if
+}//_MBTiles_SplitSrcPath
+
+
+// gbMBTilesReader_ScanLevel function.  The filepath is only a name for logs.
+static void _ParseMBTilesTileToIndex(const uint32_t x,
+                                     const uint32_t y,
+                                     const uint32_t z,
+                                     void*          context)
+{
+    Retile_IndexScanContext* c = (Retile_IndexScanContext*)context;
+    char                     filepath[64];
+    
+    snprintf(filepath, sizeof(filepath), "mbtiles/%u/%u/%u.png", z, x, y);
+    
+    gbTileIndex_Add(c->idx, x, y, z, filepath);
+    c->n++;
+}//_ParseMBTilesTileToIndex
+
+
+// ================
+// _ReadPathToIndex
+// ================
 //
-// Reads files in srcPath recurisvely into a SQLite3 database at dbFilePath.
-// The tile x/y/z is parsed from the filename and stored into INT columns
-// for later data clustering.
+// Reads files in srcPath recurisvely into the in-memory tile index idx,
+// replacing its contents.  The tile x/y/z is parsed from the filename, and
+// the index is then sorted by quadkey for later data clustering.
+//
+// For kRetile_Template_MBTiles, the tiles of one level of _mbtilesSrc are
+// read instead, from its index only.  (see _MBTiles_SplitSrcPath)
 //
 // This is to avoid something like attemping to load every tile for that zoom
 // level, which would be absurdly inefficient.
 //
-size_t _ReadPathToDB(const char* srcPath,
-                     const char* dbFilePath,
-                     const int   urlTemplateId)
+size_t _ReadPathToIndex(const char*  srcPath,
+                        gbTileIndex* idx,
+                        const int    urlTemplateId,
+                        const int    thread_n)
 {
-    size_t        n = 0;
-    sqlite3*      db;
-    sqlite3_stmt* insertStmt;
-    
-    printf("Creating temporary DB (if needed)...\n");
+    size_t n = 0;
     
-    gbDB_CreateIfNeededDB(dbFilePath);
-    gbDB_ExecSQL_Generic(dbFilePath, "CREATE TABLE IF NOT EXISTS TileRef(ID INTEGER PRIMARY KEY, X INT, Y INT, Z INT, FilePath VARCHAR(1024));");
-    gbDB_ExecSQL_Generic(dbFilePath, "DELETE FROM TileRef;");
+    printf("Reading tile index...\n");
     
-    gbDB_PrepConn_DBPath_CString(dbFilePath, "INSERT INTO TileRef(X, Y, Z, FilePath) VALUES (?, ?, ?, ?);", &db, &insertStmt);
+    gbTileIndex_Clear(idx);
     
-    gbDB_BeginOrCommitTransactionReusingDB(db, true);
- 
-    _ParsePathToDB(srcPath, db, insertStmt, &n, urlTemplateId, true);
+    if (urlTemplateId == kRetile_Template_MBTiles)
+    {
+        char filePath[1024];
+        int  z;
+        
+        _MBTiles_SplitSrcPath(srcPath, filePath, &z);
+        
+        z = z >= 0 ? z : gbMBTilesReader_GetMaxZ(_mbtilesSrc);
+        
+        Retile_IndexScanContext c = { idx, 0, urlTemplateId };
+        
+        if (z >= 0 && z <= kGB_TileIndex_MaxZ)
+        {
+            gbMBTilesReader_ScanLevel(_mbtilesSrc, (uint32_t)z, _ParseMBTilesTileToIndex, &c);
+        }//if
+        
+        n = c.n;
+    }//if
+    else
+    {
+        _ParsePathToIndex(srcPath, idx, &n, urlTemplateId, true, thread_n);
+    }//else
     
-    printf("Closing DB and transaction...\n");
+    printf("Sorting tile index (n=%zu)...\n", n);
     
-    gbDB_BeginOrCommitTransactionReusingDB(db, false);
-    gbDB_CloseDBConnAndQueryStmt(db, insertStmt);
+    gbTileIndex_Sort(idx, thread_n > 0 ? (size_t)thread_n : 0);
     
     if (n == 0 && srcPath)
     {
-        printf("_ReadPathToDB: [ERR]  No files found at path [%s].\n", srcPath != NULL ? srcPath : "<NULL>");
+        printf("_ReadPathToIndex: [ERR]  No files found at path [%s].\n", srcPath != NULL ? srcPath : "<NULL>");
     }//if
     
     return n;
-}//_ReadPathToDB
+}//_ReadPathToIndex
 
 
 
@@ -662,6 +750,34 @@ static inline void _GetFilenameForXYZ_FromTemplate_OSM(const uint32_t x,
 
 
 
+// ==================================
+// _GetFilenameForXYZ_FromTemplateId:
+// ==================================
+//
+// Dest filename relative to the dest path for any urlTemplateId.
+//
+static inline void _GetFilenameForXYZ_FromTemplateId(const uint32_t x,
+                                                     const uint32_t y,
+                                                     const uint32_t z,
+                                                     const int      urlTemplateId,
+                                                     char*          dest)
+{
+    switch (urlTemplateId)
+    {
+        case kRetile_Template_ZXY:
+            _GetFilenameForZXY_FromTemplate(x, y, z, NULL, dest);
+            break;
+        case kRetile_Template_XYZ:
+            _GetFilenameForXYZ_FromTemplate(x, y, z, NULL, dest);
+            break;
+        default:
+            _GetFilenameForXYZ_FromTemplate_OSM(x, y, z, NULL, dest);
+            break;
+    }//switch
+}//_GetFilenameForXYZ_FromTemplateId
+
+
+
 // ==========================
 // _FixDestTileBufferIfNeeded
 // ==========================
@@ -700,41 +816,134 @@ static inline void _FixDestTileBufferIfNeeded(uint32_t**   dest_tile,
 
 
 
-// ==========================
-// _IncDecrementWithSemaphore
-// ==========================
+// ================
+// Retile_WorkQueue
+// ================
 //
-// Terrible mutex boilerplate code for wrapping read, increment and decrement ops for x.
+// Wraps whichever thread pooling backend is available, so the dispatch
+// wrappers don't need to care.
 //
-static inline int _IncDecrementWithSemaphore(int*                 x,
-                                             dispatch_semaphore_t sema,
-                                             const bool           isInc,
-                                             const bool           isDec)
+// - libdispatch (GCD), inferred via the Accelerate framework, as before.
+// - gbThreadPool (pthreads) otherwise.
+//
+// Both keep at most kRetile_MaxInFlight tasks queued or running at once,
+// which bounds the number of decoded tiles held in memory.
+//
+#define kRetile_MaxInFlight 32
+
+// Levels per single-pass pyramid subtree task. (4^3 = 64 src tiles max)
+#define kRetile_PyramidSubtreeDepth 3
+
+typedef struct Retile_WorkQueue
+{
+#ifdef __ACCELERATE__
+    dispatch_semaphore_t sema_write;
+    dispatch_group_t     group;
+#else
+    gbThreadPool*        pool;
+#endif
+} Retile_WorkQueue;
+
+
+
+#ifdef __ACCELERATE__
+typedef struct Retile_Work
+{
+    gbThreadPool_WorkFunction fn;
+    void*                     ctx;
+    Retile_WorkQueue*         wq;
+} Retile_Work;
+
+
+// ===========================
+// _WorkQueue_GCD_Trampoline:
+// ===========================
+//
+// dispatch_group_async_f target.  Runs the work, then releases its slot in
+// the parallelism limit semaphore.  The group tracks completion.
+//
+static void _WorkQueue_GCD_Trampoline(void* context)
 {
-    int retVal = -1;
+    Retile_Work* work = (Retile_Work*)context;
     
-    dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
+    work->fn(work->ctx);
     
-    if (isInc)
-    {
-        *x = *x + 1;
-    }//if
-    else if (isDec)
-    {
-        *x = *x - 1;
-    }//else if
+    dispatch_semaphore_signal(work->wq->sema_write);
     
-    retVal = *x;
+    free(work);
+}//_WorkQueue_GCD_Trampoline
+#endif
 
-    dispatch_semaphore_signal(sema);
-    
-    return retVal;
-}//_DecrementWithSemaphore
 
+// ================
+// _WorkQueue_Init:
+// ================
+//
+// thread_n is the number of worker threads for the pthreads backend.
+// (0 -> one per CPU)  libdispatch manages its own threads and ignores this.
+//
+static inline void _WorkQueue_Init(Retile_WorkQueue* wq,
+                                   const int         thread_n)
+{
+#ifdef __ACCELERATE__
+    wq->group      = dispatch_group_create();
+    wq->sema_write = dispatch_semaphore_create(kRetile_MaxInFlight);
+#else
+    wq->pool       = gbThreadPool_Create(thread_n > 0 ? (size_t)thread_n : 0, kRetile_MaxInFlight);
+#endif
+}//_WorkQueue_Init
 
 
+// ===================
+// _WorkQueue_AddWork:
+// ===================
+//
+// Runs fn(ctx) asynchronously.  Blocks while the parallelism limit is
+// reached.  Ownership of ctx passes to fn.
+//
+static inline void _WorkQueue_AddWork(Retile_WorkQueue*         wq,
+                                      gbThreadPool_WorkFunction fn,
+                                      void*                     ctx)
+{
+#ifdef __ACCELERATE__
+    Retile_Work* work = malloc(sizeof(Retile_Work));
+    
+    work->fn  = fn;
+    work->ctx = ctx;
+    work->wq  = wq;
+    
+    dispatch_semaphore_wait(wq->sema_write, DISPATCH_TIME_FOREVER);
+    
+    dispatch_group_async_f(wq->group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), work, _WorkQueue_GCD_Trampoline);
+#else
+    gbThreadPool_AddWork(wq->pool, fn, ctx);
+#endif
+}//_WorkQueue_AddWork
 
 
+// ==========================
+// _WorkQueue_WaitAndRelease:
+// ==========================
+//
+// Blocks until every task added has finished, then frees the backend.
+// There is no timeout; completion is signalled, not polled.
+//
+static inline void _WorkQueue_WaitAndRelease(Retile_WorkQueue* wq,
+                                             const char*       logPrefix)
+{
+    printf("%sWaiting on compress and write queue...\n", logPrefix);
+    
+#ifdef __ACCELERATE__
+    dispatch_group_wait(wq->group, DISPATCH_TIME_FOREVER);
+    
+    dispatch_release(wq->group);
+    dispatch_release(wq->sema_write);
+#else
+    gbThreadPool_WaitAll(wq->pool);
+    gbThreadPool_Destroy(wq->pool);
+    wq->pool = NULL;
+#endif
+}//_WorkQueue_WaitAndRelease
 
 
 
@@ -757,56 +966,36 @@ typedef struct Retile_Buffer
     uint32_t  z;
     char*     filename;
     char*     dest_filename;
+    bool      isView;       // data points into a larger buffer owned elsewhere
 } Retile_Buffer;
 
 
 
 
-// ==================
-// _CopyRetileBuffers
-// ==================
+// ===================
+// _ResetRetileBuffers
+// ===================
 //
-// Copies a collection of n Retile_Buffers to dest from src.
-// Any non-null data/filenames will be malloc'd and copied.
+// Sets a collection of n Retile_Buffers to empty, without freeing anything.
+// For buffers whose data and filenames are owned elsewhere.
 //
-static inline void _CopyRetileBuffers(Retile_Buffer* dest,
-                                      Retile_Buffer* src,
-                                      const size_t   n)
+static inline void _ResetRetileBuffers(Retile_Buffer* bufs,
+                                       const size_t   n)
 {
     for (size_t i = 0; i < n; i++)
     {
-        dest[i].data          = NULL;
-        dest[i].width         = src[i].width;
-        dest[i].height        = src[i].height;
-        dest[i].rowBytes      = src[i].rowBytes;
-        dest[i].x             = src[i].x;
-        dest[i].y             = src[i].y;
-        dest[i].z             = src[i].z;
-        dest[i].filename      = NULL;
-        dest[i].dest_filename = NULL;
-        
-        if (src[i].data != NULL)
-        {
-            dest[i].data = malloc(sizeof(uint8_t) * dest[i].height * dest[i].rowBytes);
-            
-            memcpy( (dest[i].data), (src[i].data), sizeof(uint8_t) * dest[i].height * dest[i].rowBytes);
-        }//if
-        
-        if (src[i].filename != NULL)
-        {
-            dest[i].filename = malloc(sizeof(char) * 1024);
-            
-            memcpy( (dest[i].filename), (src[i].filename), sizeof(char) * 1024);
-        }//if
-        
-        if (src[i].dest_filename != NULL)
-        {
-            dest[i].dest_filename = malloc(sizeof(char) * 1024);
-            
-            memcpy( (dest[i].dest_filename), (src[i].dest_filename), sizeof(char) * 1024);
-        }//if
+        bufs[i].data          = NULL;
+        bufs[i].width         = 0;
+        bufs[i].height        = 0;
+        bufs[i].rowBytes      = 0;
+        bufs[i].x             = 0;
+        bufs[i].y             = 0;
+        bufs[i].z             = 0;
+        bufs[i].filename      = NULL;
+        bufs[i].dest_filename = NULL;
+        bufs[i].isView        = false;
     }//for
-}//_CopyRetileBuffers
+}//_ResetRetileBuffers
 
 
 
@@ -844,132 +1033,6 @@ static inline void _FreeRetileBuffersData(Retile_Buffer* src,
 
 
 
-// ==================================================
-// _DownsampleCompressAndWrite_RetileBuffers_RGBA8888
-// ==================================================
-//
-// For references to a group of tiles in rt_bufs,
-// read, decompess, resample, composite, compress and write a PNG file.
-//
-static inline void _DownsampleCompressAndWrite_RetileBuffers_RGBA8888(const char*    filepath,
-                                                                      Retile_Buffer* rt_bufs,
-                                                                      const size_t   rt_buf_n,
-                                                                      const bool     alsoReprocessSrc,
-                                                                      const int interpolationTypeId)
-{
-    size_t   local_width    = 256;
-    size_t   local_height   = 256;
-    size_t   local_rowBytes = 1024;
-    uint32_t local_x        = 0;
-    uint32_t local_y        = 0;
-    uint32_t local_z        = 0;
-    size_t   valid_n        = 0;
-    
-    uint32_t* local_rgba = malloc(sizeof(uint8_t) * local_height * local_rowBytes);
-    
-    memset(local_rgba, 0, sizeof(uint32_t) * local_height * local_width);
-    
-    for (size_t i = 0; i < rt_buf_n; i++)
-    {
-        if (rt_bufs[i].filename != NULL)
-        {
-            gbImage_PNG_Read_RGBA8888(  rt_bufs[i].filename,
-                                      &(rt_bufs[i].data),
-                                      &(rt_bufs[i].width),
-                                      &(rt_bufs[i].height),
-                                      &(rt_bufs[i].rowBytes));
-            
-            if (rt_bufs[i].data != NULL)
-            {
-                _FixDestTileBufferIfNeeded(&local_rgba,
-                                           &local_width,     &local_height,     &local_rowBytes,
-                                           rt_bufs[i].width, rt_bufs[i].height, rt_bufs[i].rowBytes);
-                
-                local_x = rt_bufs[i].x >> 1;
-                local_y = rt_bufs[i].y >> 1;
-                local_z = rt_bufs[i].z  - 1;
-                
-                gbImage_Resize_HalfTile_RGBA8888((uint8_t*)(rt_bufs[i].data),
-                                                 rt_bufs[i].x, rt_bufs[i].y, rt_bufs[i].z,
-                                                 (uint8_t*)local_rgba,
-                                                 local_x, local_y, local_z,
-                                                 rt_bufs[i].rowBytes / rt_bufs[i].width,
-                                                 rt_bufs[i].width, rt_bufs[i].height, rt_bufs[i].rowBytes,
-                                                 interpolationTypeId);
-                
-                if (alsoReprocessSrc)
-                {
-                    gbImage_PNG_Write_RGBA8888(rt_bufs[i].dest_filename, rt_bufs[i].width, rt_bufs[i].height, (uint8_t*)rt_bufs[i].data);
-                    
-                    if (strcmp(rt_bufs[i].filename, rt_bufs[i].dest_filename) != 0)
-                    {
-                        remove(rt_bufs[i].filename); // delete src if different formats
-                    }//if
-                }//if
-                
-                valid_n++;
-            }//if
-        }//if
-    }//for
-    
-    if (valid_n > 0)
-    {
-        gbImage_PNG_Write_RGBA8888(filepath, local_width, local_height, (uint8_t*)local_rgba);
-    }//if
-    
-    free(local_rgba);
-    local_rgba = NULL;
-}//_DownsampleCompressAndWriteTile_RetileBuffers_RGBA8888
-
-
-// ==================================================================
-// _DownsampleCompressAndWrite_RetileBuffers_DispatchWrapper_RGBA8888
-// ==================================================================
-//
-// Wrapper for _ResampleCompressAndWrite_RetileBuffers_RGBA8888 that uses Apple's
-// GCD thread pooling.
-//
-// 1. Copies all src data from the reader.
-// 2. Waits for parallelism limit semaphore. (sema_write) (blocking)
-// 3. Locks and decrements queue_n when done (sema_idx)
-//
-static inline void _DownsampleCompressAndWrite_RetileBuffers_DispatchWrapper_RGBA8888(const char*          filepath,
-                                                                                      Retile_Buffer*       rt_bufs,
-                                                                                      const size_t         rt_buf_n,
-                                                                                      dispatch_semaphore_t sema_write,
-                                                                                      dispatch_semaphore_t sema_idx,
-                                                                                      int*                 queue_n,
-                                                                                      const bool           alsoReprocessSrc,
-                                                                                      const int            interpolationTypeId)
-{
-#ifdef __ACCELERATE__
-    // copy filenames and refs synchronously, as they are stack alloc / reused
-    
-    const size_t   local_rt_buf_n = rt_buf_n;
-    char*          local_filepath = malloc(sizeof(char) * 1024);
-    Retile_Buffer* local_rt_bufs  = malloc(sizeof(Retile_Buffer) * local_rt_buf_n);
-    
-    memcpy(local_filepath, filepath, 1024);
-    
-    _CopyRetileBuffers(local_rt_bufs, rt_bufs, local_rt_buf_n);
-    
-    dispatch_semaphore_wait(sema_write, DISPATCH_TIME_FOREVER);
-    
-    
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        
-        _DownsampleCompressAndWrite_RetileBuffers_RGBA8888(local_filepath, local_rt_bufs, local_rt_buf_n, alsoReprocessSrc, interpolationTypeId);
-        
-        _FreeRetileBuffersData(local_rt_bufs, local_rt_buf_n);
-        free(local_filepath);
-        free(local_rt_bufs);
-        
-        dispatch_semaphore_signal(sema_write);
-        
-        _IncDecrementWithSemaphore(queue_n, sema_idx, false, true);
-    });
-#endif
-}//_DownsampleCompressAndWriteTile_RetileBuffers_DispatchWrapper_RGBA8888
 
 
 
@@ -1000,6 +1063,7 @@ static inline void _GetFilepathAndCreateIntermediatePathsIfNeeded(char*
             _StringByAppendingPathComponent(sub_dest_path, basePath, temp_char_comp);
             mkdir(sub_dest_path, 0777);
             *last_path_created_z = z;
+            *last_path_created_x = UINT32_MAX;  // same x, other z, is another dir
         }//if
         
         if (x != *last_path_created_x)
@@ -1042,47 +1106,2672 @@ static inline void _GetFilepathAndCreateIntermediatePathsIfNeeded(char*
 
 
 
-
-
-// =======================
-// _QueueDownsampleFromDB:
-// =======================
+// ===============
+// Retile_Progress
+// ===============
 //
-// Main raster tile pyramid level downsampling (z -> z-1) function.
+// -resume: an append-only log of finished work, so a -zOut / -zOutTo run that
+// was interrupted can carry on where it left off rather than start over.
 //
-// For a database at dbFilePath populated by _ReadPathToDB, this uses limited
-// data clustering based on Microsoft's QuadKey to make sure each "quad" of
-// tiles to be downsampled (which can be 1-4 tiles) are read consecutively.
-// This clustering allows for a performant, scalable approach to the problem.
+// The log is <destPath>/.retile_progress, one record per line:  (with -shard,
+// .retile_progress.<i>of<n>, so shards sharing a dest keep separate logs)
 //
-// (more info: http://msdn.microsoft.com/en-us/library/bb259689.aspx )
+//     run   <src_z> <dest_min_z>    the run the log belongs to
+//     tile  <z> <key>               all tiles of z up to key (hex) are written
+//     level <z>                     all of z is written
+//
+// Tiles finish out of order, so the tile key is a watermark, only advanced
+// past a tile once every tile queued before it is done as well.  tile records
+// are written every kRetile_ProgressBatchN tiles, and a tile costs a mutex
+// and a compare or two; a lost record only means a few tiles are redone.
+//
+// For -zOutTo, the watermark is kept at the subtree level, and logged after
+// every subtree. (see _QueuePyramidFromIndex)  The log is deleted when the
+// run completes.
+//
+#define kRetile_ProgressBatchN  256
+#define kRetile_ProgressLogName ".retile_progress"
+
+typedef struct Retile_Progress
+{
+    FILE*           fp;
+    char            path[1024];
+    pthread_mutex_t mutex;
+    bool            isLevelDone[kGB_TileIndex_MaxZ + 1];
+    uint64_t        resumeKey  [kGB_TileIndex_MaxZ + 1];    // UINT64_MAX -> none
+    
+    uint32_t        z;                      // current level
+    size_t          push_n;                 // seqs handed out
+    size_t          next_seq;               // lowest seq not yet done
+    uint64_t        last_key;               // key of next_seq - 1
+    size_t          unlogged_n;
+    size_t          batch_n;                // unlogged_n that triggers a record
+    size_t*         pending_seqs;           // done, but after next_seq
+    uint64_t*       pending_keys;
+    size_t          pending_n;
+    size_t          pending_cap;
+} Retile_Progress;
+
+
+
+
+// ===============
+// _Progress_Open:
+// ===============
+//
+// Starts a log, logName, in destPath.  If shouldResume and a log for the same
+// src_z and dest_min_z is there, it is loaded and appended to; otherwise it is
+// replaced.
+//
+static void _Progress_Open(Retile_Progress* p,
+                           const char*      destPath,
+                           const char*      logName,
+                           const uint32_t   src_z,
+                           const uint32_t   dest_min_z,
+                           const bool       shouldResume)
+{
+    memset(p, 0, sizeof(Retile_Progress));
+    
+    for (size_t i = 0; i <= kGB_TileIndex_MaxZ; i++)
+    {
+        p->resumeKey[i] = UINT64_MAX;
+    }//for
+    
+    pthread_mutex_init(&p->mutex, NULL);
+    
+    mkdir(destPath, 0777);
+    
+    _StringByAppendingPathComponent(p->path, destPath, logName);
+    
+    FILE* fp      = shouldResume ? fopen(p->path, "r") : NULL;
+    bool  isValid = false;
+    
+    if (fp != NULL)
+    {
+        char     line[256];
+        char     kind[16];
+        uint32_t a;
+        uint64_t b;
+        
+        isValid = fgets(line, sizeof(line), fp) != NULL
+                  && sscanf(line, "run %u %llu", &a, (unsigned long long*)&b) == 2
+                  && a == src_z && b == dest_min_z;
+        
+        while (isValid && fgets(line, sizeof(line), fp) != NULL)
+        {
+            const int n = sscanf(line, "%15s %u %llx", kind, &a, (unsigned long long*)&b);
+            
+            if (n >= 2 && a <= kGB_TileIndex_MaxZ)
+            {
+                if (n == 3 && strcmp(kind, "tile") == 0)
+                {
+                    p->resumeKey[a] = b;            // later records win
+                }//if
+                else if (strcmp(kind, "level") == 0)
+                {
+                    p->isLevelDone[a] = true;
+                }//else if
+            }//if
+        }//while
+        
+        fclose(fp);
+        
+        if (!isValid)
+        {
+            printf("Retile: [WARN] %s is for a different run, starting over.\n", p->path);
+        }//if
+    }//if
+    else if (shouldResume)
+    {
+        printf("Retile: No progress log at %s, starting from the beginning.\n", p->path);
+    }//else if
+    
+    if (isValid)
+    {
+        for (size_t i = 0; i <= kGB_TileIndex_MaxZ; i++)
+        {
+            if (p->isLevelDone[i] || p->resumeKey[i] != UINT64_MAX)
+            {
+                printf("Retile: Resuming, z=%d %s.\n", (int)i, p->isLevelDone[i] ? "is done" : "is partly done");
+            }//if
+        }//for
+    }//if
+    
+    p->fp = fopen(p->path, isValid ? "a" : "w");
+    
+    if (p->fp == NULL)
+    {
+        printf("Retile: [WARN] Could not open %s, progress will not be saved.\n", p->path);
+    }//if
+    else if (!isValid)
+    {
+        fprintf(p->fp, "run %u %u\n", src_z, dest_min_z);
+        fflush(p->fp);
+    }//else if
+}//_Progress_Open
+
+
+
+
+// =====================
+// _Progress_BeginLevel:
+// =====================
+//
+// Resets the watermark for level z.  Seqs start from 0 again.  A record is
+// written every batch_n tiles.
+//
+static void _Progress_BeginLevel(Retile_Progress* p,
+                                 const uint32_t   z,
+                                 const size_t     batch_n)
+{
+    pthread_mutex_lock(&p->mutex);
+    
+    p->z          = z;
+    p->batch_n    = batch_n > 0 ? batch_n : 1;
+    p->push_n     = 0;
+    p->next_seq   = 0;
+    p->last_key   = UINT64_MAX;
+    p->unlogged_n = 0;
+    p->pending_n  = 0;
+    
+    pthread_mutex_unlock(&p->mutex);
+}//_Progress_BeginLevel
+
+
+
+
+// ===============
+// _Progress_Done:
+// ===============
+//
+// Marks tile seq, with key, as written.  Thread safe.
+//
+static void _Progress_Done(Retile_Progress* p,
+                           const size_t     seq,
+                           const uint64_t   key)
+{
+    pthread_mutex_lock(&p->mutex);
+    
+    if (seq != p->next_seq)
+    {
+        if (p->pending_n == p->pending_cap)
+        {
+            p->pending_cap  = p->pending_cap > 0 ? p->pending_cap * 2 : 64;
+            p->pending_seqs = realloc(p->pending_seqs, sizeof(size_t)   * p->pending_cap);
+            p->pending_keys = realloc(p->pending_keys, sizeof(uint64_t) * p->pending_cap);
+        }//if
+        
+        p->pending_seqs[p->pending_n] = seq;
+        p->pending_keys[p->pending_n] = key;
+        p->pending_n++;
+    }//if
+    else
+    {
+        p->last_key = key;
+        p->next_seq++;
+        p->unlogged_n++;
+        
+        size_t i = 0;
+        
+        while (i < p->pending_n)                    // at most what is in flight
+        {
+            if (p->pending_seqs[i] == p->next_seq)
+            {
+                p->last_key = p->pending_keys[i];
+                p->next_seq++;
+                p->unlogged_n++;
+                
+                p->pending_n--;
+                p->pending_seqs[i] = p->pending_seqs[p->pending_n];
+                p->pending_keys[i] = p->pending_keys[p->pending_n];
+                i = 0;
+            }//if
+            else
+            {
+                i++;
+            }//else
+        }//while
+        
+        if (p->unlogged_n >= p->batch_n && p->fp != NULL)
+        {
+            fprintf(p->fp, "tile %u %llx\n", p->z, (unsigned long long)p->last_key);
+            fflush(p->fp);
+            p->unlogged_n = 0;
+        }//if
+    }//else
+    
+    pthread_mutex_unlock(&p->mutex);
+}//_Progress_Done
+
+
+
+
+// ===================
+// _Progress_EndLevel:
+// ===================
+//
+// Records that all of level z is written.
+//
+static void _Progress_EndLevel(Retile_Progress* p,
+                               const uint32_t   z)
+{
+    pthread_mutex_lock(&p->mutex);
+    
+    p->isLevelDone[z] = true;
+    
+    if (p->fp != NULL)
+    {
+        fprintf(p->fp, "level %u\n", z);
+        fflush(p->fp);
+    }//if
+    
+    pthread_mutex_unlock(&p->mutex);
+}//_Progress_EndLevel
+
+
+
+
+// ================
+// _Progress_Close:
+// ================
+//
+// Closes the log, deleting it if isComplete.
+//
+static void _Progress_Close(Retile_Progress* p,
+                            const bool       isComplete)
+{
+    if (p->fp != NULL)
+    {
+        fclose(p->fp);
+        p->fp = NULL;
+        
+        if (isComplete)
+        {
+            unlink(p->path);
+        }//if
+    }//if
+    
+    free(p->pending_seqs);
+    free(p->pending_keys);
+    
+    pthread_mutex_destroy(&p->mutex);
+}//_Progress_Close
+
+
+
+
+// ===============
+// Retile_Pipeline
+// ===============
+//
+// The downsample (-zOut) and enlarge (-zIn) paths run each unit of work
+// through a gbPipeline of five stages, rather than having one worker do
+// everything for it in sequence:
+//
+//   read -> decode -> resample -> encode -> write
+//
+// read and write are blocking file I/O, the rest are CPU bound, and each
+// stage has its own worker threads and bounded queue.  This lets the disk
+// (or NFS mount) stay busy while the CPUs compress, and vice versa.
+//
+// A unit of work is a Retile_PipelineItem: the quad of src tiles for one
+// downsampled tile, or the single src tile to be enlarged.  After resampling,
+// an enlarge item is split into one Retile_PipelinePart per dest tile, so its
+// 4 (or 16, 64...) children are encoded and written in parallel rather than
+// by one encode worker in turn; throughput then scales with the dest tile
+// count, not the src tile count.  Other items are a single part.
+//
+// Items and tile-sized RGBA buffers are recycled through gbBufferPools rather
+// than malloc'd and freed for every tile.  An item's path strings are kept in
+// the item itself, so queueing one is a single pool get plus a few short
+// string copies.
+//
+// The pipeline uses pthreads directly, with or without libdispatch.
+//
+typedef struct Retile_PipelineConfig
+{
+    int thread_n[kRetile_Stage_Count];      // 0 -> default for that stage
+    int queue_depth;                        // 0 -> kRetile_MaxInFlight
+} Retile_PipelineConfig;
+
+#define kRetile_TileBufferBytes     (256 * 256 * 4)
+#define kRetile_PipelineItem_MaxSrc 4
+#define kRetile_MaxEnlargeN         4   // -zIn <n>: 340 dest tiles, ~85MB RGBA, per src tile
+#define kRetile_PipelineItem_PathN  ((1 + kRetile_PipelineItem_MaxSrc) * 1024)  // filepath + reprocess dest per src
+
+typedef struct Retile_PipelineContext
+{
+    const char*      destPath;
+    int              urlTemplateId;
+    int              interpolationTypeId;
+    bool             alsoReprocessSrc;
+    bool             isEnlarge;
+    uint32_t         dest_z_shift;          // enlarge only
+    gbBufferPool*    tile_pool;             // kRetile_TileBufferBytes RGBA tiles
+    gbBufferPool*    item_pool;             // Retile_PipelineItems
+    gbBufferPool*    part_pool;             // Retile_PipelineParts
+    gbPipeline*      pipe;                  // for forking parts
+    Retile_Progress* progress;              // NULL -> not logged
+} Retile_PipelineContext;
+
+// For reprocessed src tiles, dest[i].filename is where the recompressed tile
+// is written, and dest[i].dest_filename (if not NULL) is the original, which
+// is deleted afterwards.  For enlarged tiles, dest[i].filename is NULL and the
+// path is created by the write stage.
+//
+// No filename is owned by its Retile_Buffer: src[i].filename points into the
+// tile index, which outlives the pipeline, and all others into paths.
+typedef struct Retile_PipelineItem
+{
+    const char*    filepath;                // downsample only, the dest tile
+    Retile_Buffer  src      [kRetile_PipelineItem_MaxSrc];
+    size_t         src_n;
+    uint8_t*       src_png  [kRetile_PipelineItem_MaxSrc];  // read -> decode
+    size_t         src_png_n[kRetile_PipelineItem_MaxSrc];
+    Retile_Buffer* dest;                    // resample -> encode
+    size_t         dest_n;
+    uint8_t**      dest_whole;              // enlarge, whole-tile kernels: the buffers dest views point into
+    size_t         dest_whole_n;
+    uint8_t**      dest_png;                // encode -> write
+    size_t*        dest_png_n;
+    size_t         part_n;                  // parts not yet written
+    size_t         progress_seq;
+    uint64_t       progress_key;            // UINT64_MAX -> not logged
+    size_t         path_n;                  // bytes of paths used
+    char           paths[kRetile_PipelineItem_PathN];
+} Retile_PipelineItem;
+
+// encode -> write: dest[start] to dest[end - 1] of an item.  The item is
+// freed along with its last part.
+typedef struct Retile_PipelinePart
+{
+    Retile_PipelineItem* it;
+    size_t               start;
+    size_t               end;
+} Retile_PipelinePart;
+
+
+
+
+// ========================
+// _Pipeline_GetTileBuffer:
+// ========================
+//
+// A buffer of size bytes, from the tile pool if it is the pool's size.
+//
+static inline uint32_t* _Pipeline_GetTileBuffer(const Retile_PipelineContext* c,
+                                                const size_t                  size)
+{
+    return size == gbBufferPool_GetBufferSize(c->tile_pool) ? gbBufferPool_Get(c->tile_pool) : malloc(size);
+}//_Pipeline_GetTileBuffer
+
+
+
+
+// =======================
+// _Pipeline_ReleaseTiles:
+// =======================
+//
+// Returns the data of n buffers to the tile pool.  (or frees it, if it is
+// some other size)  Views are just dropped.  Filenames are not touched.
+//
+static inline void _Pipeline_ReleaseTiles(const Retile_PipelineContext* c,
+                                          Retile_Buffer*                bufs,
+                                          const size_t                  n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (bufs[i].data != NULL)
+        {
+            if (!bufs[i].isView)
+            {
+                gbBufferPool_Put(c->tile_pool, bufs[i].data, bufs[i].height * bufs[i].rowBytes);
+            }//if
+            
+            bufs[i].data = NULL;
+        }//if
+    }//for
+}//_Pipeline_ReleaseTiles
+
+
+// Frees the whole-tile buffers of an item, once nothing views them.
+static inline void _Pipeline_ReleaseWholeTiles(Retile_PipelineItem* it)
+{
+    for (size_t i = 0; i < it->dest_whole_n; i++)
+    {
+        free(it->dest_whole[i]);
+    }//for
+    
+    if (it->dest_whole != NULL)
+    {
+        free(it->dest_whole);
+        it->dest_whole = NULL;
+    }//if
+    
+    it->dest_whole_n = 0;
+}//_Pipeline_ReleaseWholeTiles
+
+
+
+
+// ===================
+// _PipelineItem_Free:
+// ===================
+//
+// Frees anything an item still holds, and returns it to the item pool.
+//
+static void _PipelineItem_Free(Retile_PipelineItem*          it,
+                               const Retile_PipelineContext* c)
+{
+    _Pipeline_ReleaseTiles(c, it->src, it->src_n);
+    
+    for (size_t i = 0; i < it->src_n; i++)
+    {
+        if (it->src_png[i] != NULL)
+        {
+            free(it->src_png[i]);
+        }//if
+    }//for
+    
+    if (it->dest != NULL)
+    {
+        _Pipeline_ReleaseTiles(c, it->dest, it->dest_n);
+        
+        for (size_t i = 0; i < it->dest_n; i++)
+        {
+            if (it->dest_png[i] != NULL)
+            {
+                free(it->dest_png[i]);
+            }//if
+        }//for
+        
+        free(it->dest);
+        free(it->dest_png);
+        free(it->dest_png_n);
+    }//if
+    
+    _Pipeline_ReleaseWholeTiles(it);
+    
+    if (c->progress != NULL && it->progress_key != UINT64_MAX)
+    {
+        _Progress_Done(c->progress, it->progress_seq, it->progress_key);
+    }//if
+    
+    gbBufferPool_Put(c->item_pool, it, sizeof(Retile_PipelineItem));
+}//_PipelineItem_Free
+
+
+
+
+// ======================
+// _PipelineItem_AddDest:
+// ======================
+//
+// Appends a dest tile to the item.  Takes ownership of data, which must be
+// from _Pipeline_GetTileBuffer.  filename and dest_filename must live as long
+// as the item.
+//
+static inline void _PipelineItem_AddDest(Retile_PipelineItem* it,
+                                         uint32_t*            data,
+                                         const size_t         width,
+                                         const size_t         height,
+                                         const size_t         rowBytes,
+                                         const uint32_t       x,
+                                         const uint32_t       y,
+                                         const uint32_t       z,
+                                         char*                filename,
+                                         char*                dest_filename)
+{
+    Retile_Buffer* b = &(it->dest[it->dest_n]);
+    
+    b->data          = data;
+    b->width         = width;
+    b->height        = height;
+    b->rowBytes      = rowBytes;
+    b->x             = x;
+    b->y             = y;
+    b->z             = z;
+    b->filename      = filename;
+    b->dest_filename = dest_filename;
+    b->isView        = false;
+    
+    it->dest_png  [it->dest_n] = NULL;
+    it->dest_png_n[it->dest_n] = 0;
+    it->dest_n++;
+}//_PipelineItem_AddDest
+
+
+
+
+// =======================
+// _PipelineItem_CopyPath:
+// =======================
+//
+// Copies src into the item's path arena, returning the copy.
+//
+static inline char* _PipelineItem_CopyPath(Retile_PipelineItem* it,
+                                           const char*          src)
+{
+    const size_t len  = strnlen(src, 1023) + 1;
+    char*        dest = &(it->paths[it->path_n]);
+    
+    if (it->path_n + len > sizeof(it->paths))
+    {
+        printf("_PipelineItem_CopyPath: [ERR] Path arena full, dropping [%s]\n", src);
+        return NULL;
+    }//if
+    
+    memcpy(dest, src, len - 1);
+    dest[len - 1] = '\0';
+    it->path_n   += len;
+    
+    return dest;
+}//_PipelineItem_CopyPath
+
+
+
+
+// ==================
+// _ReadFileToBuffer:
+// ==================
+//
+// Reads an entire file into a malloc'd buffer.  Returns NULL on failure.
+//
+static uint8_t* _ReadFileToBuffer(const char* filename,
+                                  size_t*     size)
+{
+    uint8_t* buf = NULL;
+    FILE*    fp  = fopen(filename, "rb");
+    
+    *size = 0;
+    
+    if (fp == NULL)
+    {
+        printf("_ReadFileToBuffer: can't open file [%s]\n", filename);
+        return NULL;
+    }//if
+    
+    if (fseek(fp, 0, SEEK_END) == 0)
+    {
+        const long n = ftell(fp);
+        
+        if (n > 0 && fseek(fp, 0, SEEK_SET) == 0)
+        {
+            buf = malloc((size_t)n);
+            
+            if (fread(buf, 1, (size_t)n, fp) == (size_t)n)
+            {
+                *size = (size_t)n;
+            }//if
+            else
+            {
+                printf("_ReadFileToBuffer: short read [%s]\n", filename);
+                free(buf);
+                buf = NULL;
+            }//else
+        }//if
+    }//if
+    
+    fclose(fp);
+    
+    return buf;
+}//_ReadFileToBuffer
+
+
+// The encoded src tile of b, from its file or from _mbtilesSrc.
+static inline uint8_t* _ReadSrcTileToBuffer(const Retile_Buffer* b,
+                                            size_t*              size)
+{
+    return _mbtilesSrc != NULL ? gbMBTilesReader_Read(_mbtilesSrc, b->x, b->y, b->z, size)
+                               : _ReadFileToBuffer(b->filename, size);
+}//_ReadSrcTileToBuffer
+
+
+
+
+// ===================
+// _WriteBufferToFile:
+// ===================
+//
+// Returns true on success.
+//
+static bool _WriteBufferToFile(const char*    filename,
+                               const uint8_t* src,
+                               const size_t   size)
+{
+    FILE* fp = fopen(filename, "wb");
+    
+    if (fp == NULL)
+    {
+        fprintf(stderr, "_WriteBufferToFile: Could not open file %s for writing\n", filename);
+        return false;
+    }//if
+    
+    const bool isOK = fwrite(src, 1, size, fp) == size;
+    
+    if (fclose(fp) != 0 || !isOK)
+    {
+        fprintf(stderr, "_WriteBufferToFile: Error writing %s\n", filename);
+        return false;
+    }//if
+    
+    return true;
+}//_WriteBufferToFile
+
+
+
+
+// =============================================
+// _Pipeline_Read_Work ... _Pipeline_Write_Work:
+// =============================================
+//
+// gbPipeline stage functions.  context is the Retile_PipelineContext.
+//
+static void* _Pipeline_Read_Work(void* item, void* context)
+{
+    Retile_PipelineItem* it = (Retile_PipelineItem*)item;
+    
+    for (size_t i = 0; i < it->src_n; i++)
+    {
+        if (it->src[i].filename != NULL)
+        {
+            it->src_png[i] = _ReadSrcTileToBuffer(&(it->src[i]), &(it->src_png_n[i]));
+        }//if
+    }//for
+    
+    return it;
+}//_Pipeline_Read_Work
+
+
+static void* _Pipeline_Decode_Work(void* item, void* context)
+{
+    Retile_PipelineItem*          it = (Retile_PipelineItem*)item;
+    const Retile_PipelineContext* c  = (const Retile_PipelineContext*)context;
+    
+    for (size_t i = 0; i < it->src_n; i++)
+    {
+        if (it->src_png[i] != NULL)
+        {
+            uint32_t* buf = gbBufferPool_Get(c->tile_pool);
+            
+            gbImage_PNG_Read_RGBA8888_FromMemory_ReusingBuffer(  it->src_png[i],
+                                                                 it->src_png_n[i],
+                                                                 it->src[i].filename,
+                                                                 buf,
+                                                                 gbBufferPool_GetBufferSize(c->tile_pool),
+                                                               &(it->src[i].data),
+                                                               &(it->src[i].width),
+                                                               &(it->src[i].height),
+                                                               &(it->src[i].rowBytes));
+            
+            if (it->src[i].data != buf)
+            {
+                gbBufferPool_Put(c->tile_pool, buf, gbBufferPool_GetBufferSize(c->tile_pool));
+            }//if
+            
+            free(it->src_png[i]);
+            it->src_png[i]   = NULL;
+            it->src_png_n[i] = 0;
+        }//if
+    }//for
+    
+    return it;
+}//_Pipeline_Decode_Work
+
+
+// Moves a decoded src tile into the item's dest tiles for recompression.
+static inline void _Pipeline_AddReprocessDest(Retile_PipelineItem* it,
+                                              Retile_Buffer*       src)
+{
+    _PipelineItem_AddDest(it, src->data, src->width, src->height, src->rowBytes, src->x, src->y, src->z,
+                          src->dest_filename,
+                          strcmp(src->filename, src->dest_filename) != 0 ? src->filename : NULL); // delete src if different formats
+    src->data = NULL;
+}//_Pipeline_AddReprocessDest
+
+
+// Downsample: composites up to 4 src tiles into one z-1 tile.
+static void _Pipeline_Resample_Downsample(Retile_PipelineItem*          it,
+                                          const Retile_PipelineContext* c)
+{
+    size_t   local_width    = 256;
+    size_t   local_height   = 256;
+    size_t   local_rowBytes = 1024;
+    uint32_t local_x        = 0;
+    uint32_t local_y        = 0;
+    uint32_t local_z        = 0;
+    size_t   valid_n        = 0;
+    
+    uint32_t* local_rgba = _Pipeline_GetTileBuffer(c, sizeof(uint8_t) * local_height * local_rowBytes);
+    
+    memset(local_rgba, 0, sizeof(uint32_t) * local_height * local_width);
+    
+    it->dest       = malloc(sizeof(Retile_Buffer) * (it->src_n + 1));
+    it->dest_png   = malloc(sizeof(uint8_t*)      * (it->src_n + 1));
+    it->dest_png_n = malloc(sizeof(size_t)        * (it->src_n + 1));
+    
+    for (size_t i = 0; i < it->src_n; i++)
+    {
+        if (it->src[i].data != NULL)
+        {
+            _FixDestTileBufferIfNeeded(&local_rgba,
+                                       &local_width,     &local_height,     &local_rowBytes,
+                                       it->src[i].width, it->src[i].height, it->src[i].rowBytes);
+            
+            local_x = it->src[i].x >> 1;
+            local_y = it->src[i].y >> 1;
+            local_z = it->src[i].z  - 1;
+            
+            gbImage_Resize_HalfTile_RGBA8888((uint8_t*)(it->src[i].data),
+                                             it->src[i].x, it->src[i].y, it->src[i].z,
+                                             (uint8_t*)local_rgba,
+                                             local_x, local_y, local_z,
+                                             it->src[i].rowBytes / it->src[i].width,
+                                             it->src[i].width, it->src[i].height, it->src[i].rowBytes,
+                                             c->interpolationTypeId);
+            
+            if (c->alsoReprocessSrc && it->src[i].dest_filename != NULL)
+            {
+                _Pipeline_AddReprocessDest(it, &(it->src[i]));
+            }//if
+            
+            valid_n++;
+        }//if
+    }//for
+    
+    if (valid_n > 0)
+    {
+        _PipelineItem_AddDest(it, local_rgba, local_width, local_height, local_rowBytes, local_x, local_y, local_z,
+                              (char*)it->filepath, NULL);
+    }//if
+    else
+    {
+        gbBufferPool_Put(c->tile_pool, local_rgba, sizeof(uint8_t) * local_height * local_rowBytes);
+    }//else
+}//_Pipeline_Resample_Downsample
+
+
+// Enlarge, one level, for the padded kernels: parent is padded and resampled
+// once, and its up to 4 z+1 children are added as views into the result,
+// which the item owns until they have been encoded.
+static void _Pipeline_Resample_EnlargeWhole(Retile_PipelineItem*          it,
+                                            const Retile_PipelineContext* c,
+                                            const Retile_Buffer*          parent)
+{
+    const size_t w     = parent->width;
+    const size_t h     = parent->height;
+    const size_t roi_w = w >> 1;
+    const size_t roi_h = h >> 1;
+    bool         isEmpty[4];
+    bool         isAllEmpty = true;
+    
+    // same test as gbImage_Resize_EnlargeTile_RGBA8888's roiWasEmpty
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        const size_t roi_x = (i & 1)  * roi_w;
+        const size_t roi_y = (i >> 1) * roi_h;
+        
+        isEmpty[i] = !gbStats_GetHasAnyDataROI_RGBA8888(parent->data, parent->rowBytes / 4,
+                                                        roi_x, roi_y, roi_x + roi_w - 1, roi_y + roi_h - 1);
+        isAllEmpty = isAllEmpty && isEmpty[i];
+    }//for
+    
+    if (isAllEmpty)
+    {
+        return;
+    }//if
+    
+    size_t   rowBytes;
+    uint8_t* whole = gbImage_Resize_EnlargeWholeTile_RGBA8888((uint8_t*)(parent->data), w, h, parent->rowBytes,
+                                                              1, c->interpolationTypeId, &rowBytes);
+    
+    it->dest_whole[it->dest_whole_n] = whole;
+    it->dest_whole_n++;
+    
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        if (!isEmpty[i])
+        {
+            const uint32_t cx = i & 1;
+            const uint32_t cy = i >> 1;
+            
+            _PipelineItem_AddDest(it, (uint32_t*)(whole + cy * h * rowBytes + cx * w * 4), w, h, rowBytes,
+                                  (parent->x << 1) + cx, (parent->y << 1) + cy, parent->z + 1, NULL, NULL);
+            
+            it->dest[it->dest_n - 1].isView = true;
+        }//if
+    }//for
+}//_Pipeline_Resample_EnlargeWhole
+
+
+// Enlarge, one level: adds the up to 4 z+1 children of parent as dests.
+// Children that would be empty are skipped.  it->dest must have room.
+static void _Pipeline_Resample_EnlargeChildren(Retile_PipelineItem*          it,
+                                               const Retile_PipelineContext* c,
+                                               const Retile_Buffer*          parent)
+{
+    if (   c->interpolationTypeId == kGB_Image_Interp_Lanczos3x3
+        || c->interpolationTypeId == kGB_Image_Interp_Lanczos5x5
+        || c->interpolationTypeId == kGB_Image_Interp_Bilinear)
+    {
+        _Pipeline_Resample_EnlargeWhole(it, c, parent);
+        return;
+    }//if
+    
+    size_t    local_width    = 256;
+    size_t    local_height   = 256;
+    size_t    local_rowBytes = 1024;
+    uint32_t* local_rgba     = _Pipeline_GetTileBuffer(c, sizeof(uint8_t) * local_height * local_rowBytes);
+    bool      roiWasEmpty;
+    
+    memset(local_rgba, 0, sizeof(uint8_t) * local_height * local_rowBytes);
+    
+    _FixDestTileBufferIfNeeded(&local_rgba,
+                               &local_width,  &local_height,  &local_rowBytes,
+                               parent->width, parent->height, parent->rowBytes);
+    
+    const uint32_t dest_z  = parent->z + 1;
+    const uint32_t start_y = parent->y << 1;
+    const uint32_t start_x = parent->x << 1;
+    
+    for (uint32_t y = start_y; y < start_y + 2; y++)
+    {
+        for (uint32_t x = start_x; x < start_x + 2; x++)
+        {
+            gbImage_Resize_EnlargeTile_RGBA8888((uint8_t*)(parent->data),
+                                                (uint8_t*)local_rgba,
+                                                parent->z,
+                                                x, y, dest_z,
+                                                parent->width, parent->height,
+                                                c->interpolationTypeId,
+                                                &roiWasEmpty);
+            
+            if (!roiWasEmpty) // quite possible to zoom into nothingness on a tile, don't write those.
+            {
+                _PipelineItem_AddDest(it, local_rgba, local_width, local_height, local_rowBytes, x, y, dest_z, NULL, NULL);
+                
+                local_rgba = _Pipeline_GetTileBuffer(c, sizeof(uint8_t) * local_height * local_rowBytes);
+                memset(local_rgba, 0, sizeof(uint8_t) * local_height * local_rowBytes);
+            }//if
+        }//for
+    }//for
+    
+    gbBufferPool_Put(c->tile_pool, local_rgba, sizeof(uint8_t) * local_height * local_rowBytes);
+}//_Pipeline_Resample_EnlargeChildren
+
+
+// Enlarge: each src tile becomes up to 4 tiles at z+1.  For dest_z_shift > 1,
+// each of those becomes up to 4 at z+2, and so on, every level being made
+// from the one above it while still in memory, with the same 2x kernel.  The
+// result is that of one -zIn run per level, without the PNG round trips.
+static void _Pipeline_Resample_Enlarge(Retile_PipelineItem*          it,
+                                       const Retile_PipelineContext* c)
+{
+    const uint32_t zs        = c->dest_z_shift;
+    size_t         per_src   = 0;
+    size_t         dest_cap  = it->src_n;
+    size_t         whole_cap = 0;
+    
+    for (uint32_t l = 1; l <= zs; l++)
+    {
+        per_src += (size_t)1 << (2 * l);
+    }//for
+    
+    for (size_t i = 0; i < it->src_n; i++)
+    {
+        dest_cap  += it->src[i].data != NULL ? per_src        : 0;
+        whole_cap += it->src[i].data != NULL ? per_src >> 2   : 0;  // one per parent, at most
+    }//for
+    
+    it->dest       = malloc(sizeof(Retile_Buffer) * dest_cap);
+    it->dest_png   = malloc(sizeof(uint8_t*)      * dest_cap);
+    it->dest_png_n = malloc(sizeof(size_t)        * dest_cap);
+    it->dest_whole = malloc(sizeof(uint8_t*)      * MAX(1, whole_cap));
+    
+    for (size_t i = 0; i < it->src_n; i++)
+    {
+        if (it->src[i].data != NULL)
+        {
+            size_t level_start = it->dest_n;
+            
+            _Pipeline_Resample_EnlargeChildren(it, c, &(it->src[i]));
+            
+            for (uint32_t l = 1; l < zs; l++)
+            {
+                const size_t level_end = it->dest_n;
+                
+                for (size_t j = level_start; j < level_end; j++)
+                {
+                    _Pipeline_Resample_EnlargeChildren(it, c, &(it->dest[j]));
+                }//for
+                
+                level_start = level_end;
+            }//for
+            
+            if (c->alsoReprocessSrc && it->src[i].dest_filename != NULL)
+            {
+                _Pipeline_AddReprocessDest(it, &(it->src[i]));
+            }//if
+        }//if
+    }//for
+}//_Pipeline_Resample_Enlarge
+
+
+static void* _Pipeline_Resample_Work(void* item, void* context)
+{
+    Retile_PipelineItem*          it = (Retile_PipelineItem*)item;
+    const Retile_PipelineContext* c  = (const Retile_PipelineContext*)context;
+    
+    if (c->isEnlarge)
+    {
+        _Pipeline_Resample_Enlarge(it, c);
+    }//if
+    else
+    {
+        _Pipeline_Resample_Downsample(it, c);
+    }//else
+    
+    // src tiles are no longer needed, don't hold them through encode
+    _Pipeline_ReleaseTiles(c, it->src, it->src_n);
+    
+    if (it->dest_n == 0)
+    {
+        _PipelineItem_Free(it, c);
+        return NULL;
+    }//if
+    
+    // one part per enlarged tile, all but the first forked into encode
+    const size_t per_part = c->isEnlarge ? 1 : it->dest_n;
+    
+    Retile_PipelinePart* first = NULL;
+    
+    it->part_n = (it->dest_n + per_part - 1) / per_part;    // before any part can finish
+    
+    for (size_t i = 0; i < it->dest_n; i += per_part)
+    {
+        Retile_PipelinePart* part = gbBufferPool_Get(c->part_pool);
+        
+        part->it    = it;
+        part->start = i;
+        part->end   = MIN(it->dest_n, i + per_part);
+        
+        if (first == NULL)
+        {
+            first = part;
+        }//if
+        else
+        {
+            gbPipeline_Fork(c->pipe, kRetile_Stage_Encode, part);
+        }//else
+    }//for
+    
+    return first;
+}//_Pipeline_Resample_Work
+
+
+// Encode and write take Retile_PipelineParts.  Whole-tile buffers may still
+// be viewed by other parts, so they are left to _PipelineItem_Free.
+static void* _Pipeline_Encode_Work(void* item, void* context)
+{
+    Retile_PipelinePart*          part = (Retile_PipelinePart*)item;
+    Retile_PipelineItem*          it   = part->it;
+    const Retile_PipelineContext* c    = (const Retile_PipelineContext*)context;
+    
+    for (size_t i = part->start; i < part->end; i++)
+    {
+        gbImage_PNG_Write_RGBA8888_ToMemory_Strided(it->dest[i].width, it->dest[i].height, it->dest[i].rowBytes,
+                                                    (uint8_t*)it->dest[i].data,
+                                                    &(it->dest_png[i]), &(it->dest_png_n[i]));
+        
+        _Pipeline_ReleaseTiles(c, &(it->dest[i]), 1);
+    }//for
+    
+    return part;
+}//_Pipeline_Encode_Work
+
+
+static void* _Pipeline_Write_Work(void* item, void* context)
+{
+    Retile_PipelinePart*          part = (Retile_PipelinePart*)item;
+    Retile_PipelineItem*          it   = part->it;
+    const Retile_PipelineContext* c    = (const Retile_PipelineContext*)context;
+    
+    uint32_t _last_path_created_x = UINT32_MAX;
+    uint32_t _last_path_created_z = UINT32_MAX;
+    
+    char dest_filepath[1024] __attribute__ ((aligned(16)));
+    
+    for (size_t i = part->start; i < part->end; i++)
+    {
+        if (it->dest_png[i] != NULL)
+        {
+            const char* filepath = it->dest[i].filename;
+            
+            if (filepath == NULL && _IsArchiveTemplate(c->urlTemplateId))
+            {
+                _PutArchiveTile(it->dest[i].x, it->dest[i].y, it->dest[i].z, it->dest_png[i], it->dest_png_n[i]);
+                it->dest_png[i] = NULL;                                 // owned by the archive now
+                continue;
+            }//if
+            
+            if (filepath == NULL)
+            {
+                _GetFilepathAndCreateIntermediatePathsIfNeeded(dest_filepath, c->destPath,
+                                                               it->dest[i].x, it->dest[i].y, it->dest[i].z,
+                                                               &_last_path_created_x, &_last_path_created_z,
+                                                               c->urlTemplateId);
+                filepath = dest_filepath;
+            }//if
+            
+            if (_WriteBufferToFile(filepath, it->dest_png[i], it->dest_png_n[i]) && it->dest[i].dest_filename != NULL)
+            {
+                remove(it->dest[i].dest_filename);
+            }//if
+            
+            free(it->dest_png[i]);
+            it->dest_png[i] = NULL;
+        }//if
+    }//for
+    
+    gbBufferPool_Put(c->part_pool, part, sizeof(Retile_PipelinePart));
+    
+    if (__atomic_sub_fetch(&it->part_n, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        _PipelineItem_Free(it, c);
+    }//if
+    
+    return NULL;
+}//_Pipeline_Write_Work
+
+
+
+
+// =================
+// _Pipeline_Create:
+// =================
+//
+// Creates and starts the read -> decode -> resample -> encode -> write
+// pipeline, and the buffer pools in c.  c must outlive it.
+//
+// Default threads per stage, where cfg (or its entry) is 0:
+// - read, write:       max(2, thread_n / 2)   (I/O, mostly blocked)
+// - decode, resample:  max(1, thread_n / 2)
+// - encode:            thread_n                (zlib, the most CPU)
+//
+// thread_n: 0 -> one per CPU.
+//
+static gbPipeline* _Pipeline_Create(Retile_PipelineContext*      c,
+                                    const Retile_PipelineConfig* cfg,
+                                    const int                    thread_n)
+{
+    const size_t cpu_n   = thread_n > 0 ? (size_t)thread_n : gbThreadPool_GetCPUCount();
+    const size_t half_n  = cpu_n / 2 > 0 ? cpu_n / 2 : 1;
+    const size_t depth   = cfg != NULL && cfg->queue_depth > 0 ? (size_t)cfg->queue_depth : kRetile_MaxInFlight;
+    
+    const char*              names[kRetile_Stage_Count] = { "read", "decode", "resample", "encode", "write" };
+    gbPipeline_StageFunction fns  [kRetile_Stage_Count] = { _Pipeline_Read_Work, _Pipeline_Decode_Work, _Pipeline_Resample_Work,
+                                                            _Pipeline_Encode_Work, _Pipeline_Write_Work };
+    size_t                   ths  [kRetile_Stage_Count] = { MAX(2, half_n), half_n, half_n, cpu_n, MAX(2, half_n) };
+    
+    // everything in flight is bounded by the queues, so the pools need no cap
+    c->tile_pool = gbBufferPool_Create("tile", kRetile_TileBufferBytes,     0);
+    c->item_pool = gbBufferPool_Create("item", sizeof(Retile_PipelineItem), 0);
+    c->part_pool = gbBufferPool_Create("part", sizeof(Retile_PipelinePart), 0);
+    
+    gbPipeline* pipe = gbPipeline_Create(kRetile_Stage_Count);
+    
+    c->pipe = pipe;
+    
+    for (size_t i = 0; i < kRetile_Stage_Count; i++)
+    {
+        if (cfg != NULL && cfg->thread_n[i] > 0)
+        {
+            ths[i] = (size_t)cfg->thread_n[i];
+        }//if
+        
+        gbPipeline_SetStage(pipe, i, names[i], fns[i], (void*)c, ths[i], depth);
+    }//for
+    
+    gbPipeline_Start(pipe);
+    
+    return pipe;
+}//_Pipeline_Create
+
+
+
+
+// ============================
+// _Pipeline_PushRetileBuffers:
+// ============================
+//
+// Queues rt_bufs (at most kRetile_PipelineItem_MaxSrc) as one item.  Copies
+// their metadata and dest_filenames, as the reader's are stack alloc /
+// reused.  Their filenames must point into the tile index, and are not
+// copied.  Blocks while the read stage's queue is full.
+//
+// filepath is the dest tile for downsampling, or NULL for enlarging.
+// dest_key is its tile index key, for c->progress.  (UINT64_MAX -> none)
+//
+static inline void _Pipeline_PushRetileBuffers(gbPipeline*                   pipe,
+                                               const Retile_PipelineContext* c,
+                                               const Retile_Buffer*          rt_bufs,
+                                               const size_t                  rt_buf_n,
+                                               const char*                   filepath,
+                                               const uint64_t                dest_key)
+{
+    Retile_PipelineItem* it = gbBufferPool_Get(c->item_pool);
+    
+    it->progress_key = c->progress != NULL ? dest_key : UINT64_MAX;
+    it->progress_seq = it->progress_key != UINT64_MAX ? c->progress->push_n++ : 0;     // one producer
+    it->path_n       = 0;
+    it->filepath   = filepath != NULL ? _PipelineItem_CopyPath(it, filepath) : NULL;
+    it->src_n      = MIN(rt_buf_n, kRetile_PipelineItem_MaxSrc);
+    it->dest         = NULL;
+    it->dest_n       = 0;
+    it->dest_whole   = NULL;
+    it->dest_whole_n = 0;
+    it->dest_png     = NULL;
+    it->dest_png_n   = NULL;
+    it->part_n       = 0;
+    
+    for (size_t i = 0; i < it->src_n; i++)
+    {
+        it->src[i]               = rt_bufs[i];
+        it->src[i].data          = NULL;
+        it->src[i].isView        = false;
+        it->src[i].dest_filename = rt_bufs[i].dest_filename != NULL ? _PipelineItem_CopyPath(it, rt_bufs[i].dest_filename) : NULL;
+        it->src_png[i]           = NULL;
+        it->src_png_n[i]         = 0;
+    }//for
+    
+    gbPipeline_Push(pipe, it);
+}//_Pipeline_PushRetileBuffers
+
+
+
+
+// =========================
+// _Pipeline_WaitAndRelease:
+// =========================
+//
+// Waits for all items to be written, prints per-stage and pool stats, then
+// frees the pipeline and c's pools.
+//
+static inline void _Pipeline_WaitAndRelease(gbPipeline*             pipe,
+                                            Retile_PipelineContext* c,
+                                            const char*             logPrefix)
+{
+    printf("%sWaiting on pipeline...\n", logPrefix);
+    
+    gbPipeline_WaitAll(pipe);
+    gbPipeline_PrintStats(pipe, logPrefix);
+    gbBufferPool_PrintStats(c->tile_pool, logPrefix);
+    gbBufferPool_PrintStats(c->item_pool, logPrefix);
+    gbBufferPool_PrintStats(c->part_pool, logPrefix);
+    gbPipeline_Destroy(pipe);
+    gbBufferPool_Destroy(c->tile_pool);
+    gbBufferPool_Destroy(c->item_pool);
+    gbBufferPool_Destroy(c->part_pool);
+    
+    c->tile_pool = NULL;
+    c->item_pool = NULL;
+    c->part_pool = NULL;
+    c->pipe      = NULL;
+}//_Pipeline_WaitAndRelease
+
+
+
+
+
+
+// ===============================
+// _Pipeline_PushDownsampleQuads:
+// ===============================
+//
+// Walks a quadkey sorted index, pushing each group of 1-4 tiles that make up
+// one z-1 tile into pipe as it is completed.  See _QueueDownsampleFromIndex.
+//
+// Only entries start ... end-1 are walked, which must not split a quad.
+//
+// With pctx->progress, quads written by an earlier, interrupted run are
+// skipped.
+//
+// Returns the dest z.  idx must outlive the pipeline's work.
+//
+static uint32_t _Pipeline_PushDownsampleQuads(gbPipeline*                   pipe,
+                                              const Retile_PipelineContext* pctx,
+                                              const gbTileIndex*            idx,
+                                              const size_t                  start,
+                                              const size_t                  end,
+                                              const bool                    isVerbose)
+{
+    int       row      = 0;
+    const int rowCount = (int)(end - start);
+    const int modCount = MAX(1, (int)ceil((double)rowCount / 10.0));
+    
+    if (rowCount == 0)
+    {
+        return 0;
+    }//if
+    
+    // <multiread>
+    size_t        rt_buf_i = 0;
+    const size_t  rt_buf_n = 4;
+    
+    Retile_Buffer rt_bufs[rt_buf_n] __attribute__ ((aligned(16)));
+    char          reproc_filepaths[rt_buf_n][1024] __attribute__ ((aligned(16)));
+    
+    _ResetRetileBuffers(rt_bufs, rt_buf_n);
+    // </multiread>
+    
+    uint32_t _reproc_last_path_created_z = UINT32_MAX;
+    uint32_t _reproc_last_path_created_x = UINT32_MAX;
+    
+    uint32_t _last_path_created_z = UINT32_MAX;
+    uint32_t _last_path_created_x = UINT32_MAX;
+    
+    uint32_t src_x  = 0;
+    uint32_t src_y  = 0;
+    uint32_t src_z  = 0;
+    
+    uint32_t dest_x = 0;
+    uint32_t dest_y = 0;
+    uint32_t dest_z = 0;
+    uint32_t _last_dest_x = UINT32_MAX;
+    uint32_t _last_dest_y = UINT32_MAX;
+    
+    //char dest_filename[1024] __attribute__ ((aligned(16)));
+    char dest_filepath[1024] __attribute__ ((aligned(16)));
+    //char sub_dest_path[1024] __attribute__ ((aligned(16)));
+    //char temp_char_comp[1024] __attribute__ ((aligned(16)));
+    
+    size_t idx_i  = start;
+    bool   isDone = false;
+    
+    while (true)
+    {
+        char* filename = NULL;
+        
+        isDone = idx_i >= end;
+        
+        if (!isDone)
+        {
+            gbTileIndex_GetXYZ(idx, idx_i, &src_x, &src_y, &src_z);
+            filename = (char*)gbTileIndex_GetFilePath(idx, idx_i);
+            idx_i++;
+            
+            dest_z   = src_z - 1;
+            dest_x   = src_x >> (src_z - dest_z);
+            dest_y   = src_y >> (src_z - dest_z);
+        }//if
+
+        
+        if ((  (    ((dest_x != _last_dest_x && _last_dest_x != UINT32_MAX)
+                ||   (dest_y != _last_dest_y && _last_dest_y != UINT32_MAX)) && src_z > 0)
+             || isDone))
+        {
+            const uint64_t dest_key = gbTileIndex_GetKeyForXYZ(_last_dest_x, _last_dest_y, dest_z);
+            
+            if (_IsArchiveTemplate(pctx->urlTemplateId))
+            {
+                _Pipeline_PushRetileBuffers(pipe, pctx, rt_bufs, rt_buf_n, NULL, dest_key);    // no path, see the write stage
+            }//if
+            else if (pctx->progress == NULL || pctx->progress->resumeKey[dest_z] == UINT64_MAX || dest_key > pctx->progress->resumeKey[dest_z])
+            {
+                _GetFilepathAndCreateIntermediatePathsIfNeeded(dest_filepath, pctx->destPath,
+                                                               _last_dest_x, _last_dest_y, dest_z,
+                                                               &_last_path_created_x, &_last_path_created_z,
+                                                               pctx->urlTemplateId);
+                
+                _Pipeline_PushRetileBuffers(pipe, pctx, rt_bufs, rt_buf_n, dest_filepath, dest_key);
+            }//else if
+            
+            _ResetRetileBuffers(rt_bufs, rt_buf_n);
+            rt_buf_i = 0;
+        }//if
+        
+        if (!isDone)
+        {
+            if (filename != NULL)
+            {
+                if (rt_bufs[rt_buf_i].filename != NULL)
+                {
+                    printf("ERR: rt_bufs[%zu] filename was non-null! [%s]\n", rt_buf_i, rt_bufs[rt_buf_i].filename);
+                }//if
+                
+                rt_bufs[rt_buf_i].filename = filename;     // owned by the index
+            }//if
+            
+            rt_bufs[rt_buf_i].x = src_x;
+            rt_bufs[rt_buf_i].y = src_y;
+            rt_bufs[rt_buf_i].z = src_z;
+            
+            if (rt_bufs[rt_buf_i].filename != NULL)
+            {
+                if (pctx->alsoReprocessSrc)
+                {
+                    rt_bufs[rt_buf_i].dest_filename = reproc_filepaths[rt_buf_i];
+                    
+                    _GetFilepathAndCreateIntermediatePathsIfNeeded(rt_bufs[rt_buf_i].dest_filename, pctx->destPath,
+                                                                   rt_bufs[rt_buf_i].x, rt_bufs[rt_buf_i].y, rt_bufs[rt_buf_i].z,
+                                                                   &_reproc_last_path_created_x, &_reproc_last_path_created_z,
+                                                                   pctx->urlTemplateId);
+                }//if
+                
+                rt_buf_i     = rt_buf_i < rt_buf_n - 1 ? rt_buf_i + 1 : 0;
+                _last_dest_x = dest_x;
+                _last_dest_y = dest_y;
+            }//if
+        }//if
+        else
+        {
+            break;
+        }//else
+        
+        if (isVerbose && row % modCount == 0)
+        {
+            printf("[z=%d]: %1.0f%%\n", (int)dest_z, (double)row / (double)rowCount * 100.0);
+        }//if
+        
+        row++;
+    }//while
+    
+    return dest_z;
+}//_Pipeline_PushDownsampleQuads
+
+
+
+
+// ==========================
+// _QueueDownsampleFromIndex:
+// ==========================
+//
+// Main raster tile pyramid level downsampling (z -> z-1) function.
+//
+// For a tile index populated by _ReadPathToIndex, this relies on the index
+// being sorted by Microsoft's QuadKey to make sure each "quad" of tiles to be
+// downsampled (which can be 1-4 tiles) are read consecutively.
+// This clustering allows for a performant, scalable approach to the problem.
+//
+// (more info: http://msdn.microsoft.com/en-us/library/bb259689.aspx )
 //
 // Detecting changes in the destination tile xyz allows the accumulated quad
 // to be processed and output to a new shiny z-1 PNG.
 //
-// If Apple's GCD is present (inferred via the Accelerate framework), this
-// will be multithreaded and use asynchronous processing.
+// Processing is multithreaded and asynchronous, via the read -> decode ->
+// resample -> encode -> write pipeline (see Retile_Pipeline), sized from
+// thread_n (0 -> one per CPU) and pipe_cfg (NULL -> defaults).
+//
+// progress (may be NULL) logs the tiles written, and skips the level or the
+// part of it that an earlier run already did.
+//
+// (this function does no processing, it merely queues the work up and
+//  accumulates references.)
+//
+void _QueueDownsampleFromIndex(const char*                  destPath,
+                               const gbTileIndex*           idx,
+                               const int                    urlTemplateId,
+                               const bool                   alsoReprocessSrc,
+                               const int                    interpolationTypeId,
+                               const int                    thread_n,
+                               const Retile_PipelineConfig* pipe_cfg,
+                               Retile_Progress*             progress)
+{
+    const int rowCount = (int)gbTileIndex_GetCount(idx);
+    
+    if (rowCount == 0)
+    {
+        printf("No tiles were found to read.  Aborting.\n");
+        return;
+    }//if
+    
+    uint32_t src_x;
+    uint32_t src_y;
+    uint32_t src_z;
+    
+    gbTileIndex_GetXYZ(idx, 0, &src_x, &src_y, &src_z);
+    
+    if (progress != NULL && progress->isLevelDone[src_z - 1])
+    {
+        printf("[z=%d]: Already done, skipping.\n", (int)src_z - 1);
+        return;
+    }//if
+    
+    Retile_PipelineContext pctx = { destPath, urlTemplateId, interpolationTypeId, alsoReprocessSrc, false, 0, NULL, NULL, NULL, NULL, progress };
+    
+    if (progress != NULL)
+    {
+        _Progress_BeginLevel(progress, src_z - 1, kRetile_ProgressBatchN);
+    }//if
+    
+    gbPipeline* pipe = _Pipeline_Create(&pctx, pipe_cfg, thread_n);
+    
+    mkdir(destPath, 0777);
+    
+    printf("Resampling and writing files (src n=[%d])...\n", rowCount);
+    
+    const uint32_t dest_z = _Pipeline_PushDownsampleQuads(pipe, &pctx, idx, 0, (size_t)rowCount, true);
+    
+    char logPrefix[32];
+    snprintf(logPrefix, sizeof(logPrefix), "[z=%d]: ", (int)dest_z);
+    
+    _Pipeline_WaitAndRelease(pipe, &pctx, logPrefix);
+    
+    if (progress != NULL)
+    {
+        _Progress_EndLevel(progress, dest_z);
+    }//if
+    
+    printf("[z=%d]: 100%%\n", (int)dest_z);
+    
+    printf("[z=%d]: Done.\n", (int)dest_z);
+}//_QueueDownsampleFromIndex
+
+
+
+
+// ===========================
+// _QueueDownsampleFromLeases:
+// ===========================
+//
+// -queue: _QueueDownsampleFromIndex, for several processes, on one host or
+// many, which share the lease table at queuePath and the dest path.
+//
+// The dest tiles are cut into chunks of kRetile_LeaseDestTileN quads, in
+// quadkey order, which every process derives the same way from the same src
+// tiles.  Each process claims a chunk, pushes its quads into its pipeline,
+// waits for them to be written and marks the chunk done, until there are no
+// more.  A chunk held by a process that died, or took longer than lease_s
+// seconds, is issued again.  (see gbLeaseTable)
+//
+// The pipeline drains between chunks, so a chunk should be large enough
+// that the time to drain it is small next to the time to do it.
+//
+// The job name carries a hash of the src and dest paths and the src tile
+// keys.  Chunks are keyed by job name, so those of some other job in the
+// same lease table are never taken for this one's.
+//
+#define kRetile_LeaseDestTileN 1024
+#define kRetile_LeaseWaitS     5
+
+// FNV-1a over both paths, including their terminators.  The tile keys are
+// folded in by the caller, one per step.
+static uint64_t _Queue_HashJob(const char* srcPath,
+                               const char* destPath)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    
+    for (const char* p = srcPath; ; p++)
+    {
+        h = (h ^ (uint8_t)*p) * 0x100000001B3ULL;
+        
+        if (*p == '\0') { break; }//if
+    }//for
+    
+    for (const char* p = destPath; ; p++)
+    {
+        h = (h ^ (uint8_t)*p) * 0x100000001B3ULL;
+        
+        if (*p == '\0') { break; }//if
+    }//for
+    
+    return h;
+}//_Queue_HashJob
+
+static void _QueueDownsampleFromLeases(const char*                  srcPath,
+                                       const char*                  destPath,
+                                       const gbTileIndex*           idx,
+                                       const char*                  queuePath,
+                                       const int                    lease_s,
+                                       const int                    urlTemplateId,
+                                       const int                    interpolationTypeId,
+                                       const int                    thread_n,
+                                       const Retile_PipelineConfig* pipe_cfg)
+{
+    const size_t n = gbTileIndex_GetCount(idx);
+    
+    if (n == 0)
+    {
+        printf("No tiles were found to read.  Aborting.\n");
+        return;
+    }//if
+    
+    uint32_t src_x;
+    uint32_t src_y;
+    uint32_t src_z;
+    
+    gbTileIndex_GetXYZ(idx, 0, &src_x, &src_y, &src_z);
+    
+    // chunk i is entries starts[i] ... starts[i + 1] - 1
+    size_t   chunk_n   = 0;
+    size_t   start_cap = n / kRetile_LeaseDestTileN + 2;
+    size_t*  starts    = malloc(sizeof(size_t) * start_cap);
+    uint64_t last_key  = UINT64_MAX;
+    size_t   quad_n    = 0;
+    uint64_t job_hash  = _Queue_HashJob(srcPath, destPath);
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        const uint64_t src_key  = gbTileIndex_GetKey(idx, i);
+        const uint64_t dest_key = src_key >> 2;
+        
+        job_hash = (job_hash ^ src_key) * 0x100000001B3ULL;
+        
+        if (dest_key != last_key)
+        {
+            if (quad_n % kRetile_LeaseDestTileN == 0)
+            {
+                starts[chunk_n++] = i;
+            }//if
+            
+            quad_n++;
+            last_key = dest_key;
+        }//if
+    }//for
+    
+    starts[chunk_n] = n;
+    
+    char job[64];
+    
+    snprintf(job, sizeof(job), "zOut z=%u n=%zu id=%016llx", src_z, n, (unsigned long long)job_hash);
+    
+    gbLeaseTable* lt = gbLeaseTable_Open(queuePath, job, chunk_n, lease_s);
+    
+    if (lt == NULL)
+    {
+        printf("_QueueDownsampleFromLeases: [ERR] Could not open the lease table [%s].  Aborting.\n", queuePath);
+        free(starts);
+        return;
+    }//if
+    
+    Retile_PipelineContext pctx = { destPath, urlTemplateId, interpolationTypeId, false, false, 0, NULL, NULL, NULL, NULL, NULL };
+    
+    gbPipeline* pipe = _Pipeline_Create(&pctx, pipe_cfg, thread_n);
+    
+    mkdir(destPath, 0777);
+    
+    printf("Resampling and writing files (src n=[%zu], %zu chunks of up to %d z=%d tiles, leased from [%s])...\n",
+           n, chunk_n, kRetile_LeaseDestTileN, (int)src_z - 1, queuePath);
+    
+    size_t chunk_i = 0;
+    size_t done_n  = 0;
+    bool   isWait  = false;
+    int    res;
+    
+    while ((res = gbLeaseTable_Claim(lt, &chunk_i)) != kGB_LeaseTable_Done && res != kGB_LeaseTable_Error)
+    {
+        if (res == kGB_LeaseTable_Wait)
+        {
+            if (!isWait)
+            {
+                printf("[z=%d]: Waiting on chunks leased by other processes...\n", (int)src_z - 1);
+                isWait = true;
+            }//if
+            
+            sleep(MIN(kRetile_LeaseWaitS, MAX(1, lease_s)));
+            continue;
+        }//if
+        
+        isWait = false;
+        
+        _Pipeline_PushDownsampleQuads(pipe, &pctx, idx, starts[chunk_i], starts[chunk_i + 1], false);
+        
+        gbPipeline_WaitAll(pipe);
+        
+        gbLeaseTable_Complete(lt, chunk_i);
+        done_n++;
+        
+        printf("[z=%d]: Chunk %zu done, %zu of %zu overall.\n", (int)src_z - 1, chunk_i, gbLeaseTable_GetDoneCount(lt), chunk_n);
+    }//while
+    
+    char logPrefix[32];
+    snprintf(logPrefix, sizeof(logPrefix), "[z=%d]: ", (int)src_z - 1);
+    
+    _Pipeline_WaitAndRelease(pipe, &pctx, logPrefix);
+    
+    printf("[z=%d]: %s, %zu of %zu chunks by this process.\n", (int)src_z - 1, res == kGB_LeaseTable_Done ? "Done" : "[ERR] Lease table error, stopped", done_n, chunk_n);
+    
+    gbLeaseTable_Close(lt);
+    free(starts);
+}//_QueueDownsampleFromLeases
+
+
+
+
+// =============
+// Retile_Stream
+// =============
+//
+// -stream: OSM layout downsampling that starts before the whole source level
+// has been indexed.
+//
+// Every z-1 tile's quad lies within one pair of x columns (2k and 2k+1), so
+// the x directories are listed, paired, and each pair is scanned, sorted and
+// pushed into the pipeline by its own task as soon as its two directories
+// have been read.  Scanning overlaps with resampling, and the first output is
+// written within moments rather than after a full scan.
+//
+// Each pair gets its own small tile index, which is kept until the pipeline
+// is done with it.  (the src filenames point into it)
+//
+typedef struct Retile_StreamColumn
+{
+    uint32_t x;
+    char*    path;
+} Retile_StreamColumn;
+
+typedef struct Retile_StreamColumns
+{
+    Retile_StreamColumn* cols;
+    size_t               col_n;
+    size_t               col_cap;
+} Retile_StreamColumns;
+
+typedef struct Retile_StreamContext
+{
+    gbPipeline*                   pipe;
+    const Retile_PipelineContext* pctx;
+    gbTileIndex**                 idxs;     // one per pair, freed at the end
+    size_t                        pair_n;
+    size_t                        done_n;
+    size_t                        tile_n;
+    uint32_t                      dest_z;
+    pthread_mutex_t               mutex;
+} Retile_StreamContext;
+
+typedef struct Retile_StreamPair
+{
+    Retile_StreamContext* sc;
+    size_t                pair_i;
+    const char*           paths[2];
+    size_t                path_n;
+} Retile_StreamPair;
+
+
+
+
+// ========================
+// _StreamColumns_Add_Work:
+// ========================
+//
+// gbDirScan batch function.  Keeps subdirectories whose names are a number.
+//
+static void _StreamColumns_Add_Work(const char* const* paths,
+                                    const size_t       n,
+                                    void*              context)
+{
+    Retile_StreamColumns* c = (Retile_StreamColumns*)context;
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        const char*  name     = paths[i] + _GetPathSlashOffset(paths[i], 0) + 1;
+        const size_t name_len = strnlen(name, 1024);
+        
+        if (name_len == 0 || name_len > 9 || strspn(name, "0123456789") != name_len)
+        {
+            continue;
+        }//if
+        
+        if (c->col_n == c->col_cap)
+        {
+            c->col_cap = c->col_cap > 0 ? c->col_cap * 2 : 1024;
+            c->cols    = realloc(c->cols, sizeof(Retile_StreamColumn) * c->col_cap);
+        }//if
+        
+        c->cols[c->col_n].x    = (uint32_t)strtoul(name, NULL, 10);
+        c->cols[c->col_n].path = strdup(paths[i]);
+        c->col_n++;
+    }//for
+}//_StreamColumns_Add_Work
+
+
+static int _StreamColumn_Compare(const void* a,
+                                 const void* b)
+{
+    const uint32_t xa = ((const Retile_StreamColumn*)a)->x;
+    const uint32_t xb = ((const Retile_StreamColumn*)b)->x;
+    
+    return xa < xb ? -1 : xa > xb ? 1 : 0;
+}//_StreamColumn_Compare
+
+
+
+
+// =================
+// _StreamPair_Work:
+// =================
+//
+// Retile_WorkQueue task.  Scans one pair of x columns into a new index, sorts
+// it and pushes its quads into the pipeline.  Blocks while the pipeline is
+// full, which keeps the scan from running too far ahead.
+//
+static void _StreamPair_Work(void* context)
+{
+    Retile_StreamPair*      p   = (Retile_StreamPair*)context;
+    Retile_StreamContext*   sc  = p->sc;
+    gbTileIndex*            idx = gbTileIndex_Create();
+    Retile_IndexScanContext c   = { idx, 0, kRetile_Template_OSM };
+    
+    for (size_t i = 0; i < p->path_n; i++)
+    {
+        gbDirScan_Scan(p->paths[i], false, 1, _ParseBatchToIndex_Work, &c);
+    }//for
+    
+    gbTileIndex_Sort(idx, 1);
+    
+    const uint32_t dest_z = _Pipeline_PushDownsampleQuads(sc->pipe, sc->pctx, idx, 0, gbTileIndex_GetCount(idx), false);
+    
+    pthread_mutex_lock(&sc->mutex);
+    
+    const size_t modCount = MAX(1, sc->pair_n / 10);
+    
+    sc->idxs[p->pair_i] = idx;
+    sc->tile_n         += c.n;
+    sc->dest_z          = c.n > 0 ? dest_z : sc->dest_z;
+    sc->done_n++;
+    
+    if (sc->done_n % modCount == 0)
+    {
+        printf("[Stream]: %1.0f%% of columns scanned\n", (double)sc->done_n / (double)sc->pair_n * 100.0);
+    }//if
+    
+    pthread_mutex_unlock(&sc->mutex);
+    
+    free(p);
+}//_StreamPair_Work
+
+
+
+
+// ==========================
+// _StreamDownsampleFromPath:
+// ==========================
+//
+// As _ReadPathToIndex followed by _QueueDownsampleFromIndex, but overlapped.
+// srcPath must be an OSM layout z level, ie: srcPath/{x}/{y}.png
+//
+// Column pairs are scanned by a Retile_WorkQueue of thread_n threads, and
+// the pipeline is sized from thread_n and pipe_cfg as usual.
+//
+// Returns the number of src tiles found.
+//
+size_t _StreamDownsampleFromPath(const char*                  srcPath,
+                                 const char*                  destPath,
+                                 const int                    urlTemplateId,
+                                 const bool                   alsoReprocessSrc,
+                                 const int                    interpolationTypeId,
+                                 const int                    thread_n,
+                                 const Retile_PipelineConfig* pipe_cfg)
+{
+    Retile_StreamColumns cols = { NULL, 0, 0 };
+    
+    printf("Listing x columns...\n");
+    
+    gbDirScan_ListDirs(srcPath, _StreamColumns_Add_Work, &cols);
+    
+    if (cols.col_n == 0)
+    {
+        printf("_StreamDownsampleFromPath: [ERR] No {x} directories found at path [%s].\n", srcPath);
+        return 0;
+    }//if
+    
+    qsort(cols.cols, cols.col_n, sizeof(Retile_StreamColumn), _StreamColumn_Compare);
+    
+    size_t pair_n = 0;
+    
+    for (size_t i = 0; i < cols.col_n; i++)
+    {
+        pair_n += i == 0 || cols.cols[i].x >> 1 != cols.cols[i - 1].x >> 1 ? 1 : 0;
+    }//for
+    
+    Retile_PipelineContext pctx = { destPath, urlTemplateId, interpolationTypeId, alsoReprocessSrc, false, 0, NULL, NULL, NULL, NULL, NULL };
+    Retile_StreamContext   sc;
+    Retile_WorkQueue       wq;
+    
+    memset(&sc, 0, sizeof(Retile_StreamContext));
+    
+    sc.pipe   = _Pipeline_Create(&pctx, pipe_cfg, thread_n);
+    sc.pctx   = &pctx;
+    sc.idxs   = calloc(pair_n, sizeof(gbTileIndex*));
+    sc.pair_n = pair_n;
+    
+    pthread_mutex_init(&sc.mutex, NULL);
+    
+    mkdir(destPath, 0777);
+    
+    printf("Streaming columns (n=[%zu], pairs=[%zu])...\n", cols.col_n, pair_n);
+    
+    _WorkQueue_Init(&wq, thread_n);
+    
+    size_t pair_i = 0;
+    
+    for (size_t i = 0; i < cols.col_n; i++)
+    {
+        Retile_StreamPair* p = malloc(sizeof(Retile_StreamPair));
+        
+        p->sc       = &sc;
+        p->pair_i   = pair_i++;
+        p->paths[0] = cols.cols[i].path;
+        p->path_n   = 1;
+        
+        if (i + 1 < cols.col_n && cols.cols[i + 1].x >> 1 == cols.cols[i].x >> 1)
+        {
+            p->paths[1] = cols.cols[i + 1].path;
+            p->path_n   = 2;
+            i++;
+        }//if
+        
+        _WorkQueue_AddWork(&wq, _StreamPair_Work, p);
+    }//for
+    
+    _WorkQueue_WaitAndRelease(&wq, "[Stream]: ");
+    
+    char logPrefix[32];
+    snprintf(logPrefix, sizeof(logPrefix), "[z=%d]: ", (int)sc.dest_z);
+    
+    printf("%sScanned %zu tiles.\n", logPrefix, sc.tile_n);
+    
+    _Pipeline_WaitAndRelease(sc.pipe, &pctx, logPrefix);
+    
+    for (size_t i = 0; i < pair_n; i++)
+    {
+        gbTileIndex_Destroy(sc.idxs[i]);
+    }//for
+    
+    for (size_t i = 0; i < cols.col_n; i++)
+    {
+        free(cols.cols[i].path);
+    }//for
+    
+    free(cols.cols);
+    free(sc.idxs);
+    
+    pthread_mutex_destroy(&sc.mutex);
+    
+    printf("[z=%d]: 100%%\n", (int)sc.dest_z);
+    
+    printf("[z=%d]: Done.\n", (int)sc.dest_z);
+    
+    return sc.tile_n;
+}//_StreamDownsampleFromPath
+
+
+
+
+
+// ===================
+// Retile_PyramidLevel
+// ===================
+//
+// Accumulator for one destination zoom level of a single-pass pyramid.
+//
+// Holds at most one dest tile at a time.  Because the source tiles arrive in
+// quadkey order, once a tile for a different parent arrives, the pending
+// one is known to be complete.
+//
+typedef struct Retile_PyramidLevel
+{
+    uint32_t* rgba;                 // NULL if nothing pending
+    size_t    width;
+    size_t    height;
+    size_t    rowBytes;
+    uint32_t  x;
+    uint32_t  y;
+    uint32_t  z;
+    uint32_t  last_path_created_x;
+    uint32_t  last_path_created_z;
+} Retile_PyramidLevel;
+
+
+// ==============
+// Retile_Pyramid
+// ==============
+//
+// A stack of Retile_PyramidLevels, levels[0] being the highest zoom level
+// (top_z) and levels[level_n-1] the lowest.
+//
+// Each tile pushed into levels[0] must be from zoom level top_z + 1.
+// Completed tiles are written to disk and then pushed into the next level,
+// so no level is ever read back from disk.
+//
+// If keepBottom is set, the last completed tile of the lowest level is
+// retained in bottom rather than freed.  (used for subtrees)
+//
+typedef struct Retile_Pyramid
+{
+    Retile_PyramidLevel* levels;
+    size_t               level_n;
+    const char*          destPath;
+    int                  urlTemplateId;
+    int                  interpolationTypeId;
+    bool                 keepBottom;
+    Retile_Buffer        bottom;
+} Retile_Pyramid;
+
+
+
+
+// ==============
+// _Pyramid_Init:
+// ==============
+//
+// level_n levels, from top_z downwards.  level_n may be 0, in which case
+// pushes are ignored.
+//
+static inline void _Pyramid_Init(Retile_Pyramid* pyr,
+                                 const uint32_t  top_z,
+                                 const size_t    level_n,
+                                 const char*     destPath,
+                                 const int       urlTemplateId,
+                                 const int       interpolationTypeId,
+                                 const bool      keepBottom)
+{
+    pyr->level_n             = level_n;
+    pyr->levels              = pyr->level_n > 0 ? malloc(sizeof(Retile_PyramidLevel) * pyr->level_n) : NULL;
+    pyr->destPath            = destPath;
+    pyr->urlTemplateId       = urlTemplateId;
+    pyr->interpolationTypeId = interpolationTypeId;
+    pyr->keepBottom          = keepBottom;
+    
+    memset(&(pyr->bottom), 0, sizeof(Retile_Buffer));
+    
+    for (size_t i = 0; i < pyr->level_n; i++)
+    {
+        pyr->levels[i].rgba                = NULL;
+        pyr->levels[i].z                   = top_z - (uint32_t)i;
+        pyr->levels[i].last_path_created_x = UINT32_MAX;
+        pyr->levels[i].last_path_created_z = UINT32_MAX;
+    }//for
+}//_Pyramid_Init
+
+
+static void _Pyramid_Push(Retile_Pyramid* pyr,
+                          const size_t    level_idx,
+                          const uint32_t* src,
+                          const size_t    width,
+                          const size_t    height,
+                          const size_t    rowBytes,
+                          const uint32_t  x,
+                          const uint32_t  y,
+                          const uint32_t  z);
+
+
+// ====================
+// _Pyramid_FlushLevel:
+// ====================
+//
+// Writes the pending tile for a level, if any, and pushes it into the
+// next level down.
+//
+// The next level is fed before the PNG write, as the writer may convert the
+// buffer to RGB888 in-place.
+//
+static void _Pyramid_FlushLevel(Retile_Pyramid* pyr,
+                                const size_t    level_idx)
+{
+    Retile_PyramidLevel* lv = &(pyr->levels[level_idx]);
+    
+    if (lv->rgba == NULL)
+    {
+        return;
+    }//if
+    
+    char dest_filepath[1024] __attribute__ ((aligned(16)));
+    
+    if (!_IsArchiveTemplate(pyr->urlTemplateId))
+    {
+        _GetFilepathAndCreateIntermediatePathsIfNeeded(dest_filepath, pyr->destPath,
+                                                       lv->x, lv->y, lv->z,
+                                                       &(lv->last_path_created_x), &(lv->last_path_created_z),
+                                                       pyr->urlTemplateId);
+    }//if
+    
+    if (level_idx + 1 < pyr->level_n)
+    {
+        _Pyramid_Push(pyr, level_idx + 1, lv->rgba, lv->width, lv->height, lv->rowBytes, lv->x, lv->y, lv->z);
+    }//if
+    else if (pyr->keepBottom)
+    {
+        if (pyr->bottom.data != NULL)
+        {
+            printf("_Pyramid_FlushLevel: [ERR] More than one bottom tile for subtree, (%u, %u, %u) dropped.\n", pyr->bottom.x, pyr->bottom.y, pyr->bottom.z);
+            free(pyr->bottom.data);
+        }//if
+        
+        pyr->bottom.data     = malloc(sizeof(uint8_t) * lv->height * lv->rowBytes);
+        pyr->bottom.width    = lv->width;
+        pyr->bottom.height   = lv->height;
+        pyr->bottom.rowBytes = lv->rowBytes;
+        pyr->bottom.x        = lv->x;
+        pyr->bottom.y        = lv->y;
+        pyr->bottom.z        = lv->z;
+        
+        memcpy(pyr->bottom.data, lv->rgba, sizeof(uint8_t) * lv->height * lv->rowBytes);
+    }//else if
+    
+    if (_IsArchiveTemplate(pyr->urlTemplateId))
+    {
+        uint8_t* png   = NULL;
+        size_t   png_n = 0;
+        
+        gbImage_PNG_Write_RGBA8888_ToMemory_Strided(lv->width, lv->height, lv->rowBytes, (uint8_t*)lv->rgba, &png, &png_n);
+        
+        if (png != NULL)
+        {
+            _PutArchiveTile(lv->x, lv->y, lv->z, png, png_n);
+        }//if
+    }//if
+    else
+    {
+        gbImage_PNG_Write_RGBA8888(dest_filepath, lv->width, lv->height, (uint8_t*)lv->rgba);
+    }//else
+    
+    free(lv->rgba);
+    lv->rgba = NULL;
+}//_Pyramid_FlushLevel
+
+
+// ==============
+// _Pyramid_Push:
+// ==============
+//
+// Downsamples a tile from zoom level levels[level_idx].z + 1 into its parent
+// at levels[level_idx], first flushing the level if the parent changed.
+//
+static void _Pyramid_Push(Retile_Pyramid* pyr,
+                          const size_t    level_idx,
+                          const uint32_t* src,
+                          const size_t    width,
+                          const size_t    height,
+                          const size_t    rowBytes,
+                          const uint32_t  x,
+                          const uint32_t  y,
+                          const uint32_t  z)
+{
+    if (level_idx >= pyr->level_n)
+    {
+        return;
+    }//if
+    
+    Retile_PyramidLevel* lv = &(pyr->levels[level_idx]);
+    
+    if (lv->rgba != NULL && (lv->x != x >> 1 || lv->y != y >> 1))
+    {
+        _Pyramid_FlushLevel(pyr, level_idx);
+    }//if
+    
+    if (lv->rgba == NULL)
+    {
+        lv->width    = width;
+        lv->height   = height;
+        lv->rowBytes = rowBytes;
+        lv->x        = x >> 1;
+        lv->y        = y >> 1;
+        lv->rgba     = malloc(sizeof(uint8_t) * height * rowBytes);
+        
+        memset(lv->rgba, 0, sizeof(uint8_t) * height * rowBytes);
+    }//if
+    else
+    {
+        _FixDestTileBufferIfNeeded(&(lv->rgba),
+                                   &(lv->width), &(lv->height), &(lv->rowBytes),
+                                   width, height, rowBytes);
+    }//else
+    
+    gbImage_Resize_HalfTile_RGBA8888((const uint8_t*)src,
+                                     x, y, z,
+                                     (uint8_t*)lv->rgba,
+                                     lv->x, lv->y, lv->z,
+                                     rowBytes / width,
+                                     width, height, rowBytes,
+                                     pyr->interpolationTypeId);
+}//_Pyramid_Push
+
+
+// ================
+// _Pyramid_Finish:
+// ================
+//
+// Flushes all levels, highest zoom level first, and frees the level stack.
+//
+static inline void _Pyramid_Finish(Retile_Pyramid* pyr)
+{
+    for (size_t i = 0; i < pyr->level_n; i++)
+    {
+        _Pyramid_FlushLevel(pyr, i);
+    }//for
+    
+    if (pyr->levels != NULL)
+    {
+        free(pyr->levels);
+        pyr->levels = NULL;
+    }//if
+}//_Pyramid_Finish
+
+
+// =========================
+// _Pyramid_PushWrittenTile:
+// =========================
+//
+// Reads back a tile written by an earlier run, and pushes it into the top
+// level, as if it had just been built.  Missing tiles are skipped.
+//
+static void _Pyramid_PushWrittenTile(Retile_Pyramid* pyr,
+                                     const uint32_t  x,
+                                     const uint32_t  y,
+                                     const uint32_t  z)
+{
+    if (pyr->level_n == 0)
+    {
+        return;
+    }//if
+    
+    char      dest_filename[1024] __attribute__ ((aligned(16)));
+    char      dest_filepath[1024] __attribute__ ((aligned(16)));
+    uint32_t* rgba     = NULL;
+    size_t    width    = 0;
+    size_t    height   = 0;
+    size_t    rowBytes = 0;
+    
+    _GetFilenameForXYZ_FromTemplateId(x, y, z, pyr->urlTemplateId, dest_filename);
+    _StringByAppendingPathComponent(dest_filepath, pyr->destPath, dest_filename);
+    
+    if (access(dest_filepath, F_OK) != 0)
+    {
+        return;
+    }//if
+    
+    gbImage_PNG_Read_RGBA8888(dest_filepath, &rgba, &width, &height, &rowBytes);
+    
+    if (rgba != NULL)
+    {
+        _Pyramid_Push(pyr, 0, rgba, width, height, rowBytes, x, y, z);
+        free(rgba);
+    }//if
+}//_Pyramid_PushWrittenTile
+
+
+
+
+// =====================
+// Retile_PyramidResults
+// =====================
+//
+// Reorder buffer for subtree results.  Subtree tasks finish in any order, but
+// the tiles they return must be pushed into the main thread's pyramid in
+// quadkey order.  seq % slot_n is the slot for each subtree.
+//
+// Consuming a result also marks its subtree's key done in progress, if any,
+// as every tile under it has been written by then.
+//
+typedef struct Retile_PyramidResults
+{
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    Retile_Buffer*   slots;
+    bool*            isDone;
+    uint64_t*        keys;                  // subtree tile keys
+    size_t           slot_n;
+    Retile_Progress* progress;
+} Retile_PyramidResults;
+
+
+// ==================================
+// Retile_PyramidSubtreeWorkContext
+// ==================================
+//
+// One subtree: all source tiles under a single tile at part_z, in quadkey
+// order.  Owned by the task.
+//
+typedef struct Retile_PyramidSubtreeWorkContext
+{
+    Retile_Buffer*         rt_bufs;
+    size_t                 rt_buf_n;
+    size_t                 seq;
+    uint32_t               src_z;
+    uint32_t               part_z;
+    const char*            destPath;
+    int                    urlTemplateId;
+    int                    interpolationTypeId;
+    bool                   alsoReprocessSrc;
+    bool                   keepBottom;
+    Retile_PyramidResults* results;
+} Retile_PyramidSubtreeWorkContext;
+
+
+// ===============================
+// _PyramidSubtree_Work_RGBA8888:
+// ===============================
+//
+// Reads and decodes each source tile once, and builds every level from
+// src_z-1 down to part_z from it in memory.  The part_z tile is returned via
+// the reorder buffer.
+//
+static void _PyramidSubtree_Work_RGBA8888(void* context)
+{
+    Retile_PyramidSubtreeWorkContext* c = (Retile_PyramidSubtreeWorkContext*)context;
+    Retile_Pyramid                    pyr;
+    
+    _Pyramid_Init(&pyr, c->src_z - 1, c->src_z - c->part_z, c->destPath, c->urlTemplateId, c->interpolationTypeId, c->keepBottom);
+    
+    for (size_t i = 0; i < c->rt_buf_n; i++)
+    {
+        Retile_Buffer* b = &(c->rt_bufs[i]);
+        
+        if (_mbtilesSrc != NULL)
+        {
+            size_t   png_n = 0;
+            uint8_t* png   = _ReadSrcTileToBuffer(b, &png_n);
+            
+            if (png != NULL)
+            {
+                gbImage_PNG_Read_RGBA8888_FromMemory(png, png_n, b->filename, &(b->data), &(b->width), &(b->height), &(b->rowBytes));
+                free(png);
+            }//if
+        }//if
+        else
+        {
+            gbImage_PNG_Read_RGBA8888(b->filename, &(b->data), &(b->width), &(b->height), &(b->rowBytes));
+        }//else
+        
+        if (b->data != NULL)
+        {
+            _Pyramid_Push(&pyr, 0, b->data, b->width, b->height, b->rowBytes, b->x, b->y, b->z);
+            
+            if (c->alsoReprocessSrc)
+            {
+                gbImage_PNG_Write_RGBA8888(b->dest_filename, b->width, b->height, (uint8_t*)b->data);
+                
+                if (strcmp(b->filename, b->dest_filename) != 0)
+                {
+                    remove(b->filename); // delete src if different formats
+                }//if
+            }//if
+        }//if
+        
+        _FreeRetileBuffersData(b, 1);   // only one decoded src tile held at a time
+    }//for
+    
+    _Pyramid_Finish(&pyr);
+    
+    Retile_PyramidResults* r = c->results;
+    
+    pthread_mutex_lock(&r->mutex);
+    
+    r->slots [c->seq % r->slot_n] = pyr.bottom;
+    r->isDone[c->seq % r->slot_n] = true;
+    
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+    
+    free(c->rt_bufs);
+    free(c);
+}//_PyramidSubtree_Work_RGBA8888
+
+
+// ============================
+// _PyramidResults_ConsumeUpTo:
+// ============================
+//
+// Pushes finished subtree results into the main pyramid in order, from
+// *next_seq up to (but not including) end_seq.
+//
+// If shouldWait, blocks until all of those are done.  Otherwise, stops at the
+// first one that isn't.
+//
+static inline void _PyramidResults_ConsumeUpTo(Retile_PyramidResults* r,
+                                               Retile_Pyramid*        pyr,
+                                               size_t*                next_seq,
+                                               const size_t           end_seq,
+                                               const bool             shouldWait)
+{
+    while (*next_seq < end_seq)
+    {
+        const size_t  idx = *next_seq % r->slot_n;
+        Retile_Buffer tile;
+        
+        pthread_mutex_lock(&r->mutex);
+        
+        while (!r->isDone[idx] && shouldWait)
+        {
+            pthread_cond_wait(&r->cond, &r->mutex);
+        }//while
+        
+        if (!r->isDone[idx])
+        {
+            pthread_mutex_unlock(&r->mutex);
+            break;
+        }//if
+        
+        tile          = r->slots[idx];
+        r->isDone[idx] = false;
+        
+        pthread_mutex_unlock(&r->mutex);
+        
+        if (tile.data != NULL)
+        {
+            _Pyramid_Push(pyr, 0, tile.data, tile.width, tile.height, tile.rowBytes, tile.x, tile.y, tile.z);
+            free(tile.data);
+        }//if
+        
+        if (r->progress != NULL)
+        {
+            _Progress_Done(r->progress, *next_seq, r->keys[idx]);
+        }//if
+        
+        *next_seq = *next_seq + 1;
+    }//while
+}//_PyramidResults_ConsumeUpTo
+
+
+// ===========================
+// _PyramidSubtree_Submit:
+// ===========================
+//
+// Hands a subtree's source tiles to a task.  Ownership of rt_bufs passes to
+// the task.
 //
-// (even in single threaded mode, this function does no processing, it merely
-//  queues the work up and accumulates references.)
+// Before doing so, waits for the oldest result if the reorder buffer would
+// otherwise be overrun.
 //
-void _QueueDownsampleFromDB(const char* destPath,
-                            const char* dbFilePath,
-                            const int   urlTemplateId,
-                            const bool  alsoReprocessSrc,
-                            const int   interpolationTypeId)
+static inline void _PyramidSubtree_Submit(Retile_WorkQueue*      wq,
+                                          Retile_PyramidResults* results,
+                                          Retile_Pyramid*        pyr,
+                                          size_t*                next_seq,
+                                          const size_t           seq,
+                                          const uint64_t         part_key,
+                                          Retile_Buffer*         rt_bufs,
+                                          const size_t           rt_buf_n,
+                                          const uint32_t         src_z,
+                                          const uint32_t         part_z,
+                                          const char*            destPath,
+                                          const int              urlTemplateId,
+                                          const int              interpolationTypeId,
+                                          const bool             alsoReprocessSrc)
 {
-    int       row      = 0;
-    int       queue_n  = 0;
-    const int rowCount = gbDB_ExecSQL_Scalar(dbFilePath, "SELECT COUNT(*) FROM TileRef;");
+    if (seq >= results->slot_n)
+    {
+        _PyramidResults_ConsumeUpTo(results, pyr, next_seq, seq - results->slot_n + 1, true);
+    }//if
+    
+    results->keys[seq % results->slot_n] = part_key;
+    
+    Retile_PyramidSubtreeWorkContext* c = malloc(sizeof(Retile_PyramidSubtreeWorkContext));
+    
+    c->rt_bufs             = rt_bufs;
+    c->rt_buf_n            = rt_buf_n;
+    c->seq                 = seq;
+    c->src_z               = src_z;
+    c->part_z              = part_z;
+    c->destPath            = destPath;
+    c->urlTemplateId       = urlTemplateId;
+    c->interpolationTypeId = interpolationTypeId;
+    c->alsoReprocessSrc    = alsoReprocessSrc;
+    c->keepBottom          = pyr->level_n > 0;     // otherwise, nothing to feed
+    c->results             = results;
+    
+    _WorkQueue_AddWork(wq, _PyramidSubtree_Work_RGBA8888, c);
+}//_PyramidSubtree_Submit
+
+
+// ========================
+// _QueuePyramidFromIndex:
+// ========================
+//
+// Single-pass full pyramid downsample, src_z -> dest_min_z.
+//
+// Unlike _IterativeRetile, which rescans, re-reads and re-decodes each level
+// it just wrote, each source tile is read and decoded exactly once, and all
+// lower zoom levels are built from buffers held in memory.
+//
+// 1. Tiles are read from the sorted tile index in quadkey order.
+// 2. They are split into subtrees, one per tile at part_z, a few levels
+//    below src_z.  Each subtree is a task that builds src_z-1 ... part_z.
+// 3. The part_z tiles are handed back to this thread, in order, which builds
+//    part_z-1 ... dest_min_z from them.  This is a tiny fraction of the work.
+//
+// Memory use is bounded by the work queue limit and the reorder buffer,
+// plus one tile per zoom level per pyramid.
+//
+// progress (may be NULL) logs each subtree as it is consumed.  On resume,
+// subtrees an earlier run finished are not rebuilt; only their part_z tile is
+// read back, to feed the main thread's pyramid.
+//
+void _QueuePyramidFromIndex(const char*        destPath,
+                            const gbTileIndex* idx,
+                            const int          urlTemplateId,
+                            const bool         alsoReprocessSrc,
+                            const int          interpolationTypeId,
+                            const int          dest_min_z,
+                            const int          thread_n,
+                            Retile_Progress*   progress)
+{
+    const int rowCount = (int)gbTileIndex_GetCount(idx);
     const int modCount = ceil((double)rowCount / 10.0);
+    int       row      = 0;
+    uint32_t  min_z    = 0;
+    uint32_t  max_z    = 0;
     
-#ifdef __ACCELERATE__
-    queue_n = gbDB_ExecSQL_Scalar(dbFilePath, "SELECT COUNT (DISTINCT (Y/2 * (1 << (Z-1)) + X/2)) FROM TileRef;");    // no point tracking this if using single thread
+    if (rowCount == 0)
+    {
+        printf("No tiles were found to read.  Aborting.\n");
+        return;
+    }//if
     
-    dispatch_semaphore_t _sema_idx   = dispatch_semaphore_create(1);
-    dispatch_semaphore_t _sema_write = dispatch_semaphore_create(32);
-#endif
+    gbTileIndex_GetZRange(idx, &min_z, &max_z);
+    
+    const int src_z    = (int)max_z;
+    
+    if (min_z != max_z)
+    {
+        printf("_QueuePyramidFromIndex: [ERR] Source tiles must all be from the same zoom level.  Aborting.\n");
+        return;
+    }//if
+    
+    if (dest_min_z < 0 || dest_min_z >= src_z)
+    {
+        printf("_QueuePyramidFromIndex: [ERR] -zOutTo %d must be less than the source zoom level (%d).  Aborting.\n", dest_min_z, src_z);
+        return;
+    }//if
+    
+    if (progress != NULL && progress->isLevelDone[dest_min_z])
+    {
+        printf("[z=%d -> %d]: Already done, skipping.\n", src_z, dest_min_z);
+        return;
+    }//if
+    
+    const uint32_t part_z     = (uint32_t)MAX(dest_min_z, src_z - kRetile_PyramidSubtreeDepth);
+    const int      part_shift = 2 * (src_z - (int)part_z);
+    const uint64_t resume_key = progress != NULL ? progress->resumeKey[part_z] : UINT64_MAX;
+    
+    Retile_WorkQueue      wq;
+    Retile_PyramidResults results;
+    Retile_Pyramid        pyr;
+    
+    results.slot_n   = 2 * kRetile_MaxInFlight;
+    results.slots    = malloc(sizeof(Retile_Buffer) * results.slot_n);
+    results.isDone   = malloc(sizeof(bool)          * results.slot_n);
+    results.keys     = malloc(sizeof(uint64_t)      * results.slot_n);
+    results.progress = progress;
+    
+    if (progress != NULL)
+    {
+        _Progress_BeginLevel(progress, part_z, 1);
+    }//if
+    
+    memset(results.isDone, 0, sizeof(bool) * results.slot_n);
+    
+    pthread_mutex_init(&results.mutex, NULL);
+    pthread_cond_init (&results.cond,  NULL);
+    
+    // main thread's pyramid, fed by subtrees.  may have no levels.
+    _Pyramid_Init(&pyr, part_z - 1, part_z - (uint32_t)dest_min_z, destPath, urlTemplateId, interpolationTypeId, false);
+    
+    _WorkQueue_Init(&wq, thread_n);
+    
+    uint32_t       _reproc_last_path_created_z = UINT32_MAX;
+    uint32_t       _reproc_last_path_created_x = UINT32_MAX;
+    
+    size_t         rt_buf_i     = 0;
+    size_t         rt_buf_n     = 64;
+    Retile_Buffer* rt_bufs      = malloc(sizeof(Retile_Buffer) * rt_buf_n);
+    uint64_t       _last_part   = UINT64_MAX;
+    size_t         seq          = 0;
+    size_t         next_seq     = 0;
+    
+    mkdir(destPath, 0777);
+    
+    printf("Resampling and writing files (src n=[%d], z=%d -> %d, subtrees at z=%d)...\n", rowCount, src_z, dest_min_z, (int)part_z);
+    
+    for (size_t idx_i = 0; idx_i < (size_t)rowCount; idx_i++)
+    {
+        uint32_t       src_x    = 0;
+        uint32_t       src_y    = 0;
+        uint32_t       _z       = 0;
+        const char*    filename = gbTileIndex_GetFilePath(idx, idx_i);
+        const uint64_t part     = (gbTileIndex_GetKey(idx, idx_i) & ((1ULL << kGB_TileIndex_ZShift) - 1ULL)) >> part_shift;
+        
+        gbTileIndex_GetXYZ(idx, idx_i, &src_x, &src_y, &_z);
+        
+        if (resume_key != UINT64_MAX && (((uint64_t)part_z << kGB_TileIndex_ZShift) | part) <= resume_key)
+        {
+            if (part != _last_part)                 // done earlier, just feed the main pyramid
+            {
+                _Pyramid_PushWrittenTile(&pyr, src_x >> (src_z - part_z), src_y >> (src_z - part_z), part_z);
+            }//if
+            
+            _last_part = part;
+            row++;
+            continue;
+        }//if
+        
+        if (part != _last_part && rt_buf_i > 0)
+        {
+            _PyramidSubtree_Submit(&wq, &results, &pyr, &next_seq, seq++,
+                                   ((uint64_t)part_z << kGB_TileIndex_ZShift) | _last_part,
+                                   rt_bufs, rt_buf_i,
+                                   (uint32_t)src_z, part_z, destPath, urlTemplateId, interpolationTypeId, alsoReprocessSrc);
+            
+            rt_buf_i = 0;
+            rt_bufs  = malloc(sizeof(Retile_Buffer) * rt_buf_n);
+            
+            _PyramidResults_ConsumeUpTo(&results, &pyr, &next_seq, seq, false);
+        }//if
+        
+        if (rt_buf_i == rt_buf_n)
+        {
+            rt_buf_n = rt_buf_n << 1;
+            rt_bufs  = realloc(rt_bufs, sizeof(Retile_Buffer) * rt_buf_n);
+        }//if
+        
+        Retile_Buffer* b = &(rt_bufs[rt_buf_i]);
+        
+        b->data          = NULL;
+        b->width         = 0;
+        b->height        = 0;
+        b->rowBytes      = 0;
+        b->x             = src_x;
+        b->y             = src_y;
+        b->z             = (uint32_t)src_z;
+        b->filename      = malloc(sizeof(char) * 1024);
+        b->dest_filename = NULL;
+        
+        snprintf(b->filename, 1024, "%s", filename != NULL ? filename : "");
+        
+        if (alsoReprocessSrc)
+        {
+            b->dest_filename = malloc(sizeof(char) * 1024);
+            
+            _GetFilepathAndCreateIntermediatePathsIfNeeded(b->dest_filename, destPath,
+                                                           b->x, b->y, b->z,
+                                                           &_reproc_last_path_created_x, &_reproc_last_path_created_z,
+                                                           urlTemplateId);
+        }//if
+        
+        rt_buf_i++;
+        _last_part = part;
+        
+        if (row % modCount == 0)
+        {
+            printf("[z=%d -> %d]: %1.0f%%\n", src_z, dest_min_z, (double)row / (double)rowCount * 100.0);
+        }//if
+        
+        row++;
+    }//for
+    
+    if (rt_buf_i > 0)
+    {
+        _PyramidSubtree_Submit(&wq, &results, &pyr, &next_seq, seq++,
+                               ((uint64_t)part_z << kGB_TileIndex_ZShift) | _last_part,
+                               rt_bufs, rt_buf_i,
+                               (uint32_t)src_z, part_z, destPath, urlTemplateId, interpolationTypeId, alsoReprocessSrc);
+    }//if
+    else
+    {
+        free(rt_bufs);
+    }//else
+    
+    rt_bufs = NULL;
+    
+    _PyramidResults_ConsumeUpTo(&results, &pyr, &next_seq, seq, true);
+    
+    char logPrefix[32];
+    snprintf(logPrefix, sizeof(logPrefix), "[z=%d -> %d]: ", src_z, dest_min_z);
+    
+    _WorkQueue_WaitAndRelease(&wq, logPrefix);
+    
+    printf("[z=%d -> %d]: Writing z=%d ... %d\n", src_z, dest_min_z, (int)part_z - 1, dest_min_z);
+    
+    _Pyramid_Finish(&pyr);
+    
+    for (int z = src_z - 1; z >= dest_min_z && progress != NULL; z--)
+    {
+        _Progress_EndLevel(progress, (uint32_t)z);
+    }//for
+    
+    pthread_cond_destroy (&results.cond);
+    pthread_mutex_destroy(&results.mutex);
+    
+    free(results.slots);
+    free(results.isDone);
+    free(results.keys);
+    
+    printf("[z=%d -> %d]: 100%%\n", src_z, dest_min_z);
+    
+    printf("[z=%d -> %d]: Done.\n", src_z, dest_min_z);
+}//_QueuePyramidFromIndex
+
+
+
+
+
+// =======================
+// _QueueEnlargeFromIndex:
+// =======================
+//
+// Main raster tile pyramid level enlarge (z -> z+x) function.
+//
+// This is actually much less tricksy than the downsampling function, no fancy
+// data clustering.
+//
+// Processing is multithreaded and asynchronous, via the same pipeline as
+// _QueueDownsampleFromIndex.
+//
+// (this function does no processing, it merely queues the work up and
+//  accumulates references.)
+//
+void _QueueEnlargeFromIndex(const char*                  destPath,
+                            const gbTileIndex*           idx,
+                            const int                    urlTemplateId,
+                            const bool                   alsoReprocessSrc,
+                            const int                    interpolationTypeId,
+                            const uint32_t               dest_z_shift,
+                            const int                    thread_n,
+                            const Retile_PipelineConfig* pipe_cfg)
+{
+    int       row      = 0;
+    const int rowCount = (int)gbTileIndex_GetCount(idx);
+    const int modCount = ceil((double)rowCount / 10.0);
     
     if (rowCount == 0)
     {
@@ -1090,37 +3779,23 @@ void _QueueDownsampleFromDB(const char* destPath,
         return;
     }//if
     
-    sqlite3*      db;
-    sqlite3_stmt* selectStmt;
+    Retile_PipelineContext pctx = { destPath, urlTemplateId, interpolationTypeId, alsoReprocessSrc, true, dest_z_shift, NULL, NULL, NULL, NULL, NULL };
     
-    gbDB_PrepConn_DBPath_CString(dbFilePath, "SELECT X, Y, Z, FilePath FROM TileRef ORDER BY Y/2 * (1 << (Z-1)) + X/2, Y * (1 << Z) + X;", &db, &selectStmt);
+    gbPipeline* pipe = _Pipeline_Create(&pctx, pipe_cfg, thread_n);
     
     // <multiread>
     size_t        rt_buf_i = 0;
-    const size_t  rt_buf_n = 4;
+    const size_t  rt_buf_n = 1;
     
     Retile_Buffer rt_bufs[rt_buf_n] __attribute__ ((aligned(16)));
+    char          reproc_filepaths[rt_buf_n][1024] __attribute__ ((aligned(16)));
     
-    for (size_t i = 0; i < rt_buf_n; i++)
-    {
-        rt_bufs[i].data          = NULL;
-        rt_bufs[i].width         = 0;
-        rt_bufs[i].height        = 0;
-        rt_bufs[i].rowBytes      = 0;
-        rt_bufs[i].x             = 0;
-        rt_bufs[i].y             = 0;
-        rt_bufs[i].z             = 0;
-        rt_bufs[i].filename      = NULL;
-        rt_bufs[i].dest_filename = NULL;
-    }//for
+    _ResetRetileBuffers(rt_bufs, rt_buf_n);
     // </multiread>
     
     uint32_t _reproc_last_path_created_z = UINT32_MAX;
     uint32_t _reproc_last_path_created_x = UINT32_MAX;
     
-    uint32_t _last_path_created_z = UINT32_MAX;
-    uint32_t _last_path_created_x = UINT32_MAX;
-    
     uint32_t src_x  = 0;
     uint32_t src_y  = 0;
     uint32_t src_z  = 0;
@@ -1128,66 +3803,30 @@ void _QueueDownsampleFromDB(const char* destPath,
     uint32_t dest_x = 0;
     uint32_t dest_y = 0;
     uint32_t dest_z = 0;
-    uint32_t _last_dest_x = UINT32_MAX;
-    uint32_t _last_dest_y = UINT32_MAX;
-    
-    //char dest_filename[1024] __attribute__ ((aligned(16)));
-    char dest_filepath[1024] __attribute__ ((aligned(16)));
-    //char sub_dest_path[1024] __attribute__ ((aligned(16)));
-    //char temp_char_comp[1024] __attribute__ ((aligned(16)));
     
-    int sqliteStepResult = SQLITE_ROW;
+    size_t idx_i  = 0;
+    bool   isDone = false;
     
     mkdir(destPath, 0777);
     
     printf("Resampling and writing files (src n=[%d])...\n", rowCount);
     
-    while (sqliteStepResult == SQLITE_ROW || sqliteStepResult == SQLITE_DONE)
+    while (true)
     {
         char* filename = NULL;
         
-        if (sqliteStepResult != SQLITE_DONE)
-        {
-            sqliteStepResult = sqlite3_step(selectStmt);
-        }//if
+        isDone = idx_i >= (size_t)rowCount;
         
-        if (sqliteStepResult != SQLITE_DONE)
+        if (!isDone)
         {
-            src_x    = sqlite3_column_int(selectStmt, 0);
-            src_y    = sqlite3_column_int(selectStmt, 1);
-            src_z    = sqlite3_column_int(selectStmt, 2);
-            filename = (char*)sqlite3_column_text(selectStmt, 3);
+            gbTileIndex_GetXYZ(idx, idx_i, &src_x, &src_y, &src_z);
+            filename = (char*)gbTileIndex_GetFilePath(idx, idx_i);
+            idx_i++;
             
-            dest_z   = src_z - 1;
+            dest_z   = src_z + dest_z_shift;
             dest_x   = src_x >> (src_z - dest_z);
             dest_y   = src_y >> (src_z - dest_z);
-        }//if
-
-        
-        if ((  (    ((dest_x != _last_dest_x && _last_dest_x != UINT32_MAX)
-                ||   (dest_y != _last_dest_y && _last_dest_y != UINT32_MAX)) && src_z > 0)
-             || sqliteStepResult == SQLITE_DONE))
-        {
-            _GetFilepathAndCreateIntermediatePathsIfNeeded(dest_filepath, destPath,
-                                                           _last_dest_x, _last_dest_y, dest_z,
-                                                           &_last_path_created_x, &_last_path_created_z,
-                                                           urlTemplateId);
-
-#ifdef __ACCELERATE__
-            _DownsampleCompressAndWrite_RetileBuffers_DispatchWrapper_RGBA8888(dest_filepath, rt_bufs, rt_buf_n,
-                                                                               _sema_write, _sema_idx, &queue_n,
-                                                                               alsoReprocessSrc, interpolationTypeId);
-#else
-            _DownsampleCompressAndWrite_RetileBuffers_RGBA8888(dest_filepath, rt_bufs, rt_buf_n,
-                                                               alsoReprocessSrc, interpolationTypeId);
-#endif
             
-            _FreeRetileBuffersData(rt_bufs, rt_buf_n);
-            rt_buf_i = 0;
-        }//if
-        
-        if (sqliteStepResult != SQLITE_DONE)
-        {
             if (filename != NULL)
             {
                 if (rt_bufs[rt_buf_i].filename != NULL)
@@ -1195,8 +3834,7 @@ void _QueueDownsampleFromDB(const char* destPath,
                     printf("ERR: rt_bufs[%zu] filename was non-null! [%s]\n", rt_buf_i, rt_bufs[rt_buf_i].filename);
                 }//if
                 
-                rt_bufs[rt_buf_i].filename = malloc(sizeof(char) * 1024);
-                memcpy(rt_bufs[rt_buf_i].filename, filename, sizeof(char) * 1024);
+                rt_bufs[rt_buf_i].filename = filename;     // owned by the index
             }//if
             
             rt_bufs[rt_buf_i].x = src_x;
@@ -1207,7 +3845,7 @@ void _QueueDownsampleFromDB(const char* destPath,
             {
                 if (alsoReprocessSrc)
                 {
-                    rt_bufs[rt_buf_i].dest_filename = malloc(sizeof(char) * 1024);
+                    rt_bufs[rt_buf_i].dest_filename = reproc_filepaths[rt_buf_i];
                     
                     _GetFilepathAndCreateIntermediatePathsIfNeeded(rt_bufs[rt_buf_i].dest_filename, destPath,
                                                                    rt_bufs[rt_buf_i].x, rt_bufs[rt_buf_i].y, rt_bufs[rt_buf_i].z,
@@ -1216,15 +3854,22 @@ void _QueueDownsampleFromDB(const char* destPath,
                 }//if
                 
                 rt_buf_i     = rt_buf_i < rt_buf_n - 1 ? rt_buf_i + 1 : 0;
-                _last_dest_x = dest_x;
-                _last_dest_y = dest_y;
             }//if
         }//if
-        else
+        
+        
+        if (src_z > 0 && !isDone)
+        {
+            _Pipeline_PushRetileBuffers(pipe, &pctx, rt_bufs, rt_buf_n, NULL, UINT64_MAX);
+            
+            _ResetRetileBuffers(rt_bufs, rt_buf_n);
+            rt_buf_i = 0;
+        }//if
+
+        if (isDone)
         {
-            sqliteStepResult = -1;
             break;
-        }//else
+        }//if
         
         if (row % modCount == 0)
         {
@@ -1234,446 +3879,601 @@ void _QueueDownsampleFromDB(const char* destPath,
         row++;
     }//while
     
-
-#ifdef __ACCELERATE__
-    // Wait for worker queue to empty, but use a long failsafe timeout in case
-    // the initial COUNT DISTINCT did not predict things correctly.
-    // (eg, bad input PNGs, etc)
-    //
     
-    int polled_n = _IncDecrementWithSemaphore(&queue_n, _sema_idx, false, false);
+    char logPrefix[32];
+    snprintf(logPrefix, sizeof(logPrefix), "[z=%d]: ", (int)dest_z);
+    
+    _Pipeline_WaitAndRelease(pipe, &pctx, logPrefix);
+    
+    printf("[z=%d]: 100%%\n", (int)dest_z);
+    
+    printf("[z=%d]: Done.\n", (int)dest_z);
+}//_QueueEnlargeFromIndex
+
+
+
+
+// ==================
+// Retile_Incremental
+// ==================
+//
+// -incremental <manifest>: rebuilds only the tiles derived from src tiles that
+// changed since the last run.
+//
+// Every src tile is stat'd and compared with the manifest saved by the last
+// run.  A tile is dirty if it is new, or its mtime or size differ, unless
+// -incrementalHash is also given and its contents still hash the same.  Tiles
+// in the manifest which no longer exist are dirty as well.
+//
+// -zOut / -zOutTo: the dirty keys are walked up one level at a time, and each
+// dirty parent is rebuilt from its children; the src tiles for the first
+// level, and the output of the level below it after that.  A dirty parent
+// with no children left is deleted.
+//
+// -zIn: dirty src tiles are enlarged, and the children of deleted ones are
+// deleted.
+//
+// Each tile written or deleted is listed, relative to the dest path, in
+// <manifest>.changed for CDN purges and the like.  The manifest is replaced
+// once the run is done.  Without a previous manifest, everything is dirty and
+// the usual full build runs instead.
+//
+#define kRetile_IncrementalChunkN 4096
 
-    if (polled_n > 0)
+typedef struct Retile_IncrementalCheck
+{
+    const gbTileIndex*          idx;
+    gbTileManifest_Entry*       cur;        // one per idx entry, same order
+    const gbTileManifest_Entry* old;
+    size_t                      old_n;
+    bool*                       isDirty;    // one per idx entry
+    bool                        useHash;
+    size_t                      start;
+    size_t                      end;
+} Retile_IncrementalCheck;
+
+
+
+
+// =======================
+// _IncrementalCheck_Work:
+// =======================
+//
+// Retile_WorkQueue task.  Stats (and maybe hashes) one chunk of src tiles,
+// and compares them with the old manifest.
+//
+static void _IncrementalCheck_Work(void* context)
+{
+    Retile_IncrementalCheck* c = (Retile_IncrementalCheck*)context;
+    
+    for (size_t i = c->start; i < c->end; i++)
     {
-        printf("[z=%d]: Waiting on compress and write queue: %d\n", (int)dest_z, polled_n);
+        gbTileManifest_Entry* e = &(c->cur[i]);
         
-        uint32_t        currentSleepMS  = 0;
-        const uint32_t kSleepIntervalMS = 100;                      // 100ms
-        const uint32_t kSleepIntervalUS = kSleepIntervalMS * 1000;  // 100ms -> us
-        const uint32_t kMaxSleepMS      = 60 * 1000;                // 60s   -> ms
+        e->key      = gbTileIndex_GetKey(c->idx, i);
+        e->filepath = gbTileIndex_GetFilePath(c->idx, i);
+        e->hash     = 0;
         
-        while (polled_n > 0)
-        {
-            if (polled_n <= 0 || currentSleepMS > kMaxSleepMS)
-            {
-                break;
-            }//if
-            
-            polled_n = _IncDecrementWithSemaphore(&queue_n, _sema_idx, false, false);
-            
-            usleep(kSleepIntervalUS);
-            currentSleepMS += kSleepIntervalMS;
-        }//while
+        const bool                  isStat = gbTileManifest_StatFile(e->filepath, e);
+        const gbTileManifest_Entry* o      = gbTileManifest_Find(c->old, c->old_n, e->key);
         
-        if (currentSleepMS > kMaxSleepMS)
+        if (o != NULL && isStat && o->mtime_ns == e->mtime_ns && o->size == e->size)
         {
-            printf("[z=%d]: [WARN] Timeout after %d ms while waiting on queue: %d\n", (int)dest_z, (int)kMaxSleepMS, polled_n);
+            e->hash       = o->hash;
+            c->isDirty[i] = false;
         }//if
-    }//if
-    
-    dispatch_release(_sema_idx);
-    dispatch_release(_sema_write);
-#endif
-    
-    printf("[z=%d]: 100%%\n", (int)dest_z);
-    
-    printf("[z=%d]: Closing DB and transaction...\n", (int)dest_z);
-    
-    gbDB_CloseDBConnAndQueryStmt(db, selectStmt);
+        else if (c->useHash && isStat)
+        {
+            e->hash       = gbTileManifest_HashFile(e->filepath);
+            c->isDirty[i] = o == NULL || o->hash == 0 || o->hash != e->hash;
+        }//else if
+        else
+        {
+            c->isDirty[i] = true;
+        }//else
+    }//for
     
-    printf("[z=%d]: Done.\n", (int)dest_z);
-}//_QueueDownsampleFromDB
-
+    free(c);
+}//_IncrementalCheck_Work
 
 
 
 
+static int _Incremental_CompareKey(const void* a,
+                                  const void* b)
+{
+    const uint64_t ka = *(const uint64_t*)a;
+    const uint64_t kb = *(const uint64_t*)b;
+    
+    return ka < kb ? -1 : ka > kb ? 1 : 0;
+}//_Incremental_CompareKey
 
 
 
 
+// ===========================
+// _Incremental_GetParentKeys:
+// ===========================
+//
+// Unique z-1 keys of keys, which must be sorted and all of the same z.  As
+// quadkeys, the parents come out sorted as well.
+//
+static uint64_t* _Incremental_GetParentKeys(const uint64_t* keys,
+                                            const size_t    key_n,
+                                            size_t*         parent_n)
+{
+    uint64_t* parents = malloc(sizeof(uint64_t) * (key_n > 0 ? key_n : 1));
+    size_t    n       = 0;
+    uint32_t  x;
+    uint32_t  y;
+    uint32_t  z;
+    
+    for (size_t i = 0; i < key_n; i++)
+    {
+        gbTileIndex_GetXYZForKey(keys[i], &x, &y, &z);
+        
+        const uint64_t p = gbTileIndex_GetKeyForXYZ(x >> 1, y >> 1, z - 1);
+        
+        if (n == 0 || parents[n - 1] != p)
+        {
+            parents[n] = p;
+            n++;
+        }//if
+    }//for
+    
+    *parent_n = n;
+    
+    return parents;
+}//_Incremental_GetParentKeys
 
 
 
 
+// ========================
+// _Incremental_GetDestTile
+// ========================
+//
+// Full and dest-relative filepaths of the tile with key.
+//
+static inline void _Incremental_GetDestTile(const char*    destPath,
+                                            const uint64_t key,
+                                            const int      urlTemplateId,
+                                            char*          dest_filename,
+                                            char*          dest_filepath)
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    
+    gbTileIndex_GetXYZForKey(key, &x, &y, &z);
+    
+    _GetFilenameForXYZ_FromTemplateId(x, y, z, urlTemplateId, dest_filename);
+    _StringByAppendingPathComponent(dest_filepath, destPath, dest_filename);
+}//_Incremental_GetDestTile
 
 
 
 
+// ==============================
+// _Incremental_WriteChangedKeys:
+// ==============================
+//
+// Lists keys in the changed file.  If isDeleted, also deletes their tiles,
+// and their directory if that leaves it empty.
+//
+static void _Incremental_WriteChangedKeys(FILE*           fp,
+                                          const char*     destPath,
+                                          const uint64_t* keys,
+                                          const size_t    key_n,
+                                          const bool*     isDeleted,
+                                          const int       urlTemplateId)
+{
+    char dest_filename[1024] __attribute__ ((aligned(16)));
+    char dest_filepath[1024] __attribute__ ((aligned(16)));
+    char dest_path[1024]     __attribute__ ((aligned(16)));
+    
+    for (size_t i = 0; i < key_n; i++)
+    {
+        _Incremental_GetDestTile(destPath, keys[i], urlTemplateId, dest_filename, dest_filepath);
+        
+        if (isDeleted != NULL && isDeleted[i] && unlink(dest_filepath) == 0)
+        {
+            _GetPathFromFilepath(dest_path, dest_filepath);
+            rmdir(dest_path);                               // only if now empty
+        }//if
+        
+        if (fp != NULL)
+        {
+            fprintf(fp, "%s\n", dest_filename);
+        }//if
+    }//for
+}//_Incremental_WriteChangedKeys
 
 
 
 
-// ===============================================
-// _EnlargeCompressAndWrite_RetileBuffers_RGBA8888
-// ===============================================
+// ========================
+// _Incremental_Downsample:
+// ========================
 //
-// For references to a group of tiles in rt_bufs,
-// read, decompess, resample, composite, compress and write a PNG file.
+// Rebuilds the dirty ancestors of the src keys dirty (sorted), from z-1 down
+// to dest_min_z, one level at a time.  If isListOnly, nothing is rebuilt and
+// every ancestor is only listed.  (for a full build)
 //
-static inline void _EnlargeCompressAndWrite_RetileBuffers_RGBA8888(const char*    rootPath,
-                                                                   Retile_Buffer* rt_bufs,
-                                                                   const size_t   rt_buf_n,
-                                                                   const bool     alsoReprocessSrc,
-                                                                   const uint32_t dest_z,
-                                                                   const int      urlTemplateId,
-                                                                   const int      interpolationTypeId)
+static void _Incremental_Downsample(const char*                  destPath,
+                                    const gbTileIndex*           idx,
+                                    const uint64_t*              dirty,
+                                    const size_t                 dirty_n,
+                                    const uint32_t               dest_min_z,
+                                    const bool                   isListOnly,
+                                    FILE*                        changed_fp,
+                                    const int                    urlTemplateId,
+                                    const int                    interpolationTypeId,
+                                    const int                    thread_n,
+                                    const Retile_PipelineConfig* pipe_cfg)
 {
-    size_t   local_width    = 256;
-    size_t   local_height   = 256;
-    size_t   local_rowBytes = 1024;
-    uint32_t y;
-    uint32_t x;
-    size_t   valid_n        = 0;
-    uint32_t _last_path_created_x = UINT32_MAX;
-    uint32_t _last_path_created_z = UINT32_MAX;
-    
-    uint32_t* local_rgba = malloc(sizeof(uint8_t) * local_height * local_rowBytes);
-    
-    memset(local_rgba, 0, sizeof(uint32_t) * local_height * local_width);
-    
+    char dest_filename[1024] __attribute__ ((aligned(16)));
     char dest_filepath[1024] __attribute__ ((aligned(16)));
     
-    bool roiWasEmpty;
+    uint32_t  x;
+    uint32_t  y;
+    uint32_t  z;
+    uint32_t  src_z = 0;
+    uint32_t  level_z;
+    size_t    key_n = dirty_n;
+    uint64_t* keys  = malloc(sizeof(uint64_t) * (dirty_n > 0 ? dirty_n : 1));
+    
+    memcpy(keys, dirty, sizeof(uint64_t) * dirty_n);
     
-    uint32_t start_y;
-    uint32_t end_y;
-    uint32_t start_x;
-    uint32_t end_x;
-    uint32_t zs;
+    if (key_n > 0)
+    {
+        gbTileIndex_GetXYZForKey(keys[0], &x, &y, &src_z);
+    }//if
     
-    for (size_t i = 0; i < rt_buf_n; i++)
+    for (level_z = src_z; level_z > dest_min_z && key_n > 0; level_z--)
     {
-        if (rt_bufs[i].filename != NULL)
+        size_t    parent_n = 0;
+        uint64_t* parents  = _Incremental_GetParentKeys(keys, key_n, &parent_n);
+        bool*     isGone   = malloc(sizeof(bool) * parent_n);
+        
+        for (size_t i = 0; i < parent_n; i++)
         {
-            gbImage_PNG_Read_RGBA8888(  rt_bufs[i].filename,
-                                      &(rt_bufs[i].data),
-                                      &(rt_bufs[i].width),
-                                      &(rt_bufs[i].height),
-                                      &(rt_bufs[i].rowBytes));
+            isGone[i] = !isListOnly;
+        }//for
+        
+        if (!isListOnly)
+        {
+            gbTileIndex* sub = gbTileIndex_Create();
             
-            if (rt_bufs[i].data != NULL)
+            if (level_z == src_z)
             {
-                _FixDestTileBufferIfNeeded(&local_rgba,
-                                           &local_width,     &local_height,     &local_rowBytes,
-                                           rt_bufs[i].width, rt_bufs[i].height, rt_bufs[i].rowBytes);
-                
-                zs      = dest_z - rt_bufs[i].z;
+                size_t j = 0;
                 
-                start_y = rt_bufs[i].y << zs;
-                end_y   = start_y            + (1 << zs);
-                start_x = rt_bufs[i].x << zs;
-                end_x   = start_x            + (1 << zs);
-                
-                for (y = start_y; y < end_y; y++)
+                for (size_t i = 0; i < gbTileIndex_GetCount(idx) && j < parent_n; i++)
+                {
+                    gbTileIndex_GetXYZ(idx, i, &x, &y, &z);
+                    
+                    const uint64_t p = gbTileIndex_GetKeyForXYZ(x >> 1, y >> 1, z - 1);
+                    
+                    while (j < parent_n && parents[j] < p)
+                    {
+                        j++;
+                    }//while
+                    
+                    if (j < parent_n && parents[j] == p)
+                    {
+                        gbTileIndex_Add(sub, x, y, z, gbTileIndex_GetFilePath(idx, i));
+                        isGone[j] = false;
+                    }//if
+                }//for
+            }//if
+            else
+            {
+                for (size_t i = 0; i < parent_n; i++)
                 {
-                    for (x = start_x; x < end_x; x++)
+                    gbTileIndex_GetXYZForKey(parents[i], &x, &y, &z);
+                    
+                    for (uint32_t c = 0; c < 4; c++)
                     {
-                        gbImage_Resize_EnlargeTile_RGBA8888((uint8_t*)(rt_bufs[i].data),
-                                                            (uint8_t*)local_rgba,
-                                                            rt_bufs[i].z,
-                                                            x, y, dest_z,
-                                                            rt_bufs[i].width, rt_bufs[i].height,
-                                                            interpolationTypeId,
-                                                            &roiWasEmpty);
+                        const uint32_t cx = (x << 1) + (c & 1);
+                        const uint32_t cy = (y << 1) + (c >> 1);
+                        
+                        _Incremental_GetDestTile(destPath, gbTileIndex_GetKeyForXYZ(cx, cy, level_z), urlTemplateId, dest_filename, dest_filepath);
                         
-                        if (!roiWasEmpty) // quite possible to zoom into nothingness on a tile, don't write those.
+                        if (access(dest_filepath, F_OK) == 0)
                         {
-                            _GetFilepathAndCreateIntermediatePathsIfNeeded(dest_filepath, rootPath,
-                                                                           x, y, dest_z,
-                                                                           &_last_path_created_x, &_last_path_created_z,
-                                                                           urlTemplateId);
-                            
-                            gbImage_PNG_Write_RGBA8888(dest_filepath, local_width, local_height, (uint8_t*)local_rgba);
+                            gbTileIndex_Add(sub, cx, cy, level_z, dest_filepath);
+                            isGone[i] = false;
                         }//if
                     }//for
                 }//for
+            }//else
+            
+            printf("[z=%d]: Rebuilding %zu dirty tiles from %zu tiles...\n", (int)level_z - 1, parent_n, gbTileIndex_GetCount(sub));
+            
+            if (gbTileIndex_GetCount(sub) > 0)
+            {
+                gbTileIndex_Sort(sub, thread_n > 0 ? (size_t)thread_n : 0);
                 
-                
-                if (alsoReprocessSrc)
-                {
-                    gbImage_PNG_Write_RGBA8888(rt_bufs[i].dest_filename, rt_bufs[i].width, rt_bufs[i].height, (uint8_t*)rt_bufs[i].data);
-                    
-                    if (strcmp(rt_bufs[i].filename, rt_bufs[i].dest_filename) != 0)
-                    {
-                        remove(rt_bufs[i].filename); // delete src if different formats
-                    }//if
-                }//if
-                
-                valid_n++;
+                _QueueDownsampleFromIndex(destPath, sub, urlTemplateId, false, interpolationTypeId, thread_n, pipe_cfg, NULL);
             }//if
+            
+            gbTileIndex_Destroy(sub);
         }//if
+        
+        _Incremental_WriteChangedKeys(changed_fp, destPath, parents, parent_n, isGone, urlTemplateId);
+        
+        free(isGone);
+        free(keys);
+        
+        keys  = parents;
+        key_n = parent_n;
     }//for
     
-    free(local_rgba);
-    local_rgba = NULL;
-}//_EnlargeCompressAndWriteTile_RetileBuffers_RGBA8888
+    free(keys);
+}//_Incremental_Downsample
 
 
-// ===============================================================
-// _EnlargeCompressAndWrite_RetileBuffers_DispatchWrapper_RGBA8888
-// ===============================================================
-//
-// Wrapper for _EnlargeCompressAndWrite_RetileBuffers_RGBA8888 that uses Apple's
-// GCD thread pooling.
-//
-// 1. Copies all src data from the reader.
-// 2. Waits for parallelism limit semaphore. (sema_write) (blocking)
-// 3. Locks and decrements queue_n when done (sema_idx)
-//
-static inline void _EnlargeCompressAndWrite_RetileBuffers_DispatchWrapper_RGBA8888(const char*          rootPath,
-                                                                                   Retile_Buffer*       rt_bufs,
-                                                                                   const size_t         rt_buf_n,
-                                                                                   dispatch_semaphore_t sema_write,
-                                                                                   dispatch_semaphore_t sema_idx,
-                                                                                   int*                 queue_n,
-                                                                                   const bool           alsoReprocessSrc,
-                                                                                   const uint32_t       dest_z,
-                                                                                   const int            urlTemplateId,
-                                                                                   const int            interpolationTypeId)
+
+
+// Fills children with the keys of all tiles under x, y, z, down to
+// z+dest_z_shift, and returns their count.
+static size_t _Incremental_GetChildKeys(const uint32_t x,
+                                        const uint32_t y,
+                                        const uint32_t z,
+                                        const uint32_t dest_z_shift,
+                                        uint64_t*      children)
 {
-#ifdef __ACCELERATE__
-    // copy filenames and refs synchronously, as they are stack alloc / reused
+    size_t n = 0;
     
-    const size_t   local_rt_buf_n = rt_buf_n;
-    char*          local_rootpath = malloc(sizeof(char) * 1024);
-    Retile_Buffer* local_rt_bufs  = malloc(sizeof(Retile_Buffer) * local_rt_buf_n);
+    for (uint32_t l = 1; l <= dest_z_shift; l++)
+    {
+        const uint32_t side = 1U << l;
+        
+        for (uint32_t c = 0; c < side * side; c++)
+        {
+            children[n] = gbTileIndex_GetKeyForXYZ((x << l) + (c % side), (y << l) + (c / side), z + l);
+            n++;
+        }//for
+    }//for
     
-    memcpy(local_rootpath, rootPath, 1024);
+    return n;
+}//_Incremental_GetChildKeys
+
+
+
+
+// =====================
+// _Incremental_Enlarge:
+// =====================
+//
+// Enlarges the dirty src tiles, and lists (and for deleted src tiles,
+// deletes) their children, down to z+dest_z_shift.  If isListOnly, nothing is
+// rebuilt.
+//
+static void _Incremental_Enlarge(const char*                  destPath,
+                                 const gbTileIndex*           idx,
+                                 const bool*                  isDirty,
+                                 const uint64_t*              deleted,
+                                 const size_t                 deleted_n,
+                                 const bool                   isListOnly,
+                                 FILE*                        changed_fp,
+                                 const int                    urlTemplateId,
+                                 const int                    interpolationTypeId,
+                                 const uint32_t               dest_z_shift,
+                                 const int                    thread_n,
+                                 const Retile_PipelineConfig* pipe_cfg)
+{
+    uint32_t     x;
+    uint32_t     y;
+    uint32_t     z;
+    size_t       child_n;
+    size_t       child_cap = 0;
+    gbTileIndex* sub       = gbTileIndex_Create();
+    
+    for (uint32_t l = 1; l <= dest_z_shift; l++)
+    {
+        child_cap += (size_t)1 << (2 * l);
+    }//for
     
-    _CopyRetileBuffers(local_rt_bufs, rt_bufs, local_rt_buf_n);
+    uint64_t* children = malloc(sizeof(uint64_t) * child_cap);
+    bool*     isGone   = malloc(sizeof(bool)     * child_cap);
     
-    dispatch_semaphore_wait(sema_write, DISPATCH_TIME_FOREVER);
+    memset(isGone, 1, sizeof(bool) * child_cap);
     
+    for (size_t i = 0; i < gbTileIndex_GetCount(idx); i++)
+    {
+        if (isDirty == NULL || isDirty[i])
+        {
+            gbTileIndex_GetXYZ(idx, i, &x, &y, &z);
+            gbTileIndex_Add(sub, x, y, z, gbTileIndex_GetFilePath(idx, i));
+            
+            child_n = _Incremental_GetChildKeys(x, y, z, dest_z_shift, children);
+            
+            _Incremental_WriteChangedKeys(changed_fp, destPath, children, child_n, NULL, urlTemplateId);
+        }//if
+    }//for
     
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        
-        _EnlargeCompressAndWrite_RetileBuffers_RGBA8888(local_rootpath, local_rt_bufs, local_rt_buf_n, alsoReprocessSrc, dest_z, urlTemplateId, interpolationTypeId);
+    for (size_t i = 0; i < deleted_n; i++)
+    {
+        gbTileIndex_GetXYZForKey(deleted[i], &x, &y, &z);
         
-        _FreeRetileBuffersData(local_rt_bufs, local_rt_buf_n);
-        free(local_rootpath);
-        free(local_rt_bufs);
+        child_n = _Incremental_GetChildKeys(x, y, z, dest_z_shift, children);
         
-        dispatch_semaphore_signal(sema_write);
+        _Incremental_WriteChangedKeys(changed_fp, destPath, children, child_n, isListOnly ? NULL : isGone, urlTemplateId);
+    }//for
+    
+    if (!isListOnly && gbTileIndex_GetCount(sub) > 0)
+    {
+        printf("Enlarging %zu dirty tiles...\n", gbTileIndex_GetCount(sub));
         
-        _IncDecrementWithSemaphore(queue_n, sema_idx, false, true);
-    });
-#endif
-}//_EnlargeCompressAndWriteTile_RetileBuffers_DispatchWrapper_RGBA8888
+        _QueueEnlargeFromIndex(destPath, sub, urlTemplateId, false, interpolationTypeId, dest_z_shift, thread_n, pipe_cfg);
+    }//if
+    
+    free(children);
+    free(isGone);
+    
+    gbTileIndex_Destroy(sub);
+}//_Incremental_Enlarge
 
 
-// ====================
-// _QueueEnlargeFromDB:
-// ====================
-//
-// Main raster tile pyramid level enlarge (z -> z+x) function.
-//
-// This is actually much less tricksy than the downsampling function, no fancy
-// data clustering.
-//
-// If Apple's GCD is present (inferred via the Accelerate framework), this
-// will be multithreaded and use asynchronous processing.
+
+
+// ======================
+// _IncrementalFromIndex:
+// ======================
 //
-// (even in single threaded mode, this function does no processing, it merely
-//  queues the work up and accumulates references.)
+// -incremental entry point, in place of the usual _Queue*FromIndex call.
+// idx must hold a single zoom level.  dest_min_z is for -zOutTo only, and
+// dest_z_shift for -zIn only.
 //
-void _QueueEnlargeFromDB(const char*    destPath,
-                         const char*    dbFilePath,
-                         const int      urlTemplateId,
-                         const bool     alsoReprocessSrc,
-                         const int      interpolationTypeId,
-                         const uint32_t dest_z_shift)
+void _IncrementalFromIndex(const char*                  destPath,
+                           const gbTileIndex*           idx,
+                           const char*                  manifestPath,
+                           const bool                   useHash,
+                           const int                    opMode,
+                           const int                    urlTemplateId,
+                           const int                    interpolationTypeId,
+                           const int                    dest_min_z,
+                           const uint32_t               dest_z_shift,
+                           const int                    thread_n,
+                           const Retile_PipelineConfig* pipe_cfg)
 {
-    int       row      = 0;
-    int       queue_n  = 0;
-    const int rowCount = gbDB_ExecSQL_Scalar(dbFilePath, "SELECT COUNT(*) FROM TileRef;");
-    const int modCount = ceil((double)rowCount / 10.0);
-    
-#ifdef __ACCELERATE__
-    queue_n = rowCount;
+    const size_t n = gbTileIndex_GetCount(idx);
+    uint32_t     min_z;
+    uint32_t     max_z;
     
-    dispatch_semaphore_t _sema_idx   = dispatch_semaphore_create(1);
-    dispatch_semaphore_t _sema_write = dispatch_semaphore_create(32);
-#endif
+    gbTileIndex_GetZRange(idx, &min_z, &max_z);
     
-    if (rowCount == 0)
+    if (min_z != max_z)
     {
-        printf("No tiles were found to read.  Aborting.\n");
+        printf("_IncrementalFromIndex: [ERR] -incremental needs a single src zoom level, found z=%d to %d.\n", (int)min_z, (int)max_z);
         return;
     }//if
     
-    sqlite3*      db;
-    sqlite3_stmt* selectStmt;
+    size_t                old_n   = 0;
+    gbTileManifest_Entry* old     = gbTileManifest_Load(manifestPath, &old_n);
+    gbTileManifest_Entry* cur     = malloc(sizeof(gbTileManifest_Entry) * n);
+    bool*                 isDirty = malloc(sizeof(bool) * n);
     
-    gbDB_PrepConn_DBPath_CString(dbFilePath, "SELECT X, Y, Z, FilePath FROM TileRef ORDER BY Y/2 * (1 << (Z-1)) + X/2, Y * (1 << Z) + X;", &db, &selectStmt);
+    printf("Checking src tiles against manifest (n=%zu, manifest n=%zu)...\n", n, old_n);
     
-    // <multiread>
-    size_t        rt_buf_i = 0;
-    const size_t  rt_buf_n = 1;
+    Retile_WorkQueue wq;
     
-    Retile_Buffer rt_bufs[rt_buf_n] __attribute__ ((aligned(16)));
+    _WorkQueue_Init(&wq, thread_n);
     
-    for (size_t i = 0; i < rt_buf_n; i++)
-    {
-        rt_bufs[i].data          = NULL;
-        rt_bufs[i].width         = 0;
-        rt_bufs[i].height        = 0;
-        rt_bufs[i].rowBytes      = 0;
-        rt_bufs[i].x             = 0;
-        rt_bufs[i].y             = 0;
-        rt_bufs[i].z             = 0;
-        rt_bufs[i].filename      = NULL;
-        rt_bufs[i].dest_filename = NULL;
+    for (size_t i = 0; i < n; i += kRetile_IncrementalChunkN)
+    {
+        Retile_IncrementalCheck* c = malloc(sizeof(Retile_IncrementalCheck));
+        
+        c->idx     = idx;
+        c->cur     = cur;
+        c->old     = old;
+        c->old_n   = old_n;
+        c->isDirty = isDirty;
+        c->useHash = useHash;
+        c->start   = i;
+        c->end     = MIN(n, i + kRetile_IncrementalChunkN);
+        
+        _WorkQueue_AddWork(&wq, _IncrementalCheck_Work, c);
     }//for
-    // </multiread>
-    
-    uint32_t _reproc_last_path_created_z = UINT32_MAX;
-    uint32_t _reproc_last_path_created_x = UINT32_MAX;
-    
-    uint32_t src_x  = 0;
-    uint32_t src_y  = 0;
-    uint32_t src_z  = 0;
-    
-    uint32_t dest_x = 0;
-    uint32_t dest_y = 0;
-    uint32_t dest_z = 0;
     
-    int sqliteStepResult = SQLITE_ROW;
-    
-    mkdir(destPath, 0777);
+    _WorkQueue_WaitAndRelease(&wq, "");
     
-    printf("Resampling and writing files (src n=[%d])...\n", rowCount);
+    // dirty = changed src tiles plus deleted ones, sorted
+    size_t    dirty_n   = 0;
+    size_t    deleted_n = 0;
+    uint64_t* dirty     = malloc(sizeof(uint64_t) * (n + old_n + 1));
+    uint64_t* deleted   = malloc(sizeof(uint64_t) * (old_n + 1));
     
-    while (sqliteStepResult == SQLITE_ROW || sqliteStepResult == SQLITE_DONE)
+    for (size_t i = 0; i < n; i++)
     {
-        char* filename = NULL;
-        
-        if (sqliteStepResult != SQLITE_DONE)
-        {
-            sqliteStepResult = sqlite3_step(selectStmt);
-        }//if
-        
-        if (sqliteStepResult != SQLITE_DONE)
-        {
-            src_x    = sqlite3_column_int(selectStmt, 0);
-            src_y    = sqlite3_column_int(selectStmt, 1);
-            src_z    = sqlite3_column_int(selectStmt, 2);
-            filename = (char*)sqlite3_column_text(selectStmt, 3);
-            
-            dest_z   = src_z + dest_z_shift;
-            dest_x   = src_x >> (src_z - dest_z);
-            dest_y   = src_y >> (src_z - dest_z);
-            
-            if (filename != NULL)
-            {
-                if (rt_bufs[rt_buf_i].filename != NULL)
-                {
-                    printf("ERR: rt_bufs[%zu] filename was non-null! [%s]\n", rt_buf_i, rt_bufs[rt_buf_i].filename);
-                }//if
-                
-                rt_bufs[rt_buf_i].filename = malloc(sizeof(char) * 1024);
-                memcpy(rt_bufs[rt_buf_i].filename, filename, sizeof(char) * 1024);
-            }//if
-            
-            rt_bufs[rt_buf_i].x = src_x;
-            rt_bufs[rt_buf_i].y = src_y;
-            rt_bufs[rt_buf_i].z = src_z;
-            
-            if (rt_bufs[rt_buf_i].filename != NULL)
-            {
-                if (alsoReprocessSrc)
-                {
-                    rt_bufs[rt_buf_i].dest_filename = malloc(sizeof(char) * 1024);
-                    
-                    _GetFilepathAndCreateIntermediatePathsIfNeeded(rt_bufs[rt_buf_i].dest_filename, destPath,
-                                                                   rt_bufs[rt_buf_i].x, rt_bufs[rt_buf_i].y, rt_bufs[rt_buf_i].z,
-                                                                   &_reproc_last_path_created_x, &_reproc_last_path_created_z,
-                                                                   urlTemplateId);
-                }//if
-                
-                rt_buf_i     = rt_buf_i < rt_buf_n - 1 ? rt_buf_i + 1 : 0;
-            }//if
-        }//if
-        
-        
-        if (src_z > 0 && sqliteStepResult != SQLITE_DONE)
-        {
-#ifdef __ACCELERATE__
-            _EnlargeCompressAndWrite_RetileBuffers_DispatchWrapper_RGBA8888(destPath, rt_bufs, rt_buf_n,
-                                                                            _sema_write, _sema_idx, &queue_n,
-                                                                            alsoReprocessSrc, dest_z, urlTemplateId, interpolationTypeId);
-#else
-            _EnlargeCompressAndWrite_RetileBuffers_RGBA8888(destPath, rt_bufs, rt_buf_n,
-                                                            alsoReprocessSrc, dest_z, urlTemplateId, interpolationTypeId);
-#endif
-            
-            _FreeRetileBuffersData(rt_bufs, rt_buf_n);
-            rt_buf_i = 0;
-        }//if
-
-        if (sqliteStepResult == SQLITE_DONE)
+        if (isDirty[i])
         {
-            sqliteStepResult = -1;
-            break;
+            dirty[dirty_n] = cur[i].key;
+            dirty_n++;
         }//if
-        
-        if (row % modCount == 0)
+    }//for
+    
+    for (size_t i = 0; i < old_n; i++)
+    {
+        if (gbTileManifest_Find(cur, n, old[i].key) == NULL)
         {
-            printf("[z=%d]: %1.0f%%\n", (int)dest_z, (double)row / (double)rowCount * 100.0);
+            deleted[deleted_n] = old[i].key;
+            deleted_n++;
         }//if
-        
-        row++;
-    }//while
+    }//for
     
+    const size_t changed_src_n = dirty_n;
     
-#ifdef __ACCELERATE__
-    // Wait for worker queue to empty, but use a long failsafe timeout in case
-    // the initial COUNT DISTINCT did not predict things correctly.
-    // (eg, bad input PNGs, etc)
-    //
+    memcpy(dirty + dirty_n, deleted, sizeof(uint64_t) * deleted_n);
+    dirty_n += deleted_n;
+    
+    qsort(dirty, dirty_n, sizeof(uint64_t), _Incremental_CompareKey);
+    
+    const bool isListOnly = old == NULL;
     
-    int polled_n = _IncDecrementWithSemaphore(&queue_n, _sema_idx, false, false);
+    printf("Incremental: %zu new or changed, %zu deleted, %zu unchanged.%s\n",
+           changed_src_n, deleted_n, n - changed_src_n, isListOnly ? "  (no manifest, full build)" : "");
     
-    if (polled_n > 0)
+    char changedPath[1024];
+    snprintf(changedPath, sizeof(changedPath), "%s.changed", manifestPath);
+    
+    FILE* changed_fp = fopen(changedPath, "w");
+    
+    if (changed_fp == NULL)
     {
-        printf("[z=%d]: Waiting on compress and write queue: %d\n", (int)dest_z, polled_n);
-        
-        uint32_t        currentSleepMS  = 0;
-        const uint32_t kSleepIntervalMS = 100;                      // 100ms
-        const uint32_t kSleepIntervalUS = kSleepIntervalMS * 1000;  // 100ms -> us
-        const uint32_t kMaxSleepMS      = 60 * 1000;                // 60s   -> ms
-        
-        while (polled_n > 0)
-        {
-            if (polled_n <= 0 || currentSleepMS > kMaxSleepMS)
-            {
-                break;
-            }//if
-            
-            polled_n = _IncDecrementWithSemaphore(&queue_n, _sema_idx, false, false);
-            
-            usleep(kSleepIntervalUS);
-            currentSleepMS += kSleepIntervalMS;
-        }//while
-        
-        if (currentSleepMS > kMaxSleepMS)
+        printf("_IncrementalFromIndex: [ERR] Could not open [%s] for writing.\n", changedPath);
+    }//if
+    
+    mkdir(destPath, 0777);
+    
+    if (isListOnly)
+    {
+        if (opMode == kRetile_OpMode_Downsample)
         {
-            printf("[z=%d]: [WARN] Timeout after %d ms while waiting on queue: %d\n", (int)dest_z, (int)kMaxSleepMS, polled_n);
+            _QueueDownsampleFromIndex(destPath, idx, urlTemplateId, false, interpolationTypeId, thread_n, pipe_cfg, NULL);
         }//if
+        else if (opMode == kRetile_OpMode_Pyramid)
+        {
+            _QueuePyramidFromIndex(destPath, idx, urlTemplateId, false, interpolationTypeId, dest_min_z, thread_n, NULL);
+        }//else if
+        else
+        {
+            _QueueEnlargeFromIndex(destPath, idx, urlTemplateId, false, interpolationTypeId, dest_z_shift, thread_n, pipe_cfg);
+        }//else
     }//if
     
-    dispatch_release(_sema_idx);
-    dispatch_release(_sema_write);
-#endif
-    
-    printf("[z=%d]: 100%%\n", (int)dest_z);
+    if (opMode == kRetile_OpMode_Enlarge)
+    {
+        _Incremental_Enlarge(destPath, idx, isListOnly ? NULL : isDirty, deleted, deleted_n, isListOnly,
+                             changed_fp, urlTemplateId, interpolationTypeId, dest_z_shift, thread_n, pipe_cfg);
+    }//if
+    else
+    {
+        const uint32_t dest_z = opMode == kRetile_OpMode_Pyramid ? (uint32_t)MAX(0, dest_min_z) : min_z - 1;
+        
+        _Incremental_Downsample(destPath, idx, dirty, dirty_n, dest_z, isListOnly,
+                                changed_fp, urlTemplateId, interpolationTypeId, thread_n, pipe_cfg);
+    }//else
     
-    printf("[z=%d]: Closing DB and transaction...\n", (int)dest_z);
+    if (changed_fp != NULL)
+    {
+        fclose(changed_fp);
+        printf("Incremental: Changed tiles listed in [%s].\n", changedPath);
+    }//if
     
-    gbDB_CloseDBConnAndQueryStmt(db, selectStmt);
+    if (gbTileManifest_Save(manifestPath, cur, n))
+    {
+        printf("Incremental: Manifest saved to [%s].\n", manifestPath);
+    }//if
     
-    printf("[z=%d]: Done.\n", (int)dest_z);
-}//_QueueEnlargeFromDB
+    free(old);
+    free(cur);
+    free(isDirty);
+    free(dirty);
+    free(deleted);
+}//_IncrementalFromIndex
 
 
 
@@ -1724,27 +4524,22 @@ static inline void _ReprocessTile(const char* filename)
     rgba = NULL;
 }//_ReprocessTile
 
-static inline void _ReprocessTile_DispatchWrapper(const char*          filename,
-                                                  dispatch_semaphore_t sema_write,
-                                                  dispatch_semaphore_t sema_idx,
-                                                  int*                 queue_n)
+static void _ReprocessTile_Work(void* context)
 {
-#ifdef __ACCELERATE__
-    char* local_filename = malloc(sizeof(char) * 1024);
-    memcpy(local_filename, filename, 1024);
+    char* local_filename = (char*)context;
     
-    dispatch_semaphore_wait(sema_write, DISPATCH_TIME_FOREVER);
+    _ReprocessTile(local_filename);
     
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
-        _ReprocessTile(local_filename);
-        
-        free(local_filename);
+    free(local_filename);
+}//_ReprocessTile_Work
 
-        dispatch_semaphore_signal(sema_write);
-        
-        _IncDecrementWithSemaphore(queue_n, sema_idx, false, true);
-    });
-#endif
+static inline void _ReprocessTile_DispatchWrapper(const char*       filename,
+                                                  Retile_WorkQueue* wq)
+{
+    char* local_filename = malloc(sizeof(char) * 1024);
+    memcpy(local_filename, filename, 1024);
+    
+    _WorkQueue_AddWork(wq, _ReprocessTile_Work, local_filename);
 }//_ReprocessTile_DispatchWrapper
 
 
@@ -1755,47 +4550,12 @@ static inline void _ReprocessTile_DispatchWrapper(const char*          filename,
 // =====================
 //
 // Counts the number of files in a directory by iterating through them all.
-//
-// Probably not the most efficient method, and may have problems scaling.
+// (via gbDirScan, which skips dotfiles and doesn't stat)
 //
 static inline size_t _GetFileCountForPath(const char* srcPath,
                                           const bool  isRecursive)
 {
-    size_t file_n = 0;
-    
-    tinydir_dir dir;
-    tinydir_open(&dir, srcPath);
-    
-    while (dir.has_next)
-    {
-        tinydir_file file;
-        tinydir_readfile(&dir, &file);
-        
-        if (!file.is_dir)
-        {
-            file_n++;
-        }//if
-        
-         else if (isRecursive
-                  && (strnlen(file.name, 1024) != 1 || strcmp(file.name, ".")  != 0)
-                  && (strnlen(file.name, 1024) != 2 || strcmp(file.name, "..") != 0))
-         {
-             char* subPath = malloc(sizeof(char) * strnlen(srcPath, 1024) + 1UL); // heap to reduce stack pressure from multiple recursions
-         
-             _StringByAppendingPathComponent(subPath, srcPath, file.name);
-         
-             file_n += _GetFileCountForPath(subPath, isRecursive);
-             
-             free(subPath);
-             subPath = NULL;
-         }//if
-        
-        tinydir_next(&dir);
-    }//while
-    
-    tinydir_close(&dir);
-    
-    return file_n;
+    return gbDirScan_Scan(srcPath, isRecursive, 0, NULL, NULL);
 }//_GetFileCountForPath
 
 
@@ -1819,11 +4579,11 @@ static inline size_t _GetFileCountForPath(const char* srcPath,
 // Allows for recursive scans. (not yet implemented)
 //
 static inline void _ReprocessTiles(const char* srcPath,
-                                   const bool  isRecursive)
+                                   const bool  isRecursive,
+                                   const int   thread_n)
 {
     size_t max_n = _GetFileCountForPath(srcPath, isRecursive);
     size_t n     = 0;
-    int  queue_n = (int)max_n;
     size_t mod_c = ceil((double)max_n / 10.0);
     
     char dest_filepath[1024] __attribute__ ((aligned(16)));
@@ -1831,10 +4591,9 @@ static inline void _ReprocessTiles(const char* srcPath,
     printf("Retile: Reprocessing tiles at path %s, please wait... (n = %zu)\n",
            srcPath, max_n);
     
-#ifdef __ACCELERATE__
-    dispatch_semaphore_t _sema_idx   = dispatch_semaphore_create(1);
-    dispatch_semaphore_t _sema_write = dispatch_semaphore_create(32);
-#endif
+    Retile_WorkQueue wq;
+    
+    _WorkQueue_Init(&wq, thread_n);
     
     tinydir_dir dir;
     tinydir_open(&dir, srcPath);
@@ -1848,11 +4607,7 @@ static inline void _ReprocessTiles(const char* srcPath,
         {
             _StringByAppendingPathComponent(dest_filepath, srcPath, file.name);
             
-#ifdef __ACCELERATE__
-            _ReprocessTile_DispatchWrapper(dest_filepath, _sema_write, _sema_idx, &queue_n);
-#else
-            _ReprocessTile(dest_filepath);
-#endif
+            _ReprocessTile_DispatchWrapper(dest_filepath, &wq);
         }//if
         /*
         else if (isRecursive
@@ -1882,43 +4637,7 @@ static inline void _ReprocessTiles(const char* srcPath,
     
     tinydir_close(&dir);
     
-#ifdef __ACCELERATE__
-    // Wait for worker queue to empty, but use a long failsafe timeout in case
-    // of whatever.
-    
-    int polled_n = _IncDecrementWithSemaphore(&queue_n, _sema_idx, false, false);
-    
-    if (polled_n > 0)
-    {
-        printf("Waiting on compress and write queue: %d\n", polled_n);
-        
-        uint32_t        currentSleepMS  = 0;
-        const uint32_t kSleepIntervalMS = 100;                      // 100ms
-        const uint32_t kSleepIntervalUS = kSleepIntervalMS * 1000;  // 100ms -> us
-        const uint32_t kMaxSleepMS      = 60 * 1000;                // 60s   -> ms
-        
-        while (polled_n > 0)
-        {
-            if (polled_n <= 0 || currentSleepMS > kMaxSleepMS)
-            {
-                break;
-            }//if
-            
-            polled_n = _IncDecrementWithSemaphore(&queue_n, _sema_idx, false, false);
-            
-            usleep(kSleepIntervalUS);
-            currentSleepMS += kSleepIntervalMS;
-        }//while
-        
-        if (currentSleepMS > kMaxSleepMS)
-        {
-            printf("[WARN] Timeout after %d ms while waiting on queue: %d\n", (int)kMaxSleepMS, polled_n);
-        }//if
-    }//if
-    
-    dispatch_release(_sema_idx);
-    dispatch_release(_sema_write);
-#endif
+    _WorkQueue_WaitAndRelease(&wq, "");
     
     printf("[Reprocess]: 100%%\n");
     
@@ -1982,32 +4701,51 @@ static inline double CURRENT_TIMESTAMP_SS_D()
 //
 // Expects to work in-place on a path structure.
 //
+// Progress is logged in rootPath.  If shouldResume, levels finished by an
+// earlier run are skipped without being scanned, and the level it stopped in
+// carries on from the last tile it logged.  (see Retile_Progress)
+//
 // (downsamples only)
 //
-static inline void _IterativeRetile(const char* dbFilePath,
-                                    const char* rootPath,
-                                    const int   dest_min_z,
-                                    const int   dest_max_z,
-                                    const int   srcUrlTemplateId,
-                                    const int   destUrlTemplateId,
-                                    const bool  alsoReprocessSrc,
-                                    const int   interpolationTypeId)
+static inline void _IterativeRetile(gbTileIndex* idx,
+                                    const char*  rootPath,
+                                    const int    dest_min_z,
+                                    const int    dest_max_z,
+                                    const int    srcUrlTemplateId,
+                                    const int    destUrlTemplateId,
+                                    const bool   alsoReprocessSrc,
+                                    const int    interpolationTypeId,
+                                    const int    thread_n,
+                                    const bool   shouldResume)
 {
     char* _src_path = malloc(sizeof(char) * 1024);
     char* _comp     = malloc(sizeof(char) * 1024);
     
+    Retile_Progress progress;
+    
+    _Progress_Open(&progress, rootPath, kRetile_ProgressLogName, (uint32_t)dest_max_z + 1, (uint32_t)dest_min_z, shouldResume);
+    
     for (int z = dest_max_z; z >= dest_min_z; z--)
     {
+        if (progress.isLevelDone[z])
+        {
+            printf("[z=%d]: Already done, skipping.\n", z);
+            continue;
+        }//if
+        
         sprintf(_comp, "%d", z + 1);
         _StringByAppendingPathComponent(_src_path, rootPath, _comp);
         
-        _ReadPathToDB(_src_path, dbFilePath,
-                      z == dest_max_z ? srcUrlTemplateId
-                                      : destUrlTemplateId);
+        _ReadPathToIndex(_src_path, idx,
+                         z == dest_max_z ? srcUrlTemplateId
+                                         : destUrlTemplateId,
+                         thread_n);
         
-        _QueueDownsampleFromDB(rootPath, dbFilePath, destUrlTemplateId, alsoReprocessSrc && z == dest_max_z, interpolationTypeId);
+        _QueueDownsampleFromIndex(rootPath, idx, destUrlTemplateId, alsoReprocessSrc && z == dest_max_z, interpolationTypeId, thread_n, NULL, &progress);
     }//for
     
+    _Progress_Close(&progress, true);
+    
     free(_src_path);
     free(_comp);
 }//_IterativeRetile
@@ -2015,33 +4753,116 @@ static inline void _IterativeRetile(const char* dbFilePath,
 
 
 
+// ============
+// _ShardIndex:
+// ============
+//
+// -shard i/n: replaces idx with only the tiles of shard i of n, so n separate
+// processes, on one machine or many, each build a disjoint part of the dest
+// tiles with no coordination beyond the same src path and arguments.
+//
+// idx is cut into n contiguous quadkey ranges between whole subtrees of the
+// tiles at shard_z, balanced by the src tiles that actually exist.  (see
+// gbTileIndex_CopyShard)  Every dest tile at or above shard_z is then built
+// by exactly one shard, from all of its src tiles.  shard_z < 0 -> default:
+//
+//     -zIn:    src z.  Every src tile is independent.
+//     -zOut:   src z-1, the dest tiles themselves.
+//     -zOutTo: the lowest z >= dest_min_z with kRetile_ShardMinSubtreesPer
+//              subtrees per shard, so the shards balance, and the levels
+//              below it, which each shard cannot build alone, stay small.
+//
+// Returns the shard z used, or -1 if idx could not be sharded.
+//
+#define kRetile_ShardMinSubtreesPer 16
+
+static int _ShardIndex(gbTileIndex** idx,
+                       const int     opMode,
+                       const int     dest_min_z,
+                       const int     shard_z,
+                       const int     shard_i,
+                       const int     shard_n)
+{
+    uint32_t min_z;
+    uint32_t max_z;
+    
+    gbTileIndex_GetZRange(*idx, &min_z, &max_z);
+    
+    if (min_z != max_z)
+    {
+        printf("_ShardIndex: [ERR] -shard needs a single src zoom level, found z=%u ... %u.  Aborting.\n", min_z, max_z);
+        return -1;
+    }//if
+    
+    const int max_shard_z = opMode == kRetile_OpMode_Enlarge ? (int)max_z : (int)max_z - 1;
+    int       z           = shard_z;
+    
+    if (z < 0 && opMode == kRetile_OpMode_Pyramid)
+    {
+        for (z = MAX(0, dest_min_z); z < max_shard_z; z++)
+        {
+            if (gbTileIndex_GetAncestorCount(*idx, (uint32_t)z) >= (size_t)shard_n * kRetile_ShardMinSubtreesPer)
+            {
+                break;
+            }//if
+        }//for
+    }//if
+    
+    z = z < 0 || z > max_shard_z ? max_shard_z : z;
+    
+    if (z < 0)
+    {
+        printf("_ShardIndex: [ERR] Cannot shard z=%u.  Aborting.\n", max_z);
+        return -1;
+    }//if
+    
+    gbTileIndex* shard = gbTileIndex_Create();
+    const size_t n     = gbTileIndex_CopyShard(*idx, (uint32_t)z, (size_t)shard_i, (size_t)shard_n, shard);
+    
+    printf("Retile: Shard %d/%d: %zu of %zu src tiles, cut at z=%d (%zu subtrees).\n",
+           shard_i, shard_n, n, gbTileIndex_GetCount(*idx), z, gbTileIndex_GetAncestorCount(*idx, (uint32_t)z));
+    
+    if (n == 0)
+    {
+        printf("Retile: Shard %d/%d has no tiles, nothing to do.\n", shard_i, shard_n);
+    }//if
+    
+    gbTileIndex_Destroy(*idx);
+    *idx = shard;
+    
+    return z;
+}//_ShardIndex
+
+
+
+
 
 // these are lazy / test functions.
 
-static inline void _ProductionNoParamRun(const char* dbFilePath, const bool alsoReprocessSrc, const int interpolationTypeId)
+static inline void _ProductionNoParamRun(gbTileIndex* idx, const bool alsoReprocessSrc, const int interpolationTypeId)
 {
     /*
     char* rootPath = "/Library/WebServer/Documents/tilemap/TileGriddata/";
     
-    _IterativeRetile(dbFilePath, rootPath, 0, 12, kRetile_Template_XYZ, kRetile_Template_XYZ, alsoReprocessSrc, interpolationTypeId);
+    _IterativeRetile(idx, rootPath, 0, 12, kRetile_Template_XYZ, kRetile_Template_XYZ, alsoReprocessSrc, interpolationTypeId, 0, true);
     
     char* src  = "/Library/WebServer/Documents/tilemap/TileGriddata/13";
     char* dest = "/Library/WebServer/Documents/tilemap/TileGriddata";
     
-    size_t n = _ReadPathToDB(src, dbFilePath, kRetile_Template_XYZ);
+    size_t n = _ReadPathToIndex(src, idx, kRetile_Template_XYZ, 0);
     
     if (n > 0)
     {
-        _QueueEnlargeFromDB(dest, dbFilePath, kRetile_Template_XYZ, alsoReprocessSrc, kGB_Image_Interp_XBR, 1);
+        _QueueEnlargeFromIndex(dest, idx, kRetile_Template_XYZ, alsoReprocessSrc, kGB_Image_Interp_XBR, 1, 0, NULL);
     }//if
     
     
     src = "/Library/WebServer/Documents/tilemap/TileGriddata/14";
-    n   = _ReadPathToDB(src, dbFilePath, kRetile_Template_XYZ);
+    n   = _ReadPathToIndex(src, idx, kRetile_Template_XYZ, 0);
     
     if (n > 0)
     {
-        _QueueEnlargeFromDB(dest, dbFilePath, kRetile_Template_XYZ, alsoReprocessSrc, kGB_Image_Interp_XBR, 1);
+        _QueueEnlargeFromIndex(dest, idx, kRetile_Template_XYZ, alsoReprocessSrc, kGB_Image_Interp_XBR, 1, 0, NULL);
     }//if
     */
     
@@ -2049,31 +4870,31 @@ static inline void _ProductionNoParamRun(const char* dbFilePath, const bool also
 }//_ProductionNoParamRun
 
 
-static inline void _LocalTestRun(const char* dbFilePath, const bool alsoReprocessSrc, const int interpolationTypeId)
+static inline void _LocalTestRun(gbTileIndex* idx, const bool alsoReprocessSrc, const int interpolationTypeId)
 {
     // === tile pyramid testing ===
     
     //char* rootPath = "/Users/ndolezal/Downloads/TileGriddata/";
     
-    //_IterativeRetile(dbFilePath, rootPath, 0, 12, kRetile_Template_OSM, kRetile_Template_OSM, alsoReprocessSrc, interpolationTypeId);
+    //_IterativeRetile(idx, rootPath, 0, 12, kRetile_Template_OSM, kRetile_Template_OSM, alsoReprocessSrc, interpolationTypeId, 0, true);
     /*
     char* src  = "/Users/ndolezal/Downloads/TileGriddata/13";
     char* dest = "/Users/ndolezal/Downloads/TileGriddata";
     
-    size_t n = _ReadPathToDB(src, dbFilePath, kRetile_Template_OSM);
+    size_t n = _ReadPathToIndex(src, idx, kRetile_Template_OSM, 0);
     
     if (n > 0)
     {
-        _QueueEnlargeFromDB(dest, dbFilePath, kRetile_Template_OSM, alsoReprocessSrc, kGB_Image_Interp_XBR, 1);
+        _QueueEnlargeFromIndex(dest, idx, kRetile_Template_OSM, alsoReprocessSrc, kGB_Image_Interp_XBR, 1, 0, NULL);
     }//if
     */
     /*
     src = "/Users/ndolezal/Downloads/TileGriddata/14";
-    n   = _ReadPathToDB(src, dbFilePath, kRetile_Template_OSM);
+    n   = _ReadPathToIndex(src, idx, kRetile_Template_OSM, 0);
     
     if (n > 0)
     {
-        _QueueEnlargeFromDB(dest, dbFilePath, kRetile_Template_OSM, alsoReprocessSrc, kGB_Image_Interp_XBR, 1);
+        _QueueEnlargeFromIndex(dest, idx, kRetile_Template_OSM, alsoReprocessSrc, kGB_Image_Interp_XBR, 1, 0, NULL);
     }//if
     */
     
@@ -2192,7 +5013,7 @@ static inline void _LocalTestRun(const char* dbFilePath, const bool alsoReproces
 
 int main(int argc, const char * argv[])
 {
-    const char* dbFilePath            = "/tmp/retile.sqlite";
+    gbTileIndex* idx                  = gbTileIndex_Create();
     bool        showRunTime           = true;
     int64_t     st                    = CURRENT_TIMESTAMP();
 
@@ -2211,11 +5032,34 @@ int main(int argc, const char * argv[])
     int         destFormatId          = kRetile_Template_OSM;
     int         interpolationTypeId   = -9000;
     int         opMode                = kRetile_OpMode_Downsample;
+    int         thread_n              = 0;      // 0 -> one per CPU
+    int         dest_min_z            = -1;     // -zOutTo only
+    int         enlarge_n             = 1;      // -zIn only
+    bool        useStream             = false;  // -zOut -inOSM only
+    bool        shouldResume          = false;  // -zOut / -zOutTo only
+    char*       manifestPath          = NULL;   // -incremental only
+    bool        useManifestHash       = false;
+    int         shard_i               = 0;      // -shard i/n
+    int         shard_n               = 1;      // 1 -> not sharded
+    int         shard_z               = -1;     // -1 -> default for op mode
+    char*       queuePath             = NULL;   // -zOut only
+    int         lease_s               = 600;
+    char*       mbtilesPath           = NULL;   // -outMBTiles
+    char*       pmtilesPath           = NULL;   // -outPMTiles
+    bool        runSelfCheck          = false;
+    int         pngFilterMode         = kGB_PNG_Filter_None;
+    int         compressProfile       = kGB_PNG_Compress_Default;
+    
+    Retile_PipelineConfig pipe_cfg;             // -zIn / -zOut only
+    
+    memset(&pipe_cfg, 0, sizeof(pipe_cfg));     // 0 -> defaults
     
 #ifdef __ACCELERATE__
     printf("Retile: Accelerate framework enabled. Lanczos is available.\n");
     // if Accelerate, then GCD is also availabe...
     printf("Retile: Multithreading via libdispatch thread pooling enabled.\n");
+#else
+    printf("Retile: Multithreading via pthreads thread pooling enabled.\n");
 #endif
     
     for (int i=0; i<argc; i++)
@@ -2224,10 +5068,48 @@ int main(int argc, const char * argv[])
         {
             showHelp = true;
         }//if
+        else if (strncmp(argv[i], "-selfcheck", 10) == 0)
+        {
+            runSelfCheck = true;
+        }//else if
+        else if (strncmp(argv[i], "-pngFilter", 10) == 0 && i + 1 < argc)
+        {
+            if (strncmp(argv[i + 1], "adaptive", 8) == 0)
+            {
+                pngFilterMode = kGB_PNG_Filter_Adaptive;
+            }//if
+            else if (strncmp(argv[i + 1], "none", 4) != 0)
+            {
+                printf("Retile: [WARN] -pngFilter takes none or adaptive, using none.\n");
+            }//else if
+            
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-compress", 9) == 0 && i + 1 < argc)
+        {
+            if (strncmp(argv[i + 1], "fast", 4) == 0)
+            {
+                compressProfile = kGB_PNG_Compress_Fast;
+            }//if
+            else if (strncmp(argv[i + 1], "max", 3) == 0)
+            {
+                compressProfile = kGB_PNG_Compress_Max;
+            }//else if
+            else if (strncmp(argv[i + 1], "default", 7) != 0)
+            {
+                printf("Retile: [WARN] -compress takes fast, default or max, using default.\n");
+            }//else if
+            
+            i++;
+        }//else if
         else if (strncmp(argv[i], "-reprocess", 10) == 0)
         {
             alsoReprocessSrc = true;
         }//else if
+        else if (strncmp(argv[i], "-inMBTiles", 10) == 0)
+        {
+            srcFormatId = kRetile_Template_MBTiles;
+        }//else if
         else if (strncmp(argv[i], "-inOSM", 4) == 0)
         {
             srcFormatId = kRetile_Template_OSM;
@@ -2240,6 +5122,18 @@ int main(int argc, const char * argv[])
         {
             srcFormatId = kRetile_Template_XYZ;
         }//else if
+        else if (strncmp(argv[i], "-outMBTiles", 11) == 0 && i + 1 < argc)
+        {
+            mbtilesPath  = (char*)argv[i + 1];
+            destFormatId = kRetile_Template_MBTiles;
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-outPMTiles", 11) == 0 && i + 1 < argc)
+        {
+            pmtilesPath  = (char*)argv[i + 1];
+            destFormatId = kRetile_Template_PMTiles;
+            i++;
+        }//else if
         else if (strncmp(argv[i], "-outOSM", 5) == 0)
         {
             destFormatId = kRetile_Template_OSM;
@@ -2255,6 +5149,18 @@ int main(int argc, const char * argv[])
         else if (strncmp(argv[i], "-zIn", 4) == 0)
         {
             opMode = kRetile_OpMode_Enlarge;
+            
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+            {
+                enlarge_n = atoi(argv[i + 1]);
+                i++;
+            }//if
+        }//else if
+        else if (strncmp(argv[i], "-zOutTo", 7) == 0 && i + 1 < argc)
+        {
+            opMode     = kRetile_OpMode_Pyramid;
+            dest_min_z = atoi(argv[i + 1]);
+            i++;
         }//else if
         else if (strncmp(argv[i], "-zOut", 5) == 0)
         {
@@ -2288,6 +5194,74 @@ int main(int argc, const char * argv[])
         {
             interpolationTypeId = kGB_Image_Interp_XBR;
         }//else if
+        else if (strncmp(argv[i], "-threads", 8) == 0 && i + 1 < argc)
+        {
+            thread_n = atoi(argv[i + 1]);
+            thread_n = thread_n > 0 ? thread_n : 0;
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-stageThreads", 13) == 0 && i + 1 < argc)
+        {
+            const char* str = argv[i + 1];
+            
+            for (int s = 0; s < kRetile_Stage_Count && *str != '\0'; s++)
+            {
+                char* end        = NULL;
+                long  n          = strtol(str, &end, 10);
+                pipe_cfg.thread_n[s] = n > 0 ? (int)n : 0;
+                str              = *end == ',' ? end + 1 : end;
+            }//for
+            
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-stageDepth", 11) == 0 && i + 1 < argc)
+        {
+            pipe_cfg.queue_depth = atoi(argv[i + 1]);
+            pipe_cfg.queue_depth = pipe_cfg.queue_depth > 0 ? pipe_cfg.queue_depth : 0;
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-stream", 7) == 0)
+        {
+            useStream = true;
+        }//else if
+        else if (strncmp(argv[i], "-resume", 7) == 0)
+        {
+            shouldResume = true;
+        }//else if
+        else if (strncmp(argv[i], "-shardZ", 7) == 0 && i + 1 < argc)
+        {
+            shard_z = atoi(argv[i + 1]);
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-shard", 6) == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[i + 1], "%d/%d", &shard_i, &shard_n) != 2)
+            {
+                shard_n = 0;                    // -> WARN below
+            }//if
+            
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-queue", 6) == 0 && i + 1 < argc)
+        {
+            queuePath = (char*)argv[i + 1];
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-leaseSeconds", 13) == 0 && i + 1 < argc)
+        {
+            lease_s = atoi(argv[i + 1]);
+            lease_s = lease_s > 0 ? lease_s : 600;
+            i++;
+        }//else if
+        else if (strncmp(argv[i], "-incrementalHash", 16) == 0)
+        {
+            useManifestHash = true;
+        }//else if
+        else if (strncmp(argv[i], "-incremental", 12) == 0 && i + 1 < argc)
+        {
+            manifestPath = (char*)argv[i + 1];
+            i++;
+        }//else if
     }//for
     
     // set interp default for op mode
@@ -2300,17 +5274,109 @@ int main(int argc, const char * argv[])
     printf("argc:       %d\n", argc);
     printf("-help:      %d\n", showHelp ? 1 : 0);
     printf("-reprocess: %d\n", alsoReprocessSrc ? 1 : 0);
-    printf("-srcFmt:    %s\n", srcFormatId  == 0 ? "OSM" : srcFormatId  == 1 ? "ZXY" : "XYZ");
-    printf("-destFmt:   %s\n", destFormatId == 0 ? "OSM" : destFormatId == 1 ? "ZXY" : "XYZ");
-    printf("-interp:    %s\n", interpolationTypeId == kGB_Image_Interp_Average    ? "AV"
-                             : interpolationTypeId == kGB_Image_Interp_Bilinear   ? "BI"
-                             : interpolationTypeId == kGB_Image_Interp_Eagle      ? "EA"
-                             : interpolationTypeId == kGB_Image_Interp_EPX        ? "EX"
-                             : interpolationTypeId == kGB_Image_Interp_Lanczos3x3 ? "L3"
-                             : interpolationTypeId == kGB_Image_Interp_Lanczos5x5 ? "L5"
-                             : interpolationTypeId == kGB_Image_Interp_XBR        ? "XB"
-                             :                                                      "NN");
-    printf("-zdir:      %s\n", opMode == kRetile_OpMode_Downsample ? "Out" : "In");
+    printf("-srcFmt:    %s\n", srcFormatId  == 0 ? "OSM" : srcFormatId  == 1 ? "ZXY" : srcFormatId == 2 ? "XYZ" : "MBTiles");
+    printf("-destFmt:   %s\n", destFormatId == 0 ? "OSM" : destFormatId == 1 ? "ZXY" : destFormatId == 2 ? "XYZ" : destFormatId == 3 ? mbtilesPath : pmtilesPath);
+    printf("-interp:    %s\n", _GetInterpolationTypeName(interpolationTypeId));
+    printf("-zdir:      %s\n", opMode == kRetile_OpMode_Downsample ? "Out" : opMode == kRetile_OpMode_Pyramid ? "OutTo" : "In");
+    printf("-zIn n:     %d\n", enlarge_n);
+    printf("-threads:   %zu\n", thread_n > 0 ? (size_t)thread_n : gbThreadPool_GetCPUCount());
+    printf("-stages:    %d,%d,%d,%d,%d (depth %d)  (0 -> auto)\n", pipe_cfg.thread_n[0], pipe_cfg.thread_n[1], pipe_cfg.thread_n[2],
+                                                              pipe_cfg.thread_n[3], pipe_cfg.thread_n[4], pipe_cfg.queue_depth);
+    printf("-stream:    %d\n", useStream ? 1 : 0);
+    printf("-resume:    %d\n", shouldResume ? 1 : 0);
+    printf("-incremental: %s%s\n", manifestPath != NULL ? manifestPath : "<none>", useManifestHash ? " (hash)" : "");
+    printf("-shard:     %d/%d (z=%d)  (-1 -> auto)\n", shard_i, shard_n, shard_z);
+    printf("-queue:     %s (lease %ds)\n", queuePath != NULL ? queuePath : "<none>", lease_s);
+    printf("-pngFilter: %s\n", pngFilterMode == kGB_PNG_Filter_Adaptive ? "adaptive" : "none");
+    printf("-compress:  %s\n", compressProfile == kGB_PNG_Compress_Fast ? "fast" : compressProfile == kGB_PNG_Compress_Max ? "max" : "default");
+    
+    gbImage_PNG_SetFilterMode(pngFilterMode);
+    gbImage_PNG_SetCompressProfile(compressProfile);
+    
+    if (enlarge_n < 1 || enlarge_n > kRetile_MaxEnlargeN)
+    {
+        printf("Retile: [WARN] -zIn takes 1 to %d levels, using %d.\n", kRetile_MaxEnlargeN, MAX(1, MIN(kRetile_MaxEnlargeN, enlarge_n)));
+        enlarge_n = MAX(1, MIN(kRetile_MaxEnlargeN, enlarge_n));
+    }//if
+    
+    if (manifestPath != NULL && alsoReprocessSrc)
+    {
+        printf("Retile: [WARN] -reprocess rewrites the src tiles, so it is ignored with -incremental.\n");
+        alsoReprocessSrc = false;
+    }//if
+    
+    if (manifestPath != NULL && useStream)
+    {
+        printf("Retile: [WARN] -stream is ignored with -incremental.\n");
+        useStream = false;
+    }//if
+    
+    if (shard_n < 1 || shard_i < 0 || shard_i >= shard_n)
+    {
+        printf("Retile: [WARN] -shard takes i/n, with 0 <= i < n, eg: -shard 0/4.  Ignoring it.\n");
+        shard_i = 0;
+        shard_n = 1;
+    }//if
+    
+    if (destFormatId == kRetile_Template_PMTiles && (manifestPath != NULL || shouldResume || alsoReprocessSrc || shard_n > 1 || queuePath != NULL))
+    {
+        printf("Retile: [WARN] -incremental, -resume, -reprocess, -shard and -queue are ignored with -outPMTiles, which is written whole.\n");
+        manifestPath     = NULL;
+        shouldResume     = false;
+        alsoReprocessSrc = false;
+        shard_i          = 0;
+        shard_n          = 1;
+        queuePath        = NULL;
+    }//if
+    
+    if (manifestPath != NULL && shard_n > 1)
+    {
+        printf("Retile: [WARN] -shard is ignored with -incremental, as the shard cuts move when the src tiles change.\n");
+        shard_i = 0;
+        shard_n = 1;
+    }//if
+    
+    if (shard_n > 1 && useStream)
+    {
+        printf("Retile: [WARN] -stream is ignored with -shard.\n");
+        useStream = false;
+    }//if
+    
+    if (queuePath != NULL && (opMode != kRetile_OpMode_Downsample || manifestPath != NULL))
+    {
+        printf("Retile: [WARN] -queue needs -zOut, and not -incremental, ignoring it.\n");
+        queuePath = NULL;
+    }//if
+    
+    if (queuePath != NULL && shard_n > 1)
+    {
+        printf("Retile: [WARN] -shard is ignored with -queue.\n");
+        shard_i = 0;
+        shard_n = 1;
+    }//if
+    
+    if (destFormatId == kRetile_Template_MBTiles && (manifestPath != NULL || shouldResume || alsoReprocessSrc))
+    {
+        printf("Retile: [WARN] -incremental, -resume and -reprocess are ignored with -outMBTiles.\n");
+        manifestPath     = NULL;
+        shouldResume     = false;
+        alsoReprocessSrc = false;
+    }//if
+    
+    if (srcFormatId == kRetile_Template_MBTiles && (manifestPath != NULL || alsoReprocessSrc))
+    {
+        printf("Retile: [WARN] -incremental and -reprocess are ignored with -inMBTiles.\n");
+        manifestPath     = NULL;
+        alsoReprocessSrc = false;
+    }//if
+    
+    if (queuePath != NULL && (useStream || shouldResume || alsoReprocessSrc))
+    {
+        printf("Retile: [WARN] -stream, -resume and -reprocess are ignored with -queue.\n");
+        useStream        = false;
+        shouldResume     = false;
+        alsoReprocessSrc = false;
+    }//if
     
     if (showHelp || (argc <= 1 && !PROD_NO_PARAM_BYPASS && !LOCAL_NO_PARAM_BYPASS))
     {
@@ -2320,12 +5386,20 @@ int main(int argc, const char * argv[])
         printf("+--------+--------------------------------------------------------+----------+\n");
         printf("\n");
         printf("Use: retile <in_path> <out_path> -reprocess <in_fmt> <out_fmt> <interp> <zdir>\n");
+        printf("                                 -threads <n> -stageThreads <r,d,s,e,w>\n");
+        printf("                                 -stageDepth <n> -stream\n");
+        printf("                                 -incremental <manifest> -incrementalHash\n");
+        printf("                                 -resume -shard <i/n> -shardZ <z>\n");
+        printf("                                 -queue <db> -leaseSeconds <s>\n");
+        printf("                                 -pngFilter <none|adaptive>\n");
+        printf("                                 -compress <fast|default|max>\n");
         printf("\n");
         printf("out_path will get /{z}/ appended to it automatically.\n");
         printf("\n");
         printf("Example: retile /tiles/13 /tiles\n");
         printf("Example: retile /tiles/13 /tiles -reprocess\n");
         printf("Example: retile /tiles/13 /tiles -reprocess -inXYZ -outOSM\n");
+        printf("Example: retile /tiles/13 /tiles -zOutTo 0\n");
         printf("\n");
         printf("-reprocess: Optional.  Overwrites src files in-place and recompresses them,\n");
         printf("            similar to pngcrush.  Will be moved if inFMT and outFMT differ.\n");
@@ -2333,9 +5407,15 @@ int main(int argc, const char * argv[])
         printf("\n");
         printf("<in_fmt>:   Optional.  A URL template, one of: { -inOSM, -inZXY, -inXYZ }.\n");
         printf("            Default is [-inOSM].\n");
+        printf("            Or -inMBTiles, for an MBTiles file as in_path, with the zoom\n");
+        printf("            level to read appended, eg: /tiles/world.mbtiles/13\n");
         printf("\n");
         printf("<out_fmt>:  Optional.  A URL template, one of: { -outOSM, -outZXY, -outXYZ }.\n");
         printf("            Default is [-outOSM].\n");
+        printf("            Or -outMBTiles <file>, which writes the tiles into an MBTiles\n");
+        printf("            file instead, eg: -outMBTiles /tiles/world.mbtiles\n");
+        printf("            Or -outPMTiles <file>, for a PMTiles archive, which is written\n");
+        printf("            once every tile is done, eg: -outPMTiles /tiles/world.pmtiles\n");
         printf("\n");
         printf("<interp>:   Optional.  Interpolation type, one of:\n");
         printf("            Zoom In:  { -interpXB, -interpL3, -interpL5, -interpNN, -interpBI, \n");
@@ -2346,8 +5426,75 @@ int main(int argc, const char * argv[])
         printf("<zdir>:     Optional. Direction of zoom, one of: { -zIn, -zOut }.\n");
         printf("            [-zOut] creates tiles for zoom level -1, downsampling them.\n");
         printf("            [-zIn]  creates tiles for zoom level +1, enlarging them.\n");
+        printf("            [-zIn n] creates zoom levels +1 to +n (max %d) from a single\n", kRetile_MaxEnlargeN);
+        printf("                    read of each tile, eg: -zIn 3\n");
         printf("            Default is [-zOut].\n");
         printf("\n");
+        printf("-zOutTo:    Optional.  eg: -zOutTo 0\n");
+        printf("            Creates all zoom levels from z-1 down to the one given in a single\n");
+        printf("            pass, reading and decoding each source tile only once.\n");
+        printf("\n");
+        printf("-threads:   Optional.  Number of worker threads, eg: -threads 8\n");
+        printf("            Default is one per CPU.  -zOutTo ignores this where\n");
+        printf("            libdispatch is used.\n");
+        printf("\n");
+        printf("-stageThreads: Optional.  -zIn/-zOut run as a pipeline of stages:\n");
+        printf("            read -> decode -> resample -> encode -> write\n");
+        printf("            Sets the worker threads for each, eg: -stageThreads 8,2,2,8,8\n");
+        printf("            0 or missing entries use the defaults, derived from -threads.\n");
+        printf("            Per-stage queue stats are printed at the end of each run.\n");
+        printf("\n");
+        printf("-stageDepth: Optional.  Max items queued for each stage.  Default is 32.\n");
+        printf("\n");
+        printf("-stream:    Optional.  -zOut with -inOSM only.  Starts resampling each pair\n");
+        printf("            of {x} directories as soon as it has been scanned, rather than\n");
+        printf("            after the whole src path has been indexed.  Output is the same.\n");
+        printf("\n");
+        printf("-incremental: Optional.  eg: -incremental /tiles/13.manifest\n");
+        printf("            Keeps a manifest of the src tiles' mtime and size, and only\n");
+        printf("            rebuilds the tiles derived from those that changed since the\n");
+        printf("            last run.  (all of them, the first time)  Tiles written or\n");
+        printf("            deleted are listed in <manifest>.changed.\n");
+        printf("\n");
+        printf("-incrementalHash: Optional.  Also hashes changed src tiles, so ones that\n");
+        printf("            were rewritten with the same contents are not rebuilt.\n");
+        printf("\n");
+        printf("-resume:    Optional.  -zOut and -zOutTo log their progress to\n");
+        printf("            <out_path>/.retile_progress as they go.  After an interrupted\n");
+        printf("            run, repeat it with -resume to skip the work already done.\n");
+        printf("\n");
+        printf("-shard:     Optional.  eg: -shard 2/8\n");
+        printf("            Only builds shard i of n, so n processes or machines can split\n");
+        printf("            one run.  Each reads the whole src index and takes its own\n");
+        printf("            contiguous quadkey range of it, balanced by tile count.  With\n");
+        printf("            -zOutTo, the levels below the cut are built by a final merge\n");
+        printf("            run, printed at the end.  Not with -incremental.\n");
+        printf("\n");
+        printf("-shardZ:    Optional.  Zoom level to cut the shards at, eg: -shardZ 6\n");
+        printf("            Default is z (-zIn), z-1 (-zOut), or the lowest level with\n");
+        printf("            %d subtrees per shard (-zOutTo).\n", kRetile_ShardMinSubtreesPer);
+        printf("\n");
+        printf("-queue:     Optional.  -zOut only.  eg: -queue /shared/tiles_13.queue\n");
+        printf("            Processes run with the same args and -queue file split the\n");
+        printf("            work between them as they go, leasing %d dest tiles at a\n", kRetile_LeaseDestTileN);
+        printf("            time.  Work leased by a process that died is issued again.\n");
+        printf("\n");
+        printf("-leaseSeconds: Optional.  How long a -queue lease lasts.  Default is 600.\n");
+        printf("\n");
+        printf("-pngFilter: Optional.  none (default) or adaptive.  With adaptive, RGB and\n");
+        printf("            RGBA tiles, such as resampled imagery, pick the best PNG filter\n");
+        printf("            for each row.  Smaller files, slower writes.  Indexed and gray\n");
+        printf("            tiles are never filtered.\n");
+        printf("\n");
+        printf("-compress:  Optional.  fast, default or max.  fast is zlib level 1, for\n");
+        printf("            frequent rebuilds.  default is zlib level 9.  max tries several\n");
+        printf("            zlib strategies with the longest match search per tile and\n");
+        printf("            keeps the smallest, for archives.\n");
+        printf("\n");
+        printf("-selfcheck: Verifies the SIMD pixel conversion helpers of the PNG writer\n");
+        printf("            against their scalar versions, then exits.  Returns 1 if any\n");
+        printf("            result differs.  eg: retile -selfcheck\n");
+        printf("\n");
         printf("Format info:\n");
         printf("------------\n");
         printf("-inOSM, -outOSM: /{z}/{x}/{y}.png       (OpenStreetMaps convention)\n");
@@ -2374,45 +5521,182 @@ int main(int argc, const char * argv[])
         
         showRunTime = false;
     }//if
+    else if (runSelfCheck)
+    {
+        const bool isOK = gbImage_PNG_SelfCheck();
+        
+        gbTileIndex_Destroy(idx);
+        
+        return isOK ? 0 : 1;
+    }//else if
     else if (argc < 3 && PROD_NO_PARAM_BYPASS)
     {
-        _ProductionNoParamRun(dbFilePath, REPROC_SRC_BYPASS, interpolationTypeId);
+        _ProductionNoParamRun(idx, REPROC_SRC_BYPASS, interpolationTypeId);
     }//if
     else if (argc < 3 && LOCAL_NO_PARAM_BYPASS)
     {
-        _LocalTestRun(dbFilePath, REPROC_SRC_BYPASS, interpolationTypeId);
+        _LocalTestRun(idx, REPROC_SRC_BYPASS, interpolationTypeId);
     }//else if
     else if (argc >= 2)
     {
         srcPath  = (char*)argv[1];
         destPath = (char*)argv[2];
         
-        size_t n = _ReadPathToDB(srcPath, dbFilePath, srcFormatId);
+        if (mbtilesPath != NULL && (_mbtiles = gbMBTiles_Open(mbtilesPath)) == NULL)
+        {
+            printf("Retile: [ERR]  Could not open -outMBTiles [%s].  Aborting.\n", mbtilesPath);
+            gbTileIndex_Destroy(idx);
+            return 1;
+        }//if
+        
+        if (pmtilesPath != NULL && (_pmtiles = gbPMTiles_Open(pmtilesPath)) == NULL)
+        {
+            printf("Retile: [ERR]  Could not open -outPMTiles [%s].  Aborting.\n", pmtilesPath);
+            gbTileIndex_Destroy(idx);
+            return 1;
+        }//if
+        
+        if (srcFormatId == kRetile_Template_MBTiles)
+        {
+            char mbtilesSrcPath[1024];
+            int  src_z;
+            
+            _MBTiles_SplitSrcPath(srcPath, mbtilesSrcPath, &src_z);
+            
+            if ((_mbtilesSrc = gbMBTilesReader_Open(mbtilesSrcPath)) == NULL)
+            {
+                printf("Retile: [ERR]  Could not open -inMBTiles [%s].  Aborting.\n", mbtilesSrcPath);
+                gbMBTiles_Close(_mbtiles);
+                gbPMTiles_Close(_pmtiles);
+                gbTileIndex_Destroy(idx);
+                return 1;
+            }//if
+        }//if
+        
+        const bool isStream = useStream && opMode == kRetile_OpMode_Downsample && srcFormatId == kRetile_Template_OSM;
+        
+        if (useStream && !isStream)
+        {
+            printf("Retile: [WARN] -stream needs -zOut and -inOSM, ignoring it.\n");
+        }//if
+        
+        size_t n = isStream ? _StreamDownsampleFromPath(srcPath, destPath, destFormatId, alsoReprocessSrc, interpolationTypeId, thread_n, &pipe_cfg)
+                            : _ReadPathToIndex(srcPath, idx, srcFormatId, thread_n);
         
         if (n > 0)
         {
-            if (opMode == kRetile_OpMode_Downsample)
+            if (shard_n > 1)
+            {
+                shard_z = _ShardIndex(&idx, opMode, dest_min_z, shard_z, shard_i, shard_n);
+            }//if
+            
+            if (shard_n > 1 && (shard_z < 0 || gbTileIndex_GetCount(idx) == 0))
             {
-                _QueueDownsampleFromDB(destPath, dbFilePath, destFormatId, alsoReprocessSrc, interpolationTypeId);
+                // nothing to do
             }//if
+            else if (isStream)
+            {
+                // already done
+            }//else if
+            else if (queuePath != NULL)
+            {
+                _QueueDownsampleFromLeases(srcPath, destPath, idx, queuePath, lease_s, destFormatId, interpolationTypeId, thread_n, &pipe_cfg);
+            }//else if
+            else if (manifestPath != NULL)
+            {
+                _IncrementalFromIndex(destPath, idx, manifestPath, useManifestHash, opMode, destFormatId, interpolationTypeId, dest_min_z, enlarge_n, thread_n, &pipe_cfg);
+            }//else if
+            else if (opMode == kRetile_OpMode_Downsample || opMode == kRetile_OpMode_Pyramid)
+            {
+                uint32_t        min_z;
+                uint32_t        max_z;
+                Retile_Progress progress;
+                char            logName[64];
+                
+                // a shard of a pyramid stops at the cut, the merge does the rest
+                const int       pyr_min_z = shard_n > 1 ? MAX(dest_min_z, shard_z) : dest_min_z;
+                
+                gbTileIndex_GetZRange(idx, &min_z, &max_z);
+                
+                if (shard_n > 1)
+                {
+                    snprintf(logName, sizeof(logName), "%s.%dof%d", kRetile_ProgressLogName, shard_i, shard_n);
+                }//if
+                else
+                {
+                    snprintf(logName, sizeof(logName), "%s", kRetile_ProgressLogName);
+                }//else
+                
+                _Progress_Open(&progress, destPath, logName, max_z, opMode == kRetile_OpMode_Pyramid ? (uint32_t)MAX(0, pyr_min_z) : max_z - 1, shouldResume);
+                
+                if (opMode == kRetile_OpMode_Downsample)
+                {
+                    _QueueDownsampleFromIndex(destPath, idx, destFormatId, alsoReprocessSrc, interpolationTypeId, thread_n, &pipe_cfg, &progress);
+                }//if
+                else
+                {
+                    _QueuePyramidFromIndex(destPath, idx, destFormatId, alsoReprocessSrc, interpolationTypeId, pyr_min_z, thread_n, &progress);
+                }//else
+                
+                _Progress_Close(&progress, true);
+                
+                if (opMode == kRetile_OpMode_Pyramid && pyr_min_z > dest_min_z)
+                {
+                    const char* fmt = destFormatId == kRetile_Template_OSM ? "OSM" : destFormatId == kRetile_Template_ZXY ? "ZXY" : "XYZ";
+                    char        opts[128];
+                    
+                    // everything that changes the output has to match the shards
+                    snprintf(opts, sizeof(opts), "-interp%s -pngFilter %s -compress %s",
+                             _GetInterpolationTypeName(interpolationTypeId),
+                             pngFilterMode == kGB_PNG_Filter_Adaptive ? "adaptive" : "none",
+                             compressProfile == kGB_PNG_Compress_Fast ? "fast" : compressProfile == kGB_PNG_Compress_Max ? "max" : "default");
+                    
+                    if (thread_n > 0)
+                    {
+                        snprintf(opts + strlen(opts), sizeof(opts) - strlen(opts), " -threads %d", thread_n);
+                    }//if
+                    
+                    printf("Retile: Shard %d/%d done.  Once every shard is, build z=%d ... %d with:\n", shard_i, shard_n, pyr_min_z - 1, dest_min_z);
+                    
+                    if (destFormatId == kRetile_Template_MBTiles)
+                    {
+                        printf("Retile:     retile %s/%d %s -zOutTo %d -inMBTiles -outMBTiles %s %s\n", mbtilesPath, pyr_min_z, destPath, dest_min_z, mbtilesPath, opts);
+                    }//if
+                    else
+                    {
+                        printf("Retile:     retile %s/%d %s -zOutTo %d -in%s -out%s %s\n", destPath, pyr_min_z, destPath, dest_min_z, fmt, fmt, opts);
+                    }//else
+                }//if
+            }//else if
             else
             {
-                _QueueEnlargeFromDB(destPath, dbFilePath, destFormatId, alsoReprocessSrc, interpolationTypeId, 1);
+                _QueueEnlargeFromIndex(destPath, idx, destFormatId, alsoReprocessSrc, interpolationTypeId, enlarge_n, thread_n, &pipe_cfg);
             }//else
         }//if
         else
         {
             printf("Retile: [ERR]  No files found in src path: [%s].\n", srcPath);
         }//else
+        
+        gbMBTiles_Close(_mbtiles);
+        gbPMTiles_Close(_pmtiles);
+        gbMBTilesReader_Close(_mbtilesSrc);
+        _mbtiles    = NULL;
+        _pmtiles    = NULL;
+        _mbtilesSrc = NULL;
     }//if
     
     if (showRunTime)
     {
+        gbImage_PNG_PrintStats("Retile: ");
+        
         printf("Retile: Processing time: %lld mi %lld ss\n",   (CURRENT_TIMESTAMP() - st)/1000/60,
                                                               ((CURRENT_TIMESTAMP() - st)/1000      )
                                                             - ((CURRENT_TIMESTAMP() - st)/1000/60*60) );
     }//if
     
+    gbTileIndex_Destroy(idx);
+    
     return 0;
 }//main
 